@@ -37,9 +37,6 @@
   #define _FILE_OFFSET_BITS 64
 #endif
 
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
-
 #include "config.h"
 #include "types.h"
 #include "debug.h"
@@ -47,6 +44,7 @@
 #include "hash.h"
 #include "sharedmem.h"
 #include "forkserver.h"
+#include "dirty-map.h"
 #include "common.h"
 #include "hash.h"
 
@@ -153,6 +151,18 @@ struct tainted {
 
 };
 
+/* The edges of the trace of a queue entry, kept while it is a top_rated[]
+   winner or favored: their sorted indices, or a bitmap of map_size >> 3
+   bytes if that is smaller (see trace_mini_new()). */
+
+struct trace_mini {
+
+  u32 cnt,                              /* Number of edges                  */
+      dense;                            /* data is a bitmap, not indices    */
+  u8 data[];
+
+};
+
 struct queue_entry {
 
   u8 *fname;                            /* File name for the test case      */
@@ -169,7 +179,9 @@ struct queue_entry {
       favored,                          /* Currently favored?               */
       fs_redundant,                     /* Marked as redundant in the fs?   */
       is_ascii,                         /* Is the input just ascii text?    */
-      disabled;                         /* Is disabled from fuzz selection  */
+      disabled,                         /* Is disabled from fuzz selection  */
+      testcase_ref,                     /* Cached testcase used lately      */
+      sel_lost;                         /* In afl->sel_lost_buf             */
 
   u32 bitmap_size,                      /* Number of bits set in bitmap     */
       fuzz_level,                       /* Number of fuzzing iterations     */
@@ -180,7 +192,7 @@ struct queue_entry {
       depth,                            /* Path depth                       */
       exec_cksum;                       /* Checksum of the execution trace  */
 
-  u8 *trace_mini;                       /* Trace bytes, if kept             */
+  struct trace_mini *trace_mini;        /* Trace bytes, if kept             */
   u32 tc_ref;                           /* Trace bytes ref count            */
 
 #ifdef INTROSPECTION
@@ -197,6 +209,12 @@ struct queue_entry {
 
   struct queue_entry *mother;           /* queue entry this based on        */
 
+  u32 seed_bandit_slot;                 /* Slot in the per-seed bandit arena*/
+
+  double sched_finds,                   /* -p bandit: discounted havoc finds*/
+      sched_execs;                      /* and execs, as of round sched_t   */
+  u64 sched_t;
+
 };
 
 struct extra_data {
@@ -285,6 +303,7 @@ enum {
   /* 06 */ QUAD,    /* Quadratic schedule               */
   /* 07 */ RARE,    /* Rare edges                       */
   /* 08 */ SEEK,    /* EXPLORE that ignores timings     */
+  /* 09 */ BANDIT,  /* Seeds and energy from a bandit   */
 
   POWER_SCHEDULES_NUM
 
@@ -388,14 +407,18 @@ typedef struct afl_env_vars {
       afl_force_ui, afl_i_dont_care_about_missing_crashes, afl_bench_just_one,
       afl_bench_until_crash, afl_debug_child, afl_autoresume, afl_cal_fast,
       afl_cycle_schedules, afl_expand_havoc, afl_statsd, afl_cmplog_only_new,
-      afl_exit_on_seed_issues, afl_try_affinity;
+      afl_exit_on_seed_issues, afl_try_affinity, afl_bandit_share,
+      afl_cal_adaptive;
 
   u8 *afl_tmpdir, *afl_custom_mutator_library, *afl_python_module, *afl_path,
       *afl_hang_tmout, *afl_forksrv_init_tmout, *afl_preload,
       *afl_max_det_extras, *afl_statsd_host, *afl_statsd_port,
       *afl_crash_exitcode, *afl_statsd_tags_flavor, *afl_testcache_size,
       *afl_testcache_entries, *afl_kill_signal, *afl_target_env,
-      *afl_persistent_record, *afl_exit_on_time;
+      *afl_persistent_record, *afl_exit_on_time, *afl_mut_alg, *afl_batch_alg,
+      *afl_seed_bandit, *afl_havoc_batch, *afl_dirty_map,
+      *afl_forksrv_futex, *afl_fsrv_pool, *afl_shmem_inplace,
+      *afl_adaptive_tmout, *afl_testcache_prefetch;
 
 } afl_env_vars_t;
 
@@ -456,6 +479,9 @@ enum HavocCase {
   #define ADWIN_MIN_ELEM_TO_START_DROP 17
   #define ADWIN_MIN_ELEM_TO_CHECK 5
   #define ADWIN_DROP_INTERVAL 100
+  // rows of the exponential histogram, row r holds windows of 2^r elements;
+  // 40 rows take more than 10^13 elements per arm to fill
+  #define ADWIN_MAX_ROWS 40
 /* NONSTATIONARY_BANDIT */
 
 /* KLUCB */
@@ -466,11 +492,15 @@ enum HavocCase {
 /* DISCOUNTED_THOMPSON_SAMPLING */
   #undef OPTIMISTIC_DTS
   #define DTS_GAMMA 0.9999999
+  // Fold the lazy discount back into the arms below this scale
+  #define DTS_MIN_SCALE 1e-200
 /* DISCOUNTED_THOMPSON_SAMPLING*/
 
 /* DISCOUNTED_BOLTZMANN_EXPLORATION */
   // Follow SIVO's parameters
   #define DBE_GAMMA 0.99
+  // Fold the lazy discount back into the arms below this scale
+  #define DBE_MIN_SCALE 1e-200
 /* DISCOUNTED_BOLTZMANN_EXPLORATION */
 
 /* EXPPP */
@@ -482,22 +512,17 @@ enum HavocCase {
   #define EXP_BETA 256.0
 /* EXPPP */
 
-typedef struct adwin_node {
-  struct adwin_node* next;
-  struct adwin_node* prev;
-
-  int size;
-  u64 sum[ADWIN_M+1];
-} adwin_node_t;
-
+// Each row is a ring of up to ADWIN_M+1 window sums, oldest first from
+// start[row]; row 0 has the newest elements, row last_row the oldest
 typedef struct adwin {
-  adwin_node_t* head;
-  adwin_node_t* tail;
-
-  int num_add;
-  int last_node_idx;
   u64 W;
   u64 sum;
+  int num_add;
+  int last_row;
+
+  u8 size[ADWIN_MAX_ROWS];
+  u8 start[ADWIN_MAX_ROWS];
+  u64 win[ADWIN_MAX_ROWS][ADWIN_M+1];
 } adwin_t;
 
 typedef struct {
@@ -549,24 +574,46 @@ typedef struct {
   normal_bandit_arm* arms;
 } klucb_t;
 
+// prior: {rewards, failures} pseudo-counts per arm pooled from the other
+// instances (AFL_BANDIT_SHARE), NULL if not shared
+
 typedef struct {
   int n_arms;
   normal_bandit_arm* arms;
+  double* prior;
 } ts_t;
 
 typedef struct {
   int n_arms;
   adwin_bandit_arm* arms;
+  double* prior;
 } adsts_t;
 
 typedef struct {
   int n_arms;
   dts_bandit_arm* arms;
+  double* prior;
+
+  // total_rewards and total_losses of the arms are stored divided by
+  // scale (= DTS_GAMMA^t), so that discounting is a single multiplication
+  double scale;
 } dts_t;
 
 typedef struct {
   int n_arms;
   dbe_bandit_arm* arms;
+
+  // total_rewards and dis_num_selected of the arms are stored divided by
+  // scale (= DBE_GAMMA^t), so that discounting is a single multiplication
+  double scale;
+
+  // Boltzmann weights of the arms, kept between selections and only
+  // recomputed for arms whose sample_mean changed, or for all arms when
+  // redcoef or the number of active arms changed
+  double* weights;
+  double weights_redcoef;
+  int weights_active;
+  int stale_arm;
 } dbe_t;
 
 typedef struct {
@@ -591,6 +638,153 @@ typedef struct {
   u64 n_arms;
 } expix_t;
 
+enum bandit_alg {
+
+  /* 00 */ BANDIT_UNIFORM,
+  /* 01 */ BANDIT_UCB,
+  /* 02 */ BANDIT_KLUCB,
+  /* 03 */ BANDIT_TS,
+  /* 04 */ BANDIT_DTS,
+  /* 05 */ BANDIT_DBE,
+  /* 06 */ BANDIT_ADSTS,
+  /* 07 */ BANDIT_EXPPP,
+  /* 08 */ BANDIT_EXPIX,
+  BANDIT_ALG_NUM
+
+};
+
+/* A bandit instance of any algorithm, tagged with the algorithm in use */
+
+typedef struct bandit {
+
+  u8 alg;                               /* enum bandit_alg                  */
+
+  union {
+
+    uniform_t uniform;
+    ucb_t     ucb;
+    klucb_t   klucb;
+    ts_t      ts;
+    dts_t     dts;
+    dbe_t     dbe;
+    adsts_t   adsts;
+    exppp_t   exppp;
+    expix_t   expix;
+
+  };
+
+} bandit_t;
+
+/* A mutant of batched havoc (AFL_HAVOC_BATCH), waiting to be run */
+
+struct havoc_batch_entry {
+
+  u32       off, len;                   /* Mutant in havoc_batch_buf        */
+  s32       selected_case;              /* Mutation operator arm            */
+  s32       selected_t;                 /* Stack size arm                   */
+  bandit_t *batch_bandit;               /* Bandit that chose selected_t     */
+  u8        reward;
+  u8        ran;                        /* Executed and processed           */
+
+};
+
+/* An extra fork server of the pool (AFL_FSRV_POOL) that runs havoc batch
+   mutants next to the main one */
+
+struct fsrv_pool_member {
+
+  afl_forkserver_t fsrv;
+  sharedmem_t      shm;                 /* Own coverage map                 */
+  sharedmem_t *    shm_fuzz;            /* Own testcase shm, if in use      */
+  char **          argv;                /* Target argv with own input file  */
+  u64              deadline;            /* get_cur_time() of the timeout    */
+  u32              tag;                 /* Caller's id of the running input */
+  u8               busy;                /* A run was started, not collected */
+
+};
+
+/* Exec times seen with AFL_ADAPTIVE_TMOUT, in a log-linear histogram with
+   EXEC_SKETCH_SUB buckets per power of two of microseconds */
+
+#define EXEC_SKETCH_SUB 8
+#define EXEC_SKETCH_BUCKETS (30 * EXEC_SKETCH_SUB)
+
+struct exec_sketch {
+
+  u32 cnt[EXEC_SKETCH_BUCKETS];
+  u32 total;
+
+};
+
+/* Per-seed mutation operator statistics (AFL_SEED_BANDIT), kept in a fixed
+   arena of n_slots tables that are recycled in LRU order */
+
+typedef struct seed_bandit_arm {
+
+  u32 num_selected;
+  u32 num_rewarded;
+
+} seed_bandit_arm_t;
+
+typedef struct seed_bandit {
+
+  u32 n_slots, n_arms;                  /* 0 slots: per-seed mode disabled  */
+  u32 used;                             /* Slots handed out so far          */
+  u32 lru_head, lru_tail;               /* Most / least recently used slot  */
+
+  u32 *owner;                           /* Queue entry id + 1, 0 if unused  */
+  u32 *lru_prev, *lru_next;
+  seed_bandit_arm_t *arms;              /* n_slots * n_arms                 */
+
+  u64 *global_selected;                 /* Campaign-wide counts, the prior  */
+  u64 *global_rewarded;                 /* of every per-seed table          */
+
+} seed_bandit_t;
+
+/* Byte buffer a bandit snapshot is written to / read from */
+
+typedef struct bandit_stream {
+
+  u8 *   buf;
+  size_t len, cap, pos;
+  u8     err;                           /* Read past the end or bad data    */
+
+} bandit_stream_t;
+
+/* AFL_BANDIT_SHARE: every instance publishes discounted per-arm counts of
+   all its bandits in out_dir/bandit_share, mapped shared, and reads the
+   files of the other instances in the sync dir. The owner is the only
+   writer, readers retry/skip on a changing seq (seqlock), so no instance
+   ever waits for another one. */
+
+typedef struct bandit_share_slot {
+
+  u32 magic;
+  u32 n_arms;                           /* Arms over all bandits            */
+  u64 seq;                              /* Odd while the owner writes       */
+  u64 updated;                          /* get_cur_time() of last publish   */
+  double counts[];                      /* n_arms * {selected, rewarded}    */
+
+} bandit_share_slot_t;
+
+typedef struct bandit_share {
+
+  u32                  n_arms;          /* 0 until the first exchange       */
+  u64                  last_ms;
+  bandit_share_slot_t *slot;            /* Our own slot, mmap()ed           */
+  size_t               slot_size;
+  u64 *                last;            /* Own counts at the last publish   */
+  double *             prior;           /* Pooled {rewards, failures}       */
+  double *             sum;             /* Scratch: weighted peer sums      */
+  double *             peer;            /* Scratch: copy of one peer slot   */
+
+} bandit_share_t;
+
+/* Exchange interval, and the decay of shared counts per interval (also
+   applied to the slots of peers that stopped publishing) */
+#define BANDIT_SHARE_SEC 10
+#define BANDIT_SHARE_DECAY 0.98
+
 // Choose whether or not to use MOpt-wise bandit
 #define MOPTWISE_BANDIT
 #undef MOPTWISE_BANDIT_FINECOARSE
@@ -599,37 +793,61 @@ typedef struct {
 // Choose whether or not to prepare buckets-of-length also for moptwise bandit
 #undef USE_LEN_BUCKET_FOR_MOPTWISE
 
-/* Choose bandit algorithm for mutation operators */
-//#define MUT_ALG uniform
-//#define MUT_ALG ucb
-//#define MUT_ALG klucb
-#define MUT_ALG ts
-//#define MUT_ALG dts
-//#define MUT_ALG dbe
-//#define MUT_ALG adsts
-//#define MUT_ALG exppp
-//#define MUT_ALG expix
-
-/* Choose bandit algorithm for batch size */
-//#define BATCH_ALG uniform
-//#define BATCH_ALG ucb
-//#define BATCH_ALG klucb
-#define BATCH_ALG ts
-//#define BATCH_ALG dts
-//#define BATCH_ALG dbe
-//#define BATCH_ALG adsts
-//#define BATCH_ALG exppp
-//#define BATCH_ALG expix
-
-// define variables
-#define ____CONCAT(a, b) a ## b
-#define CONCAT(a, b) ____CONCAT(a, b)
-#define BANDIT_T(alg) CONCAT(alg, _t)
-#define INIT_INSTANCE(alg) CONCAT(alg, _init)
-#define SELECT_ARM(alg) CONCAT(alg, _select_arm)
-#define ADD_REWARD(alg) CONCAT(alg, _add_reward)
-#define PRINT_STATE(alg) CONCAT(alg, _print_state)
-#define PRINT_ARM(alg) CONCAT(alg, _print_arm)
+/* Per-seed mutation operator bandits (AFL_SEED_BANDIT): default number of
+   arena slots, and the weight (in pseudo-executions) of the global success
+   rate in the Beta prior of every per-seed arm */
+#define SEED_BANDIT_SLOTS 4096
+#define SEED_BANDIT_PRIOR 16.0
+
+/* Bandit power schedule (-p bandit): seeds are drawn by Thompson sampling
+   on their havoc finds per exec among this many candidates, with a Beta
+   prior of this weight (in execs) centered on the campaign-wide rate. All
+   counts decay by SEED_SCHED_GAMMA per fuzzed seed. */
+#define SEED_SCHED_CANDIDATES 16
+#define SEED_SCHED_PRIOR 1024.0
+#define SEED_SCHED_GAMMA 0.999
+
+typedef struct seed_sched {
+
+  u64    t;                             /* Seeds fuzzed so far              */
+  double finds, execs;                  /* Discounted, over all seeds       */
+  u64    havoc_execs;                   /* total_execs when havoc started   */
+  u32    havoc_paths;                   /* queued_paths when havoc started  */
+  u8     in_havoc;                      /* The current seed reached havoc   */
+
+} seed_sched_t;
+
+/* Largest number of havoc mutants run per batch (AFL_HAVOC_BATCH) */
+
+#define HAVOC_BATCH_MAX 256
+
+/* Largest number of extra fork servers (AFL_FSRV_POOL) */
+
+#define FSRV_POOL_MAX 64
+
+/* Default bandit algorithm for mutation operators,
+   can be overridden at runtime with AFL_MUT_ALG */
+//#define MUT_ALG BANDIT_UNIFORM
+//#define MUT_ALG BANDIT_UCB
+//#define MUT_ALG BANDIT_KLUCB
+#define MUT_ALG BANDIT_TS
+//#define MUT_ALG BANDIT_DTS
+//#define MUT_ALG BANDIT_DBE
+//#define MUT_ALG BANDIT_ADSTS
+//#define MUT_ALG BANDIT_EXPPP
+//#define MUT_ALG BANDIT_EXPIX
+
+/* Default bandit algorithm for batch size,
+   can be overridden at runtime with AFL_BATCH_ALG */
+//#define BATCH_ALG BANDIT_UNIFORM
+//#define BATCH_ALG BANDIT_UCB
+//#define BATCH_ALG BANDIT_KLUCB
+#define BATCH_ALG BANDIT_TS
+//#define BATCH_ALG BANDIT_DTS
+//#define BATCH_ALG BANDIT_DBE
+//#define BATCH_ALG BANDIT_ADSTS
+//#define BATCH_ALG BANDIT_EXPPP
+//#define BATCH_ALG BANDIT_EXPIX
 
 // Choose whether or not to prepare arms for each cases
 #define ATOMIZE_CASES
@@ -643,7 +861,10 @@ typedef struct {
   #define NUM_CASE 1
 #endif
 
-#define MIN_LEN_FOR_OPTIMIZED_RESTORE 918000
+/* Undo journal of a havoc iteration: at most this many operators, each
+   costing as much as moving this many bytes */
+#define HAVOC_UNDO_MAX 512
+#define HAVOC_UNDO_OP_COST 32
 #define BATCH_NUM_ARM 7
 
 #define NUM_BATCH_BUCKET 5
@@ -659,9 +880,12 @@ typedef struct afl_state {
   // <= 100, <= 1000, <= 10000, <= 100000, <= 10485760
   // havoc_stack_pow2 <= 6
 
-  BANDIT_T(MUT_ALG)   mut_bandit[NUM_MUT_BUCKET];
-  BANDIT_T(BATCH_ALG) batch_bandit[NUM_BATCH_BUCKET][NUM_CASE];
-  gsl_rng* gsl_rng_state;
+  bandit_t mut_bandit[NUM_MUT_BUCKET];
+  bandit_t batch_bandit[NUM_BATCH_BUCKET][NUM_CASE];
+  seed_bandit_t seed_bandit;
+  seed_sched_t  seed_sched;
+  bandit_stream_t bandit_stream;            /* bandit_state file buffer */
+  bandit_share_t  bandit_share;
 
   /* Position of this state in the global states list */
   u32 _id;
@@ -768,6 +992,7 @@ typedef struct afl_state {
       fast_cal,                         /* Try to calibrate faster?         */
       disable_trim,                     /* Never trim in fuzz_one           */
       shmem_testcase_mode,              /* If sharedmem testcases are used  */
+      shmem_inplace,                    /* Havoc mutates in testcase shm    */
       expand_havoc,                /* perform expensive havoc after no find */
       cycle_schedules,                  /* cycle power schedules?           */
       old_seed_selection,               /* use vanilla afl seed selection   */
@@ -777,8 +1002,15 @@ typedef struct afl_state {
       *virgin_tmout,                    /* Bits we haven't seen in tmouts   */
       *virgin_crash;                    /* Bits we haven't seen in crashes  */
 
-  double *alias_probability;            /* alias weighted probabilities     */
-  u32 *   alias_table;                /* alias weighted random lookup table */
+  double *sel_tree,                     /* Fenwick tree of the seed weights */
+      sel_avg_exec_us,                  /* Averages of the last rebuild     */
+      sel_avg_bitmap_size, sel_avg_top_size;
+  u32 sel_cap,                          /* Leaves of sel_tree               */
+      sel_cnt,                          /* Entries in sel_tree              */
+      sel_updates,                      /* Weight updates since the rebuild */
+      sel_rebuilt,                      /* queued_paths at the rebuild      */
+      sel_next,                         /* Next entry, if drawn ahead       */
+      splice_next;                      /* Next splice partner, likewise    */
   u32     active_paths;                 /* enabled entries in the queue     */
 
   u8 *var_bytes;                        /* Bytes that appear to be variable */
@@ -861,6 +1093,11 @@ typedef struct afl_state {
   u64 total_cal_us,                     /* Total calibration time (us)      */
       total_cal_cycles;                 /* Total calibration cycles         */
 
+  u64 cal_entries,                      /* Calibrations completed           */
+      cal_var_entries,                  /* ... that found variable behavior */
+      cal_var_runs,                     /* Their runs                       */
+      cal_var_diffs;                    /* ... that differed from the first */
+
   u64 total_bitmap_size,                /* Total bit count for all bitmaps  */
       total_bitmap_entries;             /* Number of bitmaps counted        */
 
@@ -880,6 +1117,18 @@ typedef struct afl_state {
 
   struct queue_entry **top_rated;           /* Top entries for bitmap bytes */
 
+  /* incremental cull_queue() */
+  u32 *cull_cover;                      /* Favored entries per bitmap byte  */
+  u8  *cull_dirty;                      /* Bytes with a new top_rated entry */
+  struct queue_entry **cull_lost_buf;   /* Favored, but not top rated now   */
+  u32 *cull_uncov_buf;                  /* Bytes an unfavored entry covered */
+  u32 *mini_idx_buf;                    /* Edges of a dense trace_mini      */
+  struct queue_entry **sel_lost_buf;    /* No longer top rated for a byte   */
+  u32 cull_lost_cnt,                    /* Entries in cull_lost_buf         */
+      cull_queued,                      /* queued_paths at the last cull    */
+      cull_incr;                        /* Incremental culls since the last
+                                           full one                         */
+
   struct extra_data *extras;            /* Extra tokens to fuzz with        */
   u32                extras_cnt;        /* Total number of tokens read      */
 
@@ -963,6 +1212,24 @@ typedef struct afl_state {
 
   u8 *ex_buf;
 
+  u8 *undo_buf;                         /* Old bytes of the havoc journal   */
+
+  u8 *havoc_batch_buf;                  /* Mutants of a havoc batch         */
+  struct havoc_batch_entry *havoc_batch;
+  u32 havoc_batch_k,                    /* Mutants per batch (1: off)       */
+      havoc_batch_cnt;                  /* Mutants waiting in the batch     */
+
+  struct fsrv_pool_member *fsrv_pool;   /* AFL_FSRV_POOL fork servers       */
+  u32 fsrv_pool_cnt,                    /* Number of extra fork servers     */
+      fsrv_pool_busy;                   /* Runs started, not collected      */
+
+  struct exec_sketch exec_sketch;       /* AFL_ADAPTIVE_TMOUT exec times    */
+  u32 adaptive_tmout_mult,              /* Deadline per quantile exec time  */
+      exec_quantile_us;                 /* That quantile, 0 while warming   */
+  u64 adaptive_kills,                   /* Runs killed at the deadline      */
+      adaptive_reruns;                  /* ... and rerun at the -t timeout  */
+  u8 *virgin_slow;                      /* Edges of confirmed timeouts: 0   */
+
   u8 *testcase_buf, *splicecase_buf;
 
   u32 custom_mutators_count;
@@ -999,6 +1266,14 @@ typedef struct afl_state {
   /* How often did we evict from the cache (for statistics only) */
   u32 q_testcase_evictions;
 
+  /* CLOCK hand of the eviction, and whether the maximum of entries was
+     learned from the size limit */
+  u32 q_testcase_clock;
+  u8  q_testcase_entries_learned;
+
+  /* AFL_TESTCACHE_PREFETCH thread and slots, see afl-fuzz-prefetch.c */
+  struct testcase_prefetch *tc_prefetch;
+
   /* Refs to each queue entry with cached testcase (for eviction, if cache_count
    * is too large) */
   struct queue_entry **q_testcase_cache;
@@ -1257,6 +1532,46 @@ void init_adwin(adwin_t *ret);
 void dest_adwin(adwin_t* adwin);
 double adwin_get_estimation(adwin_t* adwin);
 
+/* Bandit */
+
+typedef struct bandit_ops {
+
+  const char *name;
+  void (*init)(bandit_t *, u32 n_arms);
+  void (*deinit)(bandit_t *);
+  u32 (*select_arm)(afl_state_t *, bandit_t *, u8 *mask);
+  void (*add_reward)(bandit_t *, u32 arm, u8 reward);
+  void (*print_state)(bandit_t *, FILE *, int indent);          /* optional */
+  void (*print_arm)(FILE *, bandit_t *);
+  void (*save)(bandit_t *, bandit_stream_t *);
+  void (*load)(bandit_t *, bandit_stream_t *);   /* into a same-sized bandit */
+
+} bandit_ops_t;
+
+extern const bandit_ops_t bandit_ops[BANDIT_ALG_NUM];
+
+s32  bandit_alg_from_name(const char *name);
+void bandit_init(bandit_t *, u8 alg, u32 n_arms);
+void bandit_deinit(bandit_t *);
+u32  bandit_select_arm(afl_state_t *, bandit_t *, u8 *mask);
+void bandit_add_reward(bandit_t *, u32 arm, u8 reward);
+void bandit_print_state(bandit_t *, FILE *, int indent);
+void bandit_print_arm(FILE *, bandit_t *);
+void setup_bandits(afl_state_t *);
+void save_bandits(afl_state_t *);
+void load_bandits(afl_state_t *);
+void share_bandits(afl_state_t *);
+seed_bandit_arm_t *seed_bandit_get(afl_state_t *, struct queue_entry *);
+u32  seed_bandit_select_arm(afl_state_t *, seed_bandit_arm_t *, u8 *mask);
+void seed_bandit_add_reward(seed_bandit_t *, seed_bandit_arm_t *, u32 arm,
+                            u8 reward);
+double seed_sched_mean(afl_state_t *, struct queue_entry *);
+u32    seed_sched_score(afl_state_t *, struct queue_entry *);
+u32    seed_sched_pick(afl_state_t *, u32 *cand, u32 n);
+void   seed_sched_reward(afl_state_t *, struct queue_entry *, u32 finds,
+                         u64 execs);
+void destroy_bandits(afl_state_t *);
+
 /* Custom mutators */
 void setup_custom_mutators(afl_state_t *);
 void destroy_custom_mutators(afl_state_t *);
@@ -1302,19 +1617,73 @@ u32  count_bytes(afl_state_t *, u8 *);
 u32  count_non_255_bytes(afl_state_t *, u8 *);
 void simplify_trace(afl_state_t *, u8 *);
 void classify_counts(afl_forkserver_t *);
-#ifdef WORD_SIZE_64
-void discover_word(u8 *ret, u64 *current, u64 *virgin);
-#else
+#ifndef WORD_SIZE_64
 void discover_word(u8 *ret, u32 *current, u32 *virgin);
 #endif
-void init_count_class16(void);
 void minimize_bits(afl_state_t *, u8 *, u8 *);
+struct trace_mini *trace_mini_new(afl_state_t *, u8 *);
+u32 *trace_mini_edges(afl_state_t *, struct trace_mini *);
 #ifndef SIMPLE_FILES
 u8 *describe_op(afl_state_t *, u8, size_t);
 #endif
 u8 save_if_interesting(afl_state_t *, void *, u32, u8);
 u8 has_new_bits(afl_state_t *, u8 *);
-u8 has_new_bits_unclassified(afl_state_t *, u8 *);
+
+/* What check_trace() does to the trace, in this order */
+
+#define TRACE_CLASSIFY 1                  /* classify the raw hit counts     */
+#define TRACE_SIMPLIFY 2                  /* reduce them to hit / not hit    */
+#define TRACE_HASH 4                      /* checksum the resulting trace    */
+
+/* What check_trace() found in its single pass over the trace */
+
+struct trace_check {
+
+  u8  new_bits;                         /* has_new_bits(): 2 new tuples,    */
+                                        /* 1 new hit counts only, 0 nothing */
+  u64 cksum;                            /* hash64() of the trace, or 0      */
+
+};
+
+void check_trace(afl_state_t *, u8 *, u8, struct trace_check *);
+u8   has_new_bits_unclassified(afl_state_t *, u8 *, struct trace_check *);
+u8   skim_trace(afl_state_t *, u8 *);
+
+/* Coverage map kernels */
+
+/* One implementation of the loops over the coverage map. len is a multiple
+   of 64, the maps need no particular alignment. */
+
+typedef struct coverage_kernels {
+
+  const char *name;
+
+  /* classify hit counts in place */
+  void (*classify)(u8 *mem, u32 len);
+
+  /* simplify_trace(): 0x80 for hit tuples, 0x01 for the others */
+  void (*simplify)(u8 *mem, u32 len);
+
+  /* non-zero if the unclassified mem would have new bits in virgin */
+  u32 (*skim)(const u8 *virgin, const u8 *mem, u32 len);
+
+  /* has_new_bits() on the classified mem, updates virgin */
+  u8 (*discover)(u8 *mem, u8 *virgin, u32 len);
+
+  /* classify and discover in one pass */
+  u8 (*classify_discover)(u8 *mem, u8 *virgin, u32 len);
+
+} coverage_kernels_t;
+
+extern const u8                 simplify_lookup[256];
+extern const u8                 count_class_lookup8[256];
+extern u16                      count_class_lookup16[65536];
+extern const coverage_kernels_t coverage_kernels[];
+extern const coverage_kernels_t *cov_kernels;
+
+void init_count_class16(void);
+u8   coverage_kernels_supported(const coverage_kernels_t *);
+void setup_coverage_kernels(void);
 
 /* Extras */
 
@@ -1348,10 +1717,32 @@ int  statsd_format_metric(afl_state_t *afl, char *buff, size_t bufflen);
 
 fsrv_run_result_t fuzz_run_target(afl_state_t *, afl_forkserver_t *fsrv, u32);
 void              write_to_testcase(afl_state_t *, void *, u32);
+void write_to_fsrv_testcase(afl_state_t *, afl_forkserver_t *, void *, u32);
 u8   calibrate_case(afl_state_t *, struct queue_entry *, u8 *, u32, u8);
 void sync_fuzzers(afl_state_t *);
 u8   trim_case(afl_state_t *, struct queue_entry *, u8 *);
 u8   common_fuzz_stuff(afl_state_t *, u8 *, u32);
+u8   common_fuzz_result(afl_state_t *, u8 *, u32, u8);
+
+/* Fork server pool */
+
+void fsrv_pool_init(afl_state_t *);
+void fsrv_pool_deinit(afl_state_t *);
+s32  fsrv_pool_submit(afl_state_t *, u8 *, u32, u32);
+s32  fsrv_pool_collect(afl_state_t *, u8 *);
+
+/* Testcase prefetch */
+
+void testcase_prefetch_init(afl_state_t *);
+void testcase_prefetch_deinit(afl_state_t *);
+void testcase_prefetch(afl_state_t *, struct queue_entry *);
+u8 * testcase_prefetch_take(afl_state_t *, struct queue_entry *);
+void testcase_prefetch_drop(afl_state_t *, struct queue_entry *);
+
+/* Adaptive timeout */
+
+u32 adaptive_tmout(afl_state_t *);
+u8  adaptive_run_target(afl_state_t *, u8 *, u32, u8 *);
 
 /* Fuzz one */
 
@@ -1376,7 +1767,8 @@ double get_runnable_processes(void);
 void   nuke_resume_dir(afl_state_t *);
 int    check_main_node_exists(afl_state_t *);
 u32    select_next_queue_entry(afl_state_t *afl);
-void   create_alias_table(afl_state_t *afl);
+u32    select_splice_partner(afl_state_t *afl);
+void   queue_weight_update(afl_state_t *afl, struct queue_entry *q);
 void   setup_dirs_fds(afl_state_t *);
 void   setup_cmdline_file(afl_state_t *, char **);
 void   setup_stdio_file(afl_state_t *);
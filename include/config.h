@@ -133,6 +133,22 @@
 
 #define EXEC_TM_ROUND 20U
 
+/* AFL_ADAPTIVE_TMOUT: the early kill deadline follows this quantile (per
+   mille) of the exec times, once ADAPTIVE_TMOUT_WARMUP of them are known.
+   It is recomputed every ADAPTIVE_TMOUT_UPDATE execs, and the counts are
+   halved every ADAPTIVE_TMOUT_AGE execs, so that it follows the queue: */
+
+#define ADAPTIVE_TMOUT_QUANTILE 999U
+#define ADAPTIVE_TMOUT_WARMUP 4096U
+#define ADAPTIVE_TMOUT_UPDATE 1024U
+#define ADAPTIVE_TMOUT_AGE (1U << 20)
+
+/* Lowest early kill deadline (milliseconds), and one in how many early
+   kills without new coverage is rerun at the full timeout anyway: */
+
+#define ADAPTIVE_TMOUT_MIN 5U
+#define ADAPTIVE_TMOUT_SAMPLE 32U
+
 /* 64bit arch MACRO */
 #if (defined(__x86_64__) || defined(__arm64__) || defined(__aarch64__))
   #define WORD_SIZE_64 1
@@ -156,6 +172,19 @@
 #define CAL_CYCLES 8U
 #define CAL_CYCLES_LONG 20U
 
+/* AFL_CAL_ADAPTIVE: calibration of a new find stops after CAL_CYCLES_MIN or
+   more runs that match its first trace, once the chance that it is variable
+   anyway is below CAL_VAR_RISK percent: */
+
+#define CAL_CYCLES_MIN 2U
+#define CAL_VAR_RISK 1U
+
+/* cull_queue() updates the favored entries incrementally, every this many
+   updates it recomputes them from scratch to drop those that became
+   redundant meanwhile: */
+
+#define CULL_QUEUE_FULL 64U
+
 /* Number of subsequent timeouts before abandoning an input file: */
 
 #define TMOUT_LIMIT 250U
@@ -180,6 +209,12 @@
 
 #define HAVOC_MIN 12U
 
+/* The seed weights are all recomputed at the latest once the queue grew by
+   1 / SEL_REFRESH_DIV since the last time, which bounds how stale the
+   n_fuzz hits and queue averages in the weights of other entries get: */
+
+#define SEL_REFRESH_DIV 16U
+
 /* Power Schedule Divisor */
 #define POWER_BETA 1U
 #define MAX_FACTOR (POWER_BETA * 32)
@@ -377,6 +412,10 @@
 
 #define TESTCASE_CACHE_SIZE 50
 
+/* Testcases that AFL_TESTCACHE_PREFETCH reads ahead at most */
+
+#define TESTCASE_PREFETCH_SLOTS 4
+
 /* Maximum line length passed from GCC to 'as' and used for parsing
    configuration files: */
 
@@ -424,6 +463,11 @@
 
 #define FORK_WAIT_MULT 10
 
+/* Most writable memory (in MB) of a target that the user space snapshots of
+   AFL_USER_SNAPSHOT copy, larger targets are forked for every run: */
+
+#define USNAP_MAX_MB 1024
+
 /* Calibration timeout adjustments, to be a bit more generous when resuming
    fuzzing sessions or trying to calibrate already-added internal finds.
    The first value is a percentage, the other is in milliseconds: */
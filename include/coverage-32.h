@@ -50,6 +50,37 @@ inline void classify_counts(afl_forkserver_t *fsrv) {
   u32 *mem = (u32 *)fsrv->trace_bits;
   u32  i = (fsrv->map_size >> 2);
 
+  if (fsrv->dirty_map && fsrv->dirty_map->valid) {
+
+    /* AFL_DIRTY_MAP: only the lines the target touched can be non-zero */
+
+    u32 w, n = DIRTY_MAP_WORDS(fsrv->map_size);
+
+    for (w = 0; w < n; ++w) {
+
+      u64 bits = fsrv->dirty_map->bits[w];
+
+      while (bits) {
+
+        mem = (u32 *)(fsrv->trace_bits +
+                     ((w << 6) + __builtin_ctzll(bits)) * DIRTY_LINE);
+
+        for (i = 0; i < DIRTY_LINE / sizeof(u32); ++i) {
+
+          if (mem[i]) { mem[i] = classify_word(mem[i]); }
+
+        }
+
+        bits &= bits - 1;
+
+      }
+
+    }
+
+    return;
+
+  }
+
   while (i--) {
 
     /* Optimize for sparse bitmaps. */
@@ -0,0 +1,85 @@
+/*
+   american fuzzy lop++ - dirty map header
+   ---------------------------------------
+
+   Layout of the AFL_DIRTY_MAP region that afl-fuzz appends to the coverage
+   map shared memory, shared with the instrumentation runtime.
+
+   After every run, the forkserver of the runtime sets one bit per
+   DIRTY_LINE bytes of the coverage map that are not all zero and sets
+   valid. afl-fuzz clears valid before every run, and whenever it rewrites
+   the coverage map itself, so a stale dirty map is never trusted: reset,
+   classification and comparison then fall back to the whole map.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ */
+
+#ifndef _AFL_DIRTY_MAP_H
+#define _AFL_DIRTY_MAP_H
+
+#include "types.h"
+
+#include <string.h>
+
+/* Granularity of the dirty map: one cache line */
+
+#define DIRTY_LINE 64
+
+/* Offset of the dirty map in the coverage shared memory, set by afl-fuzz */
+
+#define DIRTY_MAP_ENV_VAR "__AFL_DIRTY_MAP"
+
+#define DIRTY_MAP_MAGIC 0x4d595244
+
+struct dirty_map {
+
+  u32 magic;                            /* DIRTY_MAP_MAGIC once maintained  */
+  u32 valid;                            /* bits[] match the coverage map    */
+  u32 pad[14];
+  u64 bits[];                           /* One bit per DIRTY_LINE bytes     */
+
+};
+
+/* Words of bits[] for a coverage map of map_size bytes */
+
+#define DIRTY_MAP_WORDS(map_size) \
+  (((map_size) + DIRTY_LINE * 64 - 1) / (DIRTY_LINE * 64))
+
+/* Offset of the dirty map behind the coverage map, and its size */
+
+#define DIRTY_MAP_OFFSET(map_size) \
+  (((map_size) + DIRTY_LINE - 1) / DIRTY_LINE * DIRTY_LINE)
+
+#define DIRTY_MAP_SIZE(map_size) \
+  (sizeof(struct dirty_map) + DIRTY_MAP_WORDS(map_size) * sizeof(u64))
+
+/* Zero the dirty lines of the coverage map */
+
+static inline void dirty_map_clear(struct dirty_map *dm, u8 *map,
+                                   u32 map_size) {
+
+  u32 w, n = DIRTY_MAP_WORDS(map_size);
+
+  for (w = 0; w < n; ++w) {
+
+    u64 bits = dm->bits[w];
+
+    while (bits) {
+
+      memset(map + ((w << 6) + __builtin_ctzll(bits)) * DIRTY_LINE, 0,
+             DIRTY_LINE);
+      bits &= bits - 1;
+
+    }
+
+  }
+
+}
+
+#endif
+
@@ -16,14 +16,18 @@ static char *afl_environment_deprecated[] = {
 
 static char *afl_environment_variables[] = {
 
+    "AFL_ADAPTIVE_TMOUT",
     "AFL_ALIGNED_ALLOC",
     "AFL_ALLOW_TMP",
     "AFL_ANALYZE_HEX",
     "AFL_AS",
     "AFL_AUTORESUME",
     "AFL_AS_FORCE_INSTRUMENT",
+    "AFL_BANDIT_SHARE",
+    "AFL_BATCH_ALG",
     "AFL_BENCH_JUST_ONE",
     "AFL_BENCH_UNTIL_CRASH",
+    "AFL_CAL_ADAPTIVE",
     "AFL_CAL_FAST",
     "AFL_CC",
     "AFL_CC_COMPILER",
@@ -42,6 +46,7 @@ static char *afl_environment_variables[] = {
     "AFL_DEBUG",
     "AFL_DEBUG_CHILD",
     "AFL_DEBUG_GDB",
+    "AFL_DIRTY_MAP",
     "AFL_DISABLE_TRIM",
     "AFL_DISABLE_LLVM_INSTRUMENTATION",
     "AFL_DONT_OPTIMIZE",
@@ -84,7 +89,10 @@ static char *afl_environment_variables[] = {
     "AFL_GCC_SKIP_NEVERZERO",
     "AFL_GCJ",
     "AFL_HANG_TMOUT",
+    "AFL_HAVOC_BATCH",
+    "AFL_FORKSRV_FUTEX",
     "AFL_FORKSRV_INIT_TMOUT",
+    "AFL_FSRV_POOL",
     "AFL_HARDEN",
     "AFL_I_DONT_CARE_ABOUT_MISSING_CRASHES",
     "AFL_IGNORE_UNKNOWN_ENVS",
@@ -131,6 +139,7 @@ static char *afl_environment_variables[] = {
     "AFL_LLVM_INSTRUMENT_FILE",
     "AFL_LLVM_THREADSAFE_INST",
     "AFL_LLVM_SKIP_NEVERZERO",
+    "AFL_MUT_ALG",
     "AFL_NO_AFFINITY",
     "AFL_TRY_AFFINITY",
     "AFL_LLVM_LTO_STARTID",
@@ -181,6 +190,8 @@ static char *afl_environment_variables[] = {
     "AFL_QUIET",
     "AFL_RANDOM_ALLOC_CANARY",
     "AFL_REAL_PATH",
+    "AFL_SEED_BANDIT",
+    "AFL_SHMEM_INPLACE",
     "AFL_SHUFFLE_QUEUE",
     "AFL_SKIP_BIN_CHECK",
     "AFL_SKIP_CPUFREQ",
@@ -191,6 +202,7 @@ static char *afl_environment_variables[] = {
     "AFL_STATSD_TAGS_FLAVOR",
     "AFL_TESTCACHE_SIZE",
     "AFL_TESTCACHE_ENTRIES",
+    "AFL_TESTCACHE_PREFETCH",
     "AFL_TMIN_EXACT",
     "AFL_TMPDIR",
     "AFL_TOKEN_FILE",
@@ -203,6 +215,7 @@ static char *afl_environment_variables[] = {
     "AFL_USE_LSAN",
     "AFL_WINE_PATH",
     "AFL_NO_SNAPSHOT",
+    "AFL_USER_SNAPSHOT",
     "AFL_EXPAND_HAVOC_NOW",
     "AFL_USE_FASAN",
     "AFL_USE_QASAN",
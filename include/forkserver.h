@@ -39,6 +39,11 @@ typedef struct afl_forkserver {
 
   u8 *trace_bits;                       /* SHM with instrumentation bitmap  */
 
+  struct dirty_map *dirty_map;          /* AFL_DIRTY_MAP, behind trace_bits */
+
+  struct fsrv_futex *futex;             /* AFL_FORKSRV_FUTEX control block  */
+  s32                futex_shm_id;      /* SysV shm id of the control block */
+
   s32 fsrv_pid,                         /* PID of the fork server           */
       child_pid,                        /* PID of the fuzzed program        */
       child_status,                     /* waitpid result for the child     */
@@ -77,6 +82,10 @@ typedef struct afl_forkserver {
 
   bool use_fauxsrv;                     /* Fauxsrv for non-forking targets? */
 
+  bool use_futex;                       /* AFL_FORKSRV_FUTEX requested      */
+
+  bool futex_active;                    /* Fork server uses the futex block */
+
   bool qemu_mode;                       /* if running in qemu mode or not   */
 
   bool frida_mode;                     /* if running in frida mode or not   */
@@ -142,6 +151,9 @@ u32  afl_fsrv_get_mapsize(afl_forkserver_t *fsrv, char **argv,
 void afl_fsrv_write_to_testcase(afl_forkserver_t *fsrv, u8 *buf, size_t len);
 fsrv_run_result_t afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
                                       volatile u8 *stop_soon_p);
+u8 afl_fsrv_run_start(afl_forkserver_t *fsrv, volatile u8 *stop_soon_p);
+fsrv_run_result_t afl_fsrv_run_finish(afl_forkserver_t *fsrv, u32 timeout,
+                                      volatile u8 *stop_soon_p);
 void              afl_fsrv_killall(void);
 void              afl_fsrv_deinit(afl_forkserver_t *fsrv);
 void              afl_fsrv_kill(afl_forkserver_t *fsrv);
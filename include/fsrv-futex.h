@@ -0,0 +1,102 @@
+/*
+   american fuzzy lop++ - forkserver futex control block
+   -----------------------------------------------------
+
+   Layout of the AFL_FORKSRV_FUTEX control block, a small SysV shared memory
+   segment per fork server whose id afl-fuzz passes in __AFL_FSRV_FUTEX.
+
+   A runtime that supports it sets magic before its hello message. From then
+   on, the run requests and results go through state instead of the control
+   pipes; the handshake itself still uses the pipes:
+
+     afl-fuzz: was_killed, state = REQ, wake      (one wake-up of the server)
+     server:   fork, child_pid, state = RUNNING
+     server:   waitpid, status, state = DONE, wake    (one wake-up of afl-fuzz)
+
+   afl-fuzz waits for DONE with the exec timeout and kills child_pid when it
+   expires, exactly as with the pipes.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ */
+
+#ifndef _AFL_FSRV_FUTEX_H
+#define _AFL_FSRV_FUTEX_H
+
+#include "types.h"
+
+/* Linux only, and it needs SysV shared memory */
+
+#if defined(__linux__) && !defined(USEMMAP)
+
+  #define FSRV_FUTEX 1
+
+  #include <errno.h>
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+  #include <time.h>
+  #include <unistd.h>
+
+  #define FSRV_FUTEX_ENV_VAR "__AFL_FSRV_FUTEX"
+
+  #define FSRV_FUTEX_MAGIC 0x58544646
+
+  #define FSRV_FUTEX_IDLE 0
+  #define FSRV_FUTEX_REQ 1
+  #define FSRV_FUTEX_RUNNING 2
+  #define FSRV_FUTEX_DONE 3
+
+struct fsrv_futex {
+
+  u32 magic;                            /* FSRV_FUTEX_MAGIC once supported  */
+  u32 state;                            /* FSRV_FUTEX_*, the futex word     */
+  u32 was_killed;                       /* Previous run timed out           */
+  s32 child_pid;                        /* Valid from FSRV_FUTEX_RUNNING on */
+  s32 status;                           /* waitpid() status, at DONE        */
+
+};
+
+/* Wait while *addr is val, at most timeout_ms if that is not 0. Returns 0 on
+   a wake-up or if *addr was no longer val, -1 with errno (ETIMEDOUT, EINTR)
+   otherwise. */
+
+static inline int fsrv_futex_wait(u32 *addr, u32 val, u32 timeout_ms) {
+
+  struct timespec ts;
+
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+  if (syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout_ms ? &ts : NULL,
+              NULL, 0) < 0 &&
+      errno != EAGAIN) {
+
+    return -1;
+
+  }
+
+  return 0;
+
+}
+
+static inline void fsrv_futex_set(struct fsrv_futex *ff, u32 state) {
+
+  __atomic_store_n(&ff->state, state, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &ff->state, FUTEX_WAKE, 1, NULL, NULL, 0);
+
+}
+
+static inline u32 fsrv_futex_get(struct fsrv_futex *ff) {
+
+  return __atomic_load_n(&ff->state, __ATOMIC_ACQUIRE);
+
+}
+
+#endif                                          /* __linux__ && !USEMMAP */
+
+#endif
+
@@ -54,6 +54,9 @@ typedef struct sharedmem {
   int             shmemfuzz_mode;
   struct cmp_map *cmp_map;
 
+  int               dirty_mode;                  /* AFL_DIRTY_MAP requested */
+  struct dirty_map *dirty_map;            /* Behind map, NULL if not in use */
+
 } sharedmem_t;
 
 u8 * afl_shm_init(sharedmem_t *, size_t, unsigned char non_instrumented_mode);
@@ -0,0 +1,574 @@
+/*
+   american fuzzy lop++ - user space snapshot routines
+   ---------------------------------------------------
+
+   Originally written by Michal Zalewski
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                     Heiko Eißfeldt <heiko.eissfeldt@hexco.de>,
+                     Andrea Fioraldi <andreafioraldi@gmail.com>,
+                     Dominik Maier <mail@dmnk.co>
+
+   Copyright 2016, 2017 Google Inc. All rights reserved.
+   Copyright 2019-2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Snapshots without the kernel module (AFL_USER_SNAPSHOT): the writable
+   private memory of the fork server child is copied once and registered
+   write-protected with an asynchronous userfaultfd. When the target calls
+   exit(), PAGEMAP_SCAN tells which pages were written, only those are
+   copied back and the child rolls back to the snapshot instead of dying.
+   Needs Linux 6.7 or newer. Anything that cannot be rolled back (new
+   threads, closed or remapped pre-snapshot state, _exit()) simply ends the
+   child and the fork server forks a fresh one.
+
+ */
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#include <ucontext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// From linux/userfaultfd.h and linux/fs.h of Linux 6.7
+
+#ifndef UFFD_USER_MODE_ONLY
+  #define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+  #define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+  #define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+
+#ifndef PAGEMAP_SCAN
+  #define PAGE_IS_WRITTEN (1 << 1)
+
+struct page_region {
+
+  __u64 start, end, categories;
+
+};
+
+struct pm_scan_arg {
+
+  __u64 size, flags, start, end, walk_end, vec, vec_len, max_pages,
+      category_inverted, category_mask, category_anyof_mask, return_mask;
+
+};
+
+  #define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+#define USNAP_RANGES 512                        /* writable mappings      */
+#define USNAP_LINES 4096                        /* lines of the maps file */
+#define USNAP_MAPS_LEN (256 << 10)              /* size of the maps file  */
+#define USNAP_FDS 1024                          /* fds tracked            */
+#define USNAP_REGIONS 512                       /* PAGEMAP_SCAN batch     */
+#define USNAP_STACK (64 << 10)                  /* restore stack          */
+
+struct usnap_range {
+
+  unsigned long start, end;
+  u8           *copy;
+
+};
+
+/* All of it lives in a shared mapping, which is neither copied nor rolled
+   back. */
+
+struct usnap {
+
+  ucontext_t snap, restore;
+  volatile u8 restored, valid;
+  pid_t       pid;
+  unsigned long brk;
+
+  int uffd, pagemap_fd, maps_fd, fd_dir, task_dir;
+
+  u32                nranges;
+  struct usnap_range range[USNAP_RANGES];
+
+  u32  nlines, maps_len, cur_len, nfds;
+  u32  line[USNAP_LINES];
+  char maps[USNAP_MAPS_LEN], cur[USNAP_MAPS_LEN];
+
+  u8                 fds[USNAP_FDS / 8];
+  u32                nseen, nclose;
+  int                close[USNAP_FDS];
+  struct page_region region[USNAP_REGIONS];
+  u8                 dents[4096];
+  u8                 stack[USNAP_STACK] __attribute__((aligned(16)));
+
+};
+
+static struct usnap *usnap;
+
+/* Takes the snapshot, and is where the child continues after every roll
+   back. A macro as the frame must stay live while the target runs. */
+
+#define usnap_take()                                 \
+  do {                                               \
+                                                     \
+    usnap->restored = 0;                             \
+    getcontext(&usnap->snap);                        \
+    if (!usnap->restored) { usnap_save(); }          \
+                                                     \
+  } while (0)
+
+static int usnap_uffd(void) {
+
+  struct uffdio_api api = {.api = UFFD_API,
+                           .features = UFFD_FEATURE_WP_ASYNC |
+                                       UFFD_FEATURE_WP_UNPOPULATED};
+  int fd = syscall(SYS_userfaultfd, O_CLOEXEC | UFFD_USER_MODE_ONLY);
+
+  if (fd < 0) { return -1; }
+
+  if (ioctl(fd, UFFDIO_API, &api) ||
+      !(api.features & UFFD_FEATURE_WP_ASYNC)) {
+
+    close(fd);
+    return -1;
+
+  }
+
+  return fd;
+
+}
+
+/* Can this kernel do it? Called in the fork server. */
+
+static int usnap_init(void) {
+
+  struct pm_scan_arg arg = {.size = sizeof(arg)};
+  int                fd, ret;
+
+  if ((fd = usnap_uffd()) < 0) { return -1; }
+  close(fd);
+
+  if ((fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC)) < 0) {
+
+    return -1;
+
+  }
+
+  ret = ioctl(fd, PAGEMAP_SCAN, &arg);
+  close(fd);
+  if (ret < 0) { return -1; }
+
+  usnap = mmap(NULL, sizeof(struct usnap), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (usnap == MAP_FAILED) {
+
+    usnap = NULL;
+    return -1;
+
+  }
+
+  return 0;
+
+}
+
+static u32 usnap_read_maps(char *buf) {
+
+  ssize_t len, ret;
+
+  for (len = 0; len < USNAP_MAPS_LEN - 1; len += ret) {
+
+    ret = pread(usnap->maps_fd, buf + len, USNAP_MAPS_LEN - 1 - len, len);
+    if (ret <= 0) { break; }
+
+  }
+
+  if (len >= USNAP_MAPS_LEN - 1) { return 0; }
+  buf[len] = 0;
+  return len;
+
+}
+
+/* Walks /proc/self/fd or /proc/self/task, calls back with every number. */
+
+static int usnap_dir(int dir, int (*fn)(int, void *), void *data) {
+
+  struct usnap_dirent {
+
+    u64            d_ino;
+    s64            d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+
+  } *d;
+
+  long len, pos;
+
+  if (lseek(dir, 0, SEEK_SET)) { return -1; }
+
+  while ((len = syscall(SYS_getdents64, dir, usnap->dents,
+                        sizeof(usnap->dents))) > 0) {
+
+    for (pos = 0; pos < len; pos += d->d_reclen) {
+
+      d = (struct usnap_dirent *)(usnap->dents + pos);
+      if (d->d_name[0] == '.') { continue; }
+      if (fn(atoi(d->d_name), data)) { return -1; }
+
+    }
+
+  }
+
+  return len;
+
+}
+
+static int usnap_fd_seen(int fd, void *data) {
+
+  if (fd >= USNAP_FDS) { return -1; }
+  usnap->fds[fd >> 3] |= 1 << (fd & 7);
+  ++*(u32 *)data;
+  return 0;
+
+}
+
+/* Counts the fds of the snapshot that are still open, notes the others. */
+
+static int usnap_fd_check(int fd, void *data) {
+
+  (void)data;
+
+  if (fd < USNAP_FDS && usnap->fds[fd >> 3] & (1 << (fd & 7))) {
+
+    ++usnap->nseen;
+
+  } else {
+
+    if (usnap->nclose >= USNAP_FDS) { return -1; }
+    usnap->close[usnap->nclose++] = fd;
+
+  }
+
+  return 0;
+
+}
+
+static int usnap_count(int n, void *data) {
+
+  (void)n;
+  ++*(u32 *)data;
+  return 0;
+
+}
+
+/* Is a line of the maps file a private anonymous mapping (or heap) that
+   came after the snapshot and can just go? */
+
+static int usnap_maps_extra(char *line) {
+
+  char *perm = line + strcspn(line, " ") + 1, *path = perm;
+  u32   field;
+
+  /* perms offset dev inode [path] */
+  for (field = 0; field < 3; ++field) {
+
+    path += strcspn(path, " \n");
+    if (*path != ' ') { return 0; }
+    ++path;
+
+  }
+
+  path += strcspn(path, " \n");
+  path += strspn(path, " ");
+
+  return perm[3] == 'p' && (*path == '\n' || !strncmp(path, "[heap]", 6));
+
+}
+
+/* Is a line of the maps file the heap of the snapshot, grown since? The
+   brk() before the rollback shrinks it back. */
+
+static int usnap_maps_heap(char *line, char *base) {
+
+  char *rest = line + strcspn(line, " "), *base_rest = base + strcspn(base, " ");
+  char *end = strchr(rest, '\n'), *p;
+
+  if (!end || strtoul(line, &p, 16) != strtoul(base, NULL, 16) ||
+      strtoul(p + 1, NULL, 16) <= strtoul(strchr(base, '-') + 1, NULL, 16) ||
+      strncmp(rest, base_rest, end - rest + 1)) {
+
+    return 0;
+
+  }
+
+  rest = end;
+  while (rest > line && rest[-1] == ' ') { --rest; }
+  return rest - line >= 6 && !strncmp(rest - 6, "[heap]", 6);
+
+}
+
+/* Compares the maps file with the one at the snapshot: 0 if they only
+   differ by new anonymous mappings, which unmap removes right away, and by
+   heap growth. */
+
+static int usnap_maps_check(u8 unmap) {
+
+  char         *cur = usnap->cur, *end, *base, *p;
+  unsigned long start, stop, base_start;
+  u32           i = 0;
+
+  if (!usnap->cur_len) { return -1; }
+
+  if (usnap->cur_len == usnap->maps_len &&
+      !memcmp(usnap->maps, cur, usnap->maps_len)) {
+
+    return 0;
+
+  }
+
+  while (*cur) {
+
+    end = strchr(cur, '\n');
+    if (!end) { return -1; }
+    start = strtoul(cur, &p, 16);
+    stop = strtoul(p + 1, NULL, 16);
+
+    base = i < usnap->nlines ? usnap->maps + usnap->line[i] : NULL;
+    base_start = base ? strtoul(base, NULL, 16) : ~0UL;
+
+    if (start == base_start && (!strncmp(cur, base, end - cur + 1) ||
+                                usnap_maps_heap(cur, base))) {
+
+      ++i;
+
+    } else if (stop <= base_start && usnap_maps_extra(cur)) {
+
+      if (unmap) { munmap((void *)start, stop - start); }
+
+    } else {
+
+      return -1;
+
+    }
+
+    cur = end + 1;
+
+  }
+
+  return i == usnap->nlines ? 0 : -1;
+
+}
+
+/* Copies the written pages back and write protects them again, on the
+   restore stack as the main stack is rolled back too. */
+
+static void usnap_restore(void) {
+
+  struct pm_scan_arg         arg = {.size = sizeof(arg)};
+  struct uffdio_writeprotect wp = {.mode = UFFDIO_WRITEPROTECT_MODE_WP};
+  struct usnap_range        *r;
+  u32                        i;
+  int                        n, j;
+
+  for (i = 0; i < usnap->nranges; ++i) {
+
+    r = &usnap->range[i];
+    arg.start = r->start;
+    arg.end = r->end;
+    arg.vec = (uintptr_t)usnap->region;
+    arg.vec_len = USNAP_REGIONS;
+    arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask = PAGE_IS_WRITTEN;
+
+    do {
+
+      if ((n = ioctl(usnap->pagemap_fd, PAGEMAP_SCAN, &arg)) < 0) {
+
+        _exit(0);
+
+      }
+
+      for (j = 0; j < n; ++j) {
+
+        wp.range.start = usnap->region[j].start;
+        wp.range.len = usnap->region[j].end - usnap->region[j].start;
+        memcpy((void *)(uintptr_t)wp.range.start,
+               r->copy + (wp.range.start - r->start), wp.range.len);
+        if (ioctl(usnap->uffd, UFFDIO_WRITEPROTECT, &wp)) { _exit(0); }
+
+      }
+
+      arg.start = arg.walk_end;
+
+    } while (n == USNAP_REGIONS && arg.start < arg.end);
+
+  }
+
+  setcontext(&usnap->snap);
+  _exit(0);
+
+}
+
+/* Registered with atexit() before the snapshot: rolls back the child
+   instead of letting it exit, if nothing is in the way. */
+
+static void usnap_exit(void) {
+
+  u32 cnt = 0;
+
+  if (!usnap || !usnap->valid || getpid() != usnap->pid) { return; }
+
+  usnap->valid = 0;
+
+  if (usnap_dir(usnap->task_dir, usnap_count, &cnt) || cnt != 1) { return; }
+
+  usnap->nseen = usnap->nclose = 0;
+  if (usnap_dir(usnap->fd_dir, usnap_fd_check, NULL) ||
+      usnap->nseen != usnap->nfds) {
+
+    return;
+
+  }
+
+  usnap->cur_len = usnap_read_maps(usnap->cur);
+  if (usnap_maps_check(0)) { return; }
+
+  /* from here on, there is no way back */
+
+  for (cnt = 0; cnt < usnap->nclose; ++cnt) {
+
+    close(usnap->close[cnt]);
+
+  }
+
+  syscall(SYS_brk, usnap->brk);
+  usnap_maps_check(1);
+
+  usnap->valid = 1;
+  usnap->restored = 1;
+  setcontext(&usnap->restore);
+  _exit(0);
+
+}
+
+static void usnap_close(void) {
+
+  if (usnap->uffd >= 0) { close(usnap->uffd); }
+  if (usnap->pagemap_fd >= 0) { close(usnap->pagemap_fd); }
+  if (usnap->maps_fd >= 0) { close(usnap->maps_fd); }
+  if (usnap->fd_dir >= 0) { close(usnap->fd_dir); }
+  if (usnap->task_dir >= 0) { close(usnap->task_dir); }
+
+}
+
+/* Takes the snapshot in a fresh fork server child. */
+
+static void usnap_save(void) {
+
+  struct uffdio_register     reg = {.mode = UFFDIO_REGISTER_MODE_WP};
+  struct uffdio_writeprotect wp = {.mode = UFFDIO_WRITEPROTECT_MODE_WP};
+  struct usnap_range        *r;
+  char                      *line, *end, *perm, *p;
+  unsigned long              size = 0;
+  u32                        i;
+  u8                        *copy;
+
+  usnap->valid = 0;
+  usnap->pid = getpid();
+  usnap->nranges = usnap->nlines = usnap->nfds = 0;
+  memset(usnap->fds, 0, sizeof(usnap->fds));
+
+  if (atexit(usnap_exit)) { return; }
+
+  usnap->brk = syscall(SYS_brk, 0);
+  usnap->uffd = usnap_uffd();
+  usnap->pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  usnap->maps_fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  usnap->fd_dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  usnap->task_dir =
+      open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if (usnap->uffd < 0 || usnap->pagemap_fd < 0 || usnap->maps_fd < 0 ||
+      usnap->fd_dir < 0 || usnap->task_dir < 0 ||
+      !usnap_read_maps(usnap->cur)) {
+
+    goto fail;
+
+  }
+
+  /* all the writable private mappings, including the stack */
+
+  for (line = usnap->cur; *line; line = end + 1) {
+
+    if (!(end = strchr(line, '\n'))) { goto fail; }
+
+    perm = line + strcspn(line, " ") + 1;
+    if (perm[1] != 'w' || perm[3] != 'p') { continue; }
+    if (usnap->nranges >= USNAP_RANGES) { goto fail; }
+
+    r = &usnap->range[usnap->nranges++];
+    r->start = strtoul(line, &p, 16);
+    r->end = strtoul(p + 1, NULL, 16);
+    size += r->end - r->start;
+
+  }
+
+  if (size > (unsigned long)USNAP_MAX_MB << 20) { goto fail; }
+
+  copy = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+              -1, 0);
+  if (copy == MAP_FAILED) { goto fail; }
+
+  for (i = 0; i < usnap->nranges; ++i) {
+
+    r = &usnap->range[i];
+    reg.range.start = wp.range.start = r->start;
+    reg.range.len = wp.range.len = r->end - r->start;
+
+    if (ioctl(usnap->uffd, UFFDIO_REGISTER, &reg)) { goto fail; }
+
+    r->copy = copy;
+    memcpy(copy, (void *)r->start, r->end - r->start);
+    copy += r->end - r->start;
+
+    if (ioctl(usnap->uffd, UFFDIO_WRITEPROTECT, &wp)) { goto fail; }
+
+  }
+
+  /* the baseline to compare with at exit: the maps, which now show the copy
+     too, and the open fds */
+
+  if (!(usnap->maps_len = usnap_read_maps(usnap->maps))) { goto fail; }
+
+  for (line = usnap->maps; *line; line = strchr(line, '\n') + 1) {
+
+    if (usnap->nlines >= USNAP_LINES) { goto fail; }
+    usnap->line[usnap->nlines++] = line - usnap->maps;
+
+  }
+
+  if (usnap_dir(usnap->fd_dir, usnap_fd_seen, &usnap->nfds)) { goto fail; }
+
+  getcontext(&usnap->restore);
+  usnap->restore.uc_stack.ss_sp = usnap->stack;
+  usnap->restore.uc_stack.ss_size = sizeof(usnap->stack);
+  usnap->restore.uc_link = NULL;
+  makecontext(&usnap->restore, usnap_restore, 0);
+
+  usnap->valid = 1;
+  return;
+
+fail:
+  usnap_close();
+
+}
+
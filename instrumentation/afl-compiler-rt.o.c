@@ -20,6 +20,8 @@
 #include "config.h"
 #include "types.h"
 #include "cmplog.h"
+#include "dirty-map.h"
+#include "fsrv-futex.h"
 #include "llvm-alternative-coverage.h"
 
 #include <stdio.h>
@@ -49,6 +51,7 @@
 
 #ifdef __linux__
   #include "snapshot-inl.h"
+  #include "usnapshot-inl.h"
 #endif
 
 /* This is a somewhat ugly hack for the experimental 'trace-pc-guard' mode.
@@ -118,6 +121,19 @@ int __afl_sharedmem_fuzzing __attribute__((weak));
 struct cmp_map *__afl_cmp_map;
 struct cmp_map *__afl_cmp_map_backup;
 
+/* AFL_DIRTY_MAP: dirty map behind the shared coverage map */
+
+static struct dirty_map *__afl_dirty_map;
+static u8 *              __afl_dirty_area;
+static u32               __afl_dirty_len, __afl_dirty_words;
+
+/* AFL_FORKSRV_FUTEX: run requests and results through shared memory */
+
+static struct fsrv_futex *__afl_fsrv_futex;
+#ifdef FSRV_FUTEX
+static pid_t __afl_fsrv_ppid;
+#endif
+
 /* Child pid? */
 
 static s32 child_pid;
@@ -257,6 +273,72 @@ static void __afl_map_shm_fuzz() {
 
 }
 
+/* AFL_DIRTY_MAP setup: afl-fuzz placed a struct dirty_map behind the coverage
+   map in the same shared memory and passes its offset. */
+
+static void __afl_map_dirty(u8 *shm_base, int shm_fd) {
+
+  char *off_str = getenv(DIRTY_MAP_ENV_VAR);
+  u32   off;
+
+  if (!off_str) { return; }
+
+  /* our coverage map must not overlap the dirty map */
+  off = atoi(off_str);
+  if (!off || off % DIRTY_LINE || __afl_map_size > off) { return; }
+
+#ifdef USEMMAP
+  shm_base = mmap(0, off + DIRTY_MAP_SIZE(off), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, shm_fd, 0);
+  if (shm_base == MAP_FAILED) { return; }
+#else
+  (void)shm_fd;
+#endif
+
+  __afl_dirty_area = shm_base;
+  __afl_dirty_map = (struct dirty_map *)(shm_base + off);
+  __afl_dirty_len = DIRTY_MAP_OFFSET(__afl_map_size);
+  __afl_dirty_words = DIRTY_MAP_WORDS(off);
+  __afl_dirty_map->magic = DIRTY_MAP_MAGIC;
+
+}
+
+/* Called by the forkserver after every run: mark the lines of the coverage
+   map that are not all zero. */
+
+static void __afl_update_dirty(void) {
+
+  u64 *mem = (u64 *)__afl_dirty_area;
+  u32  w, j, lines = __afl_dirty_len / DIRTY_LINE;
+
+  if (!__afl_dirty_map) { return; }
+
+  /* all words, a previous target may have had a larger map */
+  for (w = 0; w < __afl_dirty_words; ++w) {
+
+    u64 bits = 0;
+
+    for (j = 0; j < 64 && (w << 6) + j < lines; ++j) {
+
+      u64 *line = mem + ((w << 6) + j) * (DIRTY_LINE / sizeof(u64));
+
+      if (line[0] | line[1] | line[2] | line[3] | line[4] | line[5] | line[6] |
+          line[7]) {
+
+        bits |= 1ULL << j;
+
+      }
+
+    }
+
+    __afl_dirty_map->bits[w] = bits;
+
+  }
+
+  __afl_dirty_map->valid = 1;
+
+}
+
 /* SHM setup. */
 
 static void __afl_map_shm(void) {
@@ -377,6 +459,8 @@ static void __afl_map_shm(void) {
 
     }
 
+    if (shm_base != MAP_FAILED) { __afl_map_dirty(shm_base, shm_fd); }
+
     close(shm_fd);
     shm_fd = -1;
 
@@ -426,6 +510,8 @@ static void __afl_map_shm(void) {
 
     }
 
+    __afl_map_dirty(__afl_area_ptr, -1);
+
 #endif
 
     /* Write something into the bitmap so that even with low AFL_INST_RATIO,
@@ -654,6 +740,102 @@ void write_error_with_location(char *text, char *filename, int linenumber) {
 
 }
 
+/* AFL_FORKSRV_FUTEX setup: attach the control block afl-fuzz created for
+   this fork server and tell it we use it. */
+
+static void __afl_map_fsrv_futex(void) {
+
+#ifdef FSRV_FUTEX
+  char *id_str = getenv(FSRV_FUTEX_ENV_VAR);
+  void *ptr;
+
+  if (!id_str) { return; }
+
+  ptr = shmat(atoi(id_str), NULL, 0);
+  if (ptr == (void *)-1) { return; }
+
+  __afl_fsrv_futex = (struct fsrv_futex *)ptr;
+  __afl_fsrv_ppid = getppid();
+  __atomic_store_n(&__afl_fsrv_futex->magic, FSRV_FUTEX_MAGIC,
+                   __ATOMIC_RELEASE);
+#endif
+
+}
+
+/* Wait for the next run request of afl-fuzz. Returns 0 on success. */
+
+static int __afl_fsrv_read_req(u32 *was_killed) {
+
+#ifdef FSRV_FUTEX
+  if (__afl_fsrv_futex) {
+
+    u32 state;
+
+    while ((state = fsrv_futex_get(__afl_fsrv_futex)) != FSRV_FUTEX_REQ) {
+
+      /* there is no EOF to tell us that afl-fuzz is gone */
+      if (fsrv_futex_wait(&__afl_fsrv_futex->state, state, 1000) &&
+          errno != ETIMEDOUT && errno != EINTR) {
+
+        return -1;
+
+      }
+
+      if (getppid() != __afl_fsrv_ppid) { return -1; }
+
+    }
+
+    *was_killed = __afl_fsrv_futex->was_killed;
+    return 0;
+
+  }
+
+#endif
+
+  return read(FORKSRV_FD, was_killed, 4) == 4 ? 0 : -1;
+
+}
+
+/* Tell afl-fuzz the pid of the new child. afl-fuzz only needs it to kill
+   the child on a timeout, so the futex transport does not wake it up. */
+
+static int __afl_fsrv_write_pid(s32 pid) {
+
+#ifdef FSRV_FUTEX
+  if (__afl_fsrv_futex) {
+
+    __afl_fsrv_futex->child_pid = pid;
+    __atomic_store_n(&__afl_fsrv_futex->state, FSRV_FUTEX_RUNNING,
+                     __ATOMIC_RELEASE);
+    return 0;
+
+  }
+
+#endif
+
+  return write(FORKSRV_FD + 1, &pid, 4) == 4 ? 0 : -1;
+
+}
+
+/* Relay the wait status of the child to afl-fuzz */
+
+static int __afl_fsrv_write_status(s32 status) {
+
+#ifdef FSRV_FUTEX
+  if (__afl_fsrv_futex) {
+
+    __afl_fsrv_futex->status = status;
+    fsrv_futex_set(__afl_fsrv_futex, FSRV_FUTEX_DONE);
+    return 0;
+
+  }
+
+#endif
+
+  return write(FORKSRV_FD + 1, &status, 4) == 4 ? 0 : -1;
+
+}
+
 #ifdef __linux__
 static void __afl_start_snapshots(void) {
 
@@ -737,7 +919,7 @@ static void __afl_start_snapshots(void) {
 
       // uh this forkserver does not understand extended option passing
       // or does not want the dictionary
-      if (!__afl_fuzz_ptr) already_read_first = 1;
+      if (!__afl_fuzz_ptr && !__afl_fsrv_futex) already_read_first = 1;
 
     }
 
@@ -754,7 +936,7 @@ static void __afl_start_snapshots(void) {
     } else {
 
       /* Wait for parent by reading from the pipe. Abort if read fails. */
-      if (read(FORKSRV_FD, &was_killed, 4) != 4) {
+      if (__afl_fsrv_read_req(&was_killed)) {
 
         write_error("reading from afl-fuzz");
         _exit(1);
@@ -829,8 +1011,13 @@ static void __afl_start_snapshots(void) {
         close(FORKSRV_FD);
         close(FORKSRV_FD + 1);
 
-        if (!afl_snapshot_take(AFL_SNAPSHOT_MMAP | AFL_SNAPSHOT_FDS |
-                               AFL_SNAPSHOT_REGS | AFL_SNAPSHOT_EXIT)) {
+        if (usnap) {
+
+          usnap_take();
+          raise(SIGSTOP);
+
+        } else if (!afl_snapshot_take(AFL_SNAPSHOT_MMAP | AFL_SNAPSHOT_FDS |
+                                      AFL_SNAPSHOT_REGS | AFL_SNAPSHOT_EXIT)) {
 
           raise(SIGSTOP);
 
@@ -843,6 +1030,24 @@ static void __afl_start_snapshots(void) {
 
       }
 
+      /* Copying the memory of a big target for a user space snapshot takes
+         a while, which must not count against the timeout of the run. The
+         child stops once it is done. */
+
+      if (usnap) {
+
+        if (waitpid(child_pid, &status, WUNTRACED) < 0 ||
+            !WIFSTOPPED(status)) {
+
+          write_error("user space snapshot");
+          _exit(1);
+
+        }
+
+        kill(child_pid, SIGCONT);
+
+      }
+
     } else {
 
       /* Special handling for persistent mode: if the child is alive but
@@ -855,7 +1060,7 @@ static void __afl_start_snapshots(void) {
 
     /* In parent process: write PID to pipe, then wait for child. */
 
-    if (write(FORKSRV_FD + 1, &child_pid, 4) != 4) {
+    if (__afl_fsrv_write_pid(child_pid)) {
 
       write_error("write to afl-fuzz");
       _exit(1);
@@ -875,9 +1080,11 @@ static void __afl_start_snapshots(void) {
 
     if (WIFSTOPPED(status)) child_stopped = 1;
 
+    __afl_update_dirty();
+
     /* Relay wait status to pipe, then loop back. */
 
-    if (write(FORKSRV_FD + 1, &status, 4) != 4) {
+    if (__afl_fsrv_write_status(status)) {
 
       write_error("writing to afl-fuzz");
       _exit(1);
@@ -897,6 +1104,8 @@ static void __afl_start_forkserver(void) {
   if (__afl_already_initialized_forkserver) return;
   __afl_already_initialized_forkserver = 1;
 
+  __afl_map_fsrv_futex();
+
   struct sigaction orig_action;
   sigaction(SIGTERM, NULL, &orig_action);
   old_sigterm_handler = orig_action.sa_handler;
@@ -911,6 +1120,15 @@ static void __afl_start_forkserver(void) {
 
   }
 
+  /* no kernel module, snapshots in user space if wanted and possible */
+  if (!is_persistent && !__afl_cmp_map && getenv("AFL_USER_SNAPSHOT") &&
+      usnap_init() >= 0) {
+
+    __afl_start_snapshots();
+    return;
+
+  }
+
 #endif
 
   u8  tmp[4] = {0, 0, 0, 0};
@@ -997,7 +1215,7 @@ static void __afl_start_forkserver(void) {
 
       // uh this forkserver does not understand extended option passing
       // or does not want the dictionary
-      if (!__afl_fuzz_ptr) already_read_first = 1;
+      if (!__afl_fuzz_ptr && !__afl_fsrv_futex) already_read_first = 1;
 
     }
 
@@ -1015,7 +1233,7 @@ static void __afl_start_forkserver(void) {
 
     } else {
 
-      if (read(FORKSRV_FD, &was_killed, 4) != 4) {
+      if (__afl_fsrv_read_req(&was_killed)) {
 
         // write_error("read from afl-fuzz");
         _exit(1);
@@ -1105,7 +1323,7 @@ static void __afl_start_forkserver(void) {
 
     /* In parent process: write PID to pipe, then wait for child. */
 
-    if (write(FORKSRV_FD + 1, &child_pid, 4) != 4) {
+    if (__afl_fsrv_write_pid(child_pid)) {
 
       write_error("write to afl-fuzz");
       _exit(1);
@@ -1125,9 +1343,11 @@ static void __afl_start_forkserver(void) {
 
     if (WIFSTOPPED(status)) child_stopped = 1;
 
+    __afl_update_dirty();
+
     /* Relay wait status to pipe, then loop back. */
 
-    if (write(FORKSRV_FD + 1, &status, 4) != 4) {
+    if (__afl_fsrv_write_status(status)) {
 
       write_error("writing to afl-fuzz");
       _exit(1);
@@ -32,6 +32,8 @@
 #include "common.h"
 #include "list.h"
 #include "forkserver.h"
+#include "dirty-map.h"
+#include "fsrv-futex.h"
 #include "hash.h"
 
 #include <stdio.h>
@@ -48,6 +50,10 @@
 #include <sys/resource.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#ifdef FSRV_FUTEX
+  #include <sys/ipc.h>
+  #include <sys/shm.h>
+#endif
 
 /**
  * The correct fds for reading and writing pipes
@@ -96,6 +102,11 @@ void afl_fsrv_init(afl_forkserver_t *fsrv) {
   fsrv->debug = false;
   fsrv->uses_crash_exitcode = false;
   fsrv->uses_asan = false;
+  fsrv->dirty_map = NULL;
+  fsrv->use_futex = false;
+  fsrv->futex_active = false;
+  fsrv->futex = NULL;
+  fsrv->futex_shm_id = -1;
 
   fsrv->init_child_func = fsrv_exec_child;
   list_append(&fsrv_list, fsrv);
@@ -112,6 +123,7 @@ void afl_fsrv_init_dup(afl_forkserver_t *fsrv_to, afl_forkserver_t *from) {
   fsrv_to->mem_limit = from->mem_limit;
   fsrv_to->map_size = from->map_size;
   fsrv_to->real_map_size = from->real_map_size;
+  fsrv_to->dirty_map = from->dirty_map;
   fsrv_to->support_shmem_fuzz = from->support_shmem_fuzz;
   fsrv_to->out_file = from->out_file;
   fsrv_to->dev_urandom_fd = from->dev_urandom_fd;
@@ -121,12 +133,16 @@ void afl_fsrv_init_dup(afl_forkserver_t *fsrv_to, afl_forkserver_t *from) {
   fsrv_to->crash_exitcode = from->crash_exitcode;
   fsrv_to->kill_signal = from->kill_signal;
   fsrv_to->debug = from->debug;
+  fsrv_to->use_futex = from->use_futex;
 
   // These are forkserver specific.
   fsrv_to->out_dir_fd = -1;
   fsrv_to->child_pid = -1;
   fsrv_to->use_fauxsrv = 0;
   fsrv_to->last_run_timed_out = 0;
+  fsrv_to->futex_active = false;
+  fsrv_to->futex = NULL;
+  fsrv_to->futex_shm_id = -1;
 
   fsrv_to->init_child_func = from->init_child_func;
   // Note: do not copy ->add_extra_func or ->persistent_record*
@@ -212,6 +228,170 @@ restart_select:
 
 }
 
+/* Check the child pid the fork server reported. Returns 1 if the user wants
+   to quit, 0 if the pid is fine, and does not return otherwise. */
+
+static u8 fsrv_check_child_pid(afl_forkserver_t *fsrv,
+                               volatile u8 *     stop_soon_p) {
+
+  if (fsrv->child_pid > 0) { return 0; }
+
+  if (*stop_soon_p) { return 1; }
+
+  if ((fsrv->child_pid & FS_OPT_ERROR) &&
+      FS_OPT_GET_ERROR(fsrv->child_pid) == FS_ERROR_SHM_OPEN)
+    FATAL(
+        "Target reported shared memory access failed (perhaps increase "
+        "shared memory available).");
+
+  FATAL("Fork server is misbehaving (OOM?)");
+
+}
+
+#ifdef FSRV_FUTEX
+
+/* AFL_FORKSRV_FUTEX: create the control block of this fork server, or reset
+   it for a restarted one. The segment is removed right away, it lives on as
+   long as afl-fuzz or the fork server are attached. */
+
+static void fsrv_futex_init(afl_forkserver_t *fsrv) {
+
+  if (!fsrv->futex) {
+
+    fsrv->futex_shm_id = shmget(IPC_PRIVATE, sizeof(struct fsrv_futex),
+                                IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
+    if (fsrv->futex_shm_id < 0) { PFATAL("shmget() failed"); }
+
+    fsrv->futex = shmat(fsrv->futex_shm_id, NULL, 0);
+    if (fsrv->futex == (void *)-1) { PFATAL("shmat() failed"); }
+
+    shmctl(fsrv->futex_shm_id, IPC_RMID, NULL);
+
+  }
+
+  memset(fsrv->futex, 0, sizeof(struct fsrv_futex));
+
+}
+
+/* Has the fork server exited? It is left to be reaped as usual. */
+
+static u8 fsrv_futex_server_gone(afl_forkserver_t *fsrv) {
+
+  siginfo_t info = {0};
+
+  waitid(P_PID, fsrv->fsrv_pid, &info, WEXITED | WNOHANG | WNOWAIT);
+  return info.si_pid != 0;
+
+}
+
+/* Wait until the fork server reports the end of the run. Returns 1 when it
+   did, 0 once deadline_us passed and -1 if the fork server is gone or the
+   user wants to quit. The fork server is checked at the deadline, and every
+   second without one, as there is no EOF on a futex. */
+
+static s32 fsrv_futex_wait_done(afl_forkserver_t *fsrv, u64 deadline_us,
+                                volatile u8 *stop_soon_p) {
+
+  struct fsrv_futex *ff = fsrv->futex;
+  u32                state, wait_ms;
+
+  while ((state = fsrv_futex_get(ff)) != FSRV_FUTEX_DONE) {
+
+    if (*stop_soon_p) { return -1; }
+
+    wait_ms = 1000;
+
+    if (deadline_us) {
+
+      u64 now_us = get_cur_time_us();
+
+      if (now_us >= deadline_us) {
+
+        return fsrv_futex_server_gone(fsrv) ? -1 : 0;
+
+      }
+
+      wait_ms = MIN(wait_ms, (deadline_us - now_us + 999) / 1000);
+
+    }
+
+    if (fsrv_futex_wait(&ff->state, state, wait_ms) && errno == ETIMEDOUT &&
+        !deadline_us && fsrv_futex_server_gone(fsrv)) {
+
+      return -1;
+
+    }
+
+  }
+
+  return 1;
+
+}
+
+/* The run protocol of afl_fsrv_run_target() over the futex control block:
+   sets child_pid, child_status and last_run_timed_out, returns like
+   read_s32_timed(). */
+
+static u32 __attribute__((hot))
+fsrv_futex_run(afl_forkserver_t *fsrv, u32 was_killed, u32 timeout,
+               volatile u8 *stop_soon_p) {
+
+  struct fsrv_futex *ff = fsrv->futex;
+  u64                start_us = get_cur_time_us();
+  s32                done;
+  u32                exec_ms;
+
+  ff->was_killed = was_killed;
+  fsrv_futex_set(ff, FSRV_FUTEX_REQ);
+  fsrv->last_run_timed_out = 0;
+
+  done = fsrv_futex_wait_done(fsrv, start_us + (u64)timeout * 1000,
+                              stop_soon_p);
+
+  if (!done) {
+
+    /* Timeout: the child pid is published without a wake-up, it is only
+       missing if the fork server did not even get to fork() */
+
+    while (fsrv_futex_get(ff) == FSRV_FUTEX_REQ) {
+
+      if (*stop_soon_p) { return 0; }
+
+      if (fsrv_futex_server_gone(fsrv)) {
+
+        FATAL("Unable to request new process from fork server (OOM?)");
+
+      }
+
+      usleep(100);
+
+    }
+
+    fsrv->child_pid = ff->child_pid;
+    if (fsrv_check_child_pid(fsrv, stop_soon_p)) { return 0; }
+    kill(fsrv->child_pid, fsrv->kill_signal);
+    fsrv->last_run_timed_out = 1;
+
+    if (fsrv_futex_wait_done(fsrv, 0, stop_soon_p) < 0) { return 0; }
+
+    fsrv->child_status = ff->status;
+    return timeout + 1;
+
+  }
+
+  if (done < 0) { return 0; }
+
+  fsrv->child_pid = ff->child_pid;
+  if (fsrv_check_child_pid(fsrv, stop_soon_p)) { return 0; }
+  fsrv->child_status = ff->status;
+
+  exec_ms = MIN(timeout, (get_cur_time_us() - start_us) / 1000);
+  return exec_ms > 0 ? exec_ms : 1;
+
+}
+
+#endif                                                       /* FSRV_FUTEX */
+
 /* Internal forkserver for non_instrumented_mode=1 and non-forkserver mode runs.
   It execvs for each fork, forwarding exit codes and child pids to afl. */
 
@@ -401,6 +581,11 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
 
   if (pipe(st_pipe) || pipe(ctl_pipe)) { PFATAL("pipe() failed"); }
 
+  fsrv->futex_active = false;
+#ifdef FSRV_FUTEX
+  if (fsrv->use_futex) { fsrv_futex_init(fsrv); }
+#endif
+
   fsrv->last_run_timed_out = 0;
   fsrv->fsrv_pid = fork();
 
@@ -424,6 +609,21 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
 
     }
 
+#ifdef FSRV_FUTEX
+    if (fsrv->futex) {
+
+      char id_buf[16];
+      sprintf(id_buf, "%d", fsrv->futex_shm_id);
+      setenv(FSRV_FUTEX_ENV_VAR, id_buf, 1);
+
+    } else {
+
+      unsetenv(FSRV_FUTEX_ENV_VAR);
+
+    }
+
+#endif
+
     /* Umpf. On OpenBSD, the default fd limit for root users is set to
        soft 128. Let's try to fix that... */
     if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
@@ -645,6 +845,19 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
     if ((status & FS_OPT_ERROR) == FS_OPT_ERROR)
       report_error_and_exit(FS_OPT_GET_ERROR(status));
 
+#ifdef FSRV_FUTEX
+    /* the runtime sets the magic before its hello message */
+    if (fsrv->futex &&
+        __atomic_load_n(&fsrv->futex->magic, __ATOMIC_ACQUIRE) ==
+            FSRV_FUTEX_MAGIC) {
+
+      fsrv->futex_active = true;
+      if (!be_quiet) { ACTF("Using FORKSRV FUTEX feature."); }
+
+    }
+
+#endif
+
     if ((status & FS_OPT_ENABLED) == FS_OPT_ENABLED) {
 
       // workaround for recent afl++ versions
@@ -815,6 +1028,17 @@ void afl_fsrv_start(afl_forkserver_t *fsrv, char **argv,
           if (!be_quiet) { ACTF("Loaded %u autodictionary entries", count); }
           ck_free(dict);
 
+        } else if (fsrv->futex_active && !fsrv->use_shmem_fuzz) {
+
+          /* the runtime waits for an answer on the pipe, as our first run
+             request will not come through there */
+          status = FS_OPT_ENABLED;
+          if (write(fsrv->fsrv_ctl_fd, &status, 4) != 4) {
+
+            FATAL("Writing to forkserver failed.");
+
+          }
+
         }
 
       }
@@ -1100,7 +1324,9 @@ void afl_fsrv_write_to_testcase(afl_forkserver_t *fsrv, u8 *buf, size_t len) {
     if (unlikely(len > MAX_FILE)) len = MAX_FILE;
 
     *fsrv->shmem_fuzz_len = len;
-    memcpy(fsrv->shmem_fuzz, buf, len);
+
+    /* AFL_SHMEM_INPLACE: havoc mutated it right there */
+    if (buf != fsrv->shmem_fuzz) { memcpy(fsrv->shmem_fuzz, buf, len); }
 #ifdef _DEBUG
     if (getenv("AFL_DEBUG")) {
 
@@ -1172,30 +1398,59 @@ void afl_fsrv_write_to_testcase(afl_forkserver_t *fsrv, u8 *buf, size_t len) {
 
 }
 
-/* Execute target application, monitoring for timeouts. Return status
-   information. The called program will update afl->fsrv->trace_bits. */
+/* Reset the coverage map before a run. */
 
-fsrv_run_result_t afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
-                                      volatile u8 *stop_soon_p) {
-
-  s32 res;
-  u32 exec_ms;
-  u32 write_value = fsrv->last_run_timed_out;
+static inline void fsrv_reset_map(afl_forkserver_t *fsrv) {
 
   /* After this memset, fsrv->trace_bits[] are effectively volatile, so we
      must prevent any earlier operations from venturing into that
      territory. */
 
-  memset(fsrv->trace_bits, 0, fsrv->map_size);
+  if (fsrv->dirty_map) {
+
+    /* AFL_DIRTY_MAP: only clear the lines the last run touched */
+    if (fsrv->dirty_map->valid) {
+
+      dirty_map_clear(fsrv->dirty_map, fsrv->trace_bits, fsrv->map_size);
+
+    } else {
+
+      memset(fsrv->trace_bits, 0, fsrv->map_size);
+
+    }
+
+    fsrv->dirty_map->valid = 0;
+
+  } else {
+
+    memset(fsrv->trace_bits, 0, fsrv->map_size);
+
+  }
 
   MEM_BARRIER();
 
+}
+
+static fsrv_run_result_t fsrv_run_result(afl_forkserver_t *fsrv, u32 exec_ms,
+                                         volatile u8 *stop_soon_p);
+
+/* Start a run of the target without waiting for it: reset the coverage map,
+   request a new process from the fork server and read its pid. Only for the
+   pipe transport. Returns 1 if the user wants to quit, 0 otherwise. */
+
+u8 afl_fsrv_run_start(afl_forkserver_t *fsrv, volatile u8 *stop_soon_p) {
+
+  s32 res;
+  u32 write_value = fsrv->last_run_timed_out;
+
+  fsrv_reset_map(fsrv);
+
   /* we have the fork server (or faux server) up and running
   First, tell it if the previous run timed out. */
 
   if ((res = write(fsrv->fsrv_ctl_fd, &write_value, 4)) != 4) {
 
-    if (*stop_soon_p) { return 0; }
+    if (*stop_soon_p) { return 1; }
     RPFATAL(res, "Unable to request new process from fork server (OOM?)");
 
   }
@@ -1204,48 +1459,31 @@ fsrv_run_result_t afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
 
   if ((res = read(fsrv->fsrv_st_fd, &fsrv->child_pid, 4)) != 4) {
 
-    if (*stop_soon_p) { return 0; }
+    if (*stop_soon_p) { return 1; }
     RPFATAL(res, "Unable to request new process from fork server (OOM?)");
 
   }
 
-#ifdef AFL_PERSISTENT_RECORD
-  // end of persistent loop?
-  if (unlikely(fsrv->persistent_record &&
-               fsrv->persistent_record_pid != fsrv->child_pid)) {
+  return fsrv_check_child_pid(fsrv, stop_soon_p);
 
-    fsrv->persistent_record_pid = fsrv->child_pid;
-    u32 idx, val;
-    if (unlikely(!fsrv->persistent_record_idx))
-      idx = fsrv->persistent_record - 1;
-    else
-      idx = fsrv->persistent_record_idx - 1;
-    val = fsrv->persistent_record_len[idx];
-    memset((void *)fsrv->persistent_record_len, 0,
-           fsrv->persistent_record * sizeof(u32));
-    fsrv->persistent_record_len[idx] = val;
+}
 
-  }
+/* Wait at most timeout ms for the run started by afl_fsrv_run_start() to
+   end, killing the child if it does not, and report the outcome. A timeout
+   of 0 means that the caller's deadline for the run already passed. */
 
-#endif
-
-  if (fsrv->child_pid <= 0) {
+fsrv_run_result_t afl_fsrv_run_finish(afl_forkserver_t *fsrv, u32 timeout,
+                                      volatile u8 *stop_soon_p) {
 
-    if (*stop_soon_p) { return 0; }
+  u32 exec_ms = 1;
 
-    if ((fsrv->child_pid & FS_OPT_ERROR) &&
-        FS_OPT_GET_ERROR(fsrv->child_pid) == FS_ERROR_SHM_OPEN)
-      FATAL(
-          "Target reported shared memory access failed (perhaps increase "
-          "shared memory available).");
+  if (timeout) {
 
-    FATAL("Fork server is misbehaving (OOM?)");
+    exec_ms = read_s32_timed(fsrv->fsrv_st_fd, &fsrv->child_status, timeout,
+                             stop_soon_p);
 
   }
 
-  exec_ms = read_s32_timed(fsrv->fsrv_st_fd, &fsrv->child_status, timeout,
-                           stop_soon_p);
-
   if (exec_ms > timeout) {
 
     /* If there was no response from forkserver after timeout seconds,
@@ -1257,6 +1495,61 @@ fsrv_run_result_t afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
 
   }
 
+  return fsrv_run_result(fsrv, exec_ms, stop_soon_p);
+
+}
+
+/* Execute target application, monitoring for timeouts. Return status
+   information. The called program will update afl->fsrv->trace_bits. */
+
+fsrv_run_result_t afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
+                                      volatile u8 *stop_soon_p) {
+
+  if (fsrv->futex_active) {
+
+    /* AFL_FORKSRV_FUTEX: one wake-up of the fork server, one of us */
+    u32 exec_ms = 0;
+    fsrv_reset_map(fsrv);
+#ifdef FSRV_FUTEX
+    exec_ms = fsrv_futex_run(fsrv, fsrv->last_run_timed_out, timeout,
+                             stop_soon_p);
+#endif
+    return fsrv_run_result(fsrv, exec_ms, stop_soon_p);
+
+  }
+
+  if (afl_fsrv_run_start(fsrv, stop_soon_p)) { return 0; }
+
+  return afl_fsrv_run_finish(fsrv, timeout, stop_soon_p);
+
+}
+
+/* Bookkeeping at the end of a run, and classification of its outcome.
+   exec_ms is 0 if the fork server could not be reached. */
+
+static fsrv_run_result_t fsrv_run_result(afl_forkserver_t *fsrv, u32 exec_ms,
+                                         volatile u8 *stop_soon_p) {
+
+#ifdef AFL_PERSISTENT_RECORD
+  // end of persistent loop?
+  if (unlikely(fsrv->persistent_record &&
+               fsrv->persistent_record_pid != fsrv->child_pid)) {
+
+    fsrv->persistent_record_pid = fsrv->child_pid;
+    u32 idx, val;
+    if (unlikely(!fsrv->persistent_record_idx))
+      idx = fsrv->persistent_record - 1;
+    else
+      idx = fsrv->persistent_record_idx - 1;
+    val = fsrv->persistent_record_len[idx];
+    memset((void *)fsrv->persistent_record_len, 0,
+           fsrv->persistent_record * sizeof(u32));
+    fsrv->persistent_record_len[idx] = val;
+
+  }
+
+#endif
+
   if (!exec_ms) {
 
     if (*stop_soon_p) { return 0; }
@@ -1281,7 +1574,7 @@ fsrv_run_result_t afl_fsrv_run_target(afl_forkserver_t *fsrv, u32 timeout,
          "If all else fails you can disable the fork server via "
          "AFL_NO_FORKSRV=1.\n",
          fsrv->mem_limit);
-    RPFATAL(res, "Unable to communicate with fork server");
+    FATAL("Unable to communicate with fork server");
 
   }
 
@@ -1389,5 +1682,15 @@ void afl_fsrv_deinit(afl_forkserver_t *fsrv) {
   afl_fsrv_kill(fsrv);
   list_remove(&fsrv_list, fsrv);
 
+#ifdef FSRV_FUTEX
+  if (fsrv->futex) {
+
+    shmdt(fsrv->futex);
+    fsrv->futex = NULL;
+
+  }
+
+#endif
+
 }
 
@@ -0,0 +1,2761 @@
+/*
+   american fuzzy lop++ - bandit algorithms
+   ----------------------------------------
+
+   Originally written by Michal Zalewski
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                        Heiko Eißfeldt <heiko.eissfeldt@hexco.de> and
+                        Andrea Fioraldi <andreafioraldi@gmail.com>
+
+   Copyright 2016, 2017 Google Inc. All rights reserved.
+   Copyright 2019-2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Bandit algorithms used to schedule havoc mutation operators and stack
+   sizes. Every algorithm is reachable through the bandit_ops[] table; the
+   havoc loop goes through bandit_select_arm() / bandit_add_reward(), which
+   switch on the algorithm id so that each per-algorithm kernel is inlined.
+
+ */
+
+#include "afl-fuzz.h"
+
+#include <assert.h>
+#include <math.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  #define BETA_AVX2
+  #include <immintrin.h>
+#endif
+
+/* dbe_t.stale_arm when no arm, or more than one arm, changed */
+#define DBE_NO_STALE_ARM (-1)
+#define DBE_ALL_ARMS_STALE (-2)
+
+/* Random variates
+
+   Everything below draws from the afl rand_next() state, so -s reproduces
+   the bandit decisions as well. */
+
+static inline u64 rand_next64(afl_state_t *afl) {
+
+#ifdef WORD_SIZE_64
+  return rand_next(afl);
+#else
+  return ((u64)rand_next(afl) << 32) | rand_next(afl);
+#endif
+
+}
+
+/* uniform in [0, 1) */
+
+static inline double rand_unit(afl_state_t *afl) {
+
+  return (rand_next64(afl) >> 11) * 0x1.0p-53;
+
+}
+
+/* uniform in (0, 1], safe to take the log of */
+
+static inline double rand_unit_pos(afl_state_t *afl) {
+
+  return ((rand_next64(afl) >> 11) + 1) * 0x1.0p-53;
+
+}
+
+/* Standard normal, Marsaglia & Tsang's 128 layer ziggurat. The layer index
+   and the 32 bit abscissa come from different halves of one draw. */
+
+#define ZIG_R 3.442619855899
+#define ZIG_V 9.91256303526217e-3
+
+static u32    zig_k[128];
+static double zig_w[128], zig_f[128];
+static u8     zig_ready;
+
+static void zig_setup(void) {
+
+  double dn = ZIG_R, tn = dn, m1 = 2147483648.0;
+  double q = ZIG_V / exp(-.5 * dn * dn);
+  int    i;
+
+  zig_k[0] = (u32)((dn / q) * m1);
+  zig_k[1] = 0;
+  zig_w[0] = q / m1;
+  zig_w[127] = dn / m1;
+  zig_f[0] = 1.0;
+  zig_f[127] = exp(-.5 * dn * dn);
+
+  for (i = 126; i >= 1; i--) {
+
+    dn = sqrt(-2. * log(ZIG_V / dn + exp(-.5 * dn * dn)));
+    zig_k[i + 1] = (u32)((dn / tn) * m1);
+    tn = dn;
+    zig_f[i] = exp(-.5 * dn * dn);
+    zig_w[i] = dn / m1;
+
+  }
+
+  zig_ready = 1;
+
+}
+
+static double rand_normal_slow(afl_state_t *afl, s32 hz, u32 iz) {
+
+  while (1) {
+
+    double x = hz * zig_w[iz];
+
+    /* the tail */
+    if (!iz) {
+
+      double y;
+      do {
+
+        x = -log(rand_unit_pos(afl)) / ZIG_R;
+        y = -log(rand_unit_pos(afl));
+
+      } while (y + y < x * x);
+
+      return hz > 0 ? ZIG_R + x : -ZIG_R - x;
+
+    }
+
+    if (zig_f[iz] + rand_unit(afl) * (zig_f[iz - 1] - zig_f[iz]) <
+        exp(-.5 * x * x)) {
+
+      return x;
+
+    }
+
+    u64 r = rand_next64(afl);
+    hz = (s32)(r >> 32);
+    iz = r & 127;
+    if ((u32)abs(hz) < zig_k[iz]) { return hz * zig_w[iz]; }
+
+  }
+
+}
+
+static inline double rand_normal(afl_state_t *afl) {
+
+  if (unlikely(!zig_ready)) { zig_setup(); }
+
+  u64 r = rand_next64(afl);
+  s32 hz = (s32)(r >> 32);
+  u32 iz = r & 127;
+
+  if (likely((u32)abs(hz) < zig_k[iz])) { return hz * zig_w[iz]; }
+  return rand_normal_slow(afl, hz, iz);
+
+}
+
+/* Gamma(a, 1) for a >= 1, Marsaglia & Tsang. x and u are the first normal
+   and uniform to try, which lets the batched version below hand over the
+   lanes that failed its squeeze test. */
+
+static double rand_gamma_mt(afl_state_t *afl, double d, double c, double x,
+                            double u) {
+
+  while (1) {
+
+    double v = 1 + c * x;
+    if (v > 0) {
+
+      v = v * v * v;
+      if (u < 1 - 0.0331 * (x * x) * (x * x)) { return d * v; }
+      if (log(u) < 0.5 * x * x + d * (1 - v + log(v))) { return d * v; }
+
+    }
+
+    x = rand_normal(afl);
+    u = rand_unit_pos(afl);
+
+  }
+
+}
+
+static double rand_gamma(afl_state_t *afl, double a) {
+
+  if (a < 1) {
+
+    /* boost: Gamma(a) = Gamma(a + 1) * U^(1/a) */
+    double u = rand_unit_pos(afl);
+    return rand_gamma(afl, a + 1) * pow(u, 1 / a);
+
+  }
+
+  double d = a - 1.0 / 3;
+  double c = 1 / sqrt(9 * d);
+  return rand_gamma_mt(afl, d, c, rand_normal(afl), rand_unit_pos(afl));
+
+}
+
+/* Beta(a, b). Posteriors of arms that never got (or never missed) a reward
+   have a or b equal to 1, in which case the inverse CDF is exact and a lot
+   cheaper than two gamma draws. */
+
+static inline double rand_beta_small(afl_state_t *afl, double a, double b) {
+
+  if (a == 1) {
+
+    if (b == 1) { return rand_unit(afl); }
+    return -expm1(log(rand_unit_pos(afl)) / b);
+
+  }
+
+  return exp(log(rand_unit_pos(afl)) / a);
+
+}
+
+#define BETA_BATCH 32
+
+/* The Marsaglia & Tsang squeeze for the gamma lanes j..m-1: g[j] = d * v^3
+   if it accepts, a full draw otherwise. Returns m. */
+
+static int beta_squeeze_generic(afl_state_t *afl, const double *d,
+                                const double *c, const double *x,
+                                const double *u, double *g, int j, int m) {
+
+  for (; j < m; j++) {
+
+    double v = 1 + c[j] * x[j];
+    double x2 = x[j] * x[j];
+
+    if (likely(v > 0 && u[j] < 1 - 0.0331 * x2 * x2)) {
+
+      g[j] = d[j] * v * v * v;
+
+    } else {
+
+      g[j] = rand_gamma_mt(afl, d[j], c[j], x[j], u[j]);
+
+    }
+
+  }
+
+  return m;
+
+}
+
+#ifdef BETA_AVX2
+
+/* The same four lanes at a time, only the lanes it rejects go through the
+   scalar draw. Returns the first lane left for the generic version. */
+
+__attribute__((target("avx2"))) static int beta_squeeze_avx2(
+    afl_state_t *afl, const double *d, const double *c, const double *x,
+    const double *u, double *g, int m) {
+
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d sq = _mm256_set1_pd(0.0331);
+  const __m256d zero = _mm256_setzero_pd();
+  int           j;
+
+  for (j = 0; j + 4 <= m; j += 4) {
+
+    __m256d vx = _mm256_loadu_pd(x + j);
+    __m256d vv = _mm256_add_pd(one, _mm256_mul_pd(_mm256_loadu_pd(c + j), vx));
+    __m256d v3 = _mm256_mul_pd(_mm256_mul_pd(vv, vv), vv);
+    __m256d x2 = _mm256_mul_pd(vx, vx);
+    __m256d bound = _mm256_sub_pd(one, _mm256_mul_pd(sq, _mm256_mul_pd(x2, x2)));
+    __m256d ok = _mm256_and_pd(_mm256_cmp_pd(vv, zero, _CMP_GT_OQ),
+                               _mm256_cmp_pd(_mm256_loadu_pd(u + j), bound,
+                                             _CMP_LT_OQ));
+    int okm = _mm256_movemask_pd(ok);
+
+    _mm256_storeu_pd(g + j, _mm256_mul_pd(_mm256_loadu_pd(d + j), v3));
+
+    if (unlikely(okm != 0xf)) {
+
+      int l;
+      for (l = 0; l < 4; l++) {
+
+        if (!(okm & (1 << l))) {
+
+          g[j + l] = rand_gamma_mt(afl, d[j + l], c[j + l], x[j + l], u[j + l]);
+
+        }
+
+      }
+
+    }
+
+  }
+
+  return j;
+
+}
+
+#endif
+
+/* Draws out[j] ~ Beta(a[j], b[j]) for j < k <= BETA_BATCH. The gamma pairs
+   are generated lane-parallel: normals and uniforms are drawn up front, and
+   the squeeze is evaluated with AVX2 if the CPU has it. */
+
+static void rand_beta_batch(afl_state_t *afl, const double *a, const double *b,
+                            double *out, int k) {
+
+  double shape[2 * BETA_BATCH], d[2 * BETA_BATCH], c[2 * BETA_BATCH],
+      x[2 * BETA_BATCH], u[2 * BETA_BATCH], g[2 * BETA_BATCH];
+  int lane[BETA_BATCH];
+  int m = 0, j;
+
+  for (j = 0; j < k; j++) {
+
+    if (a[j] == 1 || b[j] == 1) {
+
+      out[j] = rand_beta_small(afl, a[j], b[j]);
+      continue;
+
+    }
+
+    if (unlikely(a[j] < 1 || b[j] < 1)) {
+
+      double ga = rand_gamma(afl, a[j]);
+      out[j] = ga / (ga + rand_gamma(afl, b[j]));
+      continue;
+
+    }
+
+    lane[m / 2] = j;
+    shape[m++] = a[j];
+    shape[m++] = b[j];
+
+  }
+
+  if (!m) { return; }
+
+  for (j = 0; j < m; j++) {
+
+    d[j] = shape[j] - 1.0 / 3;
+    c[j] = 1 / sqrt(9 * d[j]);
+    x[j] = rand_normal(afl);
+    u[j] = rand_unit_pos(afl);
+
+  }
+
+  j = 0;
+
+#ifdef BETA_AVX2
+  static s8 has_avx2 = -1;
+
+  if (unlikely(has_avx2 < 0)) { has_avx2 = !!__builtin_cpu_supports("avx2"); }
+  if (has_avx2) { j = beta_squeeze_avx2(afl, d, c, x, u, g, m); }
+#endif
+
+  beta_squeeze_generic(afl, d, c, x, u, g, j, m);
+
+  for (j = 0; j < m; j += 2) {
+
+    out[lane[j / 2]] = g[j] / (g[j] + g[j + 1]);
+
+  }
+
+}
+
+/* Thompson sampling step over one chunk of arms idx[0..k-1] with Beta(a, b)
+   posteriors: keeps the arm with the largest draw in *selected_idx. */
+
+static inline void thompson_chunk(afl_state_t *afl, double *a, double *b,
+                                  int *idx, int k, u8 optimistic,
+                                  double *max_sampled, int *selected_idx) {
+
+  double sampled[BETA_BATCH];
+  int    j;
+
+  rand_beta_batch(afl, a, b, sampled, k);
+
+  for (j = 0; j < k; j++) {
+
+    if (optimistic) {
+
+      // dOTS
+      double beta_mean = a[j] / (a[j] + b[j]);
+      if (sampled[j] < beta_mean) sampled[j] = beta_mean;
+
+    }
+
+    if (sampled[j] > *max_sampled) {
+
+      *max_sampled = sampled[j];
+      *selected_idx = idx[j];
+
+    }
+
+  }
+
+}
+
+static double kl(double p, double q) {
+  return p*log(p/q) + (1-p)*log((1-p)/(1-q));
+}
+
+static double dkl(double p, double q) {
+  return (q-p) / (q*(1-q));
+}
+
+static double klucb_klucb(klucb_t* inst, normal_bandit_arm* arm) {
+  const double logndn = log(inst->time_step) / arm->num_selected;
+  const double p = MAX(arm->sample_mean, KLUCB_DELTA);
+  if (p >= 1) return 1;
+
+  double q = p + KLUCB_DELTA;
+  for (int t=0; t < 25; ++t) {
+      const double f = logndn - kl(p, q);
+      const double df = -dkl(p, q);
+      if (f*f < KLUCB_EPS) break;
+
+      q -= f/df;
+      if (q < p + KLUCB_DELTA) q = p + KLUCB_DELTA;
+      if (q > 1 - KLUCB_DELTA) q = 1 - KLUCB_DELTA;
+  }
+
+  return q;
+}
+
+static double div_inf(double x, double y) {
+    if (y == 0.0 || y == -0.0)
+        return INFINITY;
+    return x / y;
+}
+
+static void exppp_gap_estimate(exppp_t *self, double *Delta) {
+    double average_losses[EXP_MAX_N_ARMS];
+    double exploration_term[EXP_MAX_N_ARMS];
+    double UCB[EXP_MAX_N_ARMS];
+    double LCB[EXP_MAX_N_ARMS];
+
+    double min_UCB = INFINITY;
+    for (u64 i = 0; i < self->n_arms; i++) {
+        average_losses[i] = div_inf((double)self->unweighted_losses[i],
+                (double)self->pulls[i]);
+        exploration_term[i] = sqrt(div_inf(EXP_ALPHA * log(self->t) +
+                    log(self->n_arms),  2 * self->pulls[i]));
+        UCB[i] = MIN(1.0, average_losses[i] + exploration_term[i]);
+        LCB[i] = MAX(0.0, average_losses[i] - exploration_term[i]);
+        min_UCB = MIN(UCB[i], min_UCB);
+    }
+    for (u64 i = 0; i < self->n_arms; i++) {
+        Delta[i] = MAX(0.0, LCB[i] - min_UCB);
+        // if (self->t >= self->n_arms) {
+        // //printf("D[%d]: %lf\n", i, Delta[i]);
+        // //printf("LCB[%d]: %lf\n", i, LCB[i]);
+        // //printf("average_losses[%d]: %lf\n", i, average_losses[i]);
+        // //printf("exploration_term[%d]: %lf\n", i, exploration_term[i]);
+        //     assert(Delta[i] >= 0.0);
+        //     assert(Delta[i] <= 1.0);
+        // }
+    }
+}
+
+static double exppp_xi(exppp_t *self, u64 arm, double *gap_estimated) {
+    return div_inf(EXP_BETA * log(self->t), (self->t * (pow(gap_estimated[arm],
+                        2))));
+}
+
+static void exppp_epsilon(exppp_t *self, double epsilons[EXP_MAX_N_ARMS]) {
+    double gap_estimated[EXP_MAX_N_ARMS];
+    exppp_gap_estimate(self, gap_estimated);
+    for (u64 arm = 0; arm < self->n_arms; arm++) {
+        //printf("gap_estimated[%d]=%lf\n", arm, gap_estimated[arm]);
+        //printf("%d %lf %lf\n", self->t, pow(gap_estimated[arm], 2), exppp_xi(self, arm, gap_estimated));
+
+        epsilons[arm] = MIN(MIN(0.5 / self->n_arms, 0.5 * sqrt(log(self->n_arms) /
+                        self->t/ self->n_arms)), exppp_xi(self, arm, gap_estimated));
+    }
+}
+
+static double exppp_eta(exppp_t *self) {
+  return 0.5 * sqrt(log(self->n_arms) / (double)self->n_arms/ (double)(self->t+1));
+}
+
+static void exppp_update_trusts(exppp_t *self) {
+  // double eta = exppp_eta(self);
+  // assert(0.0 <= eta && eta <= 1.0);
+  double sum_of_trusts = 0.0;
+
+  double epsilons[EXP_MAX_N_ARMS] = {};
+  exppp_epsilon(self, epsilons);
+  double sum_of_epsilons = 0.0;
+  for (u64 i = 0; i < self->n_arms; i++) {
+      sum_of_epsilons += epsilons[i];
+  }
+
+  for (u64 i = 0; i < self->n_arms; i++) {
+    self->trusts[i] = ((1.0 - sum_of_epsilons) * self->weights[i]) +
+        epsilons[i];
+
+    sum_of_trusts += self->trusts[i];
+  }
+  // numpy's default tolerance
+  if (sum_of_trusts < 1e-08) {
+    for (u64 i = 0; i < self->n_arms; i++) {
+      self->trusts[i] = 1.0 / self->n_arms;
+    }
+    sum_of_trusts = 1.0;
+  }
+  for (u64 i = 0; i < self->n_arms; i++){
+    self->trusts[i] /= sum_of_trusts;
+  }
+}
+
+static void exppp_add_reward(exppp_t* self, int arm, double reward) {
+  // assert(0.0 <= reward && reward <= 1.0);
+  self->total_rewards[arm] += (int)reward;
+  reward = (reward - EXP_LOWER) / EXP_AMPLITUDE;
+  double loss = 1.0 - reward;
+  self->unweighted_losses[arm] += loss;
+
+  loss = loss / self->trusts[arm];
+  self->losses[arm] += loss;
+
+  double sum_of_weights = 0.0;
+  double eta = exppp_eta(self);
+  double min_loss_eta = INFINITY;
+  for (u64 i = 0; i < self->n_arms; i++) {
+      min_loss_eta = MIN(min_loss_eta, -eta * self->losses[i]);
+  }
+  for (u64 i=0; i < self->n_arms; i++) {
+    self->weights[i] = exp(- eta * self->losses[i] -min_loss_eta);
+    sum_of_weights += self->weights[i];
+  }
+  for (u64 i=0; i < self->n_arms; i++) {
+    self->weights[i] /= sum_of_weights;
+  }
+}
+
+static u64 choice_from_distribution(afl_state_t *afl, exppp_t *self) {
+  double sum_of_possibility = 0.0;
+  double target = rand_unit(afl);
+
+  exppp_update_trusts(self);
+
+  for (u64 i = 0; i < self->n_arms; i++) {
+    sum_of_possibility += self->trusts[i];
+    if (target < sum_of_possibility) {
+      return i;
+    }
+  }
+  return self->n_arms - 1;
+}
+
+static u64 exppp_select_arm(afl_state_t *afl, exppp_t* self, u8* mask) {
+  (void)mask;  /* the exp3 variants draw from all arms */
+  u64 choice;
+  self->t++;
+  if (self->t <= self->n_arms) {
+    choice = self->t - 1;
+  } else {
+    choice = choice_from_distribution(afl, self);
+  }
+  self->pulls[choice] += 1;
+  return choice;
+}
+
+static u64 expix_select_arm(afl_state_t *afl, expix_t* self, u8* mask) {
+  (void)mask;  /* the exp3 variants draw from all arms */
+  self->t++;
+
+  double sum_of_possibility = 0.0;
+  double target = rand_unit(afl);
+
+  for (u64 i = 0; i < self->n_arms; i++) {
+    sum_of_possibility += self->weights[i];
+    if (target < sum_of_possibility) {
+      self->pulls[i]++;
+      return i;
+    }
+  }
+  self->pulls[self->n_arms - 1]++;
+  return self->n_arms - 1;
+}
+
+static void expix_add_reward(expix_t* self, int arm, double reward) {
+  self->total_rewards[arm] += (int)reward;
+
+  double eta = sqrt(2 * log(self->n_arms) / self->n_arms / self->t);
+  double gamma = eta/2;
+
+  double loss = 1.0 - reward;
+  loss = loss / (self->weights[arm] + gamma);
+  self->losses[arm] += loss;
+
+  double min_loss = INFINITY;
+  for (u64 i = 0; i < self->n_arms; i++) {
+      min_loss = MIN(min_loss, self->losses[i]);
+  }
+
+  double denom = 0;
+  for (u64 i = 0; i < self->n_arms; i++) {
+      self->weights[i] = exp(-eta * (self->losses[i] - min_loss));
+      denom += self->weights[i];
+  }
+
+  for (u64 i=0; i < self->n_arms; i++) {
+    self->weights[i] /= denom;
+  }
+}
+
+/* Adwin */
+
+void init_adwin(adwin_t *ret) {
+  memset(ret, 0, offsetof(adwin_t, win));
+}
+
+void dest_adwin(adwin_t* adwin) {
+  (void)adwin;
+}
+
+/* k-th oldest window of a row */
+static inline u64* adwin_window(adwin_t* adwin, int row, int k) {
+  int i = adwin->start[row] + k;
+  if (i >= ADWIN_M + 1) i -= ADWIN_M + 1;
+  return &adwin->win[row][i];
+}
+
+static inline void adwin_remove_front_windows(adwin_t* adwin, int row, int num) {
+  int i = adwin->start[row] + num;
+  if (i >= ADWIN_M + 1) i -= ADWIN_M + 1;
+  adwin->start[row] = i;
+  adwin->size[row] -= num;
+}
+
+static inline void adwin_add_tail_window(adwin_t* adwin, int row, u64 s) {
+  *adwin_window(adwin, row, adwin->size[row]) = s;
+  adwin->size[row]++;
+}
+
+static void adwin_add_tail_row(adwin_t* adwin) {
+  if (unlikely(adwin->last_row + 1 >= ADWIN_MAX_ROWS)) {
+    FATAL("ADWIN histogram is full (ADWIN_MAX_ROWS)");
+  }
+
+  adwin->last_row++;
+  adwin->start[adwin->last_row] = 0;
+  adwin->size[adwin->last_row] = 0;
+}
+
+static void adwin_expire_last_window(adwin_t* adwin) {
+  int last = adwin->last_row;
+
+  adwin->W -= 1ull << last;
+  adwin->sum -= *adwin_window(adwin, last, 0);
+
+  adwin_remove_front_windows(adwin, last, 1);
+
+  if (adwin->size[last] == 0 && last != 0) {
+    adwin->last_row--;
+  }
+}
+
+static void adwin_normlize_buckets(adwin_t* adwin) {
+  int row;
+
+  for (row=0; row <= adwin->last_row; row++) {
+    if (adwin->size[row] <= ADWIN_M) break;
+
+    if (row == adwin->last_row) {
+      adwin_add_tail_row(adwin);
+    }
+
+    // The calculation of variation in the original adwin implementation seems wrong 
+    u64 s = *adwin_window(adwin, row, 0) + *adwin_window(adwin, row, 1);
+    adwin_add_tail_window(adwin, row + 1, s);
+
+    adwin_remove_front_windows(adwin, row, 2);
+  }
+}
+
+static inline u8 adwin_should_drop(u64 s0, u64 n0, u64 s1, u64 n1, double ddv2, double dd2_3) {
+  double u0 = s0 / (double)n0;
+  double u1 = s1 / (double)n1;
+  double du = u0 - u1;
+
+  double inv_m = 1.0 / (1 + n0 - ADWIN_MIN_ELEM_TO_CHECK) + 1.0 / (1 + n1 - ADWIN_MIN_ELEM_TO_CHECK);
+  double eps = sqrt(ddv2*inv_m) + dd2_3 * inv_m;
+  
+  if (fabs(du) > eps) return 1;
+  
+  return 0;
+}
+
+static void adwin_drop_last_till_identical(adwin_t* adwin) {
+  if (adwin->W < ADWIN_MIN_ELEM_TO_START_DROP) return;
+
+  while (1) {
+    bool dropped = false;
+
+    u64 n0 = 0;
+    u64 s0 = 0;
+    u64 n1 = adwin->W;
+    u64 s1 = adwin->sum;
+    int row;
+
+    double n = adwin->W;
+    double dd2 = log(2.0 * log(n) / ADWIN_DELTA) * 2;
+    double u = adwin->sum / n;
+    double ddv2 = u * (1-u) * dd2;
+    double dd2_3 = dd2 / 3.0;
+
+    for (row=adwin->last_row; row >= 0; row--) {
+      int k;
+      for (k=0; k < adwin->size[row]; k++) {
+        u64 w = *adwin_window(adwin, row, k);
+        n0 += 1ull << row;
+        n1 -= 1ull << row;
+        s0 += w;
+        s1 -= w;
+
+        if (n1 < ADWIN_MIN_ELEM_TO_CHECK) goto L_CHECK_END;
+        if (n0 < ADWIN_MIN_ELEM_TO_CHECK) continue;
+
+        if (adwin_should_drop(s0, n0, s1, n1, ddv2, dd2_3)) {
+
+#ifdef ADWIN_ADAPTIVE_RESETTING
+          init_adwin(adwin);
+#else
+          dropped = true;
+          adwin_expire_last_window(adwin);
+#endif
+          goto L_CHECK_END;
+        }
+      }
+    }
+
+L_CHECK_END:
+
+    if (!dropped) break;
+  }
+}
+
+static void adwin_add_elem(adwin_t* adwin, u8 reward) {
+  adwin->W++;
+  adwin->sum += reward;
+  adwin_add_tail_window(adwin, 0, reward);
+
+  adwin_normlize_buckets(adwin);
+
+#if ADWIN_DROP_INTERVAL != 1
+  adwin->num_add++;
+  if (adwin->num_add != ADWIN_DROP_INTERVAL) return;
+  adwin->num_add = 0;
+#endif
+
+  adwin_drop_last_till_identical(adwin);
+}
+
+double adwin_get_estimation(adwin_t* adwin) {
+  if (adwin->W > 0) return adwin->sum / (double)adwin->W;
+  return 0;
+}
+
+static inline void uniform_add_reward(uniform_t* inst, int idx, u8 r) {
+  uniform_bandit_arm *arm = &inst->arms[idx];
+  arm->num_selected++;
+  arm->total_rewards += r;
+}
+
+static inline void ucb_add_reward(ucb_t* inst, int idx, u8 r) {
+  inst->time_step++;
+
+  normal_bandit_arm *arm = &inst->arms[idx];
+
+  arm->num_selected++;
+  arm->total_rewards += r;
+  arm->sample_mean = ((double)(arm->total_rewards))/(arm->num_selected);
+}
+
+static inline void klucb_add_reward(klucb_t* inst, int idx, u8 r) {
+  inst->time_step++;
+
+  normal_bandit_arm *arm = &inst->arms[idx];
+
+  arm->num_selected++;
+  arm->total_rewards += r;
+  arm->sample_mean = ((double)(arm->total_rewards))/(arm->num_selected);
+}
+
+static inline void ts_add_reward(ts_t* inst, int idx, u8 r) {
+  normal_bandit_arm *arm = &inst->arms[idx];
+
+  arm->num_selected++;
+  arm->total_rewards += r;
+  arm->sample_mean = ((double)(arm->total_rewards))/(arm->num_selected);
+}
+
+static inline void adsts_add_reward(adsts_t* inst, int idx, u8 r) {
+  adwin_bandit_arm *arm = &inst->arms[idx];
+
+  arm->num_selected++;
+  arm->total_rewards += r;
+  adwin_add_elem(&arm->adwin, r);
+}
+
+static inline void dts_add_reward(dts_t* inst, int idx, u8 r) {
+  dts_bandit_arm *arm = &inst->arms[idx];
+
+  arm->num_selected++;
+  arm->num_rewarded += r;
+
+  // already discounted in dts_select_arm, by shrinking inst->scale
+  arm->total_rewards += r / inst->scale;
+  arm->total_losses  += (1 - r) / inst->scale;
+}
+
+static inline void dbe_add_reward(dbe_t* inst, int idx, u8 r) {
+  dbe_bandit_arm *arm = &inst->arms[idx];
+
+  arm->num_selected++;
+  arm->num_rewarded += r;
+
+  // already discounted in dbe_select_arm, by shrinking inst->scale
+  arm->total_rewards += r / inst->scale;
+  arm->dis_num_selected += 1 / inst->scale;
+  // Note that, sample_mean of the other arms that are not selected, will remain the same
+  // since total_rewards' = total_rewards * gamma and dis_num_selected' = dis_num_selected * gamma,
+  // so total_rewards' / dis_num_selected' = total_rewards / dis_num_selected
+  arm->sample_mean = arm->total_rewards / arm->dis_num_selected;
+
+  if (inst->stale_arm == DBE_NO_STALE_ARM || inst->stale_arm == idx) {
+    inst->stale_arm = idx;
+  } else {
+    inst->stale_arm = DBE_ALL_ARMS_STALE;
+  }
+}
+
+static inline u64 normal_num_selected(normal_bandit_arm* arm) {
+  return arm->num_selected;
+}
+
+static inline u64 normal_total_rewards(normal_bandit_arm* arm) {
+  return arm->total_rewards;
+}
+
+static inline double normal_sample_mean(normal_bandit_arm* arm) {
+  return arm->sample_mean;
+}
+
+static inline u64 adwin_num_selected(adwin_bandit_arm* arm) {
+  return arm->adwin.W;
+}
+
+static inline u64 adwin_total_rewards(adwin_bandit_arm* arm) {
+  return arm->adwin.sum;
+}
+
+static inline double adwin_sample_mean(adwin_bandit_arm* arm) {
+  return adwin_get_estimation(&arm->adwin);
+}
+
+/* Bandit */
+
+static int dts_select_arm(afl_state_t *afl, dts_t* inst, u8* mask) {
+  int i;
+  double max_sampled = -1;
+  int selected_idx = 0;
+  int n = inst->n_arms;
+  dts_bandit_arm *slots = inst->arms;
+
+  double a[BETA_BATCH], b[BETA_BATCH];
+  int idx[BETA_BATCH];
+  int k = 0;
+
+#ifdef OPTIMISTIC_DTS
+  const u8 optimistic = 1;
+#else
+  const u8 optimistic = 0;
+#endif
+
+  for (i = 0; i < n; i++) {
+    if (mask && mask[i]) continue;
+
+    a[k] = slots[i].total_rewards * inst->scale + 1;
+    b[k] = slots[i].total_losses  * inst->scale + 1;
+    if (inst->prior) {
+      a[k] += inst->prior[2 * i];
+      b[k] += inst->prior[2 * i + 1];
+    }
+    idx[k++] = i;
+
+    if (k == BETA_BATCH) {
+      thompson_chunk(afl, a, b, idx, k, optimistic, &max_sampled, &selected_idx);
+      k = 0;
+    }
+  }
+
+  if (k) thompson_chunk(afl, a, b, idx, k, optimistic, &max_sampled, &selected_idx);
+
+  // We need to discount rewards even if skipping the arm.
+  // Rather than multiplying every arm, shrink the common scale and only
+  // fold it back into the arms once it gets close to underflowing.
+  inst->scale *= DTS_GAMMA;
+  if (inst->scale < DTS_MIN_SCALE) {
+    for (i = 0; i < n; i++) {
+      slots[i].total_rewards *= inst->scale;
+      slots[i].total_losses  *= inst->scale;
+    }
+    inst->scale = 1.0;
+  }
+
+  return selected_idx;
+}
+
+static int dbe_select_arm(afl_state_t *afl, dbe_t *inst, u8* mask) {
+  // We don't prepare SIVO's constants such as
+  // SAMPLE_RANDOMLY_UNTIL_ROUND, SAMPLE_RANDOMLY_THIS_ROUND, 
+  // SAMPLE_NOT_RANDOMLY, SAMPLE_RANDOMLY_THIS_ROUND_NO_UPDATE.
+  // the last 3 constants don't make sense because 
+  // bandit algorithms are designed to minimize regret from the beggining, 
+  // and ignoring it and using uniform distribution sometimes destroys
+  // its performance and theoretical guarantees.
+  // On the other hand, SAMPLE_RANDOMLY_UNTIL_ROUND may be legitimate, 
+  // since it can be considered as preparing more accurate prior distributions 
+  // than uniform distributions, and since that preprocess is commonly used 
+  // also in other algorithms like eps-greedy.
+  // However, recalling that this is a non-stationary setting, 
+  // and that initial samples will be forgot at some time, 
+  // the preprocess of drawing values from uniform distributions to obtain initial estimates 
+  // of expected rewards is not so meaningful.
+
+  int index = -1;
+  int n = inst->n_arms;
+  dbe_bandit_arm *slots = inst->arms;
+
+  double max_avg = 0;
+  double redcoef = 1.0;
+  int ACTIVE = 0;
+  int num_unsampled = 0;
+
+  for (int i=0; i<n; i++) {
+    if (mask && mask[i]) continue;
+
+    ACTIVE++;
+    // Lazily update sample_mean
+    if (slots[i].dis_num_selected > 0) {
+      if (max_avg < slots[i].sample_mean) max_avg = slots[i].sample_mean;
+    } else {
+      num_unsampled++;
+    }
+  }
+
+  // i'm not sure what this heuristics means :(
+  if (max_avg > 0) redcoef = 1.0 / (2.0 * max_avg);
+
+  // maybe this is working as a kind of adaptive resetting bandit(?)
+  // if so, this is not a pure discounting algorithm...
+  if (redcoef > 1 << 30) {
+    inst->scale = 1.0;
+    for (int i=0; i<n; i++) {
+      slots[i].total_rewards = 1.0;
+      slots[i].dis_num_selected = 1.0;
+      slots[i].sample_mean = 1.0;
+    }
+    inst->stale_arm = DBE_ALL_ARMS_STALE;
+    num_unsampled = 0;
+  }
+
+  // pick index if not sampled 
+  if (num_unsampled > 0) {
+    // probably just returning 0 is the same...(it's a negligible difference)
+    int k = rand_below(afl, num_unsampled);
+    for (int i=0; i<n; i++) {
+      if (mask && mask[i]) continue;
+      if (slots[i].dis_num_selected <= 0 && !k--) return i;
+    }
+  }
+
+  double beta = 4 + 2 * ACTIVE;
+  double *w = inst->weights;
+
+  // Our bandit problems are not small bandit problem like 2 arms
+  /*if( x[i].allow_small > 0 )
+    beta = x[i].allow_small;*/
+
+  // Follow SIVO. Though I'm not sure about other heuristics,
+  // this is valid since 2^x = e^(x*log_e(2))
+  if (redcoef != inst->weights_redcoef || ACTIVE != inst->weights_active ||
+      inst->stale_arm == DBE_ALL_ARMS_STALE) {
+    for (int i=0; i<n; i++) {
+      w[i] = exp2(beta * (redcoef * slots[i].sample_mean));
+    }
+    inst->weights_redcoef = redcoef;
+    inst->weights_active = ACTIVE;
+  } else if (inst->stale_arm != DBE_NO_STALE_ARM) {
+    int i = inst->stale_arm;
+    w[i] = exp2(beta * (redcoef * slots[i].sample_mean));
+  }
+  inst->stale_arm = DBE_NO_STALE_ARM;
+
+  double sum = 0;
+  for (int i=0; i<n; i++) {
+    if (mask && mask[i]) continue;
+    sum += w[i];
+  }
+
+  double target = rand_unit(afl) * sum;
+  for (int i=0; i<n; i++) {
+    if (mask && mask[i]) continue;
+    index = i;
+    if (target < w[i]) break;
+    target -= w[i];
+  }
+  if (index < 0) index = 0;
+
+  // We need to discount rewards even if skipping the arm.
+  // Rather than multiplying every arm, shrink the common scale and only
+  // fold it back into the arms once it gets close to underflowing.
+  inst->scale *= DBE_GAMMA;
+  if (inst->scale < DBE_MIN_SCALE) {
+    for (int i = 0; i < n; i++) {
+      slots[i].total_rewards *= inst->scale;
+      slots[i].dis_num_selected *= inst->scale;
+    }
+    inst->scale = 1.0;
+  }
+
+  return index;
+}
+
+static int uniform_select_arm(afl_state_t *afl, uniform_t *inst, u8* mask) {
+  int i;
+  int n = inst->n_arms;
+
+  int cnt = 0;
+  for (i = 0; i < n; i++) {
+    if (mask && mask[i]) continue;
+    cnt++;
+  }
+
+  int k = rand_below(afl, cnt);
+  for (i = 0; i < n; i++) {
+    if (mask && mask[i]) continue;
+    if (!k) return i;
+    --k;
+  }
+
+  assert(0);
+}
+
+static int ucb_select_arm(afl_state_t *afl, ucb_t *inst, u8* mask) {
+  (void)afl;
+  int i;
+  double max_ucb = -1;
+  int selected_idx = 0;
+  int n = inst->n_arms;
+  normal_bandit_arm *slots = inst->arms;
+
+  for (i = 0; i < n; i++) {
+    if (mask && mask[i]) continue;
+
+    if (normal_num_selected(&slots[i]) == 0) {
+      selected_idx = i;
+      break;
+    }
+
+    double ucb = normal_sample_mean(&slots[i])
+              + sqrt(2 * log(inst->time_step) / normal_num_selected(&slots[i]));
+    if (ucb > max_ucb) {
+      max_ucb = ucb;
+      selected_idx = i;
+    }
+  }
+
+  return selected_idx;
+}
+
+static int klucb_select_arm(afl_state_t *afl, klucb_t *inst, u8* mask) {
+  (void)afl;
+  int i;
+  double max_ucb = -1;
+  int selected_idx = 0;
+  int n = inst->n_arms;
+  normal_bandit_arm *slots = inst->arms;
+
+  for (i = 0; i < n; i++) {
+    if (mask && mask[i]) continue;
+
+    if (normal_num_selected(&slots[i]) == 0) {
+      selected_idx = i;
+      break;
+    }
+
+
+    double ucb = klucb_klucb(inst, &slots[i]);
+    if (ucb > max_ucb) {
+      max_ucb = ucb;
+      selected_idx = i;
+    }
+  }
+
+  return selected_idx;
+}
+
+static int ts_select_arm(afl_state_t *afl, ts_t* inst, u8* mask) {
+  int i;
+  int n = inst->n_arms;
+  normal_bandit_arm *slots = inst->arms;
+
+  double max_sampled = -1;
+  int selected_idx = 0;
+
+  double a[BETA_BATCH], b[BETA_BATCH];
+  int idx[BETA_BATCH];
+  int k = 0;
+
+  for (i = 0; i < n; i++) {
+    if (mask && mask[i]) continue;
+
+    u64 total_rewards = normal_total_rewards(&slots[i]);
+    a[k] = total_rewards + 1;
+    b[k] = normal_num_selected(&slots[i]) - total_rewards + 1;
+    if (inst->prior) {
+      a[k] += inst->prior[2 * i];
+      b[k] += inst->prior[2 * i + 1];
+    }
+    idx[k++] = i;
+
+    if (k == BETA_BATCH) {
+      thompson_chunk(afl, a, b, idx, k, 0, &max_sampled, &selected_idx);
+      k = 0;
+    }
+  }
+
+  if (k) thompson_chunk(afl, a, b, idx, k, 0, &max_sampled, &selected_idx);
+
+  return selected_idx;
+}
+
+static int adsts_select_arm(afl_state_t *afl, adsts_t* inst, u8* mask) {
+  int i;
+  int n = inst->n_arms;
+  adwin_bandit_arm *slots = inst->arms;
+
+  double max_sampled = -1;
+  int selected_idx = 0;
+
+  double a[BETA_BATCH], b[BETA_BATCH];
+  int idx[BETA_BATCH];
+  int k = 0;
+
+  for (i = 0; i < n; i++) {
+    if (mask && mask[i]) continue;
+
+    u64 total_rewards = adwin_total_rewards(&slots[i]);
+    a[k] = total_rewards + 1;
+    b[k] = adwin_num_selected(&slots[i]) - total_rewards + 1;
+    if (inst->prior) {
+      a[k] += inst->prior[2 * i];
+      b[k] += inst->prior[2 * i + 1];
+    }
+    idx[k++] = i;
+
+    if (k == BETA_BATCH) {
+      thompson_chunk(afl, a, b, idx, k, 0, &max_sampled, &selected_idx);
+      k = 0;
+    }
+  }
+
+  if (k) thompson_chunk(afl, a, b, idx, k, 0, &max_sampled, &selected_idx);
+
+  return selected_idx;
+}
+
+
+/* Init */
+
+static void expix_init(expix_t *v, u64 n_arms) {
+  v->weights = calloc(sizeof(double), n_arms);
+  v->losses = calloc(sizeof(double), n_arms);
+  v->pulls = calloc(sizeof(u64), n_arms);
+  v->total_rewards = calloc(sizeof(u64), n_arms);
+
+  v->t = 0;
+  v->n_arms = n_arms;
+  for (u64 i = 0; i < n_arms ; i++) {
+    v->weights[i] = 1.0 / (double)n_arms;
+  }
+}
+
+static void exppp_init(exppp_t *v, u64 n_arms) {
+  v->n_arms = n_arms;
+
+  v->weights = calloc(sizeof(double), n_arms);
+  v->losses = calloc(sizeof(double), n_arms);
+  v->unweighted_losses = calloc(sizeof(double), n_arms);
+  v->pulls = calloc(sizeof(u64), n_arms);
+  v->total_rewards = calloc(sizeof(u64), n_arms);
+  v->trusts = calloc(sizeof(double), n_arms);
+
+  for (u64 i = 0; i < n_arms; i++) {
+    v->weights[i] = 1.0 / (double)n_arms;
+    v->losses[i] = (double)n_arms;
+    v->unweighted_losses[i] = 1;
+    v->pulls[i] = 1;
+    v->trusts[i] = 1.0 / (double)n_arms;
+  }
+  v->t = n_arms;
+}
+
+static void uniform_init(uniform_t *v, int n_arms) {
+  v->n_arms = n_arms;
+  v->arms = calloc(sizeof(uniform_bandit_arm), n_arms);
+}
+
+static void ucb_init(ucb_t *v, int n_arms) {
+  v->n_arms = n_arms;
+  v->time_step = 0;
+  v->arms = calloc(sizeof(normal_bandit_arm), n_arms);
+}
+
+static void klucb_init(klucb_t *v, int n_arms) {
+  v->n_arms = n_arms;
+  v->time_step = 0;
+  v->arms = calloc(sizeof(normal_bandit_arm), n_arms);
+}
+
+static void ts_init(ts_t *v, int n_arms) {
+  v->n_arms = n_arms;
+  v->arms = calloc(sizeof(normal_bandit_arm), n_arms);
+}
+
+static void adsts_init(adsts_t *v, int n_arms) {
+  v->n_arms = n_arms;
+  v->arms = calloc(sizeof(adwin_bandit_arm), n_arms);
+
+  int i;
+  for (i=0; i<n_arms; i++) {
+    init_adwin(&v->arms[i].adwin);
+  }
+}
+
+static void dts_init(dts_t *v, int n_arms) {
+  v->n_arms = n_arms;
+  v->arms = calloc(sizeof(dts_bandit_arm), n_arms);
+  v->scale = 1.0;
+}
+
+static void dbe_init(dbe_t *v, int n_arms) {
+  v->n_arms = n_arms;
+  v->arms = calloc(sizeof(dbe_bandit_arm), n_arms);
+  v->scale = 1.0;
+  v->weights = calloc(sizeof(double), n_arms);
+  v->weights_redcoef = 0;
+  v->weights_active = 0;
+  v->stale_arm = DBE_ALL_ARMS_STALE;
+}
+
+static void expix_deinit(expix_t *v) {
+  free(v->weights);
+  free(v->losses);
+  free(v->pulls);
+  free(v->total_rewards);
+}
+
+static void exppp_deinit(exppp_t *v) {
+  free(v->weights);
+  free(v->losses);
+  free(v->unweighted_losses);
+  free(v->pulls);
+  free(v->total_rewards);
+  free(v->trusts);
+}
+
+static void uniform_deinit(uniform_t *v) {
+  free(v->arms);
+}
+
+static void ucb_deinit(ucb_t *v) {
+  free(v->arms);
+}
+
+static void klucb_deinit(klucb_t *v) {
+  free(v->arms);
+}
+
+static void ts_deinit(ts_t *v) {
+  free(v->arms);
+}
+
+static void adsts_deinit(adsts_t *v) {
+  int i;
+  for (i=0; i<v->n_arms; i++) {
+    dest_adwin(&v->arms[i].adwin);
+  }
+  free(v->arms);
+}
+
+static void dts_deinit(dts_t *v) {
+  free(v->arms);
+}
+
+static void dbe_deinit(dbe_t *v) {
+  free(v->arms);
+  free(v->weights);
+}
+
+/* Stats */
+
+static void uniform_print_arm(FILE* file, uniform_t* inst) {
+  int i;
+  int n = inst->n_arms;
+  uniform_bandit_arm *arms = inst->arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
+  }
+}
+
+static void ucb_print_arm(FILE* file, ucb_t* inst) {
+  int i;
+  int n = inst->n_arms;
+  normal_bandit_arm *arms = inst->arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
+  }
+}
+
+static void klucb_print_arm(FILE* file, klucb_t* inst) {
+  int i;
+  int n = inst->n_arms;
+  normal_bandit_arm *arms = inst->arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
+  }
+}
+
+static void ts_print_arm(FILE* file, ts_t* inst) {
+  int i;
+  int n = inst->n_arms;
+  normal_bandit_arm *arms = inst->arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
+  }
+}
+
+static void adsts_print_arm(FILE* file, adsts_t* inst) {
+  int i;
+  int n = inst->n_arms;
+  adwin_bandit_arm *arms = inst->arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
+  }
+}
+
+static void dts_print_arm(FILE* file, dts_t* inst) {
+  int i;
+  int n = inst->n_arms;
+  dts_bandit_arm *arms = inst->arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", arms[i].num_rewarded, arms[i].num_selected);
+  }
+}
+
+static void dbe_print_arm(FILE* file, dbe_t* inst) {
+  int i;
+  int n = inst->n_arms;
+  dbe_bandit_arm *arms = inst->arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", arms[i].num_rewarded, arms[i].num_selected);
+  }
+}
+
+static void expix_print_arm(FILE* file, expix_t* inst) {
+  u64 i;
+  u64 n = inst->n_arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", inst->total_rewards[i], inst->pulls[i]);
+  }
+}
+
+static void exppp_print_arm(FILE* file, exppp_t* inst) {
+  u64 i;
+  u64 n = inst->n_arms;
+  for (i=0; i<n; i++) {
+    fprintf(file, ", %llu, %llu", inst->total_rewards[i], inst->pulls[i]);
+  }
+}
+
+static void print_indent(FILE *f, int indent) {
+  for (int i = 0; i < indent; i++) {
+    fprintf(f, " ");
+  }
+}
+
+static void exppp_print_state(exppp_t *self, FILE *f, int indent) {
+  //printf("sum_of_trusts: %lf\n", sum_of_trusts);
+  print_indent(f, indent); fprintf(f, "- weights: ");
+  for (u64 i = 0; i < self->n_arms; i++) {
+	  fprintf(f, "%.6f\t", self->weights[i]);
+  }
+  fprintf(f, "\n");
+
+  print_indent(f, indent); fprintf(f, "- pulls: ");
+  for (u64 i = 0; i < self->n_arms; i++) {
+	  fprintf(f, "%lld\t", self->pulls[i]);
+  }
+  fprintf(f, "\n");
+
+  print_indent(f, indent); fprintf(f, "- trusts: ");
+  for (u64 i = 0; i < self->n_arms; i++) {
+	  fprintf(f, "%.6lf\t", self->trusts[i]);
+  }
+  fprintf(f, "\n");
+
+  print_indent(f, indent); fprintf(f, "- losses: ");
+  for (u64 i = 0; i < self->n_arms; i++) {
+	  fprintf(f, "%.6lf\t", self->losses[i]);
+  }
+  fprintf(f, "\n");
+}
+
+/* Snapshots
+
+   Every algorithm serializes the state it needs to continue where it left
+   off into a bandit_stream_t. Derived data (dbe weights) is rebuilt on the
+   next selection instead of being stored. */
+
+static void bs_put(bandit_stream_t *s, const void *p, size_t n) {
+
+  if (s->len + n > s->cap) {
+
+    s->cap = MAX(s->cap * 2, s->len + n + 4096);
+    s->buf = ck_realloc(s->buf, s->cap);
+
+  }
+
+  memcpy(s->buf + s->len, p, n);
+  s->len += n;
+
+}
+
+static void bs_get(bandit_stream_t *s, void *p, size_t n) {
+
+  if (s->err || s->pos + n > s->len) {
+
+    s->err = 1;
+    memset(p, 0, n);
+    return;
+
+  }
+
+  memcpy(p, s->buf + s->pos, n);
+  s->pos += n;
+
+}
+
+#define BS_PUT(s, v) bs_put(s, &(v), sizeof(v))
+#define BS_GET(s, v) bs_get(s, &(v), sizeof(v))
+
+static void uniform_save(uniform_t *v, bandit_stream_t *s) {
+  bs_put(s, v->arms, v->n_arms * sizeof(uniform_bandit_arm));
+}
+
+static void uniform_load(uniform_t *v, bandit_stream_t *s) {
+  bs_get(s, v->arms, v->n_arms * sizeof(uniform_bandit_arm));
+}
+
+static void ucb_save(ucb_t *v, bandit_stream_t *s) {
+  BS_PUT(s, v->time_step);
+  bs_put(s, v->arms, v->n_arms * sizeof(normal_bandit_arm));
+}
+
+static void ucb_load(ucb_t *v, bandit_stream_t *s) {
+  BS_GET(s, v->time_step);
+  bs_get(s, v->arms, v->n_arms * sizeof(normal_bandit_arm));
+}
+
+static void klucb_save(klucb_t *v, bandit_stream_t *s) {
+  BS_PUT(s, v->time_step);
+  bs_put(s, v->arms, v->n_arms * sizeof(normal_bandit_arm));
+}
+
+static void klucb_load(klucb_t *v, bandit_stream_t *s) {
+  BS_GET(s, v->time_step);
+  bs_get(s, v->arms, v->n_arms * sizeof(normal_bandit_arm));
+}
+
+static void ts_save(ts_t *v, bandit_stream_t *s) {
+  bs_put(s, v->arms, v->n_arms * sizeof(normal_bandit_arm));
+}
+
+static void ts_load(ts_t *v, bandit_stream_t *s) {
+  bs_get(s, v->arms, v->n_arms * sizeof(normal_bandit_arm));
+}
+
+static void dts_save(dts_t *v, bandit_stream_t *s) {
+  BS_PUT(s, v->scale);
+  bs_put(s, v->arms, v->n_arms * sizeof(dts_bandit_arm));
+}
+
+static void dts_load(dts_t *v, bandit_stream_t *s) {
+  BS_GET(s, v->scale);
+  bs_get(s, v->arms, v->n_arms * sizeof(dts_bandit_arm));
+}
+
+static void dbe_save(dbe_t *v, bandit_stream_t *s) {
+  BS_PUT(s, v->scale);
+  bs_put(s, v->arms, v->n_arms * sizeof(dbe_bandit_arm));
+}
+
+static void dbe_load(dbe_t *v, bandit_stream_t *s) {
+  BS_GET(s, v->scale);
+  bs_get(s, v->arms, v->n_arms * sizeof(dbe_bandit_arm));
+  v->weights_active = 0;
+  v->stale_arm = DBE_ALL_ARMS_STALE;
+}
+
+/* ADWIN: the histogram rows from the newest to the oldest, each with its
+   windows from the oldest to the newest */
+
+static void adwin_save(adwin_t *adwin, bandit_stream_t *s) {
+
+  u32 n_rows = adwin->last_row + 1, row;
+
+  BS_PUT(s, adwin->num_add);
+  BS_PUT(s, adwin->W);
+  BS_PUT(s, adwin->sum);
+  BS_PUT(s, n_rows);
+
+  for (row = 0; row < n_rows; row++) {
+
+    int size = adwin->size[row], k;
+
+    BS_PUT(s, size);
+    for (k = 0; k < size; k++) {
+
+      BS_PUT(s, *adwin_window(adwin, row, k));
+
+    }
+
+  }
+
+}
+
+static void adwin_load(adwin_t *adwin, bandit_stream_t *s) {
+
+  u32 n_rows, row;
+
+  init_adwin(adwin);
+
+  BS_GET(s, adwin->num_add);
+  BS_GET(s, adwin->W);
+  BS_GET(s, adwin->sum);
+  BS_GET(s, n_rows);
+
+  if (n_rows < 1 || n_rows > ADWIN_MAX_ROWS) { s->err = 1; }
+
+  for (row = 0; row < n_rows && !s->err; row++) {
+
+    int size;
+
+    BS_GET(s, size);
+    if (size < 0 || size > ADWIN_M + 1) {
+
+      s->err = 1;
+      break;
+
+    }
+
+    adwin->last_row = row;
+    adwin->size[row] = size;
+    bs_get(s, adwin->win[row], size * sizeof(u64));
+
+  }
+
+}
+
+static void adsts_save(adsts_t *v, bandit_stream_t *s) {
+
+  int i;
+  for (i = 0; i < v->n_arms; i++) {
+
+    BS_PUT(s, v->arms[i].num_selected);
+    BS_PUT(s, v->arms[i].total_rewards);
+    adwin_save(&v->arms[i].adwin, s);
+
+  }
+
+}
+
+static void adsts_load(adsts_t *v, bandit_stream_t *s) {
+
+  int i;
+  for (i = 0; i < v->n_arms; i++) {
+
+    BS_GET(s, v->arms[i].num_selected);
+    BS_GET(s, v->arms[i].total_rewards);
+    adwin_load(&v->arms[i].adwin, s);
+
+  }
+
+}
+
+static void exppp_save(exppp_t *v, bandit_stream_t *s) {
+  BS_PUT(s, v->t);
+  bs_put(s, v->weights, v->n_arms * sizeof(double));
+  bs_put(s, v->losses, v->n_arms * sizeof(double));
+  bs_put(s, v->unweighted_losses, v->n_arms * sizeof(double));
+  bs_put(s, v->trusts, v->n_arms * sizeof(double));
+  bs_put(s, v->total_rewards, v->n_arms * sizeof(u64));
+  bs_put(s, v->pulls, v->n_arms * sizeof(u64));
+}
+
+static void exppp_load(exppp_t *v, bandit_stream_t *s) {
+  BS_GET(s, v->t);
+  bs_get(s, v->weights, v->n_arms * sizeof(double));
+  bs_get(s, v->losses, v->n_arms * sizeof(double));
+  bs_get(s, v->unweighted_losses, v->n_arms * sizeof(double));
+  bs_get(s, v->trusts, v->n_arms * sizeof(double));
+  bs_get(s, v->total_rewards, v->n_arms * sizeof(u64));
+  bs_get(s, v->pulls, v->n_arms * sizeof(u64));
+}
+
+static void expix_save(expix_t *v, bandit_stream_t *s) {
+  BS_PUT(s, v->t);
+  bs_put(s, v->weights, v->n_arms * sizeof(double));
+  bs_put(s, v->losses, v->n_arms * sizeof(double));
+  bs_put(s, v->total_rewards, v->n_arms * sizeof(u64));
+  bs_put(s, v->pulls, v->n_arms * sizeof(u64));
+}
+
+static void expix_load(expix_t *v, bandit_stream_t *s) {
+  BS_GET(s, v->t);
+  bs_get(s, v->weights, v->n_arms * sizeof(double));
+  bs_get(s, v->losses, v->n_arms * sizeof(double));
+  bs_get(s, v->total_rewards, v->n_arms * sizeof(u64));
+  bs_get(s, v->pulls, v->n_arms * sizeof(u64));
+}
+
+/* Generic interface */
+
+#define BANDIT_THUNKS(a)                                                   \
+  static void a##_init_b(bandit_t *b, u32 n_arms) {                        \
+    a##_init(&b->a, n_arms);                                               \
+  }                                                                        \
+  static void a##_deinit_b(bandit_t *b) {                                  \
+    a##_deinit(&b->a);                                                     \
+  }                                                                        \
+  static u32 a##_select_arm_b(afl_state_t *afl, bandit_t *b, u8 *mask) {   \
+    return a##_select_arm(afl, &b->a, mask);                               \
+  }                                                                        \
+  static void a##_add_reward_b(bandit_t *b, u32 arm, u8 r) {               \
+    a##_add_reward(&b->a, arm, r);                                         \
+  }                                                                        \
+  static void a##_print_arm_b(FILE *file, bandit_t *b) {                   \
+    a##_print_arm(file, &b->a);                                            \
+  }                                                                        \
+  static void a##_save_b(bandit_t *b, bandit_stream_t *s) {                \
+    a##_save(&b->a, s);                                                    \
+  }                                                                        \
+  static void a##_load_b(bandit_t *b, bandit_stream_t *s) {                \
+    a##_load(&b->a, s);                                                    \
+  }
+
+BANDIT_THUNKS(uniform)
+BANDIT_THUNKS(ucb)
+BANDIT_THUNKS(klucb)
+BANDIT_THUNKS(ts)
+BANDIT_THUNKS(dts)
+BANDIT_THUNKS(dbe)
+BANDIT_THUNKS(adsts)
+BANDIT_THUNKS(exppp)
+BANDIT_THUNKS(expix)
+
+static void exppp_print_state_b(bandit_t *b, FILE *f, int indent) {
+  exppp_print_state(&b->exppp, f, indent);
+}
+
+#define BANDIT_OPS(a, print_state)                                          \
+  {#a, a##_init_b, a##_deinit_b, a##_select_arm_b, a##_add_reward_b,       \
+   print_state, a##_print_arm_b, a##_save_b, a##_load_b}
+
+const bandit_ops_t bandit_ops[BANDIT_ALG_NUM] = {
+
+    [BANDIT_UNIFORM] = BANDIT_OPS(uniform, NULL),
+    [BANDIT_UCB] = BANDIT_OPS(ucb, NULL),
+    [BANDIT_KLUCB] = BANDIT_OPS(klucb, NULL),
+    [BANDIT_TS] = BANDIT_OPS(ts, NULL),
+    [BANDIT_DTS] = BANDIT_OPS(dts, NULL),
+    [BANDIT_DBE] = BANDIT_OPS(dbe, NULL),
+    [BANDIT_ADSTS] = BANDIT_OPS(adsts, NULL),
+    [BANDIT_EXPPP] = BANDIT_OPS(exppp, exppp_print_state_b),
+    [BANDIT_EXPIX] = BANDIT_OPS(expix, NULL),
+
+};
+
+/* Look up a bandit algorithm by its name, -1 if unknown */
+
+s32 bandit_alg_from_name(const char *name) {
+
+  u32 i;
+  for (i = 0; i < BANDIT_ALG_NUM; i++) {
+
+    if (!strcasecmp(name, bandit_ops[i].name)) { return i; }
+
+  }
+
+  return -1;
+
+}
+
+void bandit_init(bandit_t *b, u8 alg, u32 n_arms) {
+
+  memset(b, 0, sizeof(bandit_t));
+  b->alg = alg;
+  bandit_ops[alg].init(b, n_arms);
+
+}
+
+void bandit_deinit(bandit_t *b) {
+
+  bandit_ops[b->alg].deinit(b);
+  memset(b, 0, sizeof(bandit_t));
+
+}
+
+/* The two functions below run once per havoc iteration. They switch on the
+   algorithm instead of calling through bandit_ops[] so that every kernel is
+   inlined here; the branch is the same for the whole campaign and is always
+   predicted. */
+
+u32 bandit_select_arm(afl_state_t *afl, bandit_t *b, u8 *mask) {
+
+  switch (b->alg) {
+
+    case BANDIT_UNIFORM:
+      return uniform_select_arm(afl, &b->uniform, mask);
+    case BANDIT_UCB:
+      return ucb_select_arm(afl, &b->ucb, mask);
+    case BANDIT_KLUCB:
+      return klucb_select_arm(afl, &b->klucb, mask);
+    case BANDIT_TS:
+      return ts_select_arm(afl, &b->ts, mask);
+    case BANDIT_DTS:
+      return dts_select_arm(afl, &b->dts, mask);
+    case BANDIT_DBE:
+      return dbe_select_arm(afl, &b->dbe, mask);
+    case BANDIT_ADSTS:
+      return adsts_select_arm(afl, &b->adsts, mask);
+    case BANDIT_EXPPP:
+      return exppp_select_arm(afl, &b->exppp, mask);
+    case BANDIT_EXPIX:
+      return expix_select_arm(afl, &b->expix, mask);
+    default:
+      FATAL("Unknown bandit algorithm %u", b->alg);
+
+  }
+
+}
+
+void bandit_add_reward(bandit_t *b, u32 arm, u8 r) {
+
+  switch (b->alg) {
+
+    case BANDIT_UNIFORM:
+      uniform_add_reward(&b->uniform, arm, r);
+      break;
+    case BANDIT_UCB:
+      ucb_add_reward(&b->ucb, arm, r);
+      break;
+    case BANDIT_KLUCB:
+      klucb_add_reward(&b->klucb, arm, r);
+      break;
+    case BANDIT_TS:
+      ts_add_reward(&b->ts, arm, r);
+      break;
+    case BANDIT_DTS:
+      dts_add_reward(&b->dts, arm, r);
+      break;
+    case BANDIT_DBE:
+      dbe_add_reward(&b->dbe, arm, r);
+      break;
+    case BANDIT_ADSTS:
+      adsts_add_reward(&b->adsts, arm, r);
+      break;
+    case BANDIT_EXPPP:
+      exppp_add_reward(&b->exppp, arm, r);
+      break;
+    case BANDIT_EXPIX:
+      expix_add_reward(&b->expix, arm, r);
+      break;
+    default:
+      FATAL("Unknown bandit algorithm %u", b->alg);
+
+  }
+
+}
+
+void bandit_print_state(bandit_t *b, FILE *f, int indent) {
+
+  if (bandit_ops[b->alg].print_state) {
+
+    bandit_ops[b->alg].print_state(b, f, indent);
+
+  }
+
+}
+
+void bandit_print_arm(FILE *f, bandit_t *b) {
+
+  bandit_ops[b->alg].print_arm(f, b);
+
+}
+
+/* Per-seed mutation operator statistics
+
+   With AFL_SEED_BANDIT the havoc operator is drawn by Thompson sampling from
+   counts kept for the queue entry being fuzzed, shrunk towards the
+   campaign-wide success rate p_i of each operator:
+
+     Beta(1 + K * p_i + rewarded_si, 1 + K * (1 - p_i) + failed_si)
+
+   with K = SEED_BANDIT_PRIOR. A seed that was fuzzed only briefly behaves
+   like the global bandit, one with many executions follows its own counts.
+   The per-seed tables live in a fixed arena of slots that is recycled in
+   LRU order, so memory does not grow with the queue; an evicted seed
+   starts over from the global prior. */
+
+#define SEED_BANDIT_NIL 0xffffffffU
+
+static void seed_bandit_unlink(seed_bandit_t *sb, u32 slot) {
+
+  u32 prev = sb->lru_prev[slot], next = sb->lru_next[slot];
+
+  if (prev != SEED_BANDIT_NIL) {
+
+    sb->lru_next[prev] = next;
+
+  } else {
+
+    sb->lru_head = next;
+
+  }
+
+  if (next != SEED_BANDIT_NIL) {
+
+    sb->lru_prev[next] = prev;
+
+  } else {
+
+    sb->lru_tail = prev;
+
+  }
+
+}
+
+static void seed_bandit_push_front(seed_bandit_t *sb, u32 slot) {
+
+  sb->lru_prev[slot] = SEED_BANDIT_NIL;
+  sb->lru_next[slot] = sb->lru_head;
+  if (sb->lru_head != SEED_BANDIT_NIL) { sb->lru_prev[sb->lru_head] = slot; }
+  sb->lru_head = slot;
+  if (sb->lru_tail == SEED_BANDIT_NIL) { sb->lru_tail = slot; }
+
+}
+
+/* Return the arm table of q, taking over the least recently used slot if q
+   has none. Called once per fuzz_one(), not per havoc iteration. */
+
+seed_bandit_arm_t *seed_bandit_get(afl_state_t *afl, struct queue_entry *q) {
+
+  seed_bandit_t *sb = &afl->seed_bandit;
+  u32            slot = q->seed_bandit_slot;
+
+  if (likely(slot < sb->used && sb->owner[slot] == q->id + 1)) {
+
+    if (slot != sb->lru_head) {
+
+      seed_bandit_unlink(sb, slot);
+      seed_bandit_push_front(sb, slot);
+
+    }
+
+    return sb->arms + (size_t)slot * sb->n_arms;
+
+  }
+
+  if (sb->used < sb->n_slots) {
+
+    slot = sb->used++;
+
+  } else {
+
+    slot = sb->lru_tail;
+    seed_bandit_unlink(sb, slot);
+
+  }
+
+  seed_bandit_push_front(sb, slot);
+  sb->owner[slot] = q->id + 1;
+  q->seed_bandit_slot = slot;
+
+  seed_bandit_arm_t *arms = sb->arms + (size_t)slot * sb->n_arms;
+  memset(arms, 0, sb->n_arms * sizeof(seed_bandit_arm_t));
+  return arms;
+
+}
+
+u32 seed_bandit_select_arm(afl_state_t *afl, seed_bandit_arm_t *arms,
+                           u8 *mask) {
+
+  seed_bandit_t *sb = &afl->seed_bandit;
+  u32            i, n = sb->n_arms;
+
+  double max_sampled = -1;
+  int    selected_idx = 0;
+
+  double a[BETA_BATCH], b[BETA_BATCH];
+  int    idx[BETA_BATCH];
+  int    k = 0;
+
+  for (i = 0; i < n; i++) {
+
+    if (mask && mask[i]) continue;
+
+    double p = (sb->global_rewarded[i] + 1.0) / (sb->global_selected[i] + 2.0);
+    a[k] = 1 + SEED_BANDIT_PRIOR * p + arms[i].num_rewarded;
+    b[k] = 1 + SEED_BANDIT_PRIOR * (1 - p) + arms[i].num_selected -
+           arms[i].num_rewarded;
+    idx[k++] = i;
+
+    if (k == BETA_BATCH) {
+
+      thompson_chunk(afl, a, b, idx, k, 0, &max_sampled, &selected_idx);
+      k = 0;
+
+    }
+
+  }
+
+  if (k) thompson_chunk(afl, a, b, idx, k, 0, &max_sampled, &selected_idx);
+
+  return selected_idx;
+
+}
+
+void seed_bandit_add_reward(seed_bandit_t *sb, seed_bandit_arm_t *arms,
+                            u32 arm, u8 r) {
+
+  seed_bandit_arm_t *s = &arms[arm];
+
+  ++sb->global_selected[arm];
+  sb->global_rewarded[arm] += r;
+
+  if (unlikely(s->num_selected == 0xffffffffU)) {
+
+    s->num_selected >>= 1;
+    s->num_rewarded >>= 1;
+
+  }
+
+  ++s->num_selected;
+  s->num_rewarded += r;
+
+}
+
+/* The bandit power schedule (-p bandit) treats the queue entries as arms.
+   A fuzzed seed is rewarded with the paths its havoc stage found and
+   charged with the execs it took, the success rate of an entry is
+
+     Beta(K * p + finds_q, K * (1 - p) + execs_q - finds_q)
+
+   with p the campaign-wide rate and K = SEED_SCHED_PRIOR. All counts decay
+   by SEED_SCHED_GAMMA per fuzzed seed (those of an entry lazily, when it is
+   looked at), so a seed that dried up sinks back to the prior. Thompson
+   sampling over the whole queue would cost O(n) per pick; instead the
+   caller draws a few candidates and only those are sampled. The havoc
+   energy is the posterior mean relative to p. */
+
+static inline double seed_sched_rate(afl_state_t *afl) {
+
+  return (afl->seed_sched.finds + 1) / (afl->seed_sched.execs + 2);
+
+}
+
+static inline void seed_sched_posterior(afl_state_t *afl,
+                                        struct queue_entry *q, double *a,
+                                        double *b) {
+
+  double p = seed_sched_rate(afl),
+         d = pow(SEED_SCHED_GAMMA, (double)(afl->seed_sched.t - q->sched_t));
+
+  *a = SEED_SCHED_PRIOR * p + q->sched_finds * d;
+  *b = SEED_SCHED_PRIOR * (1 - p) + (q->sched_execs - q->sched_finds) * d;
+
+}
+
+double seed_sched_mean(afl_state_t *afl, struct queue_entry *q) {
+
+  double a, b;
+
+  seed_sched_posterior(afl, q, &a, &b);
+  return a / (a + b);
+
+}
+
+u32 seed_sched_score(afl_state_t *afl, struct queue_entry *q) {
+
+  double score = 100 * seed_sched_mean(afl, q) / seed_sched_rate(afl);
+
+  if (score > afl->havoc_max_mult * 100) { score = afl->havoc_max_mult * 100; }
+  if (score < 1) { score = 1; }
+
+  return score;
+
+}
+
+/* Thompson sampling over the n <= BETA_BATCH candidate queue ids */
+
+u32 seed_sched_pick(afl_state_t *afl, u32 *cand, u32 n) {
+
+  double a[BETA_BATCH] = {0}, b[BETA_BATCH] = {0}, max_sampled = -1;
+  int    idx[BETA_BATCH], selected_idx = cand[0];
+  u32    i;
+
+  for (i = 0; i < n; i++) {
+
+    seed_sched_posterior(afl, afl->queue_buf[cand[i]], &a[i], &b[i]);
+    idx[i] = cand[i];
+
+  }
+
+  thompson_chunk(afl, a, b, idx, n, 0, &max_sampled, &selected_idx);
+
+  return selected_idx;
+
+}
+
+void seed_sched_reward(afl_state_t *afl, struct queue_entry *q, u32 finds,
+                       u64 execs) {
+
+  seed_sched_t *ss = &afl->seed_sched;
+  double        d = pow(SEED_SCHED_GAMMA, (double)(ss->t + 1 - q->sched_t));
+
+  if (finds > execs) { finds = execs; }
+
+  ss->finds = ss->finds * SEED_SCHED_GAMMA + finds;
+  ss->execs = ss->execs * SEED_SCHED_GAMMA + execs;
+  ++ss->t;
+
+  q->sched_finds = q->sched_finds * d + finds;
+  q->sched_execs = q->sched_execs * d + execs;
+  q->sched_t = ss->t;
+
+}
+
+static void setup_seed_bandit(afl_state_t *afl, u32 n_arms) {
+
+  seed_bandit_t *sb = &afl->seed_bandit;
+  s32            n_slots = atoi(afl->afl_env.afl_seed_bandit);
+
+  /* AFL_SEED_BANDIT=1 just enables the mode */
+  if (n_slots <= 1) { n_slots = SEED_BANDIT_SLOTS; }
+
+  sb->n_slots = n_slots;
+  sb->n_arms = n_arms;
+  sb->used = 0;
+  sb->lru_head = sb->lru_tail = SEED_BANDIT_NIL;
+
+  sb->owner = ck_alloc(n_slots * sizeof(u32));
+  sb->lru_prev = ck_alloc(n_slots * sizeof(u32));
+  sb->lru_next = ck_alloc(n_slots * sizeof(u32));
+  sb->arms = ck_alloc((size_t)n_slots * n_arms * sizeof(seed_bandit_arm_t));
+  sb->global_selected = ck_alloc(n_arms * sizeof(u64));
+  sb->global_rewarded = ck_alloc(n_arms * sizeof(u64));
+
+  size_t slot_size = n_arms * sizeof(seed_bandit_arm_t) + 3 * sizeof(u32);
+  OKF("Per-seed mutation operator bandits: %u slots (%zu kB)", sb->n_slots,
+      (n_slots * slot_size) >> 10);
+
+}
+
+static void destroy_seed_bandit(afl_state_t *afl) {
+
+  seed_bandit_t *sb = &afl->seed_bandit;
+
+  if (!sb->n_slots) { return; }
+
+  ck_free(sb->owner);
+  ck_free(sb->lru_prev);
+  ck_free(sb->lru_next);
+  ck_free(sb->arms);
+  ck_free(sb->global_selected);
+  ck_free(sb->global_rewarded);
+  memset(sb, 0, sizeof(seed_bandit_t));
+
+}
+
+/* Bandit state file, written next to fuzzer_stats and read back when
+   resuming. Layout (host endianness):
+
+     u32 magic, version, NUM_MUT_BUCKET, NUM_BATCH_BUCKET, NUM_CASE,
+         BATCH_NUM_ARM, ADWIN_M, number of instances
+     per instance: u32 alg, u32 n_arms, u64 payload size, payload
+     u32 n_arms of the AFL_SEED_BANDIT prior (0 if off), then its counts
+
+   A file with a different layout is ignored as a whole, an instance that
+   now runs another algorithm is skipped. */
+
+#define BANDIT_STATE_MAGIC 0x534e4442                           /* "BDNS" */
+#define BANDIT_STATE_VERSION 1
+#define BANDIT_MAX_INSTANCES (NUM_MUT_BUCKET + NUM_BATCH_BUCKET * NUM_CASE)
+
+static u32 collect_bandits(afl_state_t *afl, bandit_t **list) {
+
+  u32 n = 0, i;
+
+#ifdef BATCHSIZE_BANDIT
+  for (i = 0; i < NUM_BATCH_BUCKET; i++) {
+    u32 j;
+    for (j = 0; j < NUM_CASE; j++) {
+      list[n++] = &afl->batch_bandit[i][j];
+    }
+  }
+#endif
+
+#if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
+  for (i = 0; i < NUM_MUT_BUCKET; i++) {
+    list[n++] = &afl->mut_bandit[i];
+  }
+#endif
+
+  (void)i;
+  return n;
+
+}
+
+static u32 bandit_n_arms(bandit_t *b) {
+
+  switch (b->alg) {
+
+    case BANDIT_UNIFORM: return b->uniform.n_arms;
+    case BANDIT_UCB: return b->ucb.n_arms;
+    case BANDIT_KLUCB: return b->klucb.n_arms;
+    case BANDIT_TS: return b->ts.n_arms;
+    case BANDIT_DTS: return b->dts.n_arms;
+    case BANDIT_DBE: return b->dbe.n_arms;
+    case BANDIT_ADSTS: return b->adsts.n_arms;
+    case BANDIT_EXPPP: return b->exppp.n_arms;
+    case BANDIT_EXPIX: return b->expix.n_arms;
+    default: return 0;
+
+  }
+
+}
+
+static void bandit_state_header(bandit_stream_t *s, u32 n_inst) {
+
+  u32 hdr[] = {BANDIT_STATE_MAGIC, BANDIT_STATE_VERSION, NUM_MUT_BUCKET,
+               NUM_BATCH_BUCKET,   NUM_CASE,             BATCH_NUM_ARM,
+               ADWIN_M,            n_inst};
+
+  bs_put(s, hdr, sizeof(hdr));
+
+}
+
+/* Write all bandit instances to out_dir/bandit_state (atomically) */
+
+void save_bandits(afl_state_t *afl) {
+
+  bandit_t *       list[BANDIT_MAX_INSTANCES];
+  bandit_stream_t *s = &afl->bandit_stream;
+  seed_bandit_t *  sb = &afl->seed_bandit;
+  u32              n_inst = collect_bandits(afl, list), i;
+  u8               fn[PATH_MAX], tmp[PATH_MAX];
+  s32              fd;
+
+  s->len = s->pos = 0;
+  s->err = 0;
+  bandit_state_header(s, n_inst);
+
+  for (i = 0; i < n_inst; i++) {
+
+    u32    alg = list[i]->alg, n_arms = bandit_n_arms(list[i]);
+    u64    size = 0;
+    size_t size_at;
+
+    BS_PUT(s, alg);
+    BS_PUT(s, n_arms);
+    size_at = s->len;
+    BS_PUT(s, size);
+
+    bandit_ops[alg].save(list[i], s);
+
+    size = s->len - size_at - sizeof(u64);
+    memcpy(s->buf + size_at, &size, sizeof(u64));
+
+  }
+
+  BS_PUT(s, sb->n_arms);
+  if (sb->n_arms) {
+
+    bs_put(s, sb->global_selected, sb->n_arms * sizeof(u64));
+    bs_put(s, sb->global_rewarded, sb->n_arms * sizeof(u64));
+
+  }
+
+  snprintf(fn, PATH_MAX, "%s/bandit_state", afl->out_dir);
+  snprintf(tmp, PATH_MAX, "%s/.bandit_state.tmp", afl->out_dir);
+
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+  if (fd < 0) { PFATAL("Unable to create '%s'", tmp); }
+  ck_write(fd, s->buf, s->len, tmp);
+  close(fd);
+
+  if (rename(tmp, fn)) { PFATAL("Unable to rename '%s'", tmp); }
+
+}
+
+/* Restore the bandits from out_dir/bandit_state when resuming. The bandits
+   must already be set up. */
+
+void load_bandits(afl_state_t *afl) {
+
+  bandit_t *       list[BANDIT_MAX_INSTANCES];
+  bandit_stream_t *s = &afl->bandit_stream;
+  seed_bandit_t *  sb = &afl->seed_bandit;
+  u32              n_inst = collect_bandits(afl, list), i, restored = 0;
+  u8               fn[PATH_MAX];
+  struct stat      st;
+  s32              fd;
+
+  snprintf(fn, PATH_MAX, "%s/bandit_state", afl->out_dir);
+
+  fd = open(fn, O_RDONLY);
+  if (fd < 0) {
+
+    if (errno != ENOENT) { WARNF("Unable to open '%s'", fn); }
+    return;
+
+  }
+
+  if (fstat(fd, &st) || !st.st_size) {
+
+    close(fd);
+    WARNF("Bandit state '%s' is empty, starting from scratch", fn);
+    return;
+
+  }
+
+  s->len = st.st_size;
+  s->pos = 0;
+  s->err = 0;
+  if (s->len > s->cap) {
+
+    s->cap = s->len;
+    s->buf = ck_realloc(s->buf, s->cap);
+
+  }
+
+  ck_read(fd, s->buf, s->len, fn);
+  close(fd);
+
+  /* the header has to match exactly */
+
+  bandit_stream_t ref = {0};
+  bandit_state_header(&ref, n_inst);
+  u8 compatible = s->len >= ref.len && !memcmp(s->buf, ref.buf, ref.len);
+  ck_free(ref.buf);
+
+  if (!compatible) {
+
+    WARNF("Bandit state '%s' is from an incompatible build, starting from "
+          "scratch", fn);
+    return;
+
+  }
+
+  s->pos = ref.len;
+
+  for (i = 0; i < n_inst && !s->err; i++) {
+
+    u32 alg, n_arms;
+    u64 size;
+
+    BS_GET(s, alg);
+    BS_GET(s, n_arms);
+    BS_GET(s, size);
+    if (s->err || size > s->len - s->pos) {
+
+      s->err = 1;
+      break;
+
+    }
+
+    size_t end = s->pos + size;
+
+    if (alg != list[i]->alg || n_arms != bandit_n_arms(list[i])) {
+
+      s->pos = end;
+      continue;
+
+    }
+
+    bandit_ops[alg].load(list[i], s);
+
+    if (s->err || s->pos != end) {
+
+      /* drop whatever was half-restored */
+      bandit_deinit(list[i]);
+      bandit_init(list[i], alg, n_arms);
+      s->err = 1;
+      break;
+
+    }
+
+    restored++;
+
+  }
+
+  if (!s->err) {
+
+    u32 seed_arms;
+    BS_GET(s, seed_arms);
+
+    if (!s->err && seed_arms && seed_arms == sb->n_arms) {
+
+      bs_get(s, sb->global_selected, sb->n_arms * sizeof(u64));
+      bs_get(s, sb->global_rewarded, sb->n_arms * sizeof(u64));
+
+      if (s->err) {
+
+        memset(sb->global_selected, 0, sb->n_arms * sizeof(u64));
+        memset(sb->global_rewarded, 0, sb->n_arms * sizeof(u64));
+
+      }
+
+    }
+
+  }
+
+  if (s->err) {
+
+    WARNF("Bandit state '%s' is truncated or corrupt", fn);
+
+  } else if (restored < n_inst) {
+
+    WARNF("%u of %u bandits not restored (algorithm changed?)",
+          n_inst - restored, n_inst);
+
+  }
+
+  if (restored) { OKF("Restored %u bandits from '%s'", restored, fn); }
+
+}
+
+/* Sharing between -M/-S instances (AFL_BANDIT_SHARE)
+
+   All instances publish the same thing: per arm of every bandit, the
+   selections and rewards since the last publish, added to the previously
+   published counts after discounting them by BANDIT_SHARE_DECAY. This works
+   for every algorithm since they all keep cumulative counts. The counts of
+   all peers, further discounted by the age of their slot, are averaged into
+   a {rewards, failures} prior that the Thompson sampling variants (ts, dts,
+   adsts) add to the Beta parameters of their own arms; i.e. the rest of the
+   cluster weighs like one extra instance. */
+
+#define BANDIT_SHARE_MAGIC 0x48534442                           /* "BDSH" */
+
+static void bandit_arm_counts(bandit_t *b, u32 arm, u64 *sel, u64 *rew) {
+
+  switch (b->alg) {
+
+    case BANDIT_UNIFORM:
+      *sel = b->uniform.arms[arm].num_selected;
+      *rew = b->uniform.arms[arm].total_rewards;
+      break;
+    case BANDIT_UCB:
+      *sel = b->ucb.arms[arm].num_selected;
+      *rew = b->ucb.arms[arm].total_rewards;
+      break;
+    case BANDIT_KLUCB:
+      *sel = b->klucb.arms[arm].num_selected;
+      *rew = b->klucb.arms[arm].total_rewards;
+      break;
+    case BANDIT_TS:
+      *sel = b->ts.arms[arm].num_selected;
+      *rew = b->ts.arms[arm].total_rewards;
+      break;
+    case BANDIT_DTS:
+      *sel = b->dts.arms[arm].num_selected;
+      *rew = b->dts.arms[arm].num_rewarded;
+      break;
+    case BANDIT_DBE:
+      *sel = b->dbe.arms[arm].num_selected;
+      *rew = b->dbe.arms[arm].num_rewarded;
+      break;
+    case BANDIT_ADSTS:
+      *sel = b->adsts.arms[arm].num_selected;
+      *rew = b->adsts.arms[arm].total_rewards;
+      break;
+    case BANDIT_EXPPP:
+      *sel = b->exppp.pulls[arm];
+      *rew = b->exppp.total_rewards[arm];
+      break;
+    case BANDIT_EXPIX:
+      *sel = b->expix.pulls[arm];
+      *rew = b->expix.total_rewards[arm];
+      break;
+    default:
+      *sel = *rew = 0;
+
+  }
+
+}
+
+static double **bandit_prior_ptr(bandit_t *b) {
+
+  switch (b->alg) {
+
+    case BANDIT_TS: return &b->ts.prior;
+    case BANDIT_DTS: return &b->dts.prior;
+    case BANDIT_ADSTS: return &b->adsts.prior;
+    default: return NULL;
+
+  }
+
+}
+
+static void setup_bandit_share(afl_state_t *afl) {
+
+  bandit_t *      list[BANDIT_MAX_INSTANCES];
+  bandit_share_t *sh = &afl->bandit_share;
+  u32             n_inst = collect_bandits(afl, list), i, n_arms = 0, users = 0;
+  u8              fn[PATH_MAX];
+  s32             fd;
+
+  for (i = 0; i < n_inst; i++) {
+
+    double **prior = bandit_prior_ptr(list[i]);
+    if (prior) {
+
+      *prior = NULL;
+      users++;
+
+    }
+
+    n_arms += bandit_n_arms(list[i]);
+
+  }
+
+  sh->slot_size = sizeof(bandit_share_slot_t) + n_arms * 2 * sizeof(double);
+
+  snprintf(fn, PATH_MAX, "%s/bandit_share", afl->out_dir);
+  fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, DEFAULT_PERMISSION);
+  if (fd < 0) { PFATAL("Unable to create '%s'", fn); }
+  if (ftruncate(fd, sh->slot_size)) { PFATAL("ftruncate() failed"); }
+
+  sh->slot = mmap(NULL, sh->slot_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+  if (sh->slot == MAP_FAILED) { PFATAL("mmap() of '%s' failed", fn); }
+  close(fd);
+
+  sh->n_arms = n_arms;
+  sh->last = ck_alloc(n_arms * 2 * sizeof(u64));
+  sh->prior = ck_alloc(n_arms * 2 * sizeof(double));
+  sh->sum = ck_alloc(n_arms * 2 * sizeof(double));
+  sh->peer = ck_alloc(n_arms * 2 * sizeof(double));
+
+  sh->slot->n_arms = n_arms;
+  __atomic_store_n(&sh->slot->magic, BANDIT_SHARE_MAGIC, __ATOMIC_RELEASE);
+
+  for (i = 0, n_arms = 0; i < n_inst; i++) {
+
+    double **prior = bandit_prior_ptr(list[i]);
+    if (prior) { *prior = sh->prior + 2 * n_arms; }
+    n_arms += bandit_n_arms(list[i]);
+
+  }
+
+  if (!users) {
+
+    WARNF("AFL_BANDIT_SHARE: only ts, dts and adsts use the pooled "
+          "statistics, this instance only publishes its own");
+
+  }
+
+}
+
+static void publish_bandits(afl_state_t *afl, bandit_t **list, u32 n_inst,
+                            u64 now) {
+
+  bandit_share_t *     sh = &afl->bandit_share;
+  bandit_share_slot_t *slot = sh->slot;
+  u64                  seq = slot->seq;
+  u32                  i, arm, j = 0;
+
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  for (i = 0; i < n_inst; i++) {
+
+    u32 n = bandit_n_arms(list[i]);
+
+    for (arm = 0; arm < n; arm++, j++) {
+
+      u64 sel, rew;
+      bandit_arm_counts(list[i], arm, &sel, &rew);
+
+      /* counters that went backwards (a reset bandit) restart the delta */
+      if (sel < sh->last[2 * j] || rew < sh->last[2 * j + 1]) {
+
+        sh->last[2 * j] = sh->last[2 * j + 1] = 0;
+
+      }
+
+      slot->counts[2 * j] = slot->counts[2 * j] * BANDIT_SHARE_DECAY +
+                            (sel - sh->last[2 * j]);
+      slot->counts[2 * j + 1] = slot->counts[2 * j + 1] * BANDIT_SHARE_DECAY +
+                                (rew - sh->last[2 * j + 1]);
+      sh->last[2 * j] = sel;
+      sh->last[2 * j + 1] = rew;
+
+    }
+
+  }
+
+  slot->updated = now;
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+
+}
+
+/* Copy the counts of a peer slot into sh->peer, 0 if the peer is being
+   written to (we just try again next time) or has another layout */
+
+static u8 read_peer_slot(bandit_share_t *sh, u8 *fn, u64 *updated) {
+
+  bandit_share_slot_t *slot;
+  struct stat          st;
+  u64                  seq;
+  u8                   ok = 0;
+  s32                  fd = open(fn, O_RDONLY);
+
+  if (fd < 0) { return 0; }
+
+  if (fstat(fd, &st) || (size_t)st.st_size != sh->slot_size) {
+
+    close(fd);
+    return 0;
+
+  }
+
+  slot = mmap(NULL, sh->slot_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (slot == MAP_FAILED) { return 0; }
+
+  if (__atomic_load_n(&slot->magic, __ATOMIC_ACQUIRE) == BANDIT_SHARE_MAGIC &&
+      slot->n_arms == sh->n_arms) {
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+    if (!(seq & 1)) {
+
+      memcpy(sh->peer, slot->counts, sh->n_arms * 2 * sizeof(double));
+      *updated = slot->updated;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      ok = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+
+    }
+
+  }
+
+  munmap(slot, sh->slot_size);
+  return ok;
+
+}
+
+static void pull_bandits(afl_state_t *afl, u64 now) {
+
+  bandit_share_t *sh = &afl->bandit_share;
+  struct dirent * de;
+  DIR *           sd;
+  u32             peers = 0, j;
+  u8              fn[PATH_MAX];
+
+  sd = opendir(afl->sync_dir);
+  if (!sd) { return; }
+
+  memset(sh->sum, 0, sh->n_arms * 2 * sizeof(double));
+
+  while ((de = readdir(sd))) {
+
+    u64 updated;
+
+    if (de->d_name[0] == '.' || !strcmp(afl->sync_id, de->d_name)) {
+
+      continue;
+
+    }
+
+    snprintf(fn, PATH_MAX, "%s/%s/bandit_share", afl->sync_dir, de->d_name);
+    if (!read_peer_slot(sh, fn, &updated)) { continue; }
+
+    /* an instance that stopped publishing fades out */
+    double w = 1.0;
+    if (now > updated) {
+
+      w = pow(BANDIT_SHARE_DECAY,
+              (double)(now - updated) / (BANDIT_SHARE_SEC * 1000));
+
+    }
+
+    for (j = 0; j < sh->n_arms * 2; j++) {
+
+      sh->sum[j] += w * sh->peer[j];
+
+    }
+
+    peers++;
+
+  }
+
+  closedir(sd);
+
+  if (!peers) { return; }
+
+  for (j = 0; j < sh->n_arms; j++) {
+
+    double sel = sh->sum[2 * j] / peers, rew = sh->sum[2 * j + 1] / peers;
+    sh->prior[2 * j] = rew;
+    sh->prior[2 * j + 1] = sel > rew ? sel - rew : 0;
+
+  }
+
+}
+
+/* Publish our counts and pull the pooled prior, every BANDIT_SHARE_SEC */
+
+void share_bandits(afl_state_t *afl) {
+
+  bandit_t *list[BANDIT_MAX_INSTANCES];
+  u32       n_inst = collect_bandits(afl, list);
+  u64       now = get_cur_time();
+
+  if (!afl->bandit_share.slot) { setup_bandit_share(afl); }
+
+  publish_bandits(afl, list, n_inst, now);
+  pull_bandits(afl, now);
+
+}
+
+static void destroy_bandit_share(afl_state_t *afl) {
+
+  bandit_share_t *sh = &afl->bandit_share;
+
+  if (!sh->slot) { return; }
+
+  munmap(sh->slot, sh->slot_size);
+  ck_free(sh->last);
+  ck_free(sh->prior);
+  ck_free(sh->sum);
+  ck_free(sh->peer);
+  memset(sh, 0, sizeof(bandit_share_t));
+
+}
+
+static u8 bandit_alg_from_env(u8 *val, const char *env, u8 def) {
+
+  if (!val) { return def; }
+
+  s32 alg = bandit_alg_from_name(val);
+  if (alg < 0) {
+
+    FATAL(
+        "Unknown bandit algorithm '%s' in %s (uniform, ucb, klucb, ts, dts, "
+        "dbe, adsts, exppp or expix)",
+        val, env);
+
+  }
+
+  return alg;
+
+}
+
+/* Set up the mutation operator and batch size bandits */
+
+void setup_bandits(afl_state_t *afl) {
+
+  u8 mut_alg =
+      bandit_alg_from_env(afl->afl_env.afl_mut_alg, "AFL_MUT_ALG", MUT_ALG);
+  u8 batch_alg = bandit_alg_from_env(afl->afl_env.afl_batch_alg,
+                                     "AFL_BATCH_ALG", BATCH_ALG);
+  int i;
+
+#ifdef BATCHSIZE_BANDIT
+  for (i=0; i<NUM_BATCH_BUCKET; i++) {
+    int j;
+    for (j=0; j<NUM_CASE; j++) {
+      bandit_init(&afl->batch_bandit[i][j], batch_alg, BATCH_NUM_ARM);
+    }
+  }
+#else
+  (void)batch_alg;
+#endif
+
+  for (i=0; i<NUM_MUT_BUCKET; i++) {
+#if   defined(MOPTWISE_BANDIT)
+    bandit_init(&afl->mut_bandit[i], mut_alg, NUM_CASE);
+#elif defined(MOPTWISE_BANDIT_FINECOARSE)
+    bandit_init(&afl->mut_bandit[i], mut_alg, 2);
+#else
+    (void)mut_alg;
+#endif
+  }
+
+  OKF("Bandit algorithms: mutation operators '%s', batch size '%s'",
+      bandit_ops[mut_alg].name, bandit_ops[batch_alg].name);
+
+  if (afl->afl_env.afl_bandit_share && !afl->sync_id) {
+
+    WARNF("AFL_BANDIT_SHARE needs -M or -S, ignored");
+    afl->afl_env.afl_bandit_share = 0;
+
+  }
+
+  if (afl->afl_env.afl_seed_bandit) {
+
+#if   defined(MOPTWISE_BANDIT)
+    setup_seed_bandit(afl, NUM_CASE);
+#elif defined(MOPTWISE_BANDIT_FINECOARSE)
+    setup_seed_bandit(afl, 2);
+#else
+    WARNF("AFL_SEED_BANDIT needs a MOpt-wise bandit build, ignored");
+#endif
+
+  }
+
+}
+
+void destroy_bandits(afl_state_t *afl) {
+
+  int i;
+
+#ifdef BATCHSIZE_BANDIT
+  for (i=0; i<NUM_BATCH_BUCKET; i++) {
+    int j;
+    for (j=0; j<NUM_CASE; j++) {
+      bandit_deinit(&afl->batch_bandit[i][j]);
+    }
+  }
+#endif
+
+#if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
+  for (i=0; i<NUM_MUT_BUCKET; i++) {
+    bandit_deinit(&afl->mut_bandit[i]);
+  }
+#endif
+
+  destroy_bandit_share(afl);
+  destroy_seed_bandit(afl);
+  ck_free(afl->bandit_stream.buf);
+  memset(&afl->bandit_stream, 0, sizeof(bandit_stream_t));
+
+  (void)i;
+
+}
@@ -29,6 +29,10 @@
   #define NAME_MAX _XOPEN_NAME_MAX
 #endif
 
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+#undef XXH_INLINE_ALL
+
 /* Write bitmap to file. The bitmap is useful mostly for the secret
    -B option, to focus a separate fuzzing session on a particular
    interesting input without rediscovering all the others. */
@@ -139,116 +143,271 @@ u32 count_non_255_bytes(afl_state_t *afl, u8 *mem) {
 
 }
 
-/* Destructively simplify trace by eliminating hit count information
-   and replacing it with 0x80 or 0x01 depending on whether the tuple
-   is hit or not. Called on every new crash or timeout, should be
-   reasonably fast. */
-#define TIMES4(x) x, x, x, x
-#define TIMES8(x) TIMES4(x), TIMES4(x)
-#define TIMES16(x) TIMES8(x), TIMES8(x)
-#define TIMES32(x) TIMES16(x), TIMES16(x)
-#define TIMES64(x) TIMES32(x), TIMES32(x)
-#define TIMES255(x)                                                      \
-  TIMES64(x), TIMES64(x), TIMES64(x), TIMES32(x), TIMES16(x), TIMES8(x), \
-      TIMES4(x), x, x, x
-const u8 simplify_lookup[256] = {
+/* Import coverage processing routines. */
 
-    [0] = 1, [1] = TIMES255(128)
+#ifdef WORD_SIZE_64
+  #include "coverage-64.h"
+#else
+  #include "coverage-32.h"
+#endif
 
-};
+/* Check if the current execution path brings anything new to the table.
+   Update virgin bits to reflect the finds. Returns 1 if the only change is
+   the hit-count for a particular tuple; 2 if there are new tuples seen.
+   Updates the map, so subsequent calls will always return 0.
 
-/* Destructively classify execution counts in a trace. This is used as a
-   preprocessing step for any newly acquired traces. Called on every exec,
-   must be fast. */
+   This function is called after every exec() on a fairly large buffer, so
+   it needs to be fast. We do this in 32-bit and 64-bit flavors. */
 
-const u8 count_class_lookup8[256] = {
+inline u8 has_new_bits(afl_state_t *afl, u8 *virgin_map) {
+
+  u8 ret = 0;
+
+  if (afl->fsrv.dirty_map && afl->fsrv.dirty_map->valid) {
+
+    /* AFL_DIRTY_MAP: only the lines the target touched can be non-zero */
+
+    u32 w, n = DIRTY_MAP_WORDS(afl->fsrv.map_size);
 
-    [0] = 0,
-    [1] = 1,
-    [2] = 2,
-    [3] = 4,
-    [4] = TIMES4(8),
-    [8] = TIMES8(16),
-    [16] = TIMES16(32),
-    [32] = TIMES32(64),
-    [128] = TIMES64(128)
+    for (w = 0; w < n; ++w) {
 
-};
+      u64 bits = afl->fsrv.dirty_map->bits[w];
 
-#undef TIMES255
-#undef TIMES64
-#undef TIMES32
-#undef TIMES16
-#undef TIMES8
-#undef TIMES4
+      while (bits) {
 
-u16 count_class_lookup16[65536];
+        u32 off = ((w << 6) + __builtin_ctzll(bits)) * DIRTY_LINE;
 
-void init_count_class16(void) {
+#ifdef WORD_SIZE_64
+
+        u8 line_ret = cov_kernels->discover(afl->fsrv.trace_bits + off,
+                                            virgin_map + off, DIRTY_LINE);
+        if (line_ret > ret) { ret = line_ret; }
+
+#else
 
-  u32 b1, b2;
+        u32 *current = (u32 *)(afl->fsrv.trace_bits + off);
+        u32 *virgin = (u32 *)(virgin_map + off);
+        u32  i;
 
-  for (b1 = 0; b1 < 256; b1++) {
+        for (i = 0; i < DIRTY_LINE / sizeof(u32); ++i) {
 
-    for (b2 = 0; b2 < 256; b2++) {
+          if (unlikely(current[i]))
+            discover_word(&ret, current + i, virgin + i);
 
-      count_class_lookup16[(b1 << 8) + b2] =
-          (count_class_lookup8[b1] << 8) | count_class_lookup8[b2];
+        }
+
+#endif                                                     /* ^WORD_SIZE_64 */
+
+        bits &= bits - 1;
+
+      }
+
+    }
+
+  } else {
+
+#ifdef WORD_SIZE_64
+
+    ret = cov_kernels->discover(afl->fsrv.trace_bits, virgin_map,
+                                afl->fsrv.map_size);
+
+#else
+
+    u32 *current = (u32 *)afl->fsrv.trace_bits;
+    u32 *virgin = (u32 *)virgin_map;
+
+    u32 i = (afl->fsrv.map_size >> 2);
+
+    while (i--) {
+
+      if (unlikely(*current)) discover_word(&ret, current, virgin);
+
+      current++;
+      virgin++;
 
     }
 
+#endif                                                     /* ^WORD_SIZE_64 */
+
   }
 
-}
+  if (unlikely(ret) && likely(virgin_map == afl->virgin_bits))
+    afl->bitmap_changed = 1;
 
-/* Import coverage processing routines. */
+  return ret;
+
+}
 
 #ifdef WORD_SIZE_64
-  #include "coverage-64.h"
-#else
-  #include "coverage-32.h"
-#endif
 
-/* Check if the current execution path brings anything new to the table.
-   Update virgin bits to reflect the finds. Returns 1 if the only change is
-   the hit-count for a particular tuple; 2 if there are new tuples seen.
-   Updates the map, so subsequent calls will always return 0.
+/* check_trace() works on blocks of one dirty map word: small enough to stay
+   in L1 between the kernels and the hash. */
 
-   This function is called after every exec() on a fairly large buffer, so
-   it needs to be fast. We do this in 32-bit and 64-bit flavors. */
+  #define TRACE_BLOCK (DIRTY_LINE * 64)
 
-inline u8 has_new_bits(afl_state_t *afl, u8 *virgin_map) {
+static inline u8 check_block(u8 *mem, u8 *virgin, u32 len, u8 flags) {
+
+  if (flags & TRACE_CLASSIFY) {
+
+    if (virgin && !(flags & TRACE_SIMPLIFY)) {
+
+      return cov_kernels->classify_discover(mem, virgin, len);
+
+    }
+
+    cov_kernels->classify(mem, len);
+
+  }
+
+  if (flags & TRACE_SIMPLIFY) { cov_kernels->simplify(mem, len); }
+
+  return virgin ? cov_kernels->discover(mem, virgin, len) : 0;
+
+}
+
+#endif                                                     /* WORD_SIZE_64 */
+
+/* Classify and/or simplify the trace as asked by flags (TRACE_*), compare it
+   with virgin_map unless that is NULL, and checksum it, all in one pass over
+   the map. The results are those of classify_counts(), simplify_trace(),
+   has_new_bits() and hash64() called one after the other. */
+
+void check_trace(afl_state_t *afl, u8 *virgin_map, u8 flags,
+                 struct trace_check *res) {
+
+  struct dirty_map *dm = afl->fsrv.dirty_map;
+
+  res->new_bits = 0;
+  res->cksum = 0;
 
 #ifdef WORD_SIZE_64
 
-  u64 *current = (u64 *)afl->fsrv.trace_bits;
-  u64 *virgin = (u64 *)virgin_map;
+  u8 *          trace = afl->fsrv.trace_bits;
+  u32           map_size = afl->fsrv.map_size, off, w;
+  u8            dirty = dm && dm->valid && !(flags & TRACE_SIMPLIFY);
+  XXH64_state_t hash;
+
+  /* simplify_trace() fills the untouched lines too */
+  if (dm && (flags & TRACE_SIMPLIFY)) { dm->valid = 0; }
+
+  if (flags & TRACE_HASH) { XXH64_reset(&hash, HASH_CONST); }
+
+  for (off = 0, w = 0; off < map_size; off += TRACE_BLOCK, ++w) {
+
+    u32 len = MIN((u32)TRACE_BLOCK, map_size - off);
+    u8  ret;
+
+    if (dirty) {
+
+      /* AFL_DIRTY_MAP: only the lines the target touched can be non-zero */
+
+      u64 bits = dm->bits[w];
+
+      while (bits) {
+
+        u32 line = off + __builtin_ctzll(bits) * DIRTY_LINE;
+
+        ret = check_block(trace + line, virgin_map ? virgin_map + line : NULL,
+                          DIRTY_LINE, flags);
+        if (ret > res->new_bits) { res->new_bits = ret; }
+        bits &= bits - 1;
+
+      }
+
+    } else {
+
+      ret = check_block(trace + off, virgin_map ? virgin_map + off : NULL, len,
+                        flags);
+      if (ret > res->new_bits) { res->new_bits = ret; }
+
+    }
+
+    if (flags & TRACE_HASH) { XXH64_update(&hash, trace + off, len); }
 
-  u32 i = (afl->fsrv.map_size >> 3);
+  }
+
+  if (flags & TRACE_HASH) { res->cksum = XXH64_digest(&hash); }
+
+  if (unlikely(res->new_bits) && likely(virgin_map == afl->virgin_bits))
+    afl->bitmap_changed = 1;
 
 #else
 
-  u32 *current = (u32 *)afl->fsrv.trace_bits;
-  u32 *virgin = (u32 *)virgin_map;
+  if (flags & TRACE_CLASSIFY) { classify_counts(&afl->fsrv); }
 
-  u32 i = (afl->fsrv.map_size >> 2);
+  if (flags & TRACE_SIMPLIFY) {
+
+    if (dm) { dm->valid = 0; }
+    simplify_trace(afl, afl->fsrv.trace_bits);
+
+  }
+
+  if (virgin_map) { res->new_bits = has_new_bits(afl, virgin_map); }
+
+  if (flags & TRACE_HASH) {
+
+    res->cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+
+  }
 
 #endif                                                     /* ^WORD_SIZE_64 */
 
-  u8 ret = 0;
-  while (i--) {
+}
+
+/* Non-zero if the unclassified trace may have new bits in virgin_map,
+   without touching either. */
+
+inline u8 skim_trace(afl_state_t *afl, u8 *virgin_map) {
+
+  if (afl->fsrv.dirty_map && afl->fsrv.dirty_map->valid) {
+
+    /* AFL_DIRTY_MAP: skim only the lines the target touched */
 
-    if (unlikely(*current)) discover_word(&ret, current, virgin);
+    u32 w, n = DIRTY_MAP_WORDS(afl->fsrv.map_size);
 
-    current++;
-    virgin++;
+    for (w = 0; w < n; ++w) {
+
+      u64 bits = afl->fsrv.dirty_map->bits[w];
+
+      while (bits) {
+
+        u32 off = ((w << 6) + __builtin_ctzll(bits)) * DIRTY_LINE;
+
+#ifdef WORD_SIZE_64
+        if (cov_kernels->skim(virgin_map + off, afl->fsrv.trace_bits + off,
+                              DIRTY_LINE)) {
+#else
+        if (skim((u32 *)(virgin_map + off),
+                 (u32 *)(afl->fsrv.trace_bits + off),
+                 (u32 *)(afl->fsrv.trace_bits + off + DIRTY_LINE))) {
+#endif
+
+          return 1;
+
+        }
+
+        bits &= bits - 1;
+
+      }
+
+    }
+
+    return 0;
 
   }
 
-  if (unlikely(ret) && likely(virgin_map == afl->virgin_bits))
-    afl->bitmap_changed = 1;
+#ifdef WORD_SIZE_64
 
-  return ret;
+  return cov_kernels->skim(virgin_map, afl->fsrv.trace_bits,
+                           afl->fsrv.map_size) != 0;
+
+#else
+
+  u8 *end = afl->fsrv.trace_bits + afl->fsrv.map_size;
+
+  return skim((u32 *)virgin_map, (u32 *)afl->fsrv.trace_bits, (u32 *)end);
+
+#endif                                                     /* ^WORD_SIZE_64 */
 
 }
 
@@ -259,27 +418,24 @@ inline u8 has_new_bits(afl_state_t *afl, u8 *virgin_map) {
  * This accelerates the processing: in most cases, no interesting behavior
  * happen, and the trace bits will be discarded soon. This function optimizes
  * for such cases: one-pass scan on trace bits without modifying anything. Only
- * on rare cases it fall backs to the slow path: classify_counts() first, then
- * return has_new_bits(). */
-
-inline u8 has_new_bits_unclassified(afl_state_t *afl, u8 *virgin_map) {
+ * on rare cases it fall backs to the slow path: check_trace() classifies,
+ * compares and checksums the map, res->cksum is then the checksum of the
+ * classified trace. */
 
-  /* Handle the hot path first: no new coverage */
-  u8 *end = afl->fsrv.trace_bits + afl->fsrv.map_size;
+inline u8 has_new_bits_unclassified(afl_state_t *afl, u8 *virgin_map,
+                                    struct trace_check *res) {
 
-#ifdef WORD_SIZE_64
+  res->new_bits = 0;
+  res->cksum = 0;
 
-  if (!skim((u64 *)virgin_map, (u64 *)afl->fsrv.trace_bits, (u64 *)end))
-    return 0;
+  /* Handle the hot path first: no new coverage */
 
-#else
+  if (!skim_trace(afl, virgin_map)) { return 0; }
 
-  if (!skim((u32 *)virgin_map, (u32 *)afl->fsrv.trace_bits, (u32 *)end))
-    return 0;
+  /* Slow path: classify, compare and checksum in a single pass */
 
-#endif                                                     /* ^WORD_SIZE_64 */
-  classify_counts(&afl->fsrv);
-  return has_new_bits(afl, virgin_map);
+  check_trace(afl, virgin_map, TRACE_CLASSIFY | TRACE_HASH, res);
+  return res->new_bits;
 
 }
 
@@ -300,6 +456,75 @@ void minimize_bits(afl_state_t *afl, u8 *dst, u8 *src) {
 
 }
 
+/* Keep the edges of a trace for the favored entry logic, as sorted indices
+   or, for dense traces, as a bitmap. Big maps are mostly empty, so for them
+   the memory and the time to walk the edges go with the edges hit rather
+   than with the map size. */
+
+struct trace_mini *trace_mini_new(afl_state_t *afl, u8 *trace_bits) {
+
+  u64 *               src = (u64 *)trace_bits;
+  u32                 cnt = count_bytes(afl, trace_bits), i, j, *idx;
+  struct trace_mini *m;
+
+  if (cnt * sizeof(u32) >= afl->fsrv.map_size >> 3) {
+
+    m = ck_alloc(sizeof(struct trace_mini) + (afl->fsrv.map_size >> 3));
+    m->dense = 1;
+    minimize_bits(afl, m->data, trace_bits);
+
+  } else {
+
+    m = ck_alloc_nozero(sizeof(struct trace_mini) + cnt * sizeof(u32));
+    m->dense = 0;
+    idx = (u32 *)m->data;
+
+    for (cnt = 0, i = 0; i < afl->fsrv.map_size >> 3; ++i) {
+
+      if (likely(!src[i])) { continue; }
+
+      for (j = i << 3; j < (i + 1) << 3; ++j) {
+
+        if (trace_bits[j]) { idx[cnt++] = j; }
+
+      }
+
+    }
+
+  }
+
+  m->cnt = cnt;
+  return m;
+
+}
+
+/* The sorted edge indices of a trace_mini. Those of a bitmap are decoded
+   into a buffer that the next call reuses. */
+
+u32 *trace_mini_edges(afl_state_t *afl, struct trace_mini *m) {
+
+  u64 *bits = (u64 *)m->data, v;
+  u32 *idx, i, cnt = 0;
+
+  if (!m->dense) { return (u32 *)m->data; }
+
+  idx = afl_realloc(AFL_BUF_PARAM(mini_idx), m->cnt * sizeof(u32) + 1);
+  if (unlikely(!idx)) { PFATAL("alloc"); }
+
+  for (i = 0; i < afl->fsrv.map_size >> 6; ++i) {
+
+    for (v = bits[i]; v; v &= v - 1) {
+
+      idx[cnt++] = (i << 6) + __builtin_ctzll(v);
+
+    }
+
+  }
+
+  return idx;
+
+}
+
 #ifndef SIMPLE_FILES
 
 /* Construct a file name for a new test case, capturing the operation
@@ -465,6 +690,8 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
   u8  keeping = 0, res, classified = 0;
   u64 cksum = 0;
 
+  struct trace_check tc;
+
   u8 fn[PATH_MAX];
 
   /* Update path frequency. */
@@ -486,7 +713,7 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
     /* Keep only if there are new bits in the map, add to queue for
        future fuzzing, etc. */
 
-    new_bits = has_new_bits_unclassified(afl, afl->virgin_bits);
+    new_bits = has_new_bits_unclassified(afl, afl->virgin_bits, &tc);
 
     if (likely(!new_bits)) {
 
@@ -559,9 +786,8 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
 
     }
 
-    /* due to classify counts we have to recalculate the checksum */
-    cksum = afl->queue_top->exec_cksum =
-        hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+    /* the checksum of the classified trace, from has_new_bits_unclassified */
+    cksum = afl->queue_top->exec_cksum = tc.cksum;
 
     /* Try to calibrate inline; this also calls update_bitmap_score() when
        successful. */
@@ -599,16 +825,11 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
 
       if (likely(!afl->non_instrumented_mode)) {
 
-        if (!classified) {
-
-          classify_counts(&afl->fsrv);
-          classified = 1;
-
-        }
-
-        simplify_trace(afl, afl->fsrv.trace_bits);
+        check_trace(afl, afl->virgin_tmout,
+                    (classified ? 0 : TRACE_CLASSIFY) | TRACE_SIMPLIFY, &tc);
+        classified = 1;
 
-        if (!has_new_bits(afl, afl->virgin_tmout)) { return keeping; }
+        if (!tc.new_bits) { return keeping; }
 
       }
 
@@ -700,11 +921,10 @@ save_if_interesting(afl_state_t *afl, void *mem, u32 len, u8 fault) {
 
       if (likely(!afl->non_instrumented_mode)) {
 
-        if (!classified) { classify_counts(&afl->fsrv); }
-
-        simplify_trace(afl, afl->fsrv.trace_bits);
+        check_trace(afl, afl->virgin_crash,
+                    (classified ? 0 : TRACE_CLASSIFY) | TRACE_SIMPLIFY, &tc);
 
-        if (!has_new_bits(afl, afl->virgin_crash)) { return keeping; }
+        if (!tc.new_bits) { return keeping; }
 
       }
 
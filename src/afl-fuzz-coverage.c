@@ -0,0 +1,601 @@
+/*
+   american fuzzy lop++ - coverage map kernels
+   -------------------------------------------
+
+   Originally written by Michal Zalewski
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                        Heiko Eißfeldt <heiko.eissfeldt@hexco.de> and
+                        Andrea Fioraldi <andreafioraldi@gmail.com>
+
+   Copyright 2016, 2017 Google Inc. All rights reserved.
+   Copyright 2019-2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   The loops that run over the whole coverage map after every exec:
+   classification of hit counts, comparison against a virgin map and trace
+   simplification. On x86-64 there are AVX2 and AVX-512 versions next to
+   the generic one; setup_coverage_kernels() picks the best one the CPU
+   supports at startup, so a default build gets them too.
+
+ */
+
+#include "afl-fuzz.h"
+
+#if defined(WORD_SIZE_64) && defined(__x86_64__) && \
+    (defined(__GNUC__) || defined(__clang__))
+  #define COVERAGE_X86_KERNELS
+  #include <immintrin.h>
+#endif
+
+/* Destructively simplify trace by eliminating hit count information
+   and replacing it with 0x80 or 0x01 depending on whether the tuple
+   is hit or not. Called on every new crash or timeout, should be
+   reasonably fast. */
+#define TIMES4(x) x, x, x, x
+#define TIMES8(x) TIMES4(x), TIMES4(x)
+#define TIMES16(x) TIMES8(x), TIMES8(x)
+#define TIMES32(x) TIMES16(x), TIMES16(x)
+#define TIMES64(x) TIMES32(x), TIMES32(x)
+#define TIMES255(x)                                                      \
+  TIMES64(x), TIMES64(x), TIMES64(x), TIMES32(x), TIMES16(x), TIMES8(x), \
+      TIMES4(x), x, x, x
+const u8 simplify_lookup[256] = {
+
+    [0] = 1, [1] = TIMES255(128)
+
+};
+
+/* Destructively classify execution counts in a trace. This is used as a
+   preprocessing step for any newly acquired traces. Called on every exec,
+   must be fast. */
+
+const u8 count_class_lookup8[256] = {
+
+    [0] = 0,
+    [1] = 1,
+    [2] = 2,
+    [3] = 4,
+    [4] = TIMES4(8),
+    [8] = TIMES8(16),
+    [16] = TIMES16(32),
+    [32] = TIMES32(64),
+    [128] = TIMES64(128)
+
+};
+
+#undef TIMES255
+#undef TIMES64
+#undef TIMES32
+#undef TIMES16
+#undef TIMES8
+#undef TIMES4
+
+u16 count_class_lookup16[65536];
+
+void init_count_class16(void) {
+
+  u32 b1, b2;
+
+  for (b1 = 0; b1 < 256; b1++) {
+
+    for (b2 = 0; b2 < 256; b2++) {
+
+      count_class_lookup16[(b1 << 8) + b2] =
+          (count_class_lookup8[b1] << 8) | count_class_lookup8[b2];
+
+    }
+
+  }
+
+}
+
+#ifdef WORD_SIZE_64
+
+/* Generic kernels, one 64 bit word at a time */
+
+static inline u64 classify_word(u64 word) {
+
+  u16 mem16[4];
+  memcpy(mem16, &word, sizeof(mem16));
+
+  mem16[0] = count_class_lookup16[mem16[0]];
+  mem16[1] = count_class_lookup16[mem16[1]];
+  mem16[2] = count_class_lookup16[mem16[2]];
+  mem16[3] = count_class_lookup16[mem16[3]];
+
+  memcpy(&word, mem16, sizeof(mem16));
+  return word;
+
+}
+
+/* Updates the virgin bits, then reflects whether a new count or a new tuple is
+ * seen in ret. */
+static inline void discover_word(u8 *ret, u64 *current, u64 *virgin) {
+
+  /* Optimize for (*current & *virgin) == 0 - i.e., no bits in current bitmap
+     that have not been already cleared from the virgin map - since this will
+     almost always be the case. */
+
+  if (*current & *virgin) {
+
+    if (likely(*ret < 2)) {
+
+      u8 *cur = (u8 *)current;
+      u8 *vir = (u8 *)virgin;
+
+      /* Looks like we have not found any new bytes yet; see if any non-zero
+         bytes in current[] are pristine in virgin[]. */
+
+      if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
+          (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
+          (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
+          (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff))
+        *ret = 2;
+      else
+        *ret = 1;
+
+    }
+
+    *virgin &= ~*current;
+
+  }
+
+}
+
+static void classify_generic(u8 *bytes, u32 len) {
+
+  u64 *mem = (u64 *)bytes;
+  u32  i = len >> 3;
+
+  while (i--) {
+
+    /* Optimize for sparse bitmaps. */
+
+    if (unlikely(*mem)) { *mem = classify_word(*mem); }
+
+    mem++;
+
+  }
+
+}
+
+static void simplify_generic(u8 *bytes, u32 len) {
+
+  u64 *mem = (u64 *)bytes;
+  u32  i = len >> 3;
+
+  while (i--) {
+
+    /* Optimize for sparse bitmaps. */
+
+    if (unlikely(*mem)) {
+
+      u8 *mem8 = (u8 *)mem;
+
+      mem8[0] = simplify_lookup[mem8[0]];
+      mem8[1] = simplify_lookup[mem8[1]];
+      mem8[2] = simplify_lookup[mem8[2]];
+      mem8[3] = simplify_lookup[mem8[3]];
+      mem8[4] = simplify_lookup[mem8[4]];
+      mem8[5] = simplify_lookup[mem8[5]];
+      mem8[6] = simplify_lookup[mem8[6]];
+      mem8[7] = simplify_lookup[mem8[7]];
+
+    } else
+
+      *mem = 0x0101010101010101ULL;
+
+    mem++;
+
+  }
+
+}
+
+static u32 skim_generic(const u8 *virgin_map, const u8 *bytes, u32 len) {
+
+  const u64 *virgin = (const u64 *)virgin_map;
+  const u64 *current = (const u64 *)bytes;
+  const u64 *current_end = (const u64 *)(bytes + len);
+
+  for (; current < current_end; virgin += 4, current += 4) {
+
+    if (current[0] && classify_word(current[0]) & virgin[0]) return 1;
+    if (current[1] && classify_word(current[1]) & virgin[1]) return 1;
+    if (current[2] && classify_word(current[2]) & virgin[2]) return 1;
+    if (current[3] && classify_word(current[3]) & virgin[3]) return 1;
+
+  }
+
+  return 0;
+
+}
+
+static u8 discover_generic(u8 *bytes, u8 *virgin_map, u32 len) {
+
+  u64 *current = (u64 *)bytes;
+  u64 *virgin = (u64 *)virgin_map;
+  u32  i = len >> 3;
+  u8   ret = 0;
+
+  while (i--) {
+
+    if (unlikely(*current)) discover_word(&ret, current, virgin);
+
+    current++;
+    virgin++;
+
+  }
+
+  return ret;
+
+}
+
+static u8 classify_discover_generic(u8 *bytes, u8 *virgin_map, u32 len) {
+
+  u64 *current = (u64 *)bytes;
+  u64 *virgin = (u64 *)virgin_map;
+  u32  i = len >> 3;
+  u8   ret = 0;
+
+  while (i--) {
+
+    if (unlikely(*current)) {
+
+      *current = classify_word(*current);
+      discover_word(&ret, current, virgin);
+
+    }
+
+    current++;
+    virgin++;
+
+  }
+
+  return ret;
+
+}
+
+  #ifdef COVERAGE_X86_KERNELS
+
+/* Vector kernels. Hit counts are classified with two nibble lookups: the
+   bucket of a count below 16 only depends on its low nibble, that of any
+   other count only on its high nibble. CLASS_HI reproduces
+   count_class_lookup8[] exactly, including its zero entries for 64-127 and
+   192-255. */
+
+    #define CLASS_LO 0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16, 16, 16, 16, 16
+    #define CLASS_HI 0, 32, 64, 64, 0, 0, 0, 0, -128, -128, -128, -128, 0, 0, 0, 0
+
+    #define TARGET_AVX2 __attribute__((target("avx2")))
+
+TARGET_AVX2 static inline __m256i classify_avx2_vec(__m256i v) {
+
+  const __m256i lo_tab = _mm256_setr_epi8(CLASS_LO, CLASS_LO);
+  const __m256i hi_tab = _mm256_setr_epi8(CLASS_HI, CLASS_HI);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+  __m256i lo = _mm256_and_si256(v, nibble);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+  __m256i small = _mm256_cmpeq_epi8(hi, _mm256_setzero_si256());
+
+  return _mm256_or_si256(
+      _mm256_shuffle_epi8(hi_tab, hi),
+      _mm256_and_si256(small, _mm256_shuffle_epi8(lo_tab, lo)));
+
+}
+
+/* Updates one block of the virgin map with the classified block c, as
+   discover_word() does */
+
+TARGET_AVX2 static inline void discover_avx2_vec(u8 *ret, __m256i c,
+                                                 u8 *virgin) {
+
+  __m256i v = _mm256_loadu_si256((__m256i *)virgin);
+
+  if (likely(_mm256_testz_si256(c, v))) { return; }
+
+  if (likely(*ret < 2)) {
+
+    /* non-zero in c where virgin is still 0xff */
+    __m256i fresh =
+        _mm256_andnot_si256(_mm256_cmpeq_epi8(c, _mm256_setzero_si256()),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(-1)));
+    *ret = _mm256_testz_si256(fresh, fresh) ? 1 : 2;
+
+  }
+
+  _mm256_storeu_si256((__m256i *)virgin, _mm256_andnot_si256(c, v));
+
+}
+
+TARGET_AVX2 static void classify_avx2(u8 *bytes, u32 len) {
+
+  u32 i;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i *)(bytes + i));
+    if (_mm256_testz_si256(v, v)) { continue; }
+    _mm256_storeu_si256((__m256i *)(bytes + i), classify_avx2_vec(v));
+
+  }
+
+}
+
+TARGET_AVX2 static void simplify_avx2(u8 *bytes, u32 len) {
+
+  const __m256i hit = _mm256_set1_epi8(-128), none = _mm256_set1_epi8(1);
+  u32           i;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i *)(bytes + i));
+    __m256i zero = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+    _mm256_storeu_si256((__m256i *)(bytes + i),
+                        _mm256_blendv_epi8(hit, none, zero));
+
+  }
+
+}
+
+TARGET_AVX2 static u32 skim_avx2(const u8 *virgin, const u8 *bytes,
+                                 u32 len) {
+
+  u32 i;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i *)(bytes + i));
+    if (likely(_mm256_testz_si256(v, v))) { continue; }
+
+    if (!_mm256_testz_si256(classify_avx2_vec(v),
+                            _mm256_loadu_si256((__m256i *)(virgin + i)))) {
+
+      return 1;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+TARGET_AVX2 static u8 discover_avx2(u8 *bytes, u8 *virgin, u32 len) {
+
+  u32 i;
+  u8  ret = 0;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i c = _mm256_loadu_si256((__m256i *)(bytes + i));
+    if (likely(_mm256_testz_si256(c, c))) { continue; }
+    discover_avx2_vec(&ret, c, virgin + i);
+
+  }
+
+  return ret;
+
+}
+
+TARGET_AVX2 static u8 classify_discover_avx2(u8 *bytes, u8 *virgin,
+                                             u32 len) {
+
+  u32 i;
+  u8  ret = 0;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i *)(bytes + i));
+    if (likely(_mm256_testz_si256(v, v))) { continue; }
+
+    __m256i c = classify_avx2_vec(v);
+    _mm256_storeu_si256((__m256i *)(bytes + i), c);
+    discover_avx2_vec(&ret, c, virgin + i);
+
+  }
+
+  return ret;
+
+}
+
+    #define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+
+TARGET_AVX512 static inline __m512i classify_avx512_vec(__m512i v) {
+
+  const __m512i lo_tab =
+      _mm512_broadcast_i32x4(_mm_setr_epi8(CLASS_LO));
+  const __m512i hi_tab =
+      _mm512_broadcast_i32x4(_mm_setr_epi8(CLASS_HI));
+  const __m512i nibble = _mm512_set1_epi8(0x0f);
+
+  __m512i lo = _mm512_and_si512(v, nibble);
+  __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble);
+
+  return _mm512_or_si512(
+      _mm512_shuffle_epi8(hi_tab, hi),
+      _mm512_maskz_shuffle_epi8(_mm512_testn_epi8_mask(hi, hi), lo_tab, lo));
+
+}
+
+TARGET_AVX512 static inline void discover_avx512_vec(u8 *ret, __m512i c,
+                                                     u8 *virgin) {
+
+  __m512i v = _mm512_loadu_si512(virgin);
+
+  if (likely(!_mm512_test_epi64_mask(c, v))) { return; }
+
+  if (likely(*ret < 2)) {
+
+    /* non-zero in c where virgin is still 0xff */
+    __mmask64 fresh = _mm512_test_epi8_mask(c, c) &
+                      _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(-1));
+    *ret = fresh ? 2 : 1;
+
+  }
+
+  _mm512_storeu_si512(virgin, _mm512_andnot_si512(c, v));
+
+}
+
+TARGET_AVX512 static void classify_avx512(u8 *bytes, u32 len) {
+
+  u32 i;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i v = _mm512_loadu_si512(bytes + i);
+    if (!_mm512_test_epi64_mask(v, v)) { continue; }
+    _mm512_storeu_si512(bytes + i, classify_avx512_vec(v));
+
+  }
+
+}
+
+TARGET_AVX512 static void simplify_avx512(u8 *bytes, u32 len) {
+
+  const __m512i hit = _mm512_set1_epi8(-128), none = _mm512_set1_epi8(1);
+  u32           i;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i v = _mm512_loadu_si512(bytes + i);
+    _mm512_storeu_si512(
+        bytes + i, _mm512_mask_blend_epi8(_mm512_test_epi8_mask(v, v), none,
+                                          hit));
+
+  }
+
+}
+
+TARGET_AVX512 static u32 skim_avx512(const u8 *virgin, const u8 *bytes,
+                                     u32 len) {
+
+  u32 i;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i v = _mm512_loadu_si512(bytes + i);
+    if (likely(!_mm512_test_epi64_mask(v, v))) { continue; }
+
+    if (_mm512_test_epi64_mask(classify_avx512_vec(v),
+                               _mm512_loadu_si512(virgin + i))) {
+
+      return 1;
+
+    }
+
+  }
+
+  return 0;
+
+}
+
+TARGET_AVX512 static u8 discover_avx512(u8 *bytes, u8 *virgin, u32 len) {
+
+  u32 i;
+  u8  ret = 0;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i c = _mm512_loadu_si512(bytes + i);
+    if (likely(!_mm512_test_epi64_mask(c, c))) { continue; }
+    discover_avx512_vec(&ret, c, virgin + i);
+
+  }
+
+  return ret;
+
+}
+
+TARGET_AVX512 static u8 classify_discover_avx512(u8 *bytes, u8 *virgin,
+                                                 u32 len) {
+
+  u32 i;
+  u8  ret = 0;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i v = _mm512_loadu_si512(bytes + i);
+    if (likely(!_mm512_test_epi64_mask(v, v))) { continue; }
+
+    __m512i c = classify_avx512_vec(v);
+    _mm512_storeu_si512(bytes + i, c);
+    discover_avx512_vec(&ret, c, virgin + i);
+
+  }
+
+  return ret;
+
+}
+
+    #undef TARGET_AVX512
+    #undef TARGET_AVX2
+    #undef CLASS_HI
+    #undef CLASS_LO
+
+  #endif                                           /* COVERAGE_X86_KERNELS */
+
+const coverage_kernels_t coverage_kernels[] = {
+
+    {"generic", classify_generic, simplify_generic, skim_generic,
+     discover_generic, classify_discover_generic},
+  #ifdef COVERAGE_X86_KERNELS
+    {"avx2", classify_avx2, simplify_avx2, skim_avx2, discover_avx2,
+     classify_discover_avx2},
+    {"avx512", classify_avx512, simplify_avx512, skim_avx512,
+     discover_avx512, classify_discover_avx512},
+  #endif
+    {NULL, NULL, NULL, NULL, NULL, NULL}
+
+};
+
+const coverage_kernels_t *cov_kernels = &coverage_kernels[0];
+
+/* Can this CPU run the kernels? */
+
+u8 coverage_kernels_supported(const coverage_kernels_t *k) {
+
+  #ifdef COVERAGE_X86_KERNELS
+  if (!strcmp(k->name, "avx2")) { return !!__builtin_cpu_supports("avx2"); }
+  if (!strcmp(k->name, "avx512")) {
+
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+
+  }
+
+  #endif
+
+  return !strcmp(k->name, "generic");
+
+}
+
+#endif                                                     /* WORD_SIZE_64 */
+
+/* Pick the fastest coverage kernels the CPU supports. */
+
+void setup_coverage_kernels(void) {
+
+#ifdef WORD_SIZE_64
+
+  const coverage_kernels_t *k;
+
+  for (k = coverage_kernels; k->name; ++k) {
+
+    if (coverage_kernels_supported(k)) { cov_kernels = k; }
+
+  }
+
+  OKF("Using %s coverage map kernels.", cov_kernels->name);
+
+#endif
+
+}
+
@@ -316,6 +316,8 @@ u8 trim_case_custom(afl_state_t *afl, struct queue_entry *q, u8 *in_buf,
 
   u8 val_buf[STRINGIFY_VAL_SIZE_MAX];
 
+  struct trace_check tc;
+
   afl->stage_name = afl->stage_name_buf;
   afl->bytes_trim_in += q->len;
 
@@ -393,8 +395,8 @@ u8 trim_case_custom(afl_state_t *afl, struct queue_entry *q, u8 *in_buf,
 
       if (afl->stop_soon || fault == FSRV_RUN_ERROR) { goto abort_trimming; }
 
-      classify_counts(&afl->fsrv);
-      cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+      check_trace(afl, NULL, TRACE_CLASSIFY | TRACE_HASH, &tc);
+      cksum = tc.cksum;
 
     }
 
@@ -481,6 +483,7 @@ u8 trim_case_custom(afl_state_t *afl, struct queue_entry *q, u8 *in_buf,
     q->len = out_len;
 
     memcpy(afl->fsrv.trace_bits, afl->clean_trace_custom, afl->fsrv.map_size);
+    if (afl->fsrv.dirty_map) { afl->fsrv.dirty_map->valid = 0; }
     update_bitmap_score(afl, q);
 
   }
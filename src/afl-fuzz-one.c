@@ -28,1058 +28,712 @@
 #include <limits.h>
 #include "cmplog.h"
 
-#include <math.h>
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
+/* MOpt */
 
-static double kl(double p, double q) {
-  return p*log(p/q) + (1-p)*log((1-p)/(1-q));
-}
+static int select_algorithm(afl_state_t *afl, u32 max_algorithm) {
 
-static double dkl(double p, double q) {
-  return (q-p) / (q*(1-q));
-}
+  int i_puppet, j_puppet = 0, operator_number = max_algorithm;
 
-static double klucb_klucb(klucb_t* inst, normal_bandit_arm* arm) {
-  const double logndn = log(inst->time_step) / arm->num_selected;
-  const double p = MAX(arm->sample_mean, KLUCB_DELTA);
-  if (p >= 1) return 1;
+  double range_sele =
+      (double)afl->probability_now[afl->swarm_now][operator_number - 1];
+  double sele = ((double)(rand_below(afl, 10000) * 0.0001 * range_sele));
 
-  double q = p + KLUCB_DELTA;
-  for (int t=0; t < 25; ++t) {
-      const double f = logndn - kl(p, q);
-      const double df = -dkl(p, q);
-      if (f*f < KLUCB_EPS) break;
+  for (i_puppet = 0; i_puppet < operator_num; ++i_puppet) {
 
-      q -= f/df;
-      if (q < p + KLUCB_DELTA) q = p + KLUCB_DELTA;
-      if (q > 1 - KLUCB_DELTA) q = 1 - KLUCB_DELTA;
-  }
+    if (unlikely(i_puppet == 0)) {
 
-  return q;
-}
+      if (sele < afl->probability_now[afl->swarm_now][i_puppet]) { break; }
 
-double div_inf(double x, double y) {
-    if (y == 0.0 || y == -0.0)
-        return INFINITY;
-    return x / y;
-}
+    } else {
 
-void exppp_gap_estimate(exppp_t *self, double *Delta) {
-    double average_losses[EXP_MAX_N_ARMS];
-    double exploration_term[EXP_MAX_N_ARMS];
-    double UCB[EXP_MAX_N_ARMS];
-    double LCB[EXP_MAX_N_ARMS];
-
-    double min_UCB = INFINITY;
-    for (u64 i = 0; i < self->n_arms; i++) {
-        average_losses[i] = div_inf((double)self->unweighted_losses[i],
-                (double)self->pulls[i]);
-        exploration_term[i] = sqrt(div_inf(EXP_ALPHA * log(self->t) +
-                    log(self->n_arms),  2 * self->pulls[i]));
-        UCB[i] = MIN(1.0, average_losses[i] + exploration_term[i]);
-        LCB[i] = MAX(0.0, average_losses[i] - exploration_term[i]);
-        min_UCB = MIN(UCB[i], min_UCB);
-    }
-    for (u64 i = 0; i < self->n_arms; i++) {
-        Delta[i] = MAX(0.0, LCB[i] - min_UCB);
-        // if (self->t >= self->n_arms) {
-        // //printf("D[%d]: %lf\n", i, Delta[i]);
-        // //printf("LCB[%d]: %lf\n", i, LCB[i]);
-        // //printf("average_losses[%d]: %lf\n", i, average_losses[i]);
-        // //printf("exploration_term[%d]: %lf\n", i, exploration_term[i]);
-        //     assert(Delta[i] >= 0.0);
-        //     assert(Delta[i] <= 1.0);
-        // }
-    }
-}
+      if (sele < afl->probability_now[afl->swarm_now][i_puppet]) {
 
-double exppp_xi(exppp_t *self, u64 arm, double *gap_estimated) {
-    return div_inf(EXP_BETA * log(self->t), (self->t * (pow(gap_estimated[arm],
-                        2))));
-}
+        j_puppet = 1;
+        break;
 
-void exppp_epsilon(exppp_t *self, double epsilons[EXP_MAX_N_ARMS]) {
-    double gap_estimated[EXP_MAX_N_ARMS];
-    exppp_gap_estimate(self, gap_estimated);
-    for (u64 arm = 0; arm < self->n_arms; arm++) {
-        //printf("gap_estimated[%d]=%lf\n", arm, gap_estimated[arm]);
-        //printf("%d %lf %lf\n", self->t, pow(gap_estimated[arm], 2), exppp_xi(self, arm, gap_estimated));
+      }
 
-        epsilons[arm] = MIN(MIN(0.5 / self->n_arms, 0.5 * sqrt(log(self->n_arms) /
-                        self->t/ self->n_arms)), exppp_xi(self, arm, gap_estimated));
     }
-}
 
-double exppp_eta(exppp_t *self) {
-  return 0.5 * sqrt(log(self->n_arms) / (double)self->n_arms/ (double)(self->t+1));
-}
-
-void exppp_update_trusts(exppp_t *self) {
-  // double eta = exppp_eta(self);
-  // assert(0.0 <= eta && eta <= 1.0);
-  double sum_of_trusts = 0.0;
-
-  double epsilons[EXP_MAX_N_ARMS] = {};
-  exppp_epsilon(self, epsilons);
-  double sum_of_epsilons = 0.0;
-  for (u64 i = 0; i < self->n_arms; i++) {
-      sum_of_epsilons += epsilons[i];
   }
 
-  for (u64 i = 0; i < self->n_arms; i++) {
-    self->trusts[i] = ((1.0 - sum_of_epsilons) * self->weights[i]) +
-        epsilons[i];
+  if ((j_puppet == 1 &&
+       sele < afl->probability_now[afl->swarm_now][i_puppet - 1]) ||
+      (i_puppet + 1 < operator_num &&
+       sele > afl->probability_now[afl->swarm_now][i_puppet + 1])) {
 
-    sum_of_trusts += self->trusts[i];
-  }
-  // numpy's default tolerance
-  if (sum_of_trusts < 1e-08) {
-    for (u64 i = 0; i < self->n_arms; i++) {
-      self->trusts[i] = 1.0 / self->n_arms;
-    }
-    sum_of_trusts = 1.0;
-  }
-  for (u64 i = 0; i < self->n_arms; i++){
-    self->trusts[i] /= sum_of_trusts;
-  }
-}
+    FATAL("error select_algorithm");
 
-void exppp_add_reward(exppp_t* self, int arm, double reward) {
-  // assert(0.0 <= reward && reward <= 1.0);
-  self->total_rewards[arm] += (int)reward;
-  reward = (reward - EXP_LOWER) / EXP_AMPLITUDE;
-  double loss = 1.0 - reward;
-  self->unweighted_losses[arm] += loss;
-
-  loss = loss / self->trusts[arm];
-  self->losses[arm] += loss;
-
-  double sum_of_weights = 0.0;
-  double eta = exppp_eta(self);
-  double min_loss_eta = INFINITY;
-  for (u64 i = 0; i < self->n_arms; i++) {
-      min_loss_eta = MIN(min_loss_eta, -eta * self->losses[i]);
-  }
-  for (u64 i=0; i < self->n_arms; i++) {
-    self->weights[i] = exp(- eta * self->losses[i] -min_loss_eta);
-    sum_of_weights += self->weights[i];
-  }
-  for (u64 i=0; i < self->n_arms; i++) {
-    self->weights[i] /= sum_of_weights;
   }
-}
-
-u64 choice_from_distribution(afl_state_t *afl, exppp_t *self) {
-  double sum_of_possibility = 0.0;
-  double target = gsl_rng_uniform(afl->gsl_rng_state);
 
-  exppp_update_trusts(self);
+  return i_puppet;
 
-  for (u64 i = 0; i < self->n_arms; i++) {
-    sum_of_possibility += self->trusts[i];
-    if (target < sum_of_possibility) {
-      return i;
-    }
-  }
-  return self->n_arms - 1;
 }
 
-u64 exppp_select_arm(afl_state_t *afl, exppp_t* self, u8* mask) {
-  u64 choice;
-  self->t++;
-  if (self->t <= self->n_arms) {
-    choice = self->t - 1;
-  } else {
-    choice = choice_from_distribution(afl, self);
-  }
-  self->pulls[choice] += 1;
-  return choice;
-}
+/* Helper to choose random block len for block operations in fuzz_one().
+   Doesn't return zero, provided that max_len is > 0. */
 
-u64 expix_select_arm(afl_state_t *afl, expix_t* self, u8* mask) {
-  self->t++;
+static inline u32 choose_block_len(afl_state_t *afl, u32 limit) {
 
-  double sum_of_possibility = 0.0;
-  double target = gsl_rng_uniform(afl->gsl_rng_state);
+  u32 min_value, max_value;
+  u32 rlim = MIN(afl->queue_cycle, (u32)3);
 
-  for (u64 i = 0; i < self->n_arms; i++) {
-    sum_of_possibility += self->weights[i];
-    if (target < sum_of_possibility) {
-      self->pulls[i]++;
-      return i;
-    }
-  }
-  self->pulls[self->n_arms - 1]++;
-  return self->n_arms - 1;
-}
+  if (unlikely(!afl->run_over10m)) { rlim = 1; }
 
-void expix_add_reward(expix_t* self, int arm, double reward) {
-  self->total_rewards[arm] += (int)reward;
+  switch (rand_below(afl, rlim)) {
 
-  double eta = sqrt(2 * log(self->n_arms) / self->n_arms / self->t);
-  double gamma = eta/2;
+    case 0:
+      min_value = 1;
+      max_value = HAVOC_BLK_SMALL;
+      break;
 
-  double loss = 1.0 - reward;
-  loss = loss / (self->weights[arm] + gamma);
-  self->losses[arm] += loss;
+    case 1:
+      min_value = HAVOC_BLK_SMALL;
+      max_value = HAVOC_BLK_MEDIUM;
+      break;
 
-  double min_loss = INFINITY;
-  for (u64 i = 0; i < self->n_arms; i++) {
-      min_loss = MIN(min_loss, self->losses[i]);
-  }
+    default:
 
-  double denom = 0;
-  for (u64 i = 0; i < self->n_arms; i++) {
-      self->weights[i] = exp(-eta * (self->losses[i] - min_loss));
-      denom += self->weights[i];
-  }
+      if (likely(rand_below(afl, 10))) {
 
-  for (u64 i=0; i < self->n_arms; i++) {
-    self->weights[i] /= denom;
-  }
-}
+        min_value = HAVOC_BLK_MEDIUM;
+        max_value = HAVOC_BLK_LARGE;
 
-/* Adwin */
+      } else {
 
-void init_adwin(adwin_t *ret) {
-  ret->head = calloc(1, sizeof(adwin_node_t));
-  ret->tail = ret->head;
-}
+        min_value = HAVOC_BLK_LARGE;
+        max_value = HAVOC_BLK_XL;
 
-void dest_adwin(adwin_t* adwin) {
-  adwin_node_t* node;
-  for (node=adwin->head; node; ) {
-    adwin_node_t* nxt = node->next;
-    free(node);
-    node = nxt;
-  }
-}
+      }
 
-void adwin_remove_front_windows(adwin_node_t* node, int num) {
-  int i;
-  int lim = node->size - num;
-  for (i=0; i<lim; i++) {
-    node->sum[i] = node->sum[i+num];
   }
-  node->size -= num;
-}
 
-void adwin_add_tail_window(adwin_node_t* node, u64 s) {
-  node->sum[node->size++] = s;
+  if (min_value >= limit) { min_value = 1; }
+
+  return min_value + rand_below(afl, MIN(max_value, limit) - min_value + 1);
+
 }
 
-adwin_node_t* adwin_add_tail_node(adwin_t* adwin) {
-  adwin->last_node_idx++;
+/* Helper function to see if a particular change (xor_val = old ^ new) could
+   be a product of deterministic bit flips with the lengths and stepovers
+   attempted by afl-fuzz. This is used to avoid dupes in some of the
+   deterministic fuzzing operations that follow bit flips. We also
+   return 1 if xor_val is zero, which implies that the old and attempted new
+   values are identical and the exec would be a waste of time. */
 
-  adwin_node_t* new_tail = calloc(1, sizeof(adwin_node_t));
-  
-  adwin->tail->next = new_tail;
-  new_tail->prev = adwin->tail;
-  
-  adwin->tail = new_tail;
+static u8 could_be_bitflip(u32 xor_val) {
 
-  return adwin->tail;
-}
+  u32 sh = 0;
 
-void adwin_expire_last_window(adwin_t* adwin) {
-  adwin->W -= 1ull << adwin->last_node_idx;
-  adwin->sum -= adwin->tail->sum[0];
+  if (!xor_val) { return 1; }
 
-  adwin_remove_front_windows(adwin->tail, 1);
+  /* Shift left until first bit set. */
 
-  if (adwin->tail->size == 0 && adwin->tail != adwin->head) {
-    adwin_node_t* new_tail = adwin->tail->prev;
-    free(adwin->tail);
+  while (!(xor_val & 1)) {
 
-    new_tail->next = NULL;
-    adwin->tail = new_tail;
+    ++sh;
+    xor_val >>= 1;
 
-    adwin->last_node_idx--;
   }
-}
 
-void adwin_normlize_buckets(adwin_t* adwin) {
-  int exp;
-  adwin_node_t* node;
+  /* 1-, 2-, and 4-bit patterns are OK anywhere. */
 
-  for (exp=0, node=adwin->head; node; exp++, node=node->next) {
-    if (node->size <= ADWIN_M) break;
+  if (xor_val == 1 || xor_val == 3 || xor_val == 15) { return 1; }
 
-    adwin_node_t* next = node->next;
-    if (!next) {
-      next = adwin_add_tail_node(adwin);
-    }
-    
-    // The calculation of variation in the original adwin implementation seems wrong 
-    u64 s = node->sum[0] + node->sum[1];
-    adwin_add_tail_window(node->next, s);
+  /* 8-, 16-, and 32-bit patterns are OK only if shift factor is
+     divisible by 8, since that's the stepover for these ops. */
 
-    adwin_remove_front_windows(node, 2);
-  }
-}
+  if (sh & 7) { return 0; }
 
-inline u8 adwin_should_drop(u64 s0, u64 n0, u64 s1, u64 n1, double ddv2, double dd2_3) {
-  double u0 = s0 / (double)n0;
-  double u1 = s1 / (double)n1;
-  double du = u0 - u1;
+  if (xor_val == 0xff || xor_val == 0xffff || xor_val == 0xffffffff) {
 
-  double inv_m = 1.0 / (1 + n0 - ADWIN_MIN_ELEM_TO_CHECK) + 1.0 / (1 + n1 - ADWIN_MIN_ELEM_TO_CHECK);
-  double eps = sqrt(ddv2*inv_m) + dd2_3 * inv_m;
-  
-  if (fabs(du) > eps) return 1;
-  
-  return 0;
-}
+    return 1;
 
-void adwin_drop_last_till_identical(adwin_t* adwin) {
-  if (adwin->W < ADWIN_MIN_ELEM_TO_START_DROP) return;
-
-  while (1) {
-    bool dropped = false;
-
-    u64 n0 = 0;
-    u64 s0 = 0;
-    u64 n1 = adwin->W;
-    u64 s1 = adwin->sum;
-    int exp = adwin->last_node_idx;
-
-    double n = adwin->W;
-    double dd2 = log(2.0 * log(n) / ADWIN_DELTA) * 2;
-    double u = adwin->sum / n;
-    double ddv2 = u * (1-u) * dd2;
-    double dd2_3 = dd2 / 3.0;
-
-    adwin_node_t* node;
-    for (node=adwin->tail; node; node=node->prev) {
-      int k;
-      for (k=0; k < node->size; k++) {
-        n0 += 1ull << exp;
-        n1 -= 1ull << exp;
-        s0 += node->sum[k];
-        s1 -= node->sum[k];
-
-        if (n1 < ADWIN_MIN_ELEM_TO_CHECK) goto L_CHECK_END;
-        if (n0 < ADWIN_MIN_ELEM_TO_CHECK) continue;
-
-        if (adwin_should_drop(s0, n0, s1, n1, ddv2, dd2_3)) {
-
-#ifdef ADWIN_ADAPTIVE_RESETTING
-          dest_adwin(adwin);
-          memset(adwin, 0, sizeof(adwin_t));
-          init_adwin(adwin);
-#else
-          dropped = true;
-          adwin_expire_last_window(adwin);
-#endif
-          goto L_CHECK_END;
-        }
-      }
-      --exp;
-    }
+  }
 
-L_CHECK_END:
+  return 0;
 
-    if (!dropped) break;
-  }
 }
 
-void adwin_add_elem(adwin_t* adwin, u8 reward) {
-  adwin->W++;
-  adwin->sum += reward;
-  adwin_add_tail_window(adwin->head, reward);
-
-  adwin_normlize_buckets(adwin);
+/* Helper function to see if a particular value is reachable through
+   arithmetic operations. Used for similar purposes. */
 
-#if ADWIN_DROP_INTERVAL != 1
-  adwin->num_add++;
-  if (adwin->num_add != ADWIN_DROP_INTERVAL) return;
-  adwin->num_add = 0;
-#endif
+static u8 could_be_arith(u32 old_val, u32 new_val, u8 blen) {
 
-  adwin_drop_last_till_identical(adwin);
-}
+  u32 i, ov = 0, nv = 0, diffs = 0;
 
-double adwin_get_estimation(adwin_t* adwin) {
-  if (adwin->W > 0) return adwin->sum / (double)adwin->W;
-  return 0;
-}
+  if (old_val == new_val) { return 1; }
 
-inline void uniform_add_reward(uniform_t* inst, int idx, u8 r) {
-  uniform_bandit_arm *arm = &inst->arms[idx];
-  arm->num_selected++;
-  arm->total_rewards += r;
-}
+  /* See if one-byte adjustments to any byte could produce this result. */
 
-inline void ucb_add_reward(ucb_t* inst, int idx, u8 r) {
-  inst->time_step++;
+  for (i = 0; (u8)i < blen; ++i) {
 
-  normal_bandit_arm *arm = &inst->arms[idx];
+    u8 a = old_val >> (8 * i), b = new_val >> (8 * i);
 
-  arm->num_selected++;
-  arm->total_rewards += r;
-  arm->sample_mean = ((double)(arm->total_rewards))/(arm->num_selected);
-}
+    if (a != b) {
 
-inline void klucb_add_reward(klucb_t* inst, int idx, u8 r) {
-  inst->time_step++;
+      ++diffs;
+      ov = a;
+      nv = b;
 
-  normal_bandit_arm *arm = &inst->arms[idx];
+    }
 
-  arm->num_selected++;
-  arm->total_rewards += r;
-  arm->sample_mean = ((double)(arm->total_rewards))/(arm->num_selected);
-}
+  }
 
-inline void ts_add_reward(ts_t* inst, int idx, u8 r) {
-  normal_bandit_arm *arm = &inst->arms[idx];
+  /* If only one byte differs and the values are within range, return 1. */
 
-  arm->num_selected++;
-  arm->total_rewards += r;
-  arm->sample_mean = ((double)(arm->total_rewards))/(arm->num_selected);
-}
+  if (diffs == 1) {
 
-inline void adsts_add_reward(adsts_t* inst, int idx, u8 r) {
-  adwin_bandit_arm *arm = &inst->arms[idx];
+    if ((u8)(ov - nv) <= ARITH_MAX || (u8)(nv - ov) <= ARITH_MAX) { return 1; }
 
-  arm->num_selected++;
-  arm->total_rewards += r;
-  adwin_add_elem(&arm->adwin, r);
-}
+  }
 
-inline void dts_add_reward(dts_t* inst, int idx, u8 r) {
-  dts_bandit_arm *arm = &inst->arms[idx];
+  if (blen == 1) { return 0; }
 
-  arm->num_selected++;
-  arm->num_rewarded += r;
+  /* See if two-byte adjustments to any byte would produce this result. */
 
-  // already discounted in dts_select_arm
-  arm->total_rewards += r;
-  arm->total_losses  += 1 - r;
-}
+  diffs = 0;
 
-inline void dbe_add_reward(dbe_t* inst, int idx, u8 r) {
-  dbe_bandit_arm *arm = &inst->arms[idx];
+  for (i = 0; (u8)i < blen / 2; ++i) {
 
-  arm->num_selected++;
-  arm->num_rewarded += r;
+    u16 a = old_val >> (16 * i), b = new_val >> (16 * i);
 
-  // already discounted in dbe_select_arm
-  arm->total_rewards += r;
-  arm->dis_num_selected += 1;
-  // Note that, sample_mean of the other arms that are not selected, will remain the same
-  // since total_rewards' = total_rewards * gamma and dis_num_selected' = dis_num_selected * gamma,
-  // so total_rewards' / dis_num_selected' = total_rewards / dis_num_selected
-  arm->sample_mean = arm->total_rewards / arm->dis_num_selected;
-}
+    if (a != b) {
 
-inline u64 normal_num_selected(normal_bandit_arm* arm) {
-  return arm->num_selected;
-}
+      ++diffs;
+      ov = a;
+      nv = b;
 
-inline u64 normal_total_rewards(normal_bandit_arm* arm) {
-  return arm->total_rewards;
-}
+    }
 
-inline double normal_sample_mean(normal_bandit_arm* arm) {
-  return arm->sample_mean;
-}
+  }
 
-inline u64 adwin_num_selected(adwin_bandit_arm* arm) {
-  return arm->adwin.W;
-}
+  /* If only one word differs and the values are within range, return 1. */
 
-inline u64 adwin_total_rewards(adwin_bandit_arm* arm) {
-  return arm->adwin.sum;
-}
+  if (diffs == 1) {
 
-inline double adwin_sample_mean(adwin_bandit_arm* arm) {
-  return adwin_get_estimation(&arm->adwin);
-}
+    if ((u16)(ov - nv) <= ARITH_MAX || (u16)(nv - ov) <= ARITH_MAX) {
 
-/* Bandit */
+      return 1;
 
-int dts_select_arm(afl_state_t *afl, dts_t* inst, u8* mask) {
-  int i;
-  double max_sampled = -1;
-  int selected_idx = 0;
-  int n = inst->n_arms;
-  dts_bandit_arm *slots = inst->arms;
+    }
 
-  for (i = 0; i < n; i++) {
-    if (mask && mask[i]) continue;
+    ov = SWAP16(ov);
+    nv = SWAP16(nv);
 
-    double a = slots[i].total_rewards + 1;
-    double b = slots[i].total_losses  + 1;
-    double sampled = gsl_ran_beta(afl->gsl_rng_state, a, b);
+    if ((u16)(ov - nv) <= ARITH_MAX || (u16)(nv - ov) <= ARITH_MAX) {
 
-#ifdef OPTIMISTIC_DTS
-    // dOTS
-    double beta_mean = a/(a+b); 
-    if (sampled < beta_mean) sampled = beta_mean;
-#endif
+      return 1;
 
-    if (sampled > max_sampled) {
-      max_sampled = sampled;
-      selected_idx = i;
     }
-  }
 
-  for (i = 0; i < n; i++) {
-    // We need to discount rewards even if skipping the arm.
-    slots[i].total_rewards *= DTS_GAMMA;
-    slots[i].total_losses  *= DTS_GAMMA;
   }
 
-  return selected_idx;
-}
+  /* Finally, let's do the same thing for dwords. */
 
-int dbe_select_arm(afl_state_t *afl, dbe_t *inst, u8* mask) {
-  // We don't prepare SIVO's constants such as
-  // SAMPLE_RANDOMLY_UNTIL_ROUND, SAMPLE_RANDOMLY_THIS_ROUND, 
-  // SAMPLE_NOT_RANDOMLY, SAMPLE_RANDOMLY_THIS_ROUND_NO_UPDATE.
-  // the last 3 constants don't make sense because 
-  // bandit algorithms are designed to minimize regret from the beggining, 
-  // and ignoring it and using uniform distribution sometimes destroys
-  // its performance and theoretical guarantees.
-  // On the other hand, SAMPLE_RANDOMLY_UNTIL_ROUND may be legitimate, 
-  // since it can be considered as preparing more accurate prior distributions 
-  // than uniform distributions, and since that preprocess is commonly used 
-  // also in other algorithms like eps-greedy.
-  // However, recalling that this is a non-stationary setting, 
-  // and that initial samples will be forgot at some time, 
-  // the preprocess of drawing values from uniform distributions to obtain initial estimates 
-  // of expected rewards is not so meaningful.
-
-  int index = 0;
-  int n = inst->n_arms;
-  dbe_bandit_arm *slots = inst->arms;
-
-  double max_avg = 0;
-  double redcoef = 1.0;
-  int ACTIVE = 0;
-
-  for (int i=0; i<n; i++) {
-    if (mask && mask[i]) continue;
-
-    ACTIVE++;
-    // Lazily update sample_mean
-    if (slots[i].dis_num_selected > 0) {
-      if (max_avg < slots[i].sample_mean) max_avg = slots[i].sample_mean;
-    }
-  }
+  if (blen == 4) {
 
-  // i'm not sure what this heuristics means :(
-  if (max_avg > 0) redcoef = 1.0 / (2.0 * max_avg);
+    if ((u32)(old_val - new_val) <= ARITH_MAX ||
+        (u32)(new_val - old_val) <= ARITH_MAX) {
 
-  // maybe this is working as a kind of adaptive resetting bandit(?)
-  // if so, this is not a pure discounting algorithm...
-  if (redcoef > 1 << 30) {
-    for (int i=0; i<n; i++) {
-      slots[i].total_rewards = 1.0;
-      slots[i].dis_num_selected = 1.0;
-      slots[i].sample_mean = 1.0;
-    }
-  }
+      return 1;
 
-  int *indices = malloc(n * sizeof(int));
-  int num_indices = 0;
-  // pick index if not sampled 
-  for (int i=0; i<n; i++) {
-    if (mask && mask[i]) continue;
-    if (slots[i].dis_num_selected <= 0) {
-      indices[num_indices++] = i;
     }
-  }
-  if (num_indices > 0) {
-    // probably just returning 0 is the same...(it's a negligible difference)
-    return indices[rand_below(afl, num_indices)];
-  }
 
-  double *w = calloc(n, sizeof(double));
-  double cur, beta;
-  for (int i=0; i<n; i++) {
-    if (mask && mask[i]) continue; // due to calloc, w[i] = 0, so no problem
+    new_val = SWAP32(new_val);
+    old_val = SWAP32(old_val);
 
-    beta = 4 + 2 * ACTIVE;
+    if ((u32)(old_val - new_val) <= ARITH_MAX ||
+        (u32)(new_val - old_val) <= ARITH_MAX) {
 
-    // Our bandit problems are not small bandit problem like 2 arms
-    /*if( x[i].allow_small > 0 )
-      beta = x[i].allow_small;*/
- 
-    cur = beta * (redcoef * slots[i].sample_mean);
-    // Follow SIVO. Though I'm not sure about other heuristics,
-    // this is valid since 2^x = e^(x*log_e(2))
-    w[i] = pow(2, cur);
-  }
+      return 1;
 
-  gsl_ran_discrete_t *lookup = gsl_ran_discrete_preproc(n, w);
-  index = gsl_ran_discrete(afl->gsl_rng_state, lookup);
-  gsl_ran_discrete_free(lookup);
+    }
 
-  for (int i = 0; i < n; i++) {
-    // We need to discount rewards even if skipping the arm.
-    slots[i].total_rewards *= DBE_GAMMA;
-    slots[i].dis_num_selected  *= DBE_GAMMA;
   }
 
-  return index;
+  return 0;
+
 }
 
-int uniform_select_arm(afl_state_t *afl, ucb_t *inst, u8* mask) {
-  int i;
-  int n = inst->n_arms;
+/* Last but not least, a similar helper to see if insertion of an
+   interesting integer is redundant given the insertions done for
+   shorter blen. The last param (check_le) is set if the caller
+   already executed LE insertion for current blen and wants to see
+   if BE variant passed in new_val is unique. */
 
-  int cnt = 0;
-  for (i = 0; i < n; i++) {
-    if (mask && mask[i]) continue;
-    cnt++;
-  }
+static u8 could_be_interest(u32 old_val, u32 new_val, u8 blen, u8 check_le) {
 
-  int k = rand_below(afl, cnt);
-  for (i = 0; i < n; i++) {
-    if (mask && mask[i]) continue;
-    if (!k) return i;
-    --k;
-  }
+  u32 i, j;
 
-  assert(0);
-}
+  if (old_val == new_val) { return 1; }
 
-int ucb_select_arm(afl_state_t *afl, ucb_t *inst, u8* mask) {
-  int i;
-  double max_ucb = -1;
-  int selected_idx;
-  int n = inst->n_arms;
-  normal_bandit_arm *slots = inst->arms;
+  /* See if one-byte insertions from interesting_8 over old_val could
+     produce new_val. */
 
-  for (i = 0; i < n; i++) {
-    if (mask && mask[i]) continue;
+  for (i = 0; i < blen; ++i) {
 
-    if (normal_num_selected(&slots[i]) == 0) {
-      selected_idx = i;
-      break;
-    }
+    for (j = 0; j < sizeof(interesting_8); ++j) {
 
-    double ucb = normal_sample_mean(&slots[i])
-              + sqrt(2 * log(inst->time_step) / normal_num_selected(&slots[i]));
-    if (ucb > max_ucb) {
-      max_ucb = ucb;
-      selected_idx = i;
-    }
-  }
+      u32 tval =
+          (old_val & ~(0xff << (i * 8))) | (((u8)interesting_8[j]) << (i * 8));
 
-  return selected_idx;
-}
+      if (new_val == tval) { return 1; }
 
-int klucb_select_arm(afl_state_t *afl, klucb_t *inst, u8* mask) {
-  int i;
-  double max_ucb = -1;
-  int selected_idx;
-  int n = inst->n_arms;
-  normal_bandit_arm *slots = inst->arms;
+    }
 
-  for (i = 0; i < n; i++) {
-    if (mask && mask[i]) continue;
+  }
 
-    if (normal_num_selected(&slots[i]) == 0) {
-      selected_idx = i;
-      break;
-    }
+  /* Bail out unless we're also asked to examine two-byte LE insertions
+     as a preparation for BE attempts. */
 
+  if (blen == 2 && !check_le) { return 0; }
 
-    double ucb = klucb_klucb(inst, &slots[i]);
-    if (ucb > max_ucb) {
-      max_ucb = ucb;
-      selected_idx = i;
-    }
-  }
+  /* See if two-byte insertions over old_val could give us new_val. */
 
-  return selected_idx;
-}
+  for (i = 0; (u8)i < blen - 1; ++i) {
 
-int ts_select_arm(afl_state_t *afl, ts_t* inst, u8* mask) {
-  int i;
-  int n = inst->n_arms;
-  normal_bandit_arm *slots = inst->arms;
+    for (j = 0; j < sizeof(interesting_16) / 2; ++j) {
 
-  double max_sampled = -1;
-  int selected_idx = 0;
+      u32 tval = (old_val & ~(0xffff << (i * 8))) |
+                 (((u16)interesting_16[j]) << (i * 8));
 
-  for (i = 0; i < n; i++) {
-    if (mask && mask[i]) continue;
+      if (new_val == tval) { return 1; }
 
-    u64 total_rewards = normal_total_rewards(&slots[i]);
-    u64 a = total_rewards + 1;
-    u64 b = normal_num_selected(&slots[i]) - total_rewards + 1;
-    double sampled = gsl_ran_beta(afl->gsl_rng_state, (double)a, (double)b);
-    if (sampled > max_sampled) {
-      max_sampled = sampled;
-      selected_idx = i;
-    }
-  }
+      /* Continue here only if blen > 2. */
 
-  return selected_idx;
-}
+      if (blen > 2) {
 
-int adsts_select_arm(afl_state_t *afl, adsts_t* inst, u8* mask) {
-  int i;
-  int n = inst->n_arms;
-  adwin_bandit_arm *slots = inst->arms;
+        tval = (old_val & ~(0xffff << (i * 8))) |
+               (SWAP16(interesting_16[j]) << (i * 8));
 
-  double max_sampled = -1;
-  int selected_idx = 0;
+        if (new_val == tval) { return 1; }
 
-  for (i = 0; i < n; i++) {
-    if (mask && mask[i]) continue;
+      }
 
-    u64 total_rewards = adwin_total_rewards(&slots[i]);
-    u64 a = total_rewards + 1;
-    u64 b = adwin_num_selected(&slots[i]) - total_rewards + 1;
-    double sampled = gsl_ran_beta(afl->gsl_rng_state, (double)a, (double)b);
-    if (sampled > max_sampled) {
-      max_sampled = sampled;
-      selected_idx = i;
     }
+
   }
 
-  return selected_idx;
-}
+  if (blen == 4 && check_le) {
 
-/* MOpt */
+    /* See if four-byte insertions could produce the same result
+       (LE only). */
 
-static int select_algorithm(afl_state_t *afl, u32 max_algorithm) {
+    for (j = 0; j < sizeof(interesting_32) / 4; ++j) {
 
-  int i_puppet, j_puppet = 0, operator_number = max_algorithm;
+      if (new_val == (u32)interesting_32[j]) { return 1; }
 
-  double range_sele =
-      (double)afl->probability_now[afl->swarm_now][operator_number - 1];
-  double sele = ((double)(rand_below(afl, 10000) * 0.0001 * range_sele));
+    }
 
-  for (i_puppet = 0; i_puppet < operator_num; ++i_puppet) {
+  }
 
-    if (unlikely(i_puppet == 0)) {
+  return 0;
 
-      if (sele < afl->probability_now[afl->swarm_now][i_puppet]) { break; }
+}
 
-    } else {
+#ifndef IGNORE_FINDS
 
-      if (sele < afl->probability_now[afl->swarm_now][i_puppet]) {
+/* Helper function to compare buffers; returns first and last differing offset.
+   We use this to find reasonable locations for splicing two files. */
 
-        j_puppet = 1;
-        break;
+static void locate_diffs(u8 *ptr1, u8 *ptr2, u32 len, s32 *first, s32 *last) {
 
-      }
+  s32 f_loc = -1;
+  s32 l_loc = -1;
+  u32 pos;
 
-    }
+  for (pos = 0; pos < len; ++pos) {
 
-  }
+    if (*(ptr1++) != *(ptr2++)) {
 
-  if ((j_puppet == 1 &&
-       sele < afl->probability_now[afl->swarm_now][i_puppet - 1]) ||
-      (i_puppet + 1 < operator_num &&
-       sele > afl->probability_now[afl->swarm_now][i_puppet + 1])) {
+      if (f_loc == -1) { f_loc = pos; }
+      l_loc = pos;
 
-    FATAL("error select_algorithm");
+    }
 
   }
 
-  return i_puppet;
+  *first = f_loc;
+  *last = l_loc;
+
+  return;
 
 }
 
-/* Helper to choose random block len for block operations in fuzz_one().
-   Doesn't return zero, provided that max_len is > 0. */
+#endif                                                     /* !IGNORE_FINDS */
 
-static inline u32 choose_block_len(afl_state_t *afl, u32 limit) {
+/* Credit the bandits that chose a havoc mutant with its outcome. */
 
-  u32 min_value, max_value;
-  u32 rlim = MIN(afl->queue_cycle, (u32)3);
+static inline void havoc_credit(afl_state_t *afl, struct havoc_batch_entry *e,
+                                bandit_t *mut_bandit,
+                                seed_bandit_arm_t *seed_arms, u8 r) {
 
-  if (unlikely(!afl->run_over10m)) { rlim = 1; }
+#ifdef BATCHSIZE_BANDIT
+  bandit_add_reward(e->batch_bandit, e->selected_t, r);
+#endif
 
-  switch (rand_below(afl, rlim)) {
+#if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
+  if (seed_arms) {
 
-    case 0:
-      min_value = 1;
-      max_value = HAVOC_BLK_SMALL;
-      break;
+    seed_bandit_add_reward(&afl->seed_bandit, seed_arms, e->selected_case, r);
 
-    case 1:
-      min_value = HAVOC_BLK_SMALL;
-      max_value = HAVOC_BLK_MEDIUM;
-      break;
+  } else {
 
-    default:
+    bandit_add_reward(mut_bandit, e->selected_case, r);
 
-      if (likely(rand_below(afl, 10))) {
+  }
 
-        min_value = HAVOC_BLK_MEDIUM;
-        max_value = HAVOC_BLK_LARGE;
+#endif
 
-      } else {
+  (void)afl;
+  (void)e;
+  (void)mut_bandit;
+  (void)seed_arms;
+  (void)r;
 
-        min_value = HAVOC_BLK_LARGE;
-        max_value = HAVOC_BLK_XL;
+}
 
-      }
+/* AFL_SHMEM_INPLACE: the buffer for a havoc mutant of up to size bytes.
+   With in_shm, that is the shared memory testcase the target reads, which
+   has room for MAX_FILE bytes, so write_to_testcase() has nothing to copy. */
 
-  }
+static inline u8 *havoc_out_buf(afl_state_t *afl, u8 in_shm, u32 size) {
 
-  if (min_value >= limit) { min_value = 1; }
+  if (in_shm && size <= MAX_FILE) { return afl->fsrv.shmem_fuzz; }
 
-  return min_value + rand_below(afl, MIN(max_value, limit) - min_value + 1);
+  u8 *out_buf = afl_realloc(AFL_BUF_PARAM(out), size);
+  if (unlikely(!out_buf)) { PFATAL("alloc"); }
+  return out_buf;
 
 }
 
-/* Helper function to see if a particular change (xor_val = old ^ new) could
-   be a product of deterministic bit flips with the lengths and stepovers
-   attempted by afl-fuzz. This is used to avoid dupes in some of the
-   deterministic fuzzing operations that follow bit flips. We also
-   return 1 if xor_val is zero, which implies that the old and attempted new
-   values are identical and the exec would be a waste of time. */
+/* Open a gap of gap_len bytes at pos of the temp_len byte havoc mutant, in
+   place. Returns the (possibly reallocated) out_buf. */
 
-static u8 could_be_bitflip(u32 xor_val) {
+static inline u8 *havoc_open_gap(afl_state_t *afl, u8 *out_buf, u32 temp_len,
+                                 u32 pos, u32 gap_len) {
 
-  u32 sh = 0;
+  out_buf = havoc_out_buf(afl, out_buf == afl->fsrv.shmem_fuzz,
+                          temp_len + gap_len);
+  memmove(out_buf + pos + gap_len, out_buf + pos, temp_len - pos);
+  return out_buf;
 
-  if (!xor_val) { return 1; }
+}
 
-  /* Shift left until first bit set. */
+/* Undo journal of a havoc iteration. Every stacked operator logs how to
+   revert it, so that out_buf can be restored by replaying the log backwards
+   instead of copying all of in_buf back. The cost of the log is counted in
+   bytes moved; once it exceeds the budget (the memcpy of in_buf), logging
+   stops and the iteration ends with the memcpy. */
 
-  while (!(xor_val & 1)) {
+enum { HAVOC_UNDO_BYTES, HAVOC_UNDO_INSERT, HAVOC_UNDO_DELETE };
 
-    ++sh;
-    xor_val >>= 1;
+struct havoc_undo_op {
 
-  }
+  u32 pos, len;                         /* Range of the operator            */
+  u32 saved;                            /* Offset of the old bytes in log   */
+  u8  type;                             /* HAVOC_UNDO_*                     */
 
-  /* 1-, 2-, and 4-bit patterns are OK anywhere. */
+};
 
-  if (xor_val == 1 || xor_val == 3 || xor_val == 15) { return 1; }
+struct havoc_undo_log {
 
-  /* 8-, 16-, and 32-bit patterns are OK only if shift factor is
-     divisible by 8, since that's the stepover for these ops. */
+  struct havoc_undo_op op[HAVOC_UNDO_MAX];
+  u8 *                 saved_buf;       /* Old bytes, budget / 2 at most    */
+  u32                  cnt, saved_len, cost, budget;
 
-  if (sh & 7) { return 0; }
+};
 
-  if (xor_val == 0xff || xor_val == 0xffff || xor_val == 0xffffffff) {
+static inline void havoc_undo_reset(struct havoc_undo_log *log) {
 
-    return 1;
+  log->cnt = log->saved_len = log->cost = 0;
 
-  }
+}
 
-  return 0;
+/* Something we cannot log touched out_buf, restore it with a memcpy. */
+
+static inline void havoc_undo_giveup(struct havoc_undo_log *log) {
+
+  log->cost = log->budget + 1;
 
 }
 
-/* Helper function to see if a particular value is reachable through
-   arithmetic operations. Used for similar purposes. */
+static inline struct havoc_undo_op *havoc_undo_add(struct havoc_undo_log *log,
+                                                   u8 type, u32 pos, u32 len,
+                                                   u32 cost) {
 
-static u8 could_be_arith(u32 old_val, u32 new_val, u8 blen) {
+  struct havoc_undo_op *op;
 
-  u32 i, ov = 0, nv = 0, diffs = 0;
+  if (log->cost > log->budget) { return NULL; }
+
+  log->cost += HAVOC_UNDO_OP_COST + cost;
+  if (unlikely(log->cost > log->budget || log->cnt == HAVOC_UNDO_MAX)) {
+
+    havoc_undo_giveup(log);
+    return NULL;
+
+  }
 
-  if (old_val == new_val) { return 1; }
+  op = &log->op[log->cnt++];
+  op->type = type;
+  op->pos = pos;
+  op->len = len;
+  return op;
 
-  /* See if one-byte adjustments to any byte could produce this result. */
+}
 
-  for (i = 0; (u8)i < blen; ++i) {
+/* buf[pos, pos + len) is about to be overwritten. */
 
-    u8 a = old_val >> (8 * i), b = new_val >> (8 * i);
+static inline void havoc_undo_save(struct havoc_undo_log *log, u8 *buf,
+                                   u32 pos, u32 len) {
 
-    if (a != b) {
+  struct havoc_undo_op *op =
+      havoc_undo_add(log, HAVOC_UNDO_BYTES, pos, len, len << 1);
 
-      ++diffs;
-      ov = a;
-      nv = b;
+  if (op) {
 
-    }
+    op->saved = log->saved_len;
+    memcpy(log->saved_buf + log->saved_len, buf + pos, len);
+    log->saved_len += len;
 
   }
 
-  /* If only one byte differs and the values are within range, return 1. */
+}
 
-  if (diffs == 1) {
+/* len bytes are about to be inserted at pos, tail bytes follow them. */
 
-    if ((u8)(ov - nv) <= ARITH_MAX || (u8)(nv - ov) <= ARITH_MAX) { return 1; }
+static inline void havoc_undo_insert(struct havoc_undo_log *log, u32 pos,
+                                     u32 len, u32 tail) {
 
-  }
+  havoc_undo_add(log, HAVOC_UNDO_INSERT, pos, len, tail);
 
-  if (blen == 1) { return 0; }
+}
 
-  /* See if two-byte adjustments to any byte would produce this result. */
+/* buf[pos, pos + len) is about to be deleted, tail bytes follow it. */
 
-  diffs = 0;
+static inline void havoc_undo_delete(struct havoc_undo_log *log, u8 *buf,
+                                     u32 pos, u32 len, u32 tail) {
 
-  for (i = 0; (u8)i < blen / 2; ++i) {
+  struct havoc_undo_op *op =
+      havoc_undo_add(log, HAVOC_UNDO_DELETE, pos, len, (len << 1) + tail);
 
-    u16 a = old_val >> (16 * i), b = new_val >> (16 * i);
+  if (op) {
 
-    if (a != b) {
+    op->saved = log->saved_len;
+    memcpy(log->saved_buf + log->saved_len, buf + pos, len);
+    log->saved_len += len;
 
-      ++diffs;
-      ov = a;
-      nv = b;
+  }
 
-    }
+}
 
-  }
+/* Revert the logged operators on buf. Returns 0 if the log was given up,
+   then buf has to be restored from in_buf. */
 
-  /* If only one word differs and the values are within range, return 1. */
+static inline u8 havoc_undo_replay(struct havoc_undo_log *log, u8 *buf,
+                                   u32 *temp_len) {
 
-  if (diffs == 1) {
+  if (log->cost > log->budget) { return 0; }
 
-    if ((u16)(ov - nv) <= ARITH_MAX || (u16)(nv - ov) <= ARITH_MAX) {
+  while (log->cnt) {
 
-      return 1;
+    struct havoc_undo_op *op = &log->op[--log->cnt];
 
-    }
+    switch (op->type) {
 
-    ov = SWAP16(ov);
-    nv = SWAP16(nv);
+      case HAVOC_UNDO_BYTES:
+        memcpy(buf + op->pos, log->saved_buf + op->saved, op->len);
+        break;
 
-    if ((u16)(ov - nv) <= ARITH_MAX || (u16)(nv - ov) <= ARITH_MAX) {
+      case HAVOC_UNDO_INSERT:
+        memmove(buf + op->pos, buf + op->pos + op->len,
+                *temp_len - op->pos - op->len);
+        *temp_len -= op->len;
+        break;
 
-      return 1;
+      case HAVOC_UNDO_DELETE:
+        memmove(buf + op->pos + op->len, buf + op->pos, *temp_len - op->pos);
+        memcpy(buf + op->pos, log->saved_buf + op->saved, op->len);
+        *temp_len += op->len;
+        break;
 
     }
 
   }
 
-  /* Finally, let's do the same thing for dwords. */
+  return 1;
 
-  if (blen == 4) {
+}
 
-    if ((u32)(old_val - new_val) <= ARITH_MAX ||
-        (u32)(new_val - old_val) <= ARITH_MAX) {
+/* AFL_HAVOC_BATCH: append a havoc mutant and the decisions that produced it
+   to the batch arena. */
 
-      return 1;
+static void havoc_batch_add(afl_state_t *afl, u8 *buf, u32 len,
+                            bandit_t *batch_bandit, s32 selected_case,
+                            s32 selected_t) {
 
-    }
+  struct havoc_batch_entry *e = &afl->havoc_batch[afl->havoc_batch_cnt];
+  u32 off = afl->havoc_batch_cnt ? e[-1].off + e[-1].len : 0;
 
-    new_val = SWAP32(new_val);
-    old_val = SWAP32(old_val);
+  u8 *arena = afl_realloc(AFL_BUF_PARAM(havoc_batch), off + len);
+  if (unlikely(!arena)) { PFATAL("alloc"); }
+  memcpy(arena + off, buf, len);
 
-    if ((u32)(old_val - new_val) <= ARITH_MAX ||
-        (u32)(new_val - old_val) <= ARITH_MAX) {
+  e->off = off;
+  e->len = len;
+  e->selected_case = selected_case;
+  e->selected_t = selected_t;
+  e->batch_bandit = batch_bandit;
+  e->reward = 0;
+  e->ran = 0;
+  ++afl->havoc_batch_cnt;
 
-      return 1;
+}
 
-    }
+/* AFL_HAVOC_BATCH: note the outcome of a processed batch mutant. */
 
-  }
+static inline void havoc_batch_done(afl_state_t *afl,
+                                    struct havoc_batch_entry *e,
+                                    u64 *havoc_queued, u32 *finds) {
 
-  return 0;
+  e->ran = 1;
+
+  if (afl->queued_paths != *havoc_queued) {
+
+    e->reward = 1;
+    *havoc_queued = afl->queued_paths;
+    ++*finds;
+
+  }
 
 }
 
-/* Last but not least, a similar helper to see if insertion of an
-   interesting integer is redundant given the insertions done for
-   shorter blen. The last param (check_le) is set if the caller
-   already executed LE insertion for current blen and wants to see
-   if BE variant passed in new_val is unique. */
+/* AFL_FSRV_POOL: run the mutants of the batch on the fork server pool, and
+   process them in the order they finish. Returns 1 if the entry should be
+   abandoned. */
 
-static u8 could_be_interest(u32 old_val, u32 new_val, u8 blen, u8 check_le) {
+static u8 havoc_batch_run_pool(afl_state_t *afl, u32 cnt, u64 *havoc_queued,
+                               u32 *finds) {
 
-  u32 i, j;
+  struct havoc_batch_entry *e = afl->havoc_batch;
+  u32                       next = 0;
+  s32                       i;
+  u8                        fault, abandon = 0;
 
-  if (old_val == new_val) { return 1; }
+  while ((!abandon && next < cnt) || afl->fsrv_pool_busy) {
 
-  /* See if one-byte insertions from interesting_8 over old_val could
-     produce new_val. */
+    while (!abandon && next < cnt &&
+           fsrv_pool_submit(afl, afl->havoc_batch_buf + e[next].off,
+                            e[next].len, next) >= 0) {
 
-  for (i = 0; i < blen; ++i) {
+      ++next;
 
-    for (j = 0; j < sizeof(interesting_8); ++j) {
+    }
 
-      u32 tval =
-          (old_val & ~(0xff << (i * 8))) | (((u8)interesting_8[j]) << (i * 8));
+    if ((i = fsrv_pool_collect(afl, &fault)) < 0) { return 1; }
 
-      if (new_val == tval) { return 1; }
+    /* runs still in flight when the entry got abandoned are dropped */
+    if (abandon) { continue; }
+
+    if (common_fuzz_result(afl, afl->havoc_batch_buf + e[i].off, e[i].len,
+                           fault)) {
+
+      e[i].ran = 1;
+      abandon = 1;
+      continue;
 
     }
 
+    havoc_batch_done(afl, &e[i], havoc_queued, finds);
+
   }
 
-  /* Bail out unless we're also asked to examine two-byte LE insertions
-     as a preparation for BE attempts. */
+  return abandon;
 
-  if (blen == 2 && !check_le) { return 0; }
+}
 
-  /* See if two-byte insertions over old_val could give us new_val. */
+/* AFL_HAVOC_BATCH: run the mutants of the batch back to back, then credit
+   the bandits in one pass. Returns 1 if the entry should be abandoned. */
 
-  for (i = 0; (u8)i < blen - 1; ++i) {
+static u8 havoc_batch_flush(afl_state_t *afl, bandit_t *mut_bandit,
+                            seed_bandit_arm_t *seed_arms, u64 *havoc_queued,
+                            u32 *perf_score) {
 
-    for (j = 0; j < sizeof(interesting_16) / 2; ++j) {
+  struct havoc_batch_entry *e = afl->havoc_batch;
+  u32 i, cnt = afl->havoc_batch_cnt, finds = 0;
+  u8  abandon = 0;
 
-      u32 tval = (old_val & ~(0xffff << (i * 8))) |
-                 (((u16)interesting_16[j]) << (i * 8));
+  afl->havoc_batch_cnt = 0;
 
-      if (new_val == tval) { return 1; }
+  if (afl->fsrv_pool_cnt) {
 
-      /* Continue here only if blen > 2. */
+    abandon = havoc_batch_run_pool(afl, cnt, havoc_queued, &finds);
 
-      if (blen > 2) {
+  } else {
 
-        tval = (old_val & ~(0xffff << (i * 8))) |
-               (SWAP16(interesting_16[j]) << (i * 8));
+    for (i = 0; i < cnt; ++i) {
 
-        if (new_val == tval) { return 1; }
+      if (common_fuzz_stuff(afl, afl->havoc_batch_buf + e[i].off, e[i].len)) {
+
+        e[i].ran = 1;
+        abandon = 1;
+        break;
 
       }
 
+      havoc_batch_done(afl, &e[i], havoc_queued, &finds);
+
     }
 
   }
 
-  if (blen == 4 && check_le) {
-
-    /* See if four-byte insertions could produce the same result
-       (LE only). */
+  /* mutants that never ran, or ran after an abandoned one, get no credit */
+  for (i = 0; i < cnt; ++i) {
 
-    for (j = 0; j < sizeof(interesting_32) / 4; ++j) {
+    if (e[i].ran) {
 
-      if (new_val == (u32)interesting_32[j]) { return 1; }
+      havoc_credit(afl, &e[i], mut_bandit, seed_arms, e[i].reward);
 
     }
 
   }
 
-  return 0;
+  if (abandon) { return 1; }
 
-}
+  /* If we're finding new stuff, let's run for a bit longer, limits
+     permitting. */
 
-#ifndef IGNORE_FINDS
+  while (finds--) {
 
-/* Helper function to compare buffers; returns first and last differing offset.
-   We use this to find reasonable locations for splicing two files. */
+    if (*perf_score <= afl->havoc_max_mult * 100) {
 
-static void locate_diffs(u8 *ptr1, u8 *ptr2, u32 len, s32 *first, s32 *last) {
+      afl->stage_max *= 2;
+      *perf_score *= 2;
 
-  s32 f_loc = -1;
-  s32 l_loc = -1;
-  u32 pos;
+    }
 
-  for (pos = 0; pos < len; ++pos) {
+  }
 
-    if (*(ptr1++) != *(ptr2++)) {
+  return 0;
 
-      if (f_loc == -1) { f_loc = pos; }
-      l_loc = pos;
+}
 
-    }
+/* -p bandit: the reward of a seed is what its havoc (and splice) stage
+   found, with what it cost. Splicing jumps back to havoc, only the first
+   start counts. */
 
-  }
+static inline void seed_sched_havoc_start(afl_state_t *afl) {
 
-  *first = f_loc;
-  *last = l_loc;
+  seed_sched_t *ss = &afl->seed_sched;
 
-  return;
+  if (likely(afl->schedule != BANDIT) || ss->in_havoc) { return; }
 
-}
+  ss->havoc_paths = afl->queued_paths;
+  ss->havoc_execs = afl->fsrv.total_execs;
+  ss->in_havoc = 1;
 
-#endif                                                     /* !IGNORE_FINDS */
+}
 
 /* Take the current entry from the queue, fuzz it for a while. This
    function is a tad too long... returns 0 if fuzzed successfully, 1 if
@@ -1125,7 +779,11 @@ u8 fuzz_one_original(afl_state_t *afl) {
 
   }
 
-  if (likely(afl->pending_favored)) {
+  if (unlikely(afl->schedule == BANDIT)) {
+
+    /* -p bandit chose this seed for its finds, do not skip it */
+
+  } else if (likely(afl->pending_favored)) {
 
     /* If we have any favored, non-fuzzed new arrivals in the queue,
        possibly skip to them at the expense of already-fuzzed or non-favored
@@ -2562,13 +2220,7 @@ custom_mutator_stage:
             /* Pick a random other queue entry for passing to external API
                that has the necessary length */
 
-            do {
-
-              tid = rand_below(afl, afl->queued_paths);
-
-            } while (unlikely(tid == afl->current_entry ||
-
-                              afl->queue_buf[tid]->len < 4));
+            tid = select_splice_partner(afl);
 
             target = afl->queue_buf[tid];
             afl->splicing_with = tid;
@@ -2659,6 +2311,7 @@ custom_mutator_stage:
 
 havoc_stage:
 
+  seed_sched_havoc_start(afl);
   afl->stage_cur_byte = -1;
 
   /* The havoc stage mutation code is also invoked when splicing files; if the
@@ -2761,8 +2414,30 @@ havoc_stage:
   mut_bucket = 0;
 #endif
 
-  BANDIT_T(MUT_ALG)*    mut_bandit  = &afl->mut_bandit[mut_bucket];
-  BANDIT_T(BATCH_ALG)* used_bucket = afl->batch_bandit[batch_bucket];
+  bandit_t *mut_bandit = &afl->mut_bandit[mut_bucket];
+  bandit_t *used_bucket = afl->batch_bandit[batch_bucket];
+
+  /* AFL_SEED_BANDIT: per-seed operator statistics replace mut_bandit */
+  seed_bandit_arm_t *seed_arms = NULL;
+  if (afl->seed_bandit.n_slots) {
+    seed_arms = seed_bandit_get(afl, afl->queue_cur);
+  }
+
+  /* AFL_SHMEM_INPLACE: mutate right in the shared memory testcase */
+  u8 havoc_in_shm = afl->shmem_inplace && afl->fsrv.use_shmem_fuzz;
+  if (havoc_in_shm) {
+
+    out_buf = havoc_out_buf(afl, havoc_in_shm, len);
+    memcpy(out_buf, in_buf, len);
+
+  }
+
+  /* memcpy() of in_buf is the fallback, so that is what the undo journal of
+     an iteration may cost */
+  struct havoc_undo_log undo;
+  undo.saved_buf = afl_realloc(AFL_BUF_PARAM(undo), len);
+  if (unlikely(!undo.saved_buf)) { PFATAL("alloc"); }
+  undo.budget = len;
 
   for (afl->stage_cur = 0; afl->stage_cur < afl->stage_max; ++afl->stage_cur) {
 
@@ -2794,12 +2469,15 @@ havoc_stage:
       mask[SPLICE_OVERWRITE] = 1;
     }
     
-    selected_case = SELECT_ARM(MUT_ALG)(afl, mut_bandit, mask);
+    if (seed_arms) {
+      selected_case = seed_bandit_select_arm(afl, seed_arms, mask);
+    } else {
+      selected_case = bandit_select_arm(afl, mut_bandit, mask);
+    }
 
-#if MUT_ALG == exppp || MUT_ALG == expix
+    /* exppp and expix ignore the mask, skip the arm if it is not usable */
     u8 exp_invalid = mask[selected_case];
     if (exp_invalid) goto L_EXP_INVALID;
-#endif
 
     static const int case2r[] = {
       0, 4, 8, 10, 12, 14, 16, 20, 24, 26, 28, 30, 32, 34, 36, 38, 40, 44, 47, 48, 51, 52, MAX_HAVOC_ENTRY+1,
@@ -2818,7 +2496,11 @@ havoc_stage:
 #elif defined(MOPTWISE_BANDIT_FINECOARSE) /* MOPTWISE_BANDIT */
  
     int selected_case;
-    selected_case = SELECT_ARM(MUT_ALG) (afl, mut_bandit, NULL);
+    if (seed_arms) {
+      selected_case = seed_bandit_select_arm(afl, seed_arms, NULL);
+    } else {
+      selected_case = bandit_select_arm(afl, mut_bandit, NULL);
+    }
 
     if (selected_case == 0) r = rand_below(afl, 44);
     else r = 44 + rand_below(afl, r_max-44);
@@ -2994,24 +2676,15 @@ havoc_stage:
     }
 #endif
 
-    BANDIT_T(BATCH_ALG) *batch_bandit = &used_bucket[case_idx];
-
-    u32 mutation_pos[512];
-    u32 mutation_data32[512];
+    bandit_t *batch_bandit = &used_bucket[case_idx];
 
-    enum MutationByteSize { OTHER, BIT1, BYTE1, BYTE2, BYTE4};
-    u8  mutation_size = OTHER;
-
-    u8 *mutation_data8 = (u8*)mutation_data32;
-    u16 *mutation_data16 = (u16*)mutation_data32;
-    //printf("addr~~ %p %p %p\n", mutation_data32, mutation_data8, mutation_data16);
+    havoc_undo_reset(&undo);
 
     int selected_t = 0;
 #ifndef BATCHSIZE_BANDIT
     selected_t = rand_below(afl, afl->havoc_stack_pow2+1);
 #else
-    selected_t = SELECT_ARM(BATCH_ALG) 
-                       (afl, batch_bandit, NULL);
+    selected_t = bandit_select_arm(afl, batch_bandit, NULL);
 #endif
 
 #if BATCH_NUM_ARM == 7
@@ -3045,6 +2718,7 @@ havoc_stage:
 
             if (likely(new_len > 0 && custom_havoc_buf)) {
 
+              havoc_undo_giveup(&undo);
               temp_len = new_len;
               if (out_buf != custom_havoc_buf) {
 
@@ -3073,12 +2747,10 @@ havoc_stage:
           strcat(afl->mutation, afl->m_tmp);
 #endif
     
-          mutation_size = BIT1;
-
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len << 3);
-          mutation_pos[i] = pos; // FLIP_BIT only requires position to revert it
+          havoc_undo_save(&undo, out_buf, pos >> 3, 1);
           FLIP_BIT(out_buf, pos);
           
           }
@@ -3096,13 +2768,10 @@ havoc_stage:
           strcat(afl->mutation, afl->m_tmp);
 #endif
 
-          mutation_size = BYTE1;
-
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len);
-          mutation_pos[i] = pos; 
-          mutation_data8[i] = out_buf[pos];
+          havoc_undo_save(&undo, out_buf, pos, 1);
 
           out_buf[pos] =
               interesting_8[rand_below(afl, sizeof(interesting_8))];
@@ -3117,8 +2786,6 @@ havoc_stage:
 
           /* Set word to interesting value, little endian. */
 
-          mutation_size = BYTE2;
-
           if (temp_len < 2) { break; }
 
 #ifdef INTROSPECTION
@@ -3129,8 +2796,7 @@ havoc_stage:
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 1);
-          mutation_pos[i] = pos; 
-          mutation_data16[i] = *(u16 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 2);
 
           *(u16 *)(out_buf + pos) =
               interesting_16[rand_below(afl, sizeof(interesting_16) >> 1)];
@@ -3145,8 +2811,6 @@ havoc_stage:
 
           /* Set word to interesting value, big endian. */
 
-          mutation_size = BYTE2;
-
           if (temp_len < 2) { break; }
 
 #ifdef INTROSPECTION
@@ -3157,8 +2821,7 @@ havoc_stage:
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 1);
-          mutation_pos[i] = pos; 
-          mutation_data16[i] = *(u16 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 2);
 
           *(u16 *)(out_buf + pos) = SWAP16(
               interesting_16[rand_below(afl, sizeof(interesting_16) >> 1)]);
@@ -3173,8 +2836,6 @@ havoc_stage:
 
           /* Set dword to interesting value, little endian. */
 
-          mutation_size = BYTE4;
-
           if (temp_len < 4) { break; }
 
 #ifdef INTROSPECTION
@@ -3185,8 +2846,7 @@ havoc_stage:
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 3);
-          mutation_pos[i] = pos; 
-          mutation_data32[i] = *(u32 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 4);
 
           *(u32 *)(out_buf + pos) =
               interesting_32[rand_below(afl, sizeof(interesting_32) >> 2)];
@@ -3201,8 +2861,6 @@ havoc_stage:
 
           /* Set dword to interesting value, big endian. */
 
-          mutation_size = BYTE4;
-
           if (temp_len < 4) { break; }
 
 #ifdef INTROSPECTION
@@ -3213,8 +2871,7 @@ havoc_stage:
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 3);
-          mutation_pos[i] = pos; 
-          mutation_data32[i] = *(u32 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 4);
 
           *(u32 *)(out_buf + pos) = SWAP32(
               interesting_32[rand_below(afl, sizeof(interesting_32) >> 2)]);
@@ -3234,13 +2891,10 @@ havoc_stage:
           strcat(afl->mutation, afl->m_tmp);
 #endif
 
-          mutation_size = BYTE1;
-
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len);
-          mutation_pos[i] = pos; 
-          mutation_data8[i] = out_buf[pos];
+          havoc_undo_save(&undo, out_buf, pos, 1);
 
           out_buf[pos] -= 1 + rand_below(afl, ARITH_MAX);
 
@@ -3259,13 +2913,10 @@ havoc_stage:
           strcat(afl->mutation, afl->m_tmp);
 #endif
 
-          mutation_size = BYTE1;
-
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len);
-          mutation_pos[i] = pos; 
-          mutation_data8[i] = out_buf[pos];
+          havoc_undo_save(&undo, out_buf, pos, 1);
 
           out_buf[pos] += 1 + rand_below(afl, ARITH_MAX);
 
@@ -3279,15 +2930,12 @@ havoc_stage:
 
           /* Randomly subtract from word, little endian. */
 
-          mutation_size = BYTE2;
-
           if (temp_len < 2) { break; }
 
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 1);
-          mutation_pos[i] = pos; 
-          mutation_data16[i] = *(u16 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 2);
 
 
 #ifdef INTROSPECTION
@@ -3306,15 +2954,12 @@ havoc_stage:
 
           /* Randomly subtract from word, big endian. */
 
-          mutation_size = BYTE2;
-
           if (temp_len < 2) { break; }
 
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 1);
-          mutation_pos[i] = pos; 
-          mutation_data16[i] = *(u16 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 2);
           u16 num = 1 + rand_below(afl, ARITH_MAX);
 
 #ifdef INTROSPECTION
@@ -3335,15 +2980,12 @@ havoc_stage:
 
           /* Randomly add to word, little endian. */
 
-          mutation_size = BYTE2;
-
           if (temp_len < 2) { break; }
 
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 1);
-          mutation_pos[i] = pos; 
-          mutation_data16[i] = *(u16 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 2);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH16+-%u", pos);
@@ -3361,15 +3003,12 @@ havoc_stage:
 
           /* Randomly add to word, big endian. */
 
-          mutation_size = BYTE2;
-
           if (temp_len < 2) { break; }
 
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 1);
-          mutation_pos[i] = pos; 
-          mutation_data16[i] = *(u16 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 2);
           u16 num = 1 + rand_below(afl, ARITH_MAX);
 
 #ifdef INTROSPECTION
@@ -3390,15 +3029,12 @@ havoc_stage:
 
           /* Randomly subtract from dword, little endian. */
 
-          mutation_size = BYTE4;
-
           if (temp_len < 4) { break; }
 
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 3);
-          mutation_pos[i] = pos; 
-          mutation_data32[i] = *(u32 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 4);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH32_-%u", pos);
@@ -3416,15 +3052,12 @@ havoc_stage:
 
           /* Randomly subtract from dword, big endian. */
 
-          mutation_size = BYTE4;
-
           if (temp_len < 4) { break; }
 
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 3);
-          mutation_pos[i] = pos; 
-          mutation_data32[i] = *(u32 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 4);
           u32 num = 1 + rand_below(afl, ARITH_MAX);
 
 #ifdef INTROSPECTION
@@ -3445,15 +3078,12 @@ havoc_stage:
 
           /* Randomly add to dword, little endian. */
 
-          mutation_size = BYTE4;
-
           if (temp_len < 4) { break; }
 
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 3);
-          mutation_pos[i] = pos; 
-          mutation_data32[i] = *(u32 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 4);
 
 #ifdef INTROSPECTION
           snprintf(afl->m_tmp, sizeof(afl->m_tmp), " ARITH32+-%u", pos);
@@ -3471,15 +3101,12 @@ havoc_stage:
 
           /* Randomly add to dword, big endian. */
 
-          mutation_size = BYTE4;
-
           if (temp_len < 4) { break; }
 
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len - 3);
-          mutation_pos[i] = pos; 
-          mutation_data32[i] = *(u32 *)(out_buf + pos);
+          havoc_undo_save(&undo, out_buf, pos, 4);
           u32 num = 1 + rand_below(afl, ARITH_MAX);
 
 #ifdef INTROSPECTION
@@ -3507,13 +3134,10 @@ havoc_stage:
           strcat(afl->mutation, afl->m_tmp);
 #endif
 
-          mutation_size = BYTE1;
-
           for (i = 0; i < use_stacking; ++i) {
 
           u32 pos = rand_below(afl, temp_len);
-          mutation_pos[i] = pos; 
-          mutation_data8[i] = out_buf[pos];
+          havoc_undo_save(&undo, out_buf, pos, 1);
 
           out_buf[pos] ^= 1 + rand_below(afl, 255);
 
@@ -3540,24 +3164,26 @@ havoc_stage:
                      "clone", clone_from, clone_to, clone_len);
             strcat(afl->mutation, afl->m_tmp);
 #endif
-            u8 *new_buf =
-                afl_realloc(AFL_BUF_PARAM(out_scratch), temp_len + clone_len);
-            if (unlikely(!new_buf)) { PFATAL("alloc"); }
+            havoc_undo_insert(&undo, clone_to, clone_len, temp_len - clone_to);
+            out_buf =
+                havoc_open_gap(afl, out_buf, temp_len, clone_to, clone_len);
 
-            /* Head */
+            /* Inserted part, the bytes behind clone_to moved with the tail */
 
-            memcpy(new_buf, out_buf, clone_to);
+            if (clone_from < clone_to) {
 
-            /* Inserted part */
+              u32 head = MIN(clone_len, clone_to - clone_from);
+              memcpy(out_buf + clone_to, out_buf + clone_from, head);
+              memcpy(out_buf + clone_to + head, out_buf + clone_to + clone_len,
+                     clone_len - head);
+
+            } else {
 
-            memcpy(new_buf + clone_to, out_buf + clone_from, clone_len);
+              memcpy(out_buf + clone_to, out_buf + clone_from + clone_len,
+                     clone_len);
 
-            /* Tail */
-            memcpy(new_buf + clone_to + clone_len, out_buf + clone_to,
-                   temp_len - clone_to);
+            }
 
-            out_buf = new_buf;
-            afl_swap_bufs(AFL_BUF_PARAM(out), AFL_BUF_PARAM(out_scratch));
             temp_len += clone_len;
 
           } else break;
@@ -3584,27 +3210,16 @@ havoc_stage:
                      "insert", clone_to, clone_len);
             strcat(afl->mutation, afl->m_tmp);
 #endif
-            u8 *new_buf =
-                afl_realloc(AFL_BUF_PARAM(out_scratch), temp_len + clone_len);
-            if (unlikely(!new_buf)) { PFATAL("alloc"); }
+            u8 val = rand_below(afl, 2) ? rand_below(afl, 256)
+                                        : out_buf[rand_below(afl, temp_len)];
 
-            /* Head */
-
-            memcpy(new_buf, out_buf, clone_to);
+            havoc_undo_insert(&undo, clone_to, clone_len, temp_len - clone_to);
+            out_buf =
+                havoc_open_gap(afl, out_buf, temp_len, clone_to, clone_len);
 
             /* Inserted part */
 
-            memset(new_buf + clone_to,
-                   rand_below(afl, 2) ? rand_below(afl, 256)
-                                      : out_buf[rand_below(afl, temp_len)],
-                   clone_len);
-
-            /* Tail */
-            memcpy(new_buf + clone_to + clone_len, out_buf + clone_to,
-                   temp_len - clone_to);
-
-            out_buf = new_buf;
-            afl_swap_bufs(AFL_BUF_PARAM(out), AFL_BUF_PARAM(out_scratch));
+            memset(out_buf + clone_to, val, clone_len);
             temp_len += clone_len;
 
           } else break;
@@ -3634,6 +3249,7 @@ havoc_stage:
                      copy_from, copy_to, copy_len);
             strcat(afl->mutation, afl->m_tmp);
 #endif
+            havoc_undo_save(&undo, out_buf, copy_to, copy_len);
             memmove(out_buf + copy_to, out_buf + copy_from, copy_len);
 
           }
@@ -3660,6 +3276,7 @@ havoc_stage:
                    copy_to, copy_len);
           strcat(afl->mutation, afl->m_tmp);
 #endif
+          havoc_undo_save(&undo, out_buf, copy_to, copy_len);
           memset(out_buf + copy_to,
                  rand_below(afl, 2) ? rand_below(afl, 256)
                                     : out_buf[rand_below(afl, temp_len)],
@@ -3692,6 +3309,8 @@ havoc_stage:
                    del_len);
           strcat(afl->mutation, afl->m_tmp);
 #endif
+          havoc_undo_delete(&undo, out_buf, del_from, del_len,
+                            temp_len - del_from - del_len);
           memmove(out_buf + del_from, out_buf + del_from + del_len,
                   temp_len - del_from - del_len);
 
@@ -3726,6 +3345,7 @@ havoc_stage:
                        insert_at, extra_len);
               strcat(afl->mutation, afl->m_tmp);
 #endif
+              havoc_undo_save(&undo, out_buf, insert_at, extra_len);
               memcpy(out_buf + insert_at, afl->extras[use_extra].data,
                      extra_len);
 
@@ -3749,8 +3369,10 @@ havoc_stage:
               strcat(afl->mutation, afl->m_tmp);
 #endif
 
-              out_buf = afl_realloc(AFL_BUF_PARAM(out), temp_len + extra_len);
-              if (unlikely(!out_buf)) { PFATAL("alloc"); }
+              havoc_undo_insert(&undo, insert_at, extra_len,
+                                temp_len - insert_at);
+              out_buf = havoc_out_buf(afl, out_buf == afl->fsrv.shmem_fuzz,
+                                      temp_len + extra_len);
 
               /* Tail */
               memmove(out_buf + insert_at + extra_len, out_buf + insert_at,
@@ -3791,6 +3413,7 @@ havoc_stage:
                        " AUTO_EXTRA_OVERWRITE-%u-%u", insert_at, extra_len);
               strcat(afl->mutation, afl->m_tmp);
 #endif
+              havoc_undo_save(&undo, out_buf, insert_at, extra_len);
               memcpy(out_buf + insert_at, afl->a_extras[use_extra].data,
                      extra_len);
 
@@ -3814,8 +3437,10 @@ havoc_stage:
               strcat(afl->mutation, afl->m_tmp);
 #endif
 
-              out_buf = afl_realloc(AFL_BUF_PARAM(out), temp_len + extra_len);
-              if (unlikely(!out_buf)) { PFATAL("alloc"); }
+              havoc_undo_insert(&undo, insert_at, extra_len,
+                                temp_len - insert_at);
+              out_buf = havoc_out_buf(afl, out_buf == afl->fsrv.shmem_fuzz,
+                                      temp_len + extra_len);
 
               /* Tail */
               memmove(out_buf + insert_at + extra_len, out_buf + insert_at,
@@ -3845,12 +3470,7 @@ havoc_stage:
 
           /* Pick a random queue entry and seek to it. */
 
-          u32 tid;
-          do {
-
-            tid = rand_below(afl, afl->queued_paths);
-
-          } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4);
+          u32 tid = select_splice_partner(afl);
 
           /* Get the testcase for splicing. */
           struct queue_entry *target = afl->queue_buf[tid];
@@ -3875,6 +3495,7 @@ havoc_stage:
                      copy_len, target->fname);
             strcat(afl->mutation, afl->m_tmp);
 #endif
+            havoc_undo_save(&undo, out_buf, copy_to, copy_len);
             memmove(out_buf + copy_to, new_buf + copy_from, copy_len);
 
           } else {
@@ -3887,30 +3508,19 @@ havoc_stage:
             clone_from = rand_below(afl, new_len - clone_len + 1);
             clone_to = rand_below(afl, temp_len + 1);
 
-            u8 *temp_buf = afl_realloc(AFL_BUF_PARAM(out_scratch),
-                                       temp_len + clone_len + 1);
-            if (unlikely(!temp_buf)) { PFATAL("alloc"); }
-
 #ifdef INTROSPECTION
             snprintf(afl->m_tmp, sizeof(afl->m_tmp),
                      " SPLICE_INSERT-%u-%u-%u-%s", clone_from, clone_to,
                      clone_len, target->fname);
             strcat(afl->mutation, afl->m_tmp);
 #endif
-            /* Head */
-
-            memcpy(temp_buf, out_buf, clone_to);
+            havoc_undo_insert(&undo, clone_to, clone_len, temp_len - clone_to);
+            out_buf =
+                havoc_open_gap(afl, out_buf, temp_len, clone_to, clone_len);
 
             /* Inserted part */
 
-            memcpy(temp_buf + clone_to, new_buf + clone_from, clone_len);
-
-            /* Tail */
-            memcpy(temp_buf + clone_to + clone_len, out_buf + clone_to,
-                   temp_len - clone_to);
-
-            out_buf = temp_buf;
-            afl_swap_bufs(AFL_BUF_PARAM(out), AFL_BUF_PARAM(out_scratch));
+            memcpy(out_buf + clone_to, new_buf + clone_from, clone_len);
             temp_len += clone_len;
 
           }
@@ -3924,24 +3534,36 @@ havoc_stage:
       }
 
 
-#if MUT_ALG == exppp || MUT_ALG == expix
+#ifdef MOPTWISE_BANDIT
 L_EXP_INVALID:
 #endif
 
     afl->fsrv.total_havocs++;
 
-#if MUT_ALG == exppp || MUT_ALG == expix
+#ifdef MOPTWISE_BANDIT
     if (exp_invalid) goto L_EXP_INVALID_2;
 #endif
 
-    u8 should_abandon = common_fuzz_stuff(afl, out_buf, temp_len);
-    if (should_abandon) {
+    if (afl->havoc_batch_k > 1) {
+
+#if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
+      havoc_batch_add(afl, out_buf, temp_len, batch_bandit, selected_case,
+                      selected_t);
+#else
+      havoc_batch_add(afl, out_buf, temp_len, batch_bandit, 0, selected_t);
+#endif
+
+    } else if (common_fuzz_stuff(afl, out_buf, temp_len)) {
 #ifdef BATCHSIZE_BANDIT
-      ADD_REWARD(BATCH_ALG)(batch_bandit, selected_t, 0);
+      bandit_add_reward(batch_bandit, selected_t, 0);
 #endif
 
 #if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
-      ADD_REWARD(MUT_ALG)(mut_bandit, selected_case, 0);
+      if (seed_arms) {
+        seed_bandit_add_reward(&afl->seed_bandit, seed_arms, selected_case, 0);
+      } else {
+        bandit_add_reward(mut_bandit, selected_case, 0);
+      }
 #endif
       goto abandon_entry; 
     }
@@ -3949,77 +3571,32 @@ L_EXP_INVALID:
     /* out_buf might have been mangled a bit, so let's restore it to its
        original size and shape. */
 
-    if (len >= MIN_LEN_FOR_OPTIMIZED_RESTORE) {
-
-      // For fine grained mutations, we recover the data from the saved one.
-      switch (mutation_size) {
-        // FLIP BIT
-        case BIT1: {
-          int j;
-          u32 pos;
-          for (j = use_stacking - 1; j >= 0; j--) {
-            pos = mutation_pos[j];
-            FLIP_BIT(out_buf, pos);
-          }
-          break;
-        }
-  
-        // case mutation size = 1 byte
-        case BYTE1: {
-          int j;
-          u32 pos;
-          u8  data;
-          for (j = use_stacking - 1; j >= 0; j--) {
-            pos = mutation_pos[j];
-            data = mutation_data8[j];
-            // printf("%u %u %u %u %u\n", mutation_id, i, r_bkup, pos, data);
-            out_buf[pos] = data;
-          }
-          break;
-        }
-  
-        // case mutation size = 2 bytes
-        case BYTE2: {
-          int j;
-          u32 pos;
-          u16 data;
-          if (temp_len < 2) { break; }
-          for (j = use_stacking - 1; j >= 0; j--) {
-            pos = mutation_pos[j];
-            data = mutation_data16[j];
-            // printf("%u %u %u %u %u\n", mutation_id, j, r_bkup, pos, data);
-            *(u16 *)(out_buf + pos) = data;
-          }
-          break;
-        }
-  
-        // case mutation size = 4 bytes
-        case BYTE4: {
-          int j;
-          u32 pos;
-          u32 data;
-          if (temp_len < 4) { break; }
-          for (j = use_stacking - 1; j >= 0; j--) {
-            pos = mutation_pos[j];
-            data = mutation_data32[j];
-            // printf("%u %u %u %u %u\n", mutation_id, j, r_bkup, mutation_pos[j], data);
-            *(u32 *)(out_buf + pos) = data;
-          }
-          break;
-        }
-  
-        default: {
-          out_buf = afl_realloc(AFL_BUF_PARAM(out), len);
-          if (unlikely(!out_buf)) { PFATAL("alloc"); }
-          temp_len = len;
-          memcpy(out_buf, in_buf, len);
-        }
-      }
-    } else {
-      out_buf = afl_realloc(AFL_BUF_PARAM(out), len);
-      if (unlikely(!out_buf)) { PFATAL("alloc"); }
+    if (!havoc_undo_replay(&undo, out_buf, &temp_len)) {
+
+      out_buf = havoc_out_buf(afl, havoc_in_shm, len);
       temp_len = len;
       memcpy(out_buf, in_buf, len);
+
+    }
+
+    /* AFL_HAVOC_BATCH: the outcome is only known once the batch ran */
+
+    if (afl->havoc_batch_k > 1) {
+
+      if (afl->havoc_batch_cnt == afl->havoc_batch_k ||
+          afl->stage_cur + 1 >= afl->stage_max) {
+
+        if (havoc_batch_flush(afl, mut_bandit, seed_arms, &havoc_queued,
+                              &perf_score)) {
+
+          goto abandon_entry;
+
+        }
+
+      }
+
+      continue;
+
     }
 
     /* If we're finding new stuff, let's run for a bit longer, limits
@@ -4027,11 +3604,15 @@ L_EXP_INVALID:
 
     if (afl->queued_paths != havoc_queued) {
 #ifdef BATCHSIZE_BANDIT
-      ADD_REWARD(BATCH_ALG)(batch_bandit, selected_t, 1);
+      bandit_add_reward(batch_bandit, selected_t, 1);
 #endif
 
 #if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
-      ADD_REWARD(MUT_ALG)(mut_bandit, selected_case, 1);
+      if (seed_arms) {
+        seed_bandit_add_reward(&afl->seed_bandit, seed_arms, selected_case, 1);
+      } else {
+        bandit_add_reward(mut_bandit, selected_case, 1);
+      }
 #endif
 
       if (perf_score <= afl->havoc_max_mult * 100) {
@@ -4045,20 +3626,33 @@ L_EXP_INVALID:
     }  else {
 
 #ifdef BATCHSIZE_BANDIT
-      ADD_REWARD(BATCH_ALG)(batch_bandit, selected_t, 0);
+      bandit_add_reward(batch_bandit, selected_t, 0);
 #endif
 
-#if MUT_ALG == exppp || MUT_ALG == expix
+#ifdef MOPTWISE_BANDIT
 L_EXP_INVALID_2:
 #endif
 
 #if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
-      ADD_REWARD(MUT_ALG)(mut_bandit, selected_case, 0);
+      if (seed_arms) {
+        seed_bandit_add_reward(&afl->seed_bandit, seed_arms, selected_case, 0);
+      } else {
+        bandit_add_reward(mut_bandit, selected_case, 0);
+      }
 #endif
 
     }
   }
 
+  /* mutants left over when the last one was skipped as invalid */
+  if (afl->havoc_batch_cnt &&
+      havoc_batch_flush(afl, mut_bandit, seed_arms, &havoc_queued,
+                        &perf_score)) {
+
+    goto abandon_entry;
+
+  }
+
   new_hit_cnt = afl->queued_paths + afl->unique_crashes;
 
   if (!splice_cycle) {
@@ -4106,11 +3700,7 @@ retry_splicing:
 
     /* Pick a random queue entry and seek to it. Don't splice with yourself. */
 
-    do {
-
-      tid = rand_below(afl, afl->queued_paths);
-
-    } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4);
+    tid = select_splice_partner(afl);
 
     /* Get the testcase */
     afl->splicing_with = tid;
@@ -4166,7 +3756,7 @@ abandon_entry:
 
       --afl->pending_not_fuzzed;
       afl->queue_cur->was_fuzzed = 1;
-      afl->reinit_table = 1;
+      queue_weight_update(afl, afl->queue_cur);
       if (afl->queue_cur->favored) { --afl->pending_favored; }
 
     }
@@ -4216,7 +3806,11 @@ static u8 mopt_common_fuzzing(afl_state_t *afl, MOpt_globals_t MOpt_globals) {
 
 #else
 
-  if (likely(afl->pending_favored)) {
+  if (unlikely(afl->schedule == BANDIT)) {
+
+    /* -p bandit chose this seed for its finds, do not skip it */
+
+  } else if (likely(afl->pending_favored)) {
 
     /* If we have any favored, non-fuzzed new arrivals in the queue,
        possibly skip to them at the expense of already-fuzzed or non-favored
@@ -5585,6 +5179,7 @@ skip_extras:
 havoc_stage:
 pacemaker_fuzzing:
 
+  seed_sched_havoc_start(afl);
   afl->stage_cur_byte = -1;
 
   /* The havoc stage mutation code is also invoked when splicing files; if the
@@ -6228,14 +5823,7 @@ pacemaker_fuzzing:
 
               if (unlikely(afl->ready_for_splicing_count < 2)) break;
 
-              u32 tid;
-              do {
-
-                tid = rand_below(afl, afl->queued_paths);
-
-              } while (tid == afl->current_entry ||
-
-                       afl->queue_buf[tid]->len < 4);
+              u32 tid = select_splice_partner(afl);
 
               /* Get the testcase for splicing. */
               struct queue_entry *target = afl->queue_buf[tid];
@@ -6430,11 +6018,7 @@ pacemaker_fuzzing:
         /* Pick a random queue entry and seek to it. Don't splice with yourself.
          */
 
-        do {
-
-          tid = rand_below(afl, afl->queued_paths);
-
-        } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4);
+        tid = select_splice_partner(afl);
 
         afl->splicing_with = tid;
         target = afl->queue_buf[tid];
@@ -6784,6 +6368,8 @@ u8 fuzz_one(afl_state_t *afl) {
 
 #endif
 
+  afl->seed_sched.in_havoc = 0;
+
   // if limit_time_sig == -1 then both are run after each other
 
   if (afl->limit_time_sig <= 0) { key_val_lv_1 = fuzz_one_original(afl); }
@@ -6806,6 +6392,15 @@ u8 fuzz_one(afl_state_t *afl) {
 
   }
 
+  if (unlikely(afl->schedule == BANDIT) && afl->seed_sched.in_havoc) {
+
+    seed_sched_reward(afl, afl->queue_cur,
+                      afl->queued_paths - afl->seed_sched.havoc_paths,
+                      afl->fsrv.total_execs - afl->seed_sched.havoc_execs);
+    queue_weight_update(afl, afl->queue_cur);
+
+  }
+
   return (key_val_lv_1 | key_val_lv_2);
 
 }
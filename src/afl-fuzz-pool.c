@@ -0,0 +1,407 @@
+/*
+   american fuzzy lop++ - fork server pool
+   ---------------------------------------
+
+   Originally written by Michal Zalewski
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                        Heiko Eißfeldt <heiko.eissfeldt@hexco.de> and
+                        Andrea Fioraldi <andreafioraldi@gmail.com>
+
+   Copyright 2016, 2017 Google Inc. All rights reserved.
+   Copyright 2019-2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Extra fork servers (AFL_FSRV_POOL) that run the mutants of a havoc batch
+   concurrently. Every member has its own coverage map, input file and
+   testcase shared memory. A finished run is adopted into afl->fsrv's map,
+   so the outcome goes through the usual save_if_interesting() path, and the
+   main fork server stays free for calibration and timeout reruns.
+
+ */
+
+#include "afl-fuzz.h"
+#include "dirty-map.h"
+
+#include <poll.h>
+
+/* Point the target of the next fork server start at the given shared
+   memory. */
+
+static void pool_export_shm(char *env, sharedmem_t *shm) {
+
+#ifdef USEMMAP
+  setenv(env, shm->g_shm_file_path, 1);
+#else
+  u8 *shm_str = alloc_printf("%d", shm->shm_id);
+  setenv(env, shm_str, 1);
+  ck_free(shm_str);
+#endif
+
+}
+
+/* Copy the target argv, with the input file of the main fork server
+   replaced by the one of the member. */
+
+static char **pool_argv(afl_state_t *afl, u8 *out_file) {
+
+  u32    i, argc = 0;
+  char **argv;
+
+  while (afl->argv[argc]) {
+
+    ++argc;
+
+  }
+
+  argv = ck_alloc((argc + 1) * sizeof(char *));
+
+  for (i = 0; i < argc; ++i) {
+
+    u8 *loc = NULL;
+
+    if (!afl->fsrv.use_stdin) {
+
+      loc = strstr(afl->argv[i], afl->fsrv.out_file);
+
+    }
+
+    if (loc) {
+
+      argv[i] = alloc_printf("%.*s%s%s", (int)(loc - (u8 *)afl->argv[i]),
+                             afl->argv[i], out_file,
+                             loc + strlen(afl->fsrv.out_file));
+
+    } else {
+
+      argv[i] = ck_strdup(afl->argv[i]);
+
+    }
+
+  }
+
+  return argv;
+
+}
+
+/* Start the AFL_FSRV_POOL fork servers. Called once the main fork server
+   runs, so that map size and timeout are final. */
+
+void fsrv_pool_init(afl_state_t *afl) {
+
+  u32 i;
+
+  if (!afl->fsrv_pool_cnt) { return; }
+
+  afl->fsrv_pool =
+      ck_alloc(afl->fsrv_pool_cnt * sizeof(struct fsrv_pool_member));
+
+  /* we already have the autodict from the main fork server */
+  setenv("AFL_NO_AUTODICT", "1", 1);
+
+  for (i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    struct fsrv_pool_member *m = &afl->fsrv_pool[i];
+    afl_forkserver_t *       fsrv = &m->fsrv;
+
+    afl_fsrv_init_dup(fsrv, &afl->fsrv);
+    fsrv->target_path = afl->fsrv.target_path;
+    fsrv->qemu_mode = afl->fsrv.qemu_mode;
+    fsrv->frida_mode = afl->fsrv.frida_mode;
+    fsrv->use_fauxsrv = afl->fsrv.use_fauxsrv;
+    fsrv->uses_asan = afl->fsrv.uses_asan;
+
+    /* afl_fsrv_run_start() and the poll() in fsrv_pool_collect() need the
+       pipes */
+    fsrv->use_futex = false;
+
+    m->shm.dirty_mode = afl->shm.dirty_mode;
+    fsrv->trace_bits =
+        afl_shm_init(&m->shm, fsrv->map_size, afl->non_instrumented_mode);
+    fsrv->dirty_map = m->shm.dirty_map;
+
+    if (afl->shm_fuzz) {
+
+      u8 *map;
+
+      m->shm_fuzz = ck_alloc(sizeof(sharedmem_t));
+      map = afl_shm_init(m->shm_fuzz, MAX_FILE + sizeof(u32), 1);
+      m->shm_fuzz->shmemfuzz_mode = 1;
+      pool_export_shm(SHM_FUZZ_ENV_VAR, m->shm_fuzz);
+      fsrv->support_shmem_fuzz = 1;
+      fsrv->shmem_fuzz_len = (u32 *)map;
+      fsrv->shmem_fuzz = map + sizeof(u32);
+
+    }
+
+    if (afl->file_extension) {
+
+      fsrv->out_file = alloc_printf("%s/.cur_input_%u.%s", afl->tmp_dir, i,
+                                    afl->file_extension);
+
+    } else {
+
+      fsrv->out_file = alloc_printf("%s/.cur_input_%u", afl->tmp_dir, i);
+
+    }
+
+    unlink(fsrv->out_file);                                /* Ignore errors */
+
+    if (fsrv->use_stdin) {
+
+      fsrv->out_fd = open(fsrv->out_file, O_RDWR | O_CREAT | O_EXCL,
+                          DEFAULT_PERMISSION);
+      if (fsrv->out_fd < 0) {
+
+        PFATAL("Unable to create '%s'", fsrv->out_file);
+
+      }
+
+    } else {
+
+      fsrv->out_fd = -1;
+
+    }
+
+    m->argv = pool_argv(afl, fsrv->out_file);
+
+    afl_fsrv_start(fsrv, m->argv, &afl->stop_soon,
+                   afl->afl_env.afl_debug_child);
+
+    if (fsrv->map_size != afl->fsrv.map_size) {
+
+      FATAL("Fork server pool member %u reports a different map size", i);
+
+    }
+
+  }
+
+  /* back to the shared memory of the main fork server */
+  if (!afl->non_instrumented_mode) { pool_export_shm(SHM_ENV_VAR, &afl->shm); }
+  if (afl->shm_fuzz) { pool_export_shm(SHM_FUZZ_ENV_VAR, afl->shm_fuzz); }
+
+  OKF("Started %u extra fork servers for havoc batches.", afl->fsrv_pool_cnt);
+
+}
+
+void fsrv_pool_deinit(afl_state_t *afl) {
+
+  u32 i, j;
+
+  if (!afl->fsrv_pool) { return; }
+
+  for (i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    struct fsrv_pool_member *m = &afl->fsrv_pool[i];
+
+    if (!m->argv) { continue; }                    /* never got started */
+
+    afl_fsrv_deinit(&m->fsrv);
+    afl_shm_deinit(&m->shm);
+
+    if (m->shm_fuzz) {
+
+      afl_shm_deinit(m->shm_fuzz);
+      ck_free(m->shm_fuzz);
+
+    }
+
+    if (m->fsrv.out_fd >= 0) { close(m->fsrv.out_fd); }
+    unlink(m->fsrv.out_file);
+    ck_free(m->fsrv.out_file);
+
+    for (j = 0; m->argv[j]; ++j) {
+
+      ck_free(m->argv[j]);
+
+    }
+
+    ck_free(m->argv);
+
+  }
+
+  ck_free(afl->fsrv_pool);
+  afl->fsrv_pool = NULL;
+  afl->fsrv_pool_busy = 0;
+
+}
+
+/* Write buf to an idle member and start a run of it, remembering tag.
+   Returns the member, or -1 if all are busy or the user wants to quit. */
+
+s32 fsrv_pool_submit(afl_state_t *afl, u8 *buf, u32 len, u32 tag) {
+
+  u32 i;
+
+  if (afl->fsrv_pool_busy == afl->fsrv_pool_cnt || afl->stop_soon) {
+
+    return -1;
+
+  }
+
+  for (i = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+    struct fsrv_pool_member *m = &afl->fsrv_pool[i];
+
+    if (m->busy) { continue; }
+
+    write_to_fsrv_testcase(afl, &m->fsrv, buf, len);
+
+    if (afl_fsrv_run_start(&m->fsrv, &afl->stop_soon)) { return -1; }
+
+    m->deadline = get_cur_time() + afl->fsrv.exec_tmout;
+    m->tag = tag;
+    m->busy = 1;
+    ++afl->fsrv_pool_busy;
+    return i;
+
+  }
+
+  return -1;
+
+}
+
+/* Make the coverage of a finished member run the one of afl->fsrv, as if the
+   main fork server had run it. */
+
+static void pool_adopt_run(afl_state_t *afl, struct fsrv_pool_member *m) {
+
+  afl_forkserver_t *fsrv = &afl->fsrv;
+  struct dirty_map *dm = fsrv->dirty_map, *src = m->fsrv.dirty_map;
+
+  if (dm && src && src->valid) {
+
+    /* AFL_DIRTY_MAP: only the touched lines differ from a clean map */
+    u32 w, n = DIRTY_MAP_WORDS(fsrv->map_size);
+
+    if (dm->valid) {
+
+      dirty_map_clear(dm, fsrv->trace_bits, fsrv->map_size);
+
+    } else {
+
+      memset(fsrv->trace_bits, 0, fsrv->map_size);
+
+    }
+
+    for (w = 0; w < n; ++w) {
+
+      u64 bits = src->bits[w];
+
+      dm->bits[w] = bits;
+
+      while (bits) {
+
+        u32 off = ((w << 6) + __builtin_ctzll(bits)) * DIRTY_LINE;
+        memcpy(fsrv->trace_bits + off, m->fsrv.trace_bits + off, DIRTY_LINE);
+        bits &= bits - 1;
+
+      }
+
+    }
+
+    dm->valid = 1;
+
+  } else {
+
+    memcpy(fsrv->trace_bits, m->fsrv.trace_bits, fsrv->map_size);
+    if (dm) { dm->valid = 0; }
+
+  }
+
+  fsrv->last_kill_signal = m->fsrv.last_kill_signal;
+  ++fsrv->total_execs;
+
+}
+
+/* Wait for the first member run to end, killing the ones that exceed the
+   timeout. Its outcome goes to *fault and its coverage to afl->fsrv, see
+   pool_adopt_run(). Returns the tag of the run, or -1 if none is running or
+   the user wants to quit. */
+
+s32 fsrv_pool_collect(afl_state_t *afl, u8 *fault) {
+
+  struct pollfd            pfd[FSRV_POOL_MAX];
+  struct fsrv_pool_member *busy[FSRV_POOL_MAX], *m;
+  u32                      i, n, timeout;
+  s32                      wait_ms, ret;
+  u64                      now;
+
+  while (1) {
+
+    if (afl->stop_soon || !afl->fsrv_pool_busy) { return -1; }
+
+    now = get_cur_time();
+    wait_ms = -1;
+
+    for (i = n = 0; i < afl->fsrv_pool_cnt; ++i) {
+
+      struct fsrv_pool_member *b = &afl->fsrv_pool[i];
+
+      if (!b->busy) { continue; }
+
+      if (b->deadline <= now) {
+
+        wait_ms = 0;
+
+      } else if (wait_ms < 0 || b->deadline - now < (u64)wait_ms) {
+
+        wait_ms = b->deadline - now;
+
+      }
+
+      pfd[n].fd = b->fsrv.fsrv_st_fd;
+      pfd[n].events = POLLIN;
+      pfd[n].revents = 0;
+      busy[n++] = b;
+
+    }
+
+    /* runs that ended count as in time even if their deadline passed while
+       we were busy with other results, so look for those first */
+    ret = poll(pfd, n, wait_ms);
+
+    if (ret < 0) {
+
+      if (errno == EINTR) { continue; }
+      PFATAL("poll() failed");
+
+    }
+
+    if (ret) {
+
+      for (i = 0; !pfd[i].revents; ++i) {}
+      m = busy[i];
+      timeout = afl->fsrv.exec_tmout;
+
+    } else {
+
+      now = get_cur_time();
+      for (i = 0; i < n && busy[i]->deadline > now; ++i) {}
+      if (i == n) { continue; }
+
+      /* timed out: afl_fsrv_run_finish() kills the child */
+      m = busy[i];
+      timeout = 0;
+
+    }
+
+    *fault = afl_fsrv_run_finish(&m->fsrv, timeout, &afl->stop_soon);
+
+    m->busy = 0;
+    --afl->fsrv_pool_busy;
+
+    if (afl->stop_soon) { return -1; }
+
+    pool_adopt_run(afl, m);
+    return m->tag;
+
+  }
+
+}
+
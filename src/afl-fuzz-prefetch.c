@@ -0,0 +1,294 @@
+/*
+   american fuzzy lop++ - testcase prefetching
+   -------------------------------------------
+
+   Originally written by Michal Zalewski
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                        Heiko Eißfeldt <heiko.eissfeldt@hexco.de> and
+                        Andrea Fioraldi <andreafioraldi@gmail.com>
+
+   Copyright 2016, 2017 Google Inc. All rights reserved.
+   Copyright 2019-2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   AFL_TESTCACHE_PREFETCH: the next queue entry to fuzz and the next splice
+   partner are drawn one step ahead (select_next_queue_entry(),
+   select_splice_partner()), and a helper thread reads their testcases while
+   the current one is fuzzed. queue_testcase_get() then takes the buffer
+   over into the testcase cache instead of doing the open() and read()
+   itself. The thread only ever touches the slots below, never the queue or
+   the cache.
+
+ */
+
+#include "afl-fuzz.h"
+
+#include <pthread.h>
+
+enum {
+
+  /* 00 */ PREFETCH_FREE,
+  /* 01 */ PREFETCH_QUEUED,
+  /* 02 */ PREFETCH_READING,
+  /* 03 */ PREFETCH_DONE,
+  /* 04 */ PREFETCH_CANCELLED                  /* Reading, result unwanted */
+
+};
+
+struct prefetch_slot {
+
+  struct queue_entry *q;
+  u8 *                buf;                   /* malloc()ed, once DONE      */
+  u32                 len;
+  u8                  state;
+  u8                  fname[PATH_MAX];
+
+};
+
+struct testcase_prefetch {
+
+  pthread_t            thread;
+  pthread_mutex_t      lock;
+  pthread_cond_t       cond;
+  struct prefetch_slot slot[TESTCASE_PREFETCH_SLOTS];
+  u32                  next;                 /* Slot of the next request   */
+  u8                   stop;
+
+};
+
+/* The helper thread: read queued slots until told to stop. A file that
+   cannot be read is left to queue_testcase_get(), which will complain. */
+
+static void *prefetch_thread(void *arg) {
+
+  struct testcase_prefetch *p = arg;
+  struct prefetch_slot *    s;
+  u8 *                      buf;
+  s32                       fd;
+  u32                       i;
+
+  pthread_mutex_lock(&p->lock);
+
+  while (!p->stop) {
+
+    for (s = NULL, i = 0; i < TESTCASE_PREFETCH_SLOTS; ++i) {
+
+      if (p->slot[i].state == PREFETCH_QUEUED) {
+
+        s = &p->slot[i];
+        break;
+
+      }
+
+    }
+
+    if (!s) {
+
+      pthread_cond_wait(&p->cond, &p->lock);
+      continue;
+
+    }
+
+    /* fname and len do not change while the slot is being read */
+    s->state = PREFETCH_READING;
+    pthread_mutex_unlock(&p->lock);
+
+    buf = malloc(s->len);
+    fd = open(s->fname, O_RDONLY);
+
+    if (buf && (fd < 0 || read(fd, buf, s->len) != (ssize_t)s->len)) {
+
+      free(buf);
+      buf = NULL;
+
+    }
+
+    if (fd >= 0) { close(fd); }
+
+    pthread_mutex_lock(&p->lock);
+
+    if (s->state == PREFETCH_CANCELLED || !buf) {
+
+      free(buf);
+      s->state = PREFETCH_FREE;
+
+    } else {
+
+      s->buf = buf;
+      s->state = PREFETCH_DONE;
+
+    }
+
+  }
+
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+
+}
+
+void testcase_prefetch_init(afl_state_t *afl) {
+
+  struct testcase_prefetch *p = ck_alloc(sizeof(struct testcase_prefetch));
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+
+  if (pthread_create(&p->thread, NULL, prefetch_thread, p)) {
+
+    WARNF("Could not start the testcase prefetch thread");
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    ck_free(p);
+    return;
+
+  }
+
+  afl->tc_prefetch = p;
+  afl->sel_next = afl->splice_next = (u32)-1;
+
+  OKF("Prefetching testcases in a helper thread (%u slots)",
+      TESTCASE_PREFETCH_SLOTS);
+
+}
+
+void testcase_prefetch_deinit(afl_state_t *afl) {
+
+  struct testcase_prefetch *p = afl->tc_prefetch;
+  u32                       i;
+
+  if (!p) { return; }
+
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->thread, NULL);
+
+  for (i = 0; i < TESTCASE_PREFETCH_SLOTS; ++i) {
+
+    if (p->slot[i].state == PREFETCH_DONE) { free(p->slot[i].buf); }
+
+  }
+
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+  ck_free(p);
+  afl->tc_prefetch = NULL;
+
+}
+
+/* Have the testcase of q read ahead, unless it is cached or on its way.
+   The oldest request gives way, one that is being read is left alone. */
+
+void testcase_prefetch(afl_state_t *afl, struct queue_entry *q) {
+
+  struct testcase_prefetch *p = afl->tc_prefetch;
+  struct prefetch_slot *    s;
+  u32                       i;
+
+  if (q->testcase_buf) { return; }
+
+  pthread_mutex_lock(&p->lock);
+
+  for (i = 0; i < TESTCASE_PREFETCH_SLOTS; ++i) {
+
+    if (p->slot[i].q == q && p->slot[i].state != PREFETCH_FREE &&
+        p->slot[i].state != PREFETCH_CANCELLED) {
+
+      pthread_mutex_unlock(&p->lock);
+      return;
+
+    }
+
+  }
+
+  s = &p->slot[p->next];
+
+  if (s->state == PREFETCH_READING || s->state == PREFETCH_CANCELLED) {
+
+    pthread_mutex_unlock(&p->lock);
+    return;
+
+  }
+
+  if (s->state == PREFETCH_DONE) { free(s->buf); }
+
+  s->q = q;
+  s->buf = NULL;
+  s->len = q->len;
+  snprintf(s->fname, PATH_MAX, "%s", q->fname);
+  s->state = PREFETCH_QUEUED;
+  p->next = (p->next + 1) % TESTCASE_PREFETCH_SLOTS;
+
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+
+}
+
+/* The testcase of q if it was read ahead, for the caller to keep, else
+   NULL. Either way no slot holds q anymore, a pending read is dropped:
+   waiting for it would be no faster than reading. */
+
+u8 *testcase_prefetch_take(afl_state_t *afl, struct queue_entry *q) {
+
+  struct testcase_prefetch *p = afl->tc_prefetch;
+  struct prefetch_slot *    s;
+  u8 *                      buf = NULL;
+  u32                       i;
+
+  pthread_mutex_lock(&p->lock);
+
+  for (i = 0; i < TESTCASE_PREFETCH_SLOTS; ++i) {
+
+    s = &p->slot[i];
+    if (s->q != q) { continue; }
+
+    switch (s->state) {
+
+      case PREFETCH_DONE:
+        if (likely(s->len == q->len)) {
+
+          buf = s->buf;
+
+        } else {
+
+          free(s->buf);
+
+        }
+
+        s->state = PREFETCH_FREE;
+        break;
+
+      case PREFETCH_QUEUED:
+        s->state = PREFETCH_FREE;
+        break;
+
+      case PREFETCH_READING:
+        s->state = PREFETCH_CANCELLED;
+        break;
+
+    }
+
+    s->q = NULL;
+
+  }
+
+  pthread_mutex_unlock(&p->lock);
+
+  return buf;
+
+}
+
+/* The file behind q changed, forget what was read of it */
+
+void testcase_prefetch_drop(afl_state_t *afl, struct queue_entry *q) {
+
+  free(testcase_prefetch_take(afl, q));
+
+}
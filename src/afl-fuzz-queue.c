@@ -27,20 +27,16 @@
 #include <ctype.h>
 #include <math.h>
 
-/* select next queue entry based on alias algo - fast! */
-
-inline u32 select_next_queue_entry(afl_state_t *afl) {
-
-  u32    s = rand_below(afl, afl->queued_paths);
-  double p = rand_next_percent(afl);
-  /*
-  fprintf(stderr, "select: p=%f s=%u ... p < prob[s]=%f ? s=%u : alias[%u]=%u"
-  " ==> %u\n", p, s, afl->alias_probability[s], s, s, afl->alias_table[s], p <
-  afl->alias_probability[s] ? s : afl->alias_table[s]);
-  */
-  return (p < afl->alias_probability[s] ? s : afl->alias_table[s]);
-
-}
+/* Weighted seed selection. The weights of the queue entries are the leaves
+   of a Fenwick tree (afl->sel_tree, 1-based, sel_cap leaves), so that one
+   weight is changed and an entry is drawn in O(log n) instead of building
+   an alias table over the whole queue after every find. The parts of a
+   weight that depend on the whole queue (the averages, the n_fuzz hits of
+   other entries) are only refreshed when the tree is rebuilt: when it is
+   full, after as many weight updates as there are entries, or once the
+   queue grew by 1 / SEL_REFRESH_DIV. The alias table was rebuilt after
+   every find, here the weight of an entry that is not touched otherwise can
+   miss the n_fuzz hits of up to queued_paths / SEL_REFRESH_DIV finds. */
 
 double compute_weight(afl_state_t *afl, struct queue_entry *q,
                       double avg_exec_us, double avg_bitmap_size,
@@ -65,29 +61,51 @@ double compute_weight(afl_state_t *afl, struct queue_entry *q,
 
 }
 
-/* create the alias table that allows weighted random selection - expensive */
+/* The selection weight of a queue entry, 0 if it is disabled. */
+
+static double queue_weight(afl_state_t *afl, struct queue_entry *q) {
+
+  if (unlikely(q->disabled)) { return 0; }
+
+  if (unlikely(afl->schedule == BANDIT)) { return seed_sched_mean(afl, q); }
+
+  if (likely(afl->schedule < RARE)) {
+
+    return compute_weight(afl, q, afl->sel_avg_exec_us,
+                          afl->sel_avg_bitmap_size, afl->sel_avg_top_size);
+
+  }
 
-void create_alias_table(afl_state_t *afl) {
+  return calculate_score(afl, q);
 
-  u32    n = afl->queued_paths, i = 0, a, g;
-  double sum = 0;
+}
 
-  afl->alias_table =
-      (u32 *)afl_realloc((void **)&afl->alias_table, n * sizeof(u32));
-  afl->alias_probability = (double *)afl_realloc(
-      (void **)&afl->alias_probability, n * sizeof(double));
-  double *P = (double *)afl_realloc(AFL_BUF_PARAM(out), n * sizeof(double));
-  int *   S = (u32 *)afl_realloc(AFL_BUF_PARAM(out_scratch), n * sizeof(u32));
-  int *   L = (u32 *)afl_realloc(AFL_BUF_PARAM(in_scratch), n * sizeof(u32));
+static inline void sel_tree_add(afl_state_t *afl, u32 idx, double delta) {
 
-  if (!P || !S || !L || !afl->alias_table || !afl->alias_probability) {
+  for (++idx; idx <= afl->sel_cap; idx += idx & -idx) {
 
-    FATAL("could not acquire memory for alias table");
+    afl->sel_tree[idx] += delta;
 
   }
 
-  memset((void *)afl->alias_table, 0, n * sizeof(u32));
-  memset((void *)afl->alias_probability, 0, n * sizeof(double));
+}
+
+/* Recompute all weights and the tree - O(n) */
+
+static void queue_weights_rebuild(afl_state_t *afl) {
+
+  u32 n = afl->queued_paths, i, j;
+
+  if (n > afl->sel_cap || !afl->sel_tree) {
+
+    /* room to grow, entries are appended until the tree is full */
+    for (afl->sel_cap = 64; afl->sel_cap < n << 1; afl->sel_cap <<= 1) {}
+
+    afl->sel_tree = (double *)afl_realloc((void **)&afl->sel_tree,
+                                          (afl->sel_cap + 1) * sizeof(double));
+    if (unlikely(!afl->sel_tree)) { PFATAL("alloc"); }
+
+  }
 
   if (likely(afl->schedule < RARE)) {
 
@@ -112,131 +130,197 @@ void create_alias_table(afl_state_t *afl) {
 
     }
 
-    avg_exec_us /= active;
-    avg_bitmap_size /= active;
-    avg_top_size /= active;
+    afl->sel_avg_exec_us = avg_exec_us / active;
+    afl->sel_avg_bitmap_size = avg_bitmap_size / active;
+    afl->sel_avg_top_size = avg_top_size / active;
 
-    for (i = 0; i < n; i++) {
+  }
 
-      struct queue_entry *q = afl->queue_buf[i];
+  memset(afl->sel_tree, 0, (afl->sel_cap + 1) * sizeof(double));
 
-      if (likely(!q->disabled)) {
+  for (i = 0; i < n; i++) {
 
-        q->weight =
-            compute_weight(afl, q, avg_exec_us, avg_bitmap_size, avg_top_size);
-        q->perf_score = calculate_score(afl, q);
-        sum += q->weight;
+    struct queue_entry *q = afl->queue_buf[i];
 
-      }
+    q->weight = queue_weight(afl, q);
+    afl->sel_tree[i + 1] = q->weight;
 
-    }
+  }
 
-    for (i = 0; i < n; i++) {
+  for (i = 1; i <= afl->sel_cap; i++) {
 
-      // weight is always 0 for disabled entries
-      P[i] = (afl->queue_buf[i]->weight * n) / sum;
+    j = i + (i & -i);
+    if (j <= afl->sel_cap) { afl->sel_tree[j] += afl->sel_tree[i]; }
 
-    }
+  }
 
-  } else {
+  afl->sel_cnt = n;
+  afl->sel_updates = 0;
+  afl->sel_rebuilt = n;
+  afl->reinit_table = 0;
 
-    for (i = 0; i < n; i++) {
+}
 
-      struct queue_entry *q = afl->queue_buf[i];
+/* The weight of q changed, e.g. it was fuzzed or became favored. Entries
+   that are not in the tree yet get theirs when they are added. */
 
-      if (likely(!q->disabled)) { q->perf_score = calculate_score(afl, q); }
+void queue_weight_update(afl_state_t *afl, struct queue_entry *q) {
 
-      sum += q->perf_score;
+  double weight;
 
-    }
+  if (unlikely(q->id >= afl->sel_cnt)) { return; }
 
-    for (i = 0; i < n; i++) {
+  weight = queue_weight(afl, q);
+  sel_tree_add(afl, q->id, weight - q->weight);
+  q->weight = weight;
+  ++afl->sel_updates;
 
-      // perf_score is always 0 for disabled entries
-      P[i] = (afl->queue_buf[i]->perf_score * n) / sum;
+}
+
+/* Draw an entry with a probability proportional to its weight: descend the
+   tree to the first leaf whose prefix sum exceeds a random point. */
+
+static u32 sel_tree_draw(afl_state_t *afl) {
+
+  double r = rand_next_percent(afl) * afl->sel_tree[afl->sel_cap];
+  u32    pos = 0, step;
+
+  for (step = afl->sel_cap; step; step >>= 1) {
+
+    if (pos + step <= afl->sel_cap && afl->sel_tree[pos + step] <= r) {
+
+      pos += step;
+      r -= afl->sel_tree[pos];
 
     }
 
   }
 
-  int nS = 0, nL = 0, s;
-  for (s = (s32)n - 1; s >= 0; --s) {
+  return pos;
 
-    if (P[s] < 1) {
+}
 
-      S[nS++] = s;
+/* Draw an entry from the tree, for the bandit schedule the winner among a
+   few candidates. */
 
-    } else {
+static u32 sel_pick(afl_state_t *afl) {
 
-      L[nL++] = s;
+  u32 s = sel_tree_draw(afl);
 
-    }
+  if (unlikely(s >= afl->sel_cnt || afl->queue_buf[s]->disabled)) {
+
+    /* rounding errors of the updates, or nothing has a weight */
+    queue_weights_rebuild(afl);
+    s = sel_tree_draw(afl);
+    if (s >= afl->sel_cnt) { s = rand_below(afl, afl->sel_cnt); }
 
   }
 
-  while (nS && nL) {
+  if (unlikely(afl->schedule == BANDIT)) {
 
-    a = S[--nS];
-    g = L[--nL];
-    afl->alias_probability[a] = P[a];
-    afl->alias_table[a] = g;
-    P[g] = P[g] + P[a] - 1;
-    if (P[g] < 1) {
+    /* the candidates for the bandit: half by their estimated rate, half
+       uniformly, so that seeds with a low estimate get another chance */
 
-      S[nS++] = g;
+    u32 cand[SEED_SCHED_CANDIDATES], i;
 
-    } else {
+    for (i = 0; i < SEED_SCHED_CANDIDATES; ++i) {
 
-      L[nL++] = g;
+      cand[i] = (i & 1) ? rand_below(afl, afl->sel_cnt) : sel_tree_draw(afl);
+      if (cand[i] >= afl->sel_cnt || afl->queue_buf[cand[i]]->disabled) {
+
+        cand[i] = s;
+
+      }
 
     }
 
+    s = seed_sched_pick(afl, cand, SEED_SCHED_CANDIDATES);
+
   }
 
-  while (nL)
-    afl->alias_probability[L[--nL]] = 1;
+  return s;
 
-  while (nS)
-    afl->alias_probability[S[--nS]] = 1;
+}
 
-  afl->reinit_table = 0;
+/* select next queue entry based on the weights - fast! With
+   AFL_TESTCACHE_PREFETCH the entry is drawn one call ahead, so that its
+   testcase can be read while the current one is fuzzed. */
 
-  /*
-  #ifdef INTROSPECTION
-    u8 fn[PATH_MAX];
-    snprintf(fn, PATH_MAX, "%s/introspection_corpus.txt", afl->out_dir);
-    FILE *f = fopen(fn, "a");
-    if (f) {
-
-      for (i = 0; i < n; i++) {
-
-        struct queue_entry *q = afl->queue_buf[i];
-        fprintf(
-            f,
-            "entry=%u name=%s favored=%s variable=%s disabled=%s len=%u "
-            "exec_us=%u "
-            "bitmap_size=%u bitsmap_size=%u tops=%u weight=%f perf_score=%f\n",
-            i, q->fname, q->favored ? "true" : "false",
-            q->var_behavior ? "true" : "false", q->disabled ? "true" : "false",
-            q->len, (u32)q->exec_us, q->bitmap_size, q->bitsmap_size, q->tc_ref,
-            q->weight, q->perf_score);
+u32 select_next_queue_entry(afl_state_t *afl) {
 
-      }
+  struct queue_entry *q;
+  u32                 s;
 
-      fprintf(f, "\n");
-      fclose(f);
+  if (unlikely(afl->reinit_table || afl->queued_paths > afl->sel_cap ||
+               afl->sel_updates > afl->queued_paths ||
+               afl->queued_paths - afl->sel_rebuilt >
+                   afl->sel_rebuilt / SEL_REFRESH_DIV)) {
 
-    }
+    queue_weights_rebuild(afl);
+
+  }
+
+  while (unlikely(afl->sel_cnt < afl->queued_paths)) {
 
-  #endif
-  */
-  /*
-  fprintf(stderr, "  entry  alias  probability  perf_score   weight
-  filename\n"); for (u32 i = 0; i < n; ++i) fprintf(stderr, "  %5u  %5u  %11u
-  %0.9f  %0.9f  %s\n", i, afl->alias_table[i], afl->alias_probability[i],
-  afl->queue_buf[i]->perf_score, afl->queue_buf[i]->weight,
-            afl->queue_buf[i]->fname);
-  */
+    q = afl->queue_buf[afl->sel_cnt++];
+    q->weight = 0;
+    queue_weight_update(afl, q);
+
+  }
+
+  if (likely(!afl->tc_prefetch)) {
+
+    s = sel_pick(afl);
+
+  } else {
+
+    s = afl->sel_next;
+    if (s >= afl->sel_cnt || afl->queue_buf[s]->disabled) { s = sel_pick(afl); }
+
+    afl->sel_next = sel_pick(afl);
+    testcase_prefetch(afl, afl->queue_buf[afl->sel_next]);
+
+  }
+
+  q = afl->queue_buf[s];
+  q->perf_score = calculate_score(afl, q);
+
+  return s;
+
+}
+
+/* A random queue entry other than the current one, with at least 4 bytes,
+   to splice with. With AFL_TESTCACHE_PREFETCH it is drawn one call ahead
+   as well. The caller made sure that there is one. */
+
+u32 select_splice_partner(afl_state_t *afl) {
+
+  u32 tid = afl->splice_next;
+
+  if (likely(!afl->tc_prefetch) || tid >= afl->queued_paths ||
+      tid == afl->current_entry || afl->queue_buf[tid]->len < 4) {
+
+    do {
+
+      tid = rand_below(afl, afl->queued_paths);
+
+    } while (tid == afl->current_entry || afl->queue_buf[tid]->len < 4);
+
+  }
+
+  if (unlikely(afl->tc_prefetch)) {
+
+    do {
+
+      afl->splice_next = rand_below(afl, afl->queued_paths);
+
+    } while (afl->queue_buf[afl->splice_next]->len < 4);
+
+    testcase_prefetch(afl, afl->queue_buf[afl->splice_next]);
+
+  }
+
+  return tid;
 
 }
 
@@ -535,6 +619,8 @@ void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
   u32 i;
   u64 fav_factor;
   u64 fuzz_p2;
+  u32 lost_cnt = 0;
+  u8  won = 0;
 
   if (unlikely(afl->schedule >= FAST && afl->schedule < RARE))
     fuzz_p2 = 0;  // Skip the fuzz_p2 comparison
@@ -553,6 +639,12 @@ void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
 
   }
 
+  if (unlikely(!afl->cull_dirty)) {
+
+    afl->cull_dirty = ck_alloc(afl->fsrv.map_size >> 3);
+
+  }
+
   /* For every byte set in afl->fsrv.trace_bits[], see if there is a previous
      winner, and how it compares to us. */
   for (i = 0; i < afl->fsrv.map_size; ++i) {
@@ -607,12 +699,37 @@ void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
         }
 
         /* Looks like we're going to win. Decrease ref count for the
-           previous winner, discard its afl->fsrv.trace_bits[] if necessary. */
+           previous winner, discard its afl->fsrv.trace_bits[] if necessary.
+           A favored one keeps them until cull_queue() unfavors it. */
 
         if (!--afl->top_rated[i]->tc_ref) {
 
-          ck_free(afl->top_rated[i]->trace_mini);
-          afl->top_rated[i]->trace_mini = 0;
+          if (afl->top_rated[i]->favored) {
+
+            afl->cull_lost_buf = afl_realloc(
+                AFL_BUF_PARAM(cull_lost),
+                (afl->cull_lost_cnt + 1) * sizeof(struct queue_entry *));
+            if (unlikely(!afl->cull_lost_buf)) { PFATAL("alloc"); }
+            afl->cull_lost_buf[afl->cull_lost_cnt++] = afl->top_rated[i];
+
+          } else {
+
+            ck_free(afl->top_rated[i]->trace_mini);
+            afl->top_rated[i]->trace_mini = 0;
+
+          }
+
+        }
+
+        /* its weight depends on tc_ref, update it once after the loop */
+        if (!afl->top_rated[i]->sel_lost) {
+
+          afl->sel_lost_buf = afl_realloc(
+              AFL_BUF_PARAM(sel_lost),
+              (lost_cnt + 1) * sizeof(struct queue_entry *));
+          if (unlikely(!afl->sel_lost_buf)) { PFATAL("alloc"); }
+          afl->sel_lost_buf[lost_cnt++] = afl->top_rated[i];
+          afl->top_rated[i]->sel_lost = 1;
 
         }
 
@@ -622,38 +739,126 @@ void update_bitmap_score(afl_state_t *afl, struct queue_entry *q) {
 
       afl->top_rated[i] = q;
       ++q->tc_ref;
+      afl->cull_dirty[i >> 3] |= 1 << (i & 7);
 
       if (!q->trace_mini) {
 
-        u32 len = (afl->fsrv.map_size >> 3);
-        q->trace_mini = ck_alloc(len);
-        minimize_bits(afl, q->trace_mini, afl->fsrv.trace_bits);
+        q->trace_mini = trace_mini_new(afl, afl->fsrv.trace_bits);
 
       }
 
       afl->score_changed = 1;
+      won = 1;
 
     }
 
   }
 
+  for (i = 0; i < lost_cnt; ++i) {
+
+    afl->sel_lost_buf[i]->sel_lost = 0;
+    queue_weight_update(afl, afl->sel_lost_buf[i]);
+
+  }
+
+  if (won) { queue_weight_update(afl, q); }
+
 }
 
 /* The second part of the mechanism discussed above is a routine that
    goes over afl->top_rated[] entries, and then sequentially grabs winners for
    previously-unseen bytes (temp_v) and marks them as favored, at least
    until the next run. The favored entries are given more air time during
-   all fuzzing steps. */
+   all fuzzing steps.
 
-void cull_queue(afl_state_t *afl) {
+   Doing that for the whole map after every new find gets slow for big maps
+   and queues, so mostly the favored set is only updated for the bytes whose
+   top_rated[] entry changed: afl->cull_cover[] counts the favored entries
+   that cover every byte, a byte without one gets its winner favored, and a
+   favored entry that is no winner anywhere anymore is dropped. */
 
-  if (likely(!afl->score_changed || afl->non_instrumented_mode)) { return; }
+static void cull_favor(afl_state_t *afl, struct queue_entry *q) {
+
+  u32 *edges = trace_mini_edges(afl, q->trace_mini), i;
+
+  q->favored = 1;
+  ++afl->queued_favored;
+  if (q->fuzz_level == 0 || !q->was_fuzzed) { ++afl->pending_favored; }
+
+  for (i = 0; i < q->trace_mini->cnt; ++i) {
+
+    ++afl->cull_cover[edges[i]];
+
+  }
+
+  queue_weight_update(afl, q);
+
+  if (likely(!q->disabled)) { mark_as_redundant(afl, q, 0); }
+
+}
+
+static void cull_unfavor(afl_state_t *afl, struct queue_entry *q) {
+
+  u32 *edges = trace_mini_edges(afl, q->trace_mini), *uncov, cnt = 0, i;
+
+  q->favored = 0;
+  --afl->queued_favored;
+  if ((q->fuzz_level == 0 || !q->was_fuzzed) && afl->pending_favored) {
+
+    --afl->pending_favored;
+
+  }
+
+  /* bytes only this entry covered go to their current winner; they are
+     collected first, cull_favor() reuses the buffer of a dense trace */
+
+  uncov = afl_realloc(AFL_BUF_PARAM(cull_uncov),
+                      q->trace_mini->cnt * sizeof(u32) + 1);
+  if (unlikely(!uncov)) { PFATAL("alloc"); }
+
+  for (i = 0; i < q->trace_mini->cnt; ++i) {
+
+    if (!--afl->cull_cover[edges[i]] && afl->top_rated[edges[i]]) {
+
+      uncov[cnt++] = edges[i];
+
+    }
+
+  }
+
+  for (i = 0; i < cnt; ++i) {
+
+    if (!afl->cull_cover[uncov[i]] && !afl->top_rated[uncov[i]]->favored) {
+
+      cull_favor(afl, afl->top_rated[uncov[i]]);
+
+    }
+
+  }
+
+  ck_free(q->trace_mini);
+  q->trace_mini = 0;
+
+  queue_weight_update(afl, q);
+  if (likely(!q->disabled)) { mark_as_redundant(afl, q, 1); }
+
+}
+
+static void cull_queue_full(afl_state_t *afl) {
 
   u32 len = (afl->fsrv.map_size >> 3);
   u32 i;
   u8 *temp_v = afl->map_tmp_buf;
 
-  afl->score_changed = 0;
+  if (unlikely(!afl->cull_cover)) {
+
+    afl->cull_cover = ck_alloc(afl->fsrv.map_size * sizeof(u32));
+
+  } else {
+
+    memset(afl->cull_cover, 0, afl->fsrv.map_size * sizeof(u32));
+
+  }
 
   memset(temp_v, 255, len);
 
@@ -673,15 +878,28 @@ void cull_queue(afl_state_t *afl) {
 
     if (afl->top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
 
-      u32 j = len;
+      struct trace_mini *m = afl->top_rated[i]->trace_mini;
+      u32 *              edges, j;
 
       /* Remove all bits belonging to the current entry from temp_v. */
 
-      while (j--) {
+      if (m->dense) {
+
+        u64 *mini = (u64 *)m->data, *v = (u64 *)temp_v;
+
+        for (j = 0; j < len >> 3; ++j) {
+
+          v[j] &= ~mini[j];
+
+        }
+
+      } else {
 
-        if (afl->top_rated[i]->trace_mini[j]) {
+        edges = (u32 *)m->data;
 
-          temp_v[j] &= ~afl->top_rated[i]->trace_mini[j];
+        for (j = 0; j < m->cnt; ++j) {
+
+          temp_v[edges[j] >> 3] &= ~(1 << (edges[j] & 7));
 
         }
 
@@ -699,6 +917,14 @@ void cull_queue(afl_state_t *afl) {
 
         }
 
+        edges = trace_mini_edges(afl, m);
+
+        for (j = 0; j < m->cnt; ++j) {
+
+          ++afl->cull_cover[edges[j]];
+
+        }
+
       }
 
     }
@@ -707,6 +933,64 @@ void cull_queue(afl_state_t *afl) {
 
   for (i = 0; i < afl->queued_paths; i++) {
 
+    struct queue_entry *q = afl->queue_buf[i];
+
+    if (!q->favored && !q->tc_ref && q->trace_mini) {
+
+      ck_free(q->trace_mini);
+      q->trace_mini = 0;
+
+    }
+
+    if (likely(!q->disabled)) { mark_as_redundant(afl, q, !q->favored); }
+
+  }
+
+  afl->cull_lost_cnt = 0;
+  memset(afl->cull_dirty, 0, len);
+  afl->reinit_table = 1;
+
+}
+
+static void cull_queue_incr(afl_state_t *afl) {
+
+  u64 *dirty = (u64 *)afl->cull_dirty, bits;
+  u32  i, idx;
+
+  for (i = 0; i < afl->cull_lost_cnt; ++i) {
+
+    if (afl->cull_lost_buf[i]->favored && !afl->cull_lost_buf[i]->tc_ref) {
+
+      cull_unfavor(afl, afl->cull_lost_buf[i]);
+
+    }
+
+  }
+
+  afl->cull_lost_cnt = 0;
+
+  for (i = 0; i < afl->fsrv.map_size >> 6; ++i) {
+
+    for (bits = dirty[i]; bits; bits &= bits - 1) {
+
+      idx = (i << 6) + __builtin_ctzll(bits);
+      if (!afl->cull_cover[idx] && afl->top_rated[idx] &&
+          !afl->top_rated[idx]->favored) {
+
+        cull_favor(afl, afl->top_rated[idx]);
+
+      }
+
+    }
+
+    dirty[i] = 0;
+
+  }
+
+  /* new entries that did not make it are redundant */
+
+  for (i = afl->cull_queued; i < afl->queued_paths; i++) {
+
     if (likely(!afl->queue_buf[i]->disabled)) {
 
       mark_as_redundant(afl, afl->queue_buf[i], !afl->queue_buf[i]->favored);
@@ -717,12 +1001,36 @@ void cull_queue(afl_state_t *afl) {
 
 }
 
+void cull_queue(afl_state_t *afl) {
+
+  if (likely(!afl->score_changed || afl->non_instrumented_mode)) { return; }
+
+  afl->score_changed = 0;
+
+  if (unlikely(!afl->cull_cover || ++afl->cull_incr >= CULL_QUEUE_FULL)) {
+
+    cull_queue_full(afl);
+    afl->cull_incr = 0;
+
+  } else {
+
+    cull_queue_incr(afl);
+
+  }
+
+  afl->cull_queued = afl->queued_paths;
+
+}
+
 /* Calculate case desirability score to adjust the length of havoc fuzzing.
    A helper function for fuzz_one(). Maybe some of these constants should
    go into config.h. */
 
 u32 calculate_score(afl_state_t *afl, struct queue_entry *q) {
 
+  /* the bandit schedule spends execs on the seeds that found paths */
+  if (unlikely(afl->schedule == BANDIT)) { return seed_sched_score(afl, q); }
+
   u32 avg_exec_us = afl->total_cal_us / afl->total_cal_cycles;
   u32 avg_bitmap_size = afl->total_bitmap_size / afl->total_bitmap_entries;
   u32 perf_score = 100;
@@ -1004,6 +1312,8 @@ u32 calculate_score(afl_state_t *afl, struct queue_entry *q) {
 inline void queue_testcase_retake(afl_state_t *afl, struct queue_entry *q,
                                   u32 old_len) {
 
+  if (unlikely(afl->tc_prefetch)) { testcase_prefetch_drop(afl, q); }
+
   if (likely(q->testcase_buf)) {
 
     u32 len = q->len;
@@ -1037,6 +1347,8 @@ inline void queue_testcase_retake(afl_state_t *afl, struct queue_entry *q,
 inline void queue_testcase_retake_mem(afl_state_t *afl, struct queue_entry *q,
                                       u8 *in, u32 len, u32 old_len) {
 
+  if (unlikely(afl->tc_prefetch)) { testcase_prefetch_drop(afl, q); }
+
   if (likely(q->testcase_buf)) {
 
     u32 is_same = in == q->testcase_buf;
@@ -1104,8 +1416,7 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
   if (unlikely(!q->testcase_buf)) {
 
     /* Buf not cached, let's load it */
-    u32        tid = afl->q_testcase_max_cache_count;
-    static u32 do_once = 0;  // because even threaded we would want this. WIP
+    u32 tid = afl->q_testcase_max_cache_count;
 
     while (unlikely(
         afl->q_testcase_cache_size + len >= afl->q_testcase_max_cache_size ||
@@ -1120,7 +1431,7 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
                         afl->q_testcase_max_cache_entries &&
                     afl->q_testcase_max_cache_count <
                         afl->q_testcase_max_cache_entries) &&
-                   !do_once)) {
+                   !afl->q_testcase_entries_learned)) {
 
         if (afl->q_testcase_max_cache_count > afl->q_testcase_cache_count) {
 
@@ -1133,7 +1444,7 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
 
         }
 
-        do_once = 1;
+        afl->q_testcase_entries_learned = 1;
         // release unneeded memory
         afl->q_testcase_cache = ck_realloc(
             afl->q_testcase_cache,
@@ -1141,20 +1452,30 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
 
       }
 
-      /* Cache full. We neet to evict one or more to map one.
-         Get a random one which is not in use */
+      /* Cache full. We need to evict one or more to map one: CLOCK, the
+         hand skips (and clears) entries that were used since it passed
+         them last, and the one being fuzzed. Amortized O(1). */
+
+      while (1) {
 
-      do {
+        tid = afl->q_testcase_clock;
+        if (++afl->q_testcase_clock >= afl->q_testcase_max_cache_count) {
 
-        // if the cache (MB) is not enough for the queue then this gets
-        // undesirable because q_testcase_max_cache_count grows sometimes
-        // although the number of items in the cache will not change hence
-        // more and more loops
-        tid = rand_below(afl, afl->q_testcase_max_cache_count);
+          afl->q_testcase_clock = 0;
 
-      } while (afl->q_testcase_cache[tid] == NULL ||
+        }
 
-               afl->q_testcase_cache[tid] == afl->queue_cur);
+        if (afl->q_testcase_cache[tid] == NULL ||
+            afl->q_testcase_cache[tid] == afl->queue_cur) {
+
+          continue;
+
+        }
+
+        if (!afl->q_testcase_cache[tid]->testcase_ref) { break; }
+        afl->q_testcase_cache[tid]->testcase_ref = 0;
+
+      }
 
       struct queue_entry *old_cached = afl->q_testcase_cache[tid];
       free(old_cached->testcase_buf);
@@ -1180,22 +1501,28 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
     while (unlikely(afl->q_testcase_cache[tid] != NULL))
       ++tid;
 
-    /* Map the test case into memory. */
+    /* Map the test case into memory, unless the prefetch thread did. */
 
-    int fd = open(q->fname, O_RDONLY);
+    if (afl->tc_prefetch) { q->testcase_buf = testcase_prefetch_take(afl, q); }
 
-    if (unlikely(fd < 0)) { PFATAL("Unable to open '%s'", q->fname); }
+    if (likely(!q->testcase_buf)) {
 
-    q->testcase_buf = malloc(len);
+      int fd = open(q->fname, O_RDONLY);
 
-    if (unlikely(!q->testcase_buf)) {
+      if (unlikely(fd < 0)) { PFATAL("Unable to open '%s'", q->fname); }
 
-      PFATAL("Unable to malloc '%s' with len %u", q->fname, len);
+      q->testcase_buf = malloc(len);
 
-    }
+      if (unlikely(!q->testcase_buf)) {
 
-    ck_read(fd, q->testcase_buf, len, q->fname);
-    close(fd);
+        PFATAL("Unable to malloc '%s' with len %u", q->fname, len);
+
+      }
+
+      ck_read(fd, q->testcase_buf, len, q->fname);
+      close(fd);
+
+    }
 
     /* Register testcase as cached */
     afl->q_testcase_cache[tid] = q;
@@ -1211,6 +1538,10 @@ inline u8 *queue_testcase_get(afl_state_t *afl, struct queue_entry *q) {
 
     }
 
+  } else {
+
+    q->testcase_ref = 1;
+
   }
 
   return q->testcase_buf;
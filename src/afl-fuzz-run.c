@@ -76,6 +76,16 @@ fuzz_run_target(afl_state_t *afl, afl_forkserver_t *fsrv, u32 timeout) {
 void __attribute__((hot))
 write_to_testcase(afl_state_t *afl, void *mem, u32 len) {
 
+  write_to_fsrv_testcase(afl, &afl->fsrv, mem, len);
+
+}
+
+/* The same, for any fork server of this instance. */
+
+void __attribute__((hot))
+write_to_fsrv_testcase(afl_state_t *afl, afl_forkserver_t *fsrv, void *mem,
+                       u32 len) {
+
 #ifdef _AFL_DOCUMENT_MUTATIONS
   s32  doc_fd;
   char fn[PATH_MAX];
@@ -121,12 +131,12 @@ write_to_testcase(afl_state_t *afl, void *mem, u32 len) {
     });
 
     /* everything as planned. use the potentially new data. */
-    afl_fsrv_write_to_testcase(&afl->fsrv, new_mem, new_size);
+    afl_fsrv_write_to_testcase(fsrv, new_mem, new_size);
 
   } else {
 
     /* boring uncustom. */
-    afl_fsrv_write_to_testcase(&afl->fsrv, mem, len);
+    afl_fsrv_write_to_testcase(fsrv, mem, len);
 
   }
 
@@ -288,6 +298,29 @@ static void write_with_gap(afl_state_t *afl, u8 *mem, u32 len, u32 skip_at,
    to warn about flaky or otherwise problematic test cases early on; and when
    new paths are discovered to detect variable behavior and so on. */
 
+/* AFL_CAL_ADAPTIVE: after n runs that matched the first trace of a new find,
+   is it stable with enough confidence? The prior is the share of the
+   entries that calibration found variable so far, and the chance that a
+   variable entry shows it in a run is measured on those as well. */
+
+static u8 calibration_stable(afl_state_t *afl, u32 n) {
+
+  double prior = (afl->cal_var_entries + 1.0) / (afl->cal_entries + 2.0),
+         show = (afl->cal_var_diffs + 1.0) / (afl->cal_var_runs + 2.0),
+         missed = prior;
+
+  if (n < CAL_CYCLES_MIN) { return 0; }
+
+  while (n--) {
+
+    missed *= 1.0 - show;
+
+  }
+
+  return missed * 100 < CAL_VAR_RISK * (missed + 1.0 - prior);
+
+}
+
 u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
                   u32 handicap, u8 from_queue) {
 
@@ -297,9 +330,11 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
      first_run = (q->exec_cksum == 0);
   u64 start_us, stop_us, diff_us;
   s32 old_sc = afl->stage_cur, old_sm = afl->stage_max;
-  u32 use_tmout = afl->fsrv.exec_tmout;
+  u32 use_tmout = afl->fsrv.exec_tmout, matches = 0, diffs = 0;
   u8 *old_sn = afl->stage_name;
 
+  struct trace_check tc;
+
   /* Be a bit more generous about timeouts when resuming sessions, or when
      trying to calibrate already-added finds. This helps avoid trouble due
      to intermittent latency. */
@@ -384,17 +419,21 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
     if (unlikely(!q->bitsmap_size)) q->bitsmap_size = afl->bitsmap_size;
 #endif
 
-    classify_counts(&afl->fsrv);
-    cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
-    if (q->exec_cksum != cksum) {
+    /* A trace with the checksum of q was seen before, comparing it with
+       virgin_bits finds nothing, so do it in the same pass as the rest */
 
-      hnb = has_new_bits(afl, afl->virgin_bits);
-      if (hnb > new_bits) { new_bits = hnb; }
+    check_trace(afl, afl->virgin_bits, TRACE_CLASSIFY | TRACE_HASH, &tc);
+    cksum = tc.cksum;
+    if (tc.new_bits > new_bits) { new_bits = tc.new_bits; }
+
+    if (q->exec_cksum != cksum) {
 
       if (q->exec_cksum) {
 
         u32 i;
 
+        ++diffs;
+
         for (i = 0; i < afl->fsrv.map_size; ++i) {
 
           if (unlikely(!afl->var_bytes[i]) &&
@@ -434,10 +473,33 @@ u8 calibrate_case(afl_state_t *afl, struct queue_entry *q, u8 *use_mem,
 
       }
 
+    } else {
+
+      ++matches;
+
+    }
+
+    /* the initial corpus is calibrated in full, it is the prior */
+
+    if (afl->afl_env.afl_cal_adaptive && !from_queue && !var_detected &&
+        calibration_stable(afl, matches)) {
+
+      afl->stage_max = afl->stage_cur + 1;
+
     }
 
   }
 
+  ++afl->cal_entries;
+
+  if (var_detected) {
+
+    ++afl->cal_var_entries;
+    afl->cal_var_runs += afl->stage_max;
+    afl->cal_var_diffs += diffs;
+
+  }
+
   if (unlikely(afl->fixed_seed)) {
 
     diff_us = (u64)(afl->fsrv.exec_tmout - 1) * (u64)afl->stage_max;
@@ -771,6 +833,8 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
 
   u8 val_bufs[2][STRINGIFY_VAL_SIZE_MAX];
 
+  struct trace_check tc;
+
   /* Although the trimmer will be less useful when variable behavior is
      detected, it will still work to some extent, so we don't check for
      this. */
@@ -815,8 +879,8 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
        */
 
       ++afl->trim_execs;
-      classify_counts(&afl->fsrv);
-      cksum = hash64(afl->fsrv.trace_bits, afl->fsrv.map_size, HASH_CONST);
+      check_trace(afl, NULL, TRACE_CLASSIFY | TRACE_HASH, &tc);
+      cksum = tc.cksum;
 
       /* If the deletion had no impact on the trace, make it permanent. This
          isn't perfect for variable-path inputs, but we're just making a
@@ -897,6 +961,7 @@ u8 trim_case(afl_state_t *afl, struct queue_entry *q, u8 *in_buf) {
     queue_testcase_retake_mem(afl, q, in_buf, q->len, orig_len);
 
     memcpy(afl->fsrv.trace_bits, afl->clean_trace, afl->fsrv.map_size);
+    if (afl->fsrv.dirty_map) { afl->fsrv.dirty_map->valid = 0; }
     update_bitmap_score(afl, q);
 
   }
@@ -919,7 +984,30 @@ common_fuzz_stuff(afl_state_t *afl, u8 *out_buf, u32 len) {
 
   write_to_testcase(afl, out_buf, len);
 
-  fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
+  if (unlikely(afl->adaptive_tmout_mult)) {
+
+    /* killed early and nothing new so far: not even a timeout */
+    if (adaptive_run_target(afl, out_buf, len, &fault)) {
+
+      return afl->stop_soon;
+
+    }
+
+  } else {
+
+    fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
+
+  }
+
+  return common_fuzz_result(afl, out_buf, len, fault);
+
+}
+
+/* Process the outcome of running out_buf, with afl->fsrv.trace_bits holding
+   its coverage. Returns 1 if it's time to bail out. */
+
+u8 __attribute__((hot))
+common_fuzz_result(afl_state_t *afl, u8 *out_buf, u32 len, u8 fault) {
 
   if (afl->stop_soon) { return 1; }
 
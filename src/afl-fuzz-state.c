@@ -26,91 +26,14 @@
 #include "afl-fuzz.h"
 #include "envs.h"
 
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
-
 s8  interesting_8[] = {INTERESTING_8};
 s16 interesting_16[] = {INTERESTING_8, INTERESTING_16};
 s32 interesting_32[] = {INTERESTING_8, INTERESTING_16, INTERESTING_32};
 
 char *power_names[POWER_SCHEDULES_NUM] = {"explore", "mmopt", "exploit",
                                           "fast",    "coe",   "lin",
-                                          "quad",    "rare",  "seek"};
-
-void expix_init(afl_state_t *afl, expix_t *v, u64 n_arms) {
-  v->weights = calloc(sizeof(double), n_arms);
-  v->losses = calloc(sizeof(double), n_arms);
-  v->pulls = calloc(sizeof(u64), n_arms);
-  v->total_rewards = calloc(sizeof(u64), n_arms);
-
-  v->t = 0;
-  v->n_arms = n_arms;
-  for (u64 i = 0; i < n_arms ; i++) {
-    v->weights[i] = 1.0 / (double)n_arms;
-  }
-}
-
-void exppp_init(afl_state_t *afl, exppp_t *v, u64 n_arms) {
-  v->n_arms = n_arms;
-
-  v->weights = calloc(sizeof(double), n_arms);
-  v->losses = calloc(sizeof(double), n_arms);
-  v->unweighted_losses = calloc(sizeof(double), n_arms);
-  v->pulls = calloc(sizeof(u64), n_arms);
-  v->total_rewards = calloc(sizeof(u64), n_arms);
-  v->trusts = calloc(sizeof(double), n_arms);
-
-  for (u64 i = 0; i < n_arms; i++) {
-    v->weights[i] = 1.0 / (double)n_arms;
-    v->losses[i] = (double)n_arms;
-    v->unweighted_losses[i] = 1;
-    v->pulls[i] = 1;
-    v->trusts[i] = 1.0 / (double)n_arms;
-  }
-  v->t = n_arms;
-}
-
-void uniform_init(afl_state_t *afl, uniform_t *v, int n_arms) {
-  v->n_arms = n_arms;
-  v->arms = calloc(sizeof(uniform_bandit_arm), n_arms);
-}
-
-void ucb_init(afl_state_t *afl, ucb_t *v, int n_arms) {
-  v->n_arms = n_arms;
-  v->time_step = 0;
-  v->arms = calloc(sizeof(normal_bandit_arm), n_arms);
-}
-
-void klucb_init(afl_state_t *afl, klucb_t *v, int n_arms) {
-  v->n_arms = n_arms;
-  v->time_step = 0;
-  v->arms = calloc(sizeof(normal_bandit_arm), n_arms);
-}
-
-void ts_init(afl_state_t *afl, ts_t *v, int n_arms) {
-  v->n_arms = n_arms;
-  v->arms = calloc(sizeof(normal_bandit_arm), n_arms);
-}
-
-void adsts_init(afl_state_t *afl, adsts_t *v, int n_arms) {
-  v->n_arms = n_arms;
-  v->arms = calloc(sizeof(adwin_bandit_arm), n_arms);
-
-  int i;
-  for (i=0; i<n_arms; i++) {
-    init_adwin(&v->arms[i].adwin);
-  }
-}
-
-void dts_init(afl_state_t *afl, dts_t *v, int n_arms) {
-  v->n_arms = n_arms;
-  v->arms = calloc(sizeof(dts_bandit_arm), n_arms);
-}
-
-void dbe_init(afl_state_t *afl, dbe_t *v, int n_arms) {
-  v->n_arms = n_arms;
-  v->arms = calloc(sizeof(dbe_bandit_arm), n_arms);
-}
+                                          "quad",    "rare",  "seek",
+                                          "bandit"};
 
 /* Initialize MOpt "globals" for this afl state */
 
@@ -194,29 +117,8 @@ void afl_state_init(afl_state_t *afl, uint32_t map_size) {
   afl->cpu_aff = -1;                    /* Selected CPU core                */
 #endif                                                     /* HAVE_AFFINITY */
 
-  gsl_rng_env_setup();
-  afl->gsl_rng_state = gsl_rng_alloc (gsl_rng_default);
-
-  {
-    int i;
-
-#ifdef BATCHSIZE_BANDIT
-    for (i=0; i<NUM_BATCH_BUCKET; i++) {
-      int j;
-      for (j=0; j<NUM_CASE; j++) {
-        INIT_INSTANCE(BATCH_ALG) (afl, &afl->batch_bandit[i][j], BATCH_NUM_ARM);
-      }
-    }
-#endif
-
-    for (i=0; i<NUM_MUT_BUCKET; i++) {
-#if   defined(MOPTWISE_BANDIT)
-      INIT_INSTANCE(MUT_ALG) (afl, &afl->mut_bandit[i], NUM_CASE);
-#elif defined(MOPTWISE_BANDIT_FINECOARSE)
-      INIT_INSTANCE(MUT_ALG) (afl, &afl->mut_bandit[i], 2);
-#endif
-    }
-  }
+  /* the bandits are set up in setup_bandits() once AFL_MUT_ALG and
+     AFL_BATCH_ALG have been read */
 
   afl->virgin_bits = ck_alloc(map_size);
   afl->virgin_bits = ck_alloc(map_size);
@@ -411,6 +313,76 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_autoresume =
                 get_afl_env(afl_environment_variables[i]) ? 1 : 0;
 
+          } else if (!strncmp(env, "AFL_MUT_ALG",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_mut_alg =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_BATCH_ALG",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_batch_alg =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_BANDIT_SHARE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_bandit_share =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
+          } else if (!strncmp(env, "AFL_DIRTY_MAP",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_dirty_map =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_FORKSRV_FUTEX",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_forksrv_futex =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_FSRV_POOL",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_fsrv_pool =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_SHMEM_INPLACE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_shmem_inplace =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_ADAPTIVE_TMOUT",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_adaptive_tmout =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_HAVOC_BATCH",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_havoc_batch =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
+          } else if (!strncmp(env, "AFL_SEED_BANDIT",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_seed_bandit =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
           } else if (!strncmp(env, "AFL_PERSISTENT_RECORD",
 
                               afl_environment_variable_len)) {
@@ -439,6 +411,13 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->expand_havoc = afl->afl_env.afl_expand_havoc =
                 get_afl_env(afl_environment_variables[i]) ? 1 : 0;
 
+          } else if (!strncmp(env, "AFL_CAL_ADAPTIVE",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_cal_adaptive =
+                get_afl_env(afl_environment_variables[i]) ? 1 : 0;
+
           } else if (!strncmp(env, "AFL_CAL_FAST",
 
                               afl_environment_variable_len)) {
@@ -521,6 +500,13 @@ void read_afl_environment(afl_state_t *afl, char **envp) {
             afl->afl_env.afl_testcache_entries =
                 (u8 *)get_afl_env(afl_environment_variables[i]);
 
+          } else if (!strncmp(env, "AFL_TESTCACHE_PREFETCH",
+
+                              afl_environment_variable_len)) {
+
+            afl->afl_env.afl_testcache_prefetch =
+                (u8 *)get_afl_env(afl_environment_variables[i]);
+
           } else if (!strncmp(env, "AFL_STATSD_HOST",
 
                               afl_environment_variable_len)) {
@@ -661,34 +647,25 @@ void afl_state_deinit(afl_state_t *afl) {
   afl_free(afl->in_buf);
   afl_free(afl->in_scratch_buf);
   afl_free(afl->ex_buf);
+  afl_free(afl->undo_buf);
+  ck_free(afl->virgin_slow);
+  afl_free(afl->havoc_batch_buf);
+  ck_free(afl->havoc_batch);
 
-// Just my laziness...
-#if 0
-  {
-    int i;
-
-#ifdef BATCHSIZE_BANDIT
-    for (i=0; i<NUM_BATCH_BUCKET; i++) {
-      int j;
-      for (j=0; j<NUM_CASE; j++) {
-        DEST_INSTANCE(BATCH_ALG) (afl, &afl->batch_bandit[i][j]);
-      }
-    }
-#endif
-
-#if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
-    for (i=0; i<NUM_MUT_BUCKET; i++) {
-      DEST_INSTANCE(MUT_ALG) (afl, &afl->mut_bandit[i]);
-    }
-#endif
-  }
-#endif
+  destroy_bandits(afl);
 
   ck_free(afl->virgin_bits);
   ck_free(afl->virgin_tmout);
   ck_free(afl->virgin_crash);
   ck_free(afl->var_bytes);
   ck_free(afl->top_rated);
+  ck_free(afl->cull_cover);
+  ck_free(afl->cull_dirty);
+  afl_free(afl->cull_lost_buf);
+  afl_free(afl->cull_uncov_buf);
+  afl_free(afl->mini_idx_buf);
+  afl_free(afl->sel_lost_buf);
+  afl_free(afl->sel_tree);
   ck_free(afl->clean_trace);
   ck_free(afl->clean_trace_custom);
   ck_free(afl->first_trace);
@@ -27,85 +27,6 @@
 #include "envs.h"
 #include <limits.h>
 
-void uniform_print_arm(FILE* file, uniform_t* inst) {
-  int i;
-  int n = inst->n_arms;
-  uniform_bandit_arm *arms = inst->arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
-  }
-}
-
-void ucb_print_arm(FILE* file, ucb_t* inst) {
-  int i;
-  int n = inst->n_arms;
-  normal_bandit_arm *arms = inst->arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
-  }
-}
-
-void klucb_print_arm(FILE* file, klucb_t* inst) {
-  int i;
-  int n = inst->n_arms;
-  normal_bandit_arm *arms = inst->arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
-  }
-}
-
-void ts_print_arm(FILE* file, ts_t* inst) {
-  int i;
-  int n = inst->n_arms;
-  normal_bandit_arm *arms = inst->arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
-  }
-}
-
-void adsts_print_arm(FILE* file, adsts_t* inst) {
-  int i;
-  int n = inst->n_arms;
-  adwin_bandit_arm *arms = inst->arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", arms[i].total_rewards, arms[i].num_selected);
-  }
-}
-
-void dts_print_arm(FILE* file, dts_t* inst) {
-  int i;
-  int n = inst->n_arms;
-  dts_bandit_arm *arms = inst->arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", arms[i].num_rewarded, arms[i].num_selected);
-  }
-}
-
-void dbe_print_arm(FILE* file, dbe_t* inst) {
-  int i;
-  int n = inst->n_arms;
-  dbe_bandit_arm *arms = inst->arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", arms[i].num_rewarded, arms[i].num_selected);
-  }
-}
-
-void expix_print_arm(FILE* file, expix_t* inst) {
-  u64 i;
-  u64 n = inst->n_arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", inst->total_rewards[i], inst->pulls[i]);
-  }
-}
-
-void exppp_print_arm(FILE* file, exppp_t* inst) {
-  u64 i;
-  u64 n = inst->n_arms;
-  for (i=0; i<n; i++) {
-    fprintf(file, ", %llu, %llu", inst->total_rewards[i], inst->pulls[i]);
-  }
-}
-
 /* Write fuzzer setup file */
 
 void write_setup_file(afl_state_t *afl, u32 argc, char **argv) {
@@ -260,44 +181,12 @@ void load_stats_file(afl_state_t *afl) {
 
   if (afl->unique_crashes) { write_crash_readme(afl); }
 
-  return;
-
-}
-
-void print_indent(FILE *f, int indent) {
-  for (int i = 0; i < indent; i++) {
-    fprintf(f, " ");
-  }
-}
-
-void exppp_print_state(exppp_t *self, FILE *f, int indent) {
-  //printf("sum_of_trusts: %lf\n", sum_of_trusts);
-  print_indent(f, indent); fprintf(f, "- weights: ");
-  for (u64 i = 0; i < self->n_arms; i++) {
-	  fprintf(f, "%.6f\t", self->weights[i]);
-  }
-  fprintf(f, "\n");
-
-  print_indent(f, indent); fprintf(f, "- pulls: ");
-  for (u64 i = 0; i < self->n_arms; i++) {
-	  fprintf(f, "%lld\t", self->pulls[i]);
-  }
-  fprintf(f, "\n");
+  load_bandits(afl);
 
-  print_indent(f, indent); fprintf(f, "- trusts: ");
-  for (u64 i = 0; i < self->n_arms; i++) {
-	  fprintf(f, "%.6lf\t", self->trusts[i]);
-  }
-  fprintf(f, "\n");
+  return;
 
-  print_indent(f, indent); fprintf(f, "- losses: ");
-  for (u64 i = 0; i < self->n_arms; i++) {
-	  fprintf(f, "%.6lf\t", self->losses[i]);
-  }
-  fprintf(f, "\n");
 }
 
-
 /* Update stats file for unattended monitoring. */
 
 void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
@@ -434,6 +323,16 @@ void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
               : "default",
           afl->orig_cmdline);
 
+  if (afl->adaptive_tmout_mult) {
+
+    fprintf(f,
+            "adaptive_tmout    : %u\n"
+            "adaptive_kills    : %llu\n"
+            "adaptive_reruns   : %llu\n",
+            adaptive_tmout(afl), afl->adaptive_kills, afl->adaptive_reruns);
+
+  }
+
 #ifndef DISABLE_BANDIT_STAT
 
   fprintf(f, "bandit arms : batchbuck=%d mutbuck=%d mopt=%s mutalg=%s batalg=%s batch=%s\n", 
@@ -448,13 +347,13 @@ void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
 #endif
 
 #if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
-    ##MUT_ALG ,
+    bandit_ops[afl->mut_bandit[0].alg].name,
 #else
      "none",
 #endif
 
 #if defined(BATCHSIZE_BANDIT)
-    ##BATCH_ALG ,
+    bandit_ops[afl->batch_bandit[0][0].alg].name,
 #else
      "none",
 #endif
@@ -472,7 +371,7 @@ void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
 
 #if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
   for (i=0; i<NUM_MUT_BUCKET; i++) {
-    PRINT_STATE(MUT_ALG) (&afl->mut_bandit[i], f, 4);
+    bandit_print_state(&afl->mut_bandit[i], f, 4);
   }
 #if 0
   for (i=0; i<NUM_MUT_BUCKET; i++) {
@@ -511,7 +410,7 @@ void write_stats_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
     for (j=0; j<NUM_CASE; j++) {
 
       fprintf(f, "    mutate %02d:\n", j);
-      PRINT_STATE(BATCH_ALG)(&afl->batch_bandit[i][j], f, 6);
+      bandit_print_state(&afl->batch_bandit[i][j], f, 6);
 
       #if 0
       int k;
@@ -632,7 +531,7 @@ void maybe_update_plot_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
   int i;
 #if defined(MOPTWISE_BANDIT) || defined(MOPTWISE_BANDIT_FINECOARSE)
   for (i=0; i<NUM_MUT_BUCKET; i++) {
-    PRINT_ARM(MUT_ALG)(afl->fsrv.plot_file, &afl->mut_bandit[i]);
+    bandit_print_arm(afl->fsrv.plot_file, &afl->mut_bandit[i]);
   }
 #endif
 
@@ -640,7 +539,7 @@ void maybe_update_plot_file(afl_state_t *afl, u32 t_bytes, double bitmap_cvg,
   for (i=0; i<NUM_BATCH_BUCKET; i++) {
     int j;
     for (j=0; j<NUM_CASE; j++) {
-      PRINT_ARM(BATCH_ALG)(afl->fsrv.plot_file, &afl->batch_bandit[i][j]);
+      bandit_print_arm(afl->fsrv.plot_file, &afl->batch_bandit[i][j]);
     }
   }
 #endif
@@ -777,7 +676,8 @@ void show_stats(afl_state_t *afl) {
 
   }
 
-  /* Roughly every minute, update fuzzer stats and save auto tokens. */
+  /* Roughly every minute, update fuzzer stats and save auto tokens and the
+     bandit state. */
 
   if (unlikely(afl->force_ui_update ||
                cur_ms - afl->stats_last_stats_ms > STATS_UPDATE_SEC * 1000)) {
@@ -786,10 +686,21 @@ void show_stats(afl_state_t *afl) {
     write_stats_file(afl, t_bytes, t_byte_ratio, stab_ratio,
                      afl->stats_avg_exec);
     save_auto(afl);
+    save_bandits(afl);
     write_bitmap(afl);
 
   }
 
+  /* Exchange bandit statistics with the other instances. */
+
+  if (unlikely(afl->afl_env.afl_bandit_share &&
+               cur_ms - afl->bandit_share.last_ms > BANDIT_SHARE_SEC * 1000)) {
+
+    afl->bandit_share.last_ms = cur_ms;
+    share_bandits(afl);
+
+  }
+
   if (unlikely(afl->afl_env.afl_statsd)) {
 
     if (unlikely(afl->force_ui_update || cur_ms - afl->statsd_last_send_ms >
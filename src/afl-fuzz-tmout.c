@@ -0,0 +1,235 @@
+/*
+   american fuzzy lop++ - adaptive exec timeout
+   --------------------------------------------
+
+   Originally written by Michal Zalewski
+
+   Now maintained by Marc Heuse <mh@mh-sec.de>,
+                        Heiko Eißfeldt <heiko.eissfeldt@hexco.de> and
+                        Andrea Fioraldi <andreafioraldi@gmail.com>
+
+   Copyright 2016, 2017 Google Inc. All rights reserved.
+   Copyright 2019-2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   AFL_ADAPTIVE_TMOUT: mutants are killed at an early deadline derived from
+   the exec times seen so far instead of the -t timeout. A killed run is only
+   rerun at the full timeout, and so can become a hang, if what it covered
+   until then looks new, so most of the time spent on slow and boring
+   mutants is saved.
+
+ */
+
+#include "afl-fuzz.h"
+
+/* The histogram bucket of an exec time. */
+
+static inline u32 exec_sketch_bucket(u64 us) {
+
+  u32 v = us > 0xffffffff ? 0xffffffff : (u32)us, e;
+
+  if (v < EXEC_SKETCH_SUB) { return v; }
+
+  /* EXEC_SKETCH_SUB buckets per power of two, from its top three bits */
+  e = 31 - __builtin_clz(v);
+  return (e - 2) * EXEC_SKETCH_SUB + ((v >> (e - 3)) & (EXEC_SKETCH_SUB - 1));
+
+}
+
+/* The largest exec time of a bucket. */
+
+static inline u64 exec_sketch_upper(u32 idx) {
+
+  u32 e, m;
+
+  if (idx < EXEC_SKETCH_SUB) { return idx; }
+
+  e = idx / EXEC_SKETCH_SUB + 2;
+  m = idx % EXEC_SKETCH_SUB;
+  return ((u64)(EXEC_SKETCH_SUB + m + 1) << (e - 3)) - 1;
+
+}
+
+/* The exec time that permille of the runs did not exceed. */
+
+static u64 exec_sketch_quantile(struct exec_sketch *s, u32 permille) {
+
+  u64 above = (u64)s->total * (1000 - permille) / 1000, seen = 0;
+  s32 idx;
+
+  for (idx = EXEC_SKETCH_BUCKETS - 1; idx > 0; --idx) {
+
+    seen += s->cnt[idx];
+    if (seen > above) { break; }
+
+  }
+
+  return exec_sketch_upper(idx);
+
+}
+
+static void exec_sketch_add(afl_state_t *afl, u64 us) {
+
+  struct exec_sketch *s = &afl->exec_sketch;
+  u32                 i;
+
+  ++s->cnt[exec_sketch_bucket(us)];
+
+  if (likely(++s->total % ADAPTIVE_TMOUT_UPDATE)) { return; }
+
+  if (s->total >= ADAPTIVE_TMOUT_WARMUP) {
+
+    afl->exec_quantile_us = exec_sketch_quantile(s, ADAPTIVE_TMOUT_QUANTILE);
+
+  }
+
+  if (s->total >= ADAPTIVE_TMOUT_AGE) {
+
+    /* forget the old runs gradually, the queue changes */
+    for (s->total = 0, i = 0; i < EXEC_SKETCH_BUCKETS; ++i) {
+
+      s->cnt[i] >>= 1;
+      s->total += s->cnt[i];
+
+    }
+
+  }
+
+}
+
+/* The early kill deadline for a mutant of the current queue entry (ms). A
+   slow entry has slow mutants, so its own calibrated exec time counts too. */
+
+u32 adaptive_tmout(afl_state_t *afl) {
+
+  u64 us = afl->exec_quantile_us, ms;
+
+  if (!us) { return afl->fsrv.exec_tmout; }
+
+  if (afl->queue_cur && afl->queue_cur->exec_us > us) {
+
+    us = afl->queue_cur->exec_us;
+
+  }
+
+  ms = (us * afl->adaptive_tmout_mult + 999) / 1000;
+  if (ms < ADAPTIVE_TMOUT_MIN) { ms = ADAPTIVE_TMOUT_MIN; }
+  return ms < afl->fsrv.exec_tmout ? (u32)ms : afl->fsrv.exec_tmout;
+
+}
+
+/* Could the trace of a killed run still bring new coverage? Edges that were
+   in the trace of a confirmed timeout do not count, or every later hang
+   through them would be rerun again. */
+
+static u8 adaptive_new_bits(afl_state_t *afl) {
+
+  u64 *virgin = (u64 *)afl->virgin_bits, *slow = (u64 *)afl->virgin_slow,
+      *both = (u64 *)afl->map_tmp_buf;
+  u32 i;
+
+  if (!slow) { return skim_trace(afl, afl->virgin_bits); }
+
+  for (i = 0; i < afl->fsrv.map_size >> 3; ++i) {
+
+    both[i] = virgin[i] & slow[i];
+
+  }
+
+  return skim_trace(afl, afl->map_tmp_buf);
+
+}
+
+/* The rerun of a killed run timed out at -t as well, remember its edges. */
+
+static void adaptive_slow_seen(afl_state_t *afl) {
+
+  u32 i;
+
+  if (!afl->virgin_slow) {
+
+    afl->virgin_slow = ck_alloc(afl->fsrv.map_size);
+    memset(afl->virgin_slow, 255, afl->fsrv.map_size);
+
+  }
+
+  for (i = 0; i < afl->fsrv.map_size; ++i) {
+
+    if (afl->fsrv.trace_bits[i]) { afl->virgin_slow[i] = 0; }
+
+  }
+
+}
+
+/* Could the trace of a killed run become a new unique hang? Mirrors the
+   check in save_if_interesting(), on the partial trace. Clobbers it. */
+
+static u8 adaptive_new_hang(afl_state_t *afl) {
+
+  if (afl->unique_hangs >= KEEP_UNIQUE_HANG) { return 0; }
+
+  if (afl->fsrv.dirty_map) { afl->fsrv.dirty_map->valid = 0; }
+  simplify_trace(afl, afl->fsrv.trace_bits);
+
+  return skim_trace(afl, afl->virgin_tmout);
+
+}
+
+/* Run the mutant in buf, which is in the testcase already, with the early
+   deadline. Returns 1 if it was killed at the deadline and is not worth a
+   rerun, else *fault is the outcome of the run as with fuzz_run_target() at
+   the -t timeout. */
+
+u8 adaptive_run_target(afl_state_t *afl, u8 *buf, u32 len, u8 *fault) {
+
+  u32 tmout = adaptive_tmout(afl);
+  u64 start_us = get_cur_time_us();
+
+  *fault = fuzz_run_target(afl, &afl->fsrv, tmout);
+
+  if (likely(*fault != FSRV_RUN_TMOUT)) {
+
+    exec_sketch_add(afl, get_cur_time_us() - start_us);
+    return 0;
+
+  }
+
+  if (tmout >= afl->fsrv.exec_tmout || afl->stop_soon) { return 0; }
+
+  ++afl->adaptive_kills;
+
+  if (!adaptive_new_bits(afl) && !adaptive_new_hang(afl) &&
+      rand_below(afl, ADAPTIVE_TMOUT_SAMPLE)) {
+
+    return 1;
+
+  }
+
+  /* confirm at the full timeout; the sampled reruns keep the histogram
+     honest about runs beyond the deadline */
+
+  ++afl->adaptive_reruns;
+
+  write_to_testcase(afl, buf, len);
+  start_us = get_cur_time_us();
+  *fault = fuzz_run_target(afl, &afl->fsrv, afl->fsrv.exec_tmout);
+
+  if (*fault == FSRV_RUN_TMOUT) {
+
+    adaptive_slow_seen(afl);
+
+  } else {
+
+    exec_sketch_add(afl, get_cur_time_us() - start_us);
+
+  }
+
+  return 0;
+
+}
+
@@ -104,7 +104,7 @@ static void usage(u8 *argv0, int more_help) {
       "  -p schedule   - power schedules compute a seed's performance score:\n"
       "                  fast(default), explore, exploit, seek, rare, mmopt, "
       "coe, lin\n"
-      "                  quad -- see docs/power_schedules.md\n"
+      "                  quad, bandit -- see docs/power_schedules.md\n"
       "  -f file       - location read by the fuzzed program (default: stdin "
       "or @@)\n"
       "  -t msec       - timeout for each run (auto-scaled, default %u ms). "
@@ -195,9 +195,15 @@ static void usage(u8 *argv0, int more_help) {
       "              (must contain abort_on_error=1 and symbolize=0)\n"
       "MSAN_OPTIONS: custom settings for MSAN\n"
       "              (must contain exitcode="STRINGIFY(MSAN_ERROR)" and symbolize=0)\n"
+      "AFL_ADAPTIVE_TMOUT: kill runs after this many times the 99.9th percentile\n"
+      "                    exec time, rerunning interesting ones at -t\n"
       "AFL_AUTORESUME: resume fuzzing if directory specified by -o already exists\n"
+      "AFL_BANDIT_SHARE: pool bandit statistics with the other -M/-S instances\n"
+      "AFL_BATCH_ALG: bandit algorithm for the havoc stack size (uniform, ucb,\n"
+      "               klucb, ts, dts, dbe, adsts, exppp, expix; default: ts)\n"
       "AFL_BENCH_JUST_ONE: run the target just once\n"
       "AFL_BENCH_UNTIL_CRASH: exit soon when the first crashing input has been found\n"
+      "AFL_CAL_ADAPTIVE: stop calibrating new finds once they are likely stable\n"
       "AFL_CMPLOG_ONLY_NEW: do not run cmplog on initial testcases (good for resumes!)\n"
       "AFL_CRASH_EXITCODE: optional child exit code to be interpreted as crash\n"
       "AFL_CUSTOM_MUTATOR_LIBRARY: lib with afl_custom_fuzz() to mutate inputs\n"
@@ -205,6 +211,8 @@ static void usage(u8 *argv0, int more_help) {
       "AFL_CYCLE_SCHEDULES: after completing a cycle, switch to a different -p schedule\n"
       "AFL_DEBUG: extra debugging output for Python mode trimming\n"
       "AFL_DEBUG_CHILD: do not suppress stdout/stderr from target\n"
+      "AFL_DIRTY_MAP: reset, classify and compare only the parts of the coverage\n"
+      "               map the target touched (needs an AFL++ instrumented target)\n"
       "AFL_DISABLE_TRIM: disable the trimming of test cases\n"
       "AFL_DUMB_FORKSRV: use fork server without feedback from target\n"
       "AFL_EXIT_WHEN_DONE: exit when all inputs are run and no new finds are found\n"
@@ -212,8 +220,15 @@ static void usage(u8 *argv0, int more_help) {
       "AFL_EXPAND_HAVOC_NOW: immediately enable expand havoc mode (default: after 60 minutes and a cycle without finds)\n"
       "AFL_FAST_CAL: limit the calibration stage to three cycles for speedup\n"
       "AFL_FORCE_UI: force showing the status screen (for virtual consoles)\n"
+      "AFL_FORKSRV_FUTEX: pass run requests to the forkserver through a futex in\n"
+      "                   shared memory instead of pipes (Linux, needs an AFL++\n"
+      "                   instrumented target)\n"
       "AFL_FORKSRV_INIT_TMOUT: time spent waiting for forkserver during startup (in milliseconds)\n"
+      "AFL_FSRV_POOL: run havoc batches on this many extra forkservers in\n"
+      "               parallel (default: 0, off)\n"
       "AFL_HANG_TMOUT: override timeout value (in milliseconds)\n"
+      "AFL_HAVOC_BATCH: run havoc mutants in batches of this many, crediting the\n"
+      "                 bandits once per batch (default: 1, off)\n"
       "AFL_I_DONT_CARE_ABOUT_MISSING_CRASHES: don't warn about core dump handlers\n"
       "AFL_IGNORE_UNKNOWN_ENVS: don't warn on unknown env vars\n"
       "AFL_IMPORT_FIRST: sync and import test cases from other fuzzer instances first\n"
@@ -223,6 +238,8 @@ static void usage(u8 *argv0, int more_help) {
       "AFL_MAX_DET_EXTRAS: if more entries are in the dictionary list than this value\n"
       "                    then they are randomly selected instead all of them being\n"
       "                    used. Defaults to 200.\n"
+      "AFL_MUT_ALG: bandit algorithm for the havoc mutation operators (see\n"
+      "             AFL_BATCH_ALG for the choices; default: ts)\n"
       "AFL_NO_AFFINITY: do not check for an unused cpu core to use for fuzzing\n"
       "AFL_TRY_AFFINITY: try to bind to an unused core, but don't fail if unsuccessful\n"
       "AFL_NO_ARITH: skip arithmetic mutations in deterministic stage\n"
@@ -242,6 +259,10 @@ static void usage(u8 *argv0, int more_help) {
 
       "AFL_PRELOAD: LD_PRELOAD / DYLD_INSERT_LIBRARIES settings for target\n"
       "AFL_TARGET_ENV: pass extra environment variables to target\n"
+      "AFL_SEED_BANDIT: keep havoc mutation operator statistics per seed, shrunk\n"
+      "                 to the global ones (value: LRU arena slots, default 4096)\n"
+      "AFL_SHMEM_INPLACE: let havoc mutate right in the shared memory testcase\n"
+      "                   (only for targets that do not write to their input)\n"
       "AFL_SHUFFLE_QUEUE: reorder the input queue randomly on startup\n"
       "AFL_SKIP_BIN_CHECK: skip afl compatibility checks, also disables auto map size\n"
       "AFL_SKIP_CPUFREQ: do not warn about variable cpu clocking\n"
@@ -252,8 +273,11 @@ static void usage(u8 *argv0, int more_help) {
       "AFL_STATSD_TAGS_FLAVOR: set statsd tags format (default: disable tags)\n"
       "                        Supported formats are: 'dogstatsd', 'librato',\n"
       "                        'signalfx' and 'influxdb'\n"
+      "AFL_TESTCACHE_PREFETCH: read the next testcases in a helper thread\n"
       "AFL_TESTCACHE_SIZE: use a cache for testcases, improves performance (in MB)\n"
       "AFL_TMPDIR: directory to use for input file generation (ramdisk recommended)\n"
+      "AFL_USER_SNAPSHOT: snapshot the target in user space instead of forking it\n"
+      "                   for every run (without the snapshot lkm, Linux 6.7+)\n"
       //"AFL_PERSISTENT: not supported anymore -> no effect, just a warning\n"
       //"AFL_DEFER_FORKSRV: not supported anymore -> no effect, just a warning\n"
       "\n"
@@ -518,6 +542,10 @@ int main(int argc, char **argv_orig, char **envp) {
 
           afl->schedule = SEEK;
 
+        } else if (!stricmp(optarg, "bandit")) {
+
+          afl->schedule = BANDIT;
+
         } else {
 
           FATAL("Unknown -p power schedule");
@@ -1174,6 +1202,8 @@ int main(int argc, char **argv_orig, char **envp) {
   afl->fsrv.kill_signal =
       parse_afl_kill_signal_env(afl->afl_env.afl_kill_signal, SIGKILL);
 
+  if (afl->afl_env.afl_forksrv_futex) { afl->fsrv.use_futex = true; }
+
   setup_signal_handlers();
   check_asan_opts(afl);
 
@@ -1254,6 +1284,9 @@ int main(int argc, char **argv_orig, char **envp) {
     case SEEK:
       OKF("Using seek power schedule (SEEK)");
       break;
+    case BANDIT:
+      OKF("Using bandit seed selection and power schedule (BANDIT)");
+      break;
     case EXPLORE:
       OKF("Using exploration-based constant power schedule (EXPLORE)");
       break;
@@ -1289,6 +1322,69 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  setup_bandits(afl);
+
+  afl->havoc_batch_k = 1;
+  if (afl->afl_env.afl_havoc_batch) {
+
+    s32 havoc_batch = atoi(afl->afl_env.afl_havoc_batch);
+    if (havoc_batch < 1 || havoc_batch > HAVOC_BATCH_MAX) {
+
+      FATAL("AFL_HAVOC_BATCH must be between 1 and %u", HAVOC_BATCH_MAX);
+
+    }
+
+#ifdef INTROSPECTION
+    if (havoc_batch > 1) {
+
+      WARNF("AFL_HAVOC_BATCH is not supported with INTROSPECTION, ignored");
+      havoc_batch = 1;
+
+    }
+
+#endif
+
+    afl->havoc_batch_k = (u32)havoc_batch;
+
+  }
+
+  if (afl->afl_env.afl_fsrv_pool) {
+
+    s32 fsrv_pool = atoi(afl->afl_env.afl_fsrv_pool);
+    if (fsrv_pool < 0 || fsrv_pool > FSRV_POOL_MAX) {
+
+      FATAL("AFL_FSRV_POOL must be between 0 and %u", FSRV_POOL_MAX);
+
+    }
+
+#ifndef INTROSPECTION
+    /* keep every fork server of the pool busy during a batch */
+    if (!afl->afl_env.afl_havoc_batch) {
+
+      afl->havoc_batch_k = MIN(HAVOC_BATCH_MAX, 4 * fsrv_pool);
+
+    }
+
+#endif
+
+    if (fsrv_pool && afl->havoc_batch_k < 2) {
+
+      WARNF("AFL_FSRV_POOL needs AFL_HAVOC_BATCH > 1, ignored");
+      fsrv_pool = 0;
+
+    }
+
+    afl->fsrv_pool_cnt = (u32)fsrv_pool;
+
+  }
+
+  if (afl->havoc_batch_k > 1) {
+
+    afl->havoc_batch =
+        ck_alloc(afl->havoc_batch_k * sizeof(struct havoc_batch_entry));
+
+  }
+
   if (afl->afl_env.afl_hang_tmout) {
 
     s32 hang_tmout = atoi(afl->afl_env.afl_hang_tmout);
@@ -1297,6 +1393,23 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (afl->afl_env.afl_adaptive_tmout) {
+
+    s32 mult = atoi(afl->afl_env.afl_adaptive_tmout);
+    if (mult < 2) { FATAL("AFL_ADAPTIVE_TMOUT must be at least 2"); }
+
+    if (afl->non_instrumented_mode || afl->crash_mode) {
+
+      WARNF("AFL_ADAPTIVE_TMOUT needs coverage and no -C, ignored");
+
+    } else {
+
+      afl->adaptive_tmout_mult = (u32)mult;
+
+    }
+
+  }
+
   if (afl->afl_env.afl_exit_on_time) {
 
     u64 exit_on_time = atoi(afl->afl_env.afl_exit_on_time);
@@ -1526,6 +1639,7 @@ int main(int argc, char **argv_orig, char **envp) {
   #endif
 
   init_count_class16();
+  setup_coverage_kernels();
 
   if (afl->is_main_node && check_main_node_exists(afl) == 1) {
 
@@ -1551,6 +1665,25 @@ int main(int argc, char **argv_orig, char **envp) {
 
   setup_custom_mutators(afl);
 
+  if (afl->afl_env.afl_shmem_inplace) {
+
+    /* both would write other data to the testcase shm behind havoc's back */
+    if (afl->custom_mutators_count) {
+
+      WARNF("AFL_SHMEM_INPLACE does not work with custom mutators, ignored");
+
+    } else if (afl->havoc_batch_k > 1) {
+
+      WARNF("AFL_SHMEM_INPLACE does not work with AFL_HAVOC_BATCH, ignored");
+
+    } else {
+
+      afl->shmem_inplace = 1;
+
+    }
+
+  }
+
   write_setup_file(afl, argc, argv);
 
   setup_cmdline_file(afl, argv + optind);
@@ -1710,8 +1843,10 @@ int main(int argc, char **argv_orig, char **envp) {
   }
 
   afl->argv = use_argv;
+  if (afl->afl_env.afl_dirty_map) { afl->shm.dirty_mode = 1; }
   afl->fsrv.trace_bits =
       afl_shm_init(&afl->shm, afl->fsrv.map_size, afl->non_instrumented_mode);
+  afl->fsrv.dirty_map = afl->shm.dirty_map;
 
   if (!afl->non_instrumented_mode && !afl->fsrv.qemu_mode &&
       !afl->unicorn_mode && !afl->fsrv.frida_mode &&
@@ -1751,6 +1886,7 @@ int main(int argc, char **argv_orig, char **envp) {
       afl->fsrv.map_size = new_map_size;
       afl->fsrv.trace_bits =
           afl_shm_init(&afl->shm, new_map_size, afl->non_instrumented_mode);
+      afl->fsrv.dirty_map = afl->shm.dirty_map;
       setenv("AFL_NO_AUTODICT", "1", 1);  // loaded already
       afl_fsrv_start(&afl->fsrv, afl->argv, &afl->stop_soon,
                      afl->afl_env.afl_debug_child);
@@ -1817,6 +1953,7 @@ int main(int argc, char **argv_orig, char **envp) {
       afl->fsrv.trace_bits =
           afl_shm_init(&afl->shm, new_map_size, afl->non_instrumented_mode);
       afl->cmplog_fsrv.trace_bits = afl->fsrv.trace_bits;
+      afl->fsrv.dirty_map = afl->cmplog_fsrv.dirty_map = afl->shm.dirty_map;
       afl_fsrv_start(&afl->fsrv, afl->argv, &afl->stop_soon,
                      afl->afl_env.afl_debug_child);
       afl_fsrv_start(&afl->cmplog_fsrv, afl->argv, &afl->stop_soon,
@@ -1861,6 +1998,8 @@ int main(int argc, char **argv_orig, char **envp) {
 
   perform_dry_run(afl);
 
+  fsrv_pool_init(afl);
+
   if (afl->q_testcase_max_cache_entries) {
 
     afl->q_testcase_cache =
@@ -1869,6 +2008,20 @@ int main(int argc, char **argv_orig, char **envp) {
 
   }
 
+  if (afl->afl_env.afl_testcache_prefetch) {
+
+    if (afl->q_testcase_cache) {
+
+      testcase_prefetch_init(afl);
+
+    } else {
+
+      WARNF("AFL_TESTCACHE_PREFETCH needs the testcache, ignored");
+
+    }
+
+  }
+
   cull_queue(afl);
 
   // ensure we have at least one seed that is not disabled.
@@ -1937,7 +2090,6 @@ int main(int argc, char **argv_orig, char **envp) {
   afl->start_time = get_cur_time();
 
   u32 runs_in_current_cycle = (u32)-1;
-  u32 prev_queued_paths = 0;
   u8  skipped_fuzz;
 
   #ifdef INTROSPECTION
@@ -2146,6 +2298,8 @@ int main(int argc, char **argv_orig, char **envp) {
 
         }
 
+        afl->reinit_table = 1;
+
       }
 
       prev_queued = afl->queued_paths;
@@ -2158,15 +2312,6 @@ int main(int argc, char **argv_orig, char **envp) {
 
       if (likely(!afl->old_seed_selection)) {
 
-        if (unlikely(prev_queued_paths < afl->queued_paths ||
-                     afl->reinit_table)) {
-
-          // we have new queue entries since the last run, recreate alias table
-          prev_queued_paths = afl->queued_paths;
-          create_alias_table(afl);
-
-        }
-
         afl->current_entry = select_next_queue_entry(afl);
         afl->queue_cur = afl->queue_buf[afl->current_entry];
 
@@ -2294,6 +2439,7 @@ stop_fuzzing:
 
   }
 
+  fsrv_pool_deinit(afl);
   afl_fsrv_deinit(&afl->fsrv);
 
   /* remove tmpfile */
@@ -2307,6 +2453,7 @@ stop_fuzzing:
   ck_free(afl->fsrv.target_path);
   ck_free(afl->fsrv.out_file);
   ck_free(afl->sync_id);
+  testcase_prefetch_deinit(afl);
   if (afl->q_testcase_cache) { ck_free(afl->q_testcase_cache); }
   afl_state_deinit(afl);
   free(afl);                                                 /* not tracked */
@@ -36,6 +36,7 @@
 #include "hash.h"
 #include "sharedmem.h"
 #include "cmplog.h"
+#include "dirty-map.h"
 #include "list.h"
 
 #include <stdio.h>
@@ -81,7 +82,9 @@ void afl_shm_deinit(sharedmem_t *shm) {
 #ifdef USEMMAP
   if (shm->map != NULL) {
 
-    munmap(shm->map, shm->map_size);
+    munmap(shm->map, shm->dirty_map ? DIRTY_MAP_OFFSET(shm->map_size) +
+                                          DIRTY_MAP_SIZE(shm->map_size)
+                                    : shm->map_size);
     shm->map = NULL;
 
   }
@@ -133,6 +136,7 @@ void afl_shm_deinit(sharedmem_t *shm) {
 #endif
 
   shm->map = NULL;
+  shm->dirty_map = NULL;
 
 }
 
@@ -143,10 +147,19 @@ void afl_shm_deinit(sharedmem_t *shm) {
 u8 *afl_shm_init(sharedmem_t *shm, size_t map_size,
                  unsigned char non_instrumented_mode) {
 
+  /* AFL_DIRTY_MAP: the dirty map lives behind the coverage map */
+  size_t alloc_size = map_size;
+  if (shm->dirty_mode) {
+
+    alloc_size = DIRTY_MAP_OFFSET(map_size) + DIRTY_MAP_SIZE(map_size);
+
+  }
+
   shm->map_size = 0;
 
   shm->map = NULL;
   shm->cmp_map = NULL;
+  shm->dirty_map = NULL;
 
 #ifdef USEMMAP
 
@@ -167,7 +180,7 @@ u8 *afl_shm_init(sharedmem_t *shm, size_t map_size,
   if (shm->g_shm_fd == -1) { PFATAL("shm_open() failed"); }
 
   /* configure the size of the shared memory segment */
-  if (ftruncate(shm->g_shm_fd, map_size)) {
+  if (ftruncate(shm->g_shm_fd, alloc_size)) {
 
     PFATAL("setup_shm(): ftruncate() failed");
 
@@ -175,7 +188,7 @@ u8 *afl_shm_init(sharedmem_t *shm, size_t map_size,
 
   /* map the shared memory segment to the address space of the process */
   shm->map =
-      mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->g_shm_fd, 0);
+      mmap(0, alloc_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->g_shm_fd, 0);
   if (shm->map == MAP_FAILED) {
 
     close(shm->g_shm_fd);
@@ -243,7 +256,7 @@ u8 *afl_shm_init(sharedmem_t *shm, size_t map_size,
   u8 *shm_str;
 
   shm->shm_id =
-      shmget(IPC_PRIVATE, map_size, IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
+      shmget(IPC_PRIVATE, alloc_size, IPC_CREAT | IPC_EXCL | DEFAULT_PERMISSION);
   if (shm->shm_id < 0) { PFATAL("shmget() failed"); }
 
   if (shm->cmplog_mode) {
@@ -319,6 +332,21 @@ u8 *afl_shm_init(sharedmem_t *shm, size_t map_size,
 
 #endif
 
+  if (shm->dirty_mode) {
+
+    shm->dirty_map =
+        (struct dirty_map *)(shm->map + DIRTY_MAP_OFFSET(map_size));
+
+    if (!non_instrumented_mode) {
+
+      u8 *off_str = alloc_printf("%u", (u32)DIRTY_MAP_OFFSET(map_size));
+      setenv(DIRTY_MAP_ENV_VAR, off_str, 1);
+      ck_free(off_str);
+
+    }
+
+  }
+
   shm->map_size = map_size;
   list_append(&shm_list, shm);
 
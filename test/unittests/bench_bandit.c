@@ -0,0 +1,188 @@
+/*
+   american fuzzy lop++ - bandit microbenchmark
+   --------------------------------------------
+
+   Drives every bandit algorithm of src/afl-fuzz-bandit.c with synthetic
+   Bernoulli reward streams at 28 arms (mutation operators) and 7 arms
+   (stack sizes) and prints one JSON document to stdout:
+
+     ns_select  select_arm() alone, on the state left by the run
+     ns_reward  add_reward() alone, on random arms
+     ns_step    select + reward + drawing the reward, as in the run
+     allocs     heap allocations during the run (after bandit_init())
+     regret     expected regret against always pulling the best arm,
+                and the same per 1000 steps
+
+   The "stationary" stream keeps the arm probabilities fixed, "switching"
+   moves the best arm every steps/4 pulls.
+
+   usage: bench_bandit [steps [seed]]
+
+ */
+
+#include "afl-fuzz.h"
+
+#include <time.h>
+
+/* count allocations, link with -Wl,--wrap=malloc,--wrap=calloc,
+   --wrap=realloc */
+
+static u64 n_allocs;
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+
+void *__wrap_malloc(size_t size) {
+
+  n_allocs++;
+  return __real_malloc(size);
+
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+
+  n_allocs++;
+  return __real_calloc(n, size);
+
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+
+  n_allocs++;
+  return __real_realloc(ptr, size);
+
+}
+
+#define BENCH_TIMING_ITERS 200000
+
+static double now_ns(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+
+}
+
+/* Havoc-like success rates: one arm at 2%, the others between 0.1% and 1.5% */
+
+static void make_probs(afl_state_t *afl, double *p, u32 n, u32 *best) {
+
+  u32 i;
+  for (i = 0; i < n; i++) {
+
+    p[i] = (1 + rand_below(afl, 15)) / 1000.0;
+
+  }
+
+  *best = rand_below(afl, n);
+  p[*best] = 0.02;
+
+}
+
+static void run(afl_state_t *afl, u8 alg, u32 n_arms, u8 switching, u64 steps,
+                u32 seed, u8 first) {
+
+  double   p[NUM_CASE_ENUM];
+  u32      best, i;
+  bandit_t b;
+  double   regret = 0, t0, t_step, t_sel, t_rew;
+  u64      s, allocs;
+  u32      sink = 0;
+
+  rand_set_seed(afl, seed);
+  make_probs(afl, p, n_arms, &best);
+
+  bandit_init(&b, alg, n_arms);
+  allocs = n_allocs;
+
+  t0 = now_ns();
+  for (s = 0; s < steps; s++) {
+
+    if (switching && s && !(s % (steps / 4))) {
+
+      /* the best arm moves on, the old one becomes average */
+      p[best] = 0.008;
+      best = (best + 1 + rand_below(afl, n_arms - 1)) % n_arms;
+      p[best] = 0.02;
+
+    }
+
+    u32 arm = bandit_select_arm(afl, &b, NULL);
+    u8  r = (rand_next(afl) >> 11) * 0x1.0p-53 < p[arm];
+    bandit_add_reward(&b, arm, r);
+    regret += p[best] - p[arm];
+
+  }
+
+  t_step = (now_ns() - t0) / steps;
+  allocs = n_allocs - allocs;
+
+  t0 = now_ns();
+  for (i = 0; i < BENCH_TIMING_ITERS; i++) {
+
+    sink += bandit_select_arm(afl, &b, NULL);
+
+  }
+
+  t_sel = (now_ns() - t0) / BENCH_TIMING_ITERS;
+
+  t0 = now_ns();
+  for (i = 0; i < BENCH_TIMING_ITERS; i++) {
+
+    bandit_add_reward(&b, (i * 7 + sink) % n_arms, !(i & 63));
+
+  }
+
+  t_rew = (now_ns() - t0) / BENCH_TIMING_ITERS;
+
+  bandit_deinit(&b);
+
+  printf(
+      "%s    {\"alg\": \"%s\", \"arms\": %u, \"stream\": \"%s\", "
+      "\"ns_select\": %.1f, \"ns_reward\": %.1f, \"ns_step\": %.1f, "
+      "\"allocs\": %llu, \"regret\": %.2f, \"regret_per_1k\": %.4f}",
+      first ? "" : ",\n", bandit_ops[alg].name, n_arms,
+      switching ? "switching" : "stationary", t_sel, t_rew, t_step, allocs,
+      regret, regret * 1000 / steps);
+
+}
+
+int main(int argc, char **argv) {
+
+  static afl_state_t afl;
+  static const u32   arms[] = {NUM_CASE_ENUM, BATCH_NUM_ARM};
+  u64                steps = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+  u32                seed = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+  u32                a, i, sw;
+  u8                 first = 1;
+
+  if (steps < 4) { steps = 4; }
+
+  /* rand_below() would reseed from fd 0 otherwise */
+  afl.fixed_seed = 1;
+
+  printf("{\n  \"benchmark\": \"bandit\",\n  \"steps\": %llu,\n  \"seed\": %u,\n"
+         "  \"results\": [\n",
+         steps, seed);
+
+  for (a = 0; a < BANDIT_ALG_NUM; a++) {
+
+    for (i = 0; i < sizeof(arms) / sizeof(arms[0]); i++) {
+
+      for (sw = 0; sw < 2; sw++) {
+
+        run(&afl, a, arms[i], sw, steps, seed, first);
+        first = 0;
+
+      }
+
+    }
+
+  }
+
+  printf("\n  ]\n}\n");
+  return 0;
+
+}
+
@@ -0,0 +1,289 @@
+/*
+   american fuzzy lop++ - coverage kernel microbenchmark
+   -----------------------------------------------------
+
+   Runs every coverage map kernel of src/afl-fuzz-coverage.c that this CPU
+   supports on the same maps, checks that they agree with the generic
+   kernels and prints one JSON document to stdout with the time per map
+   (ns) of:
+
+     skim               hot path of has_new_bits_unclassified(), no new bits
+     discover           has_new_bits() on a classified map, no new bits
+     classify           classify_counts()
+     classify_discover  slow path of has_new_bits_unclassified()
+     simplify           simplify_trace()
+
+   The writing kernels run on a fresh copy of the map every time; the time
+   of that copy is measured separately and subtracted.
+
+   Without map files, synthetic maps of 64 KB, 256 KB and 1 MB are used,
+   with 2% and 10% of the entries hit. Traces of real targets, e.g. the
+   PUTs/ built with afl-clang-lto, can be passed as raw map files (one
+   byte per entry, like the output of afl-showmap -b).
+
+   usage: bench_coverage [iterations [map files...]]
+
+ */
+
+#include "afl-fuzz.h"
+
+#include <time.h>
+
+static double now_ns(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+
+}
+
+/* Hit counts as a target produces them: mostly small, some loops */
+
+static void make_map(afl_state_t *afl, u8 *map, u32 size, u32 permille) {
+
+  u32 i;
+
+  memset(map, 0, size);
+
+  for (i = 0; i < size; i++) {
+
+    if (rand_below(afl, 1000) < permille) {
+
+      u32 r = rand_below(afl, 100);
+      map[i] = r < 60 ? 1 : r < 85 ? 1 + rand_below(afl, 7)
+                                   : 1 + rand_below(afl, 255);
+
+    }
+
+  }
+
+}
+
+static u8 *load_map(u8 *fn, u32 *size) {
+
+  struct stat st;
+  s32         fd = open((char *)fn, O_RDONLY);
+  u8 *        map;
+
+  if (fd < 0 || fstat(fd, &st)) { PFATAL("Unable to open '%s'", fn); }
+
+  /* the kernels work on multiples of 64 bytes */
+  *size = (st.st_size + 63) & ~63;
+  map = ck_alloc(*size);
+  ck_read(fd, map, st.st_size, fn);
+  close(fd);
+
+  return map;
+
+}
+
+/* Compare kernel k with the generic kernels on map, returns 1 if equal */
+
+static u8 check(const coverage_kernels_t *k, const u8 *map, u32 size) {
+
+  const coverage_kernels_t *g = &coverage_kernels[0];
+
+  u8 *a = ck_alloc(size), *b = ck_alloc(size);
+  u8 *va = ck_alloc(size), *vb = ck_alloc(size);
+  u8  ok = 1, ra, rb;
+  u32 i;
+
+  memcpy(a, map, size);
+  memcpy(b, map, size);
+  g->classify(a, size);
+  k->classify(b, size);
+  ok &= !memcmp(a, b, size);
+
+  memcpy(a, map, size);
+  memcpy(b, map, size);
+  g->simplify(a, size);
+  k->simplify(b, size);
+  ok &= !memcmp(a, b, size);
+
+  /* a virgin map that already knows half of the map, with other counts */
+  memset(va, 255, size);
+  for (i = 0; i < size; i += 2) {
+
+    if (map[i]) { va[i] = ~(map[i] >> 1 | 1); }
+
+  }
+
+  memcpy(vb, va, size);
+  ok &= !!g->skim(va, map, size) == !!k->skim(vb, map, size);
+
+  memcpy(a, map, size);
+  memcpy(b, map, size);
+  ra = g->classify_discover(a, va, size);
+  rb = k->classify_discover(b, vb, size);
+  ok &= ra == rb && !memcmp(a, b, size) && !memcmp(va, vb, size);
+
+  /* same again, the new bits are gone now */
+  ok &= g->discover(a, va, size) == k->discover(b, vb, size);
+  ok &= !g->skim(va, map, size) && !k->skim(vb, map, size);
+
+  ck_free(a);
+  ck_free(b);
+  ck_free(va);
+  ck_free(vb);
+
+  return ok;
+
+}
+
+static void run(const coverage_kernels_t *k, const u8 *map, u32 size,
+                const char *name, u32 iters, u8 first) {
+
+  u8 *   work = ck_alloc(size), *virgin = ck_alloc(size);
+  double t0, t_copy, t_skim, t_disc, t_cls, t_cd, t_simp;
+  u32    i, sink = 0;
+
+  /* a virgin map that has seen this map before */
+  memset(virgin, 255, size);
+  memcpy(work, map, size);
+  coverage_kernels[0].classify_discover(work, virgin, size);
+
+  t0 = now_ns();
+  for (i = 0; i < iters; i++) {
+
+    memcpy(work, map, size);
+    sink += work[i % size];
+
+  }
+
+  t_copy = (now_ns() - t0) / iters;
+
+  t0 = now_ns();
+  for (i = 0; i < iters; i++) {
+
+    sink += k->skim(virgin, map, size);
+
+  }
+
+  t_skim = (now_ns() - t0) / iters;
+
+  memcpy(work, map, size);
+  k->classify(work, size);
+  t0 = now_ns();
+  for (i = 0; i < iters; i++) {
+
+    sink += k->discover(work, virgin, size);
+
+  }
+
+  t_disc = (now_ns() - t0) / iters;
+
+  t0 = now_ns();
+  for (i = 0; i < iters; i++) {
+
+    memcpy(work, map, size);
+    k->classify(work, size);
+
+  }
+
+  t_cls = (now_ns() - t0) / iters - t_copy;
+
+  t0 = now_ns();
+  for (i = 0; i < iters; i++) {
+
+    memcpy(work, map, size);
+    sink += k->classify_discover(work, virgin, size);
+
+  }
+
+  t_cd = (now_ns() - t0) / iters - t_copy;
+
+  t0 = now_ns();
+  for (i = 0; i < iters; i++) {
+
+    memcpy(work, map, size);
+    k->simplify(work, size);
+
+  }
+
+  t_simp = (now_ns() - t0) / iters - t_copy;
+
+  printf(
+      "%s    {\"map\": \"%s\", \"size\": %u, \"kernels\": \"%s\", "
+      "\"match\": %s, \"skim\": %.0f, \"discover\": %.0f, \"classify\": %.0f, "
+      "\"classify_discover\": %.0f, \"simplify\": %.0f, \"copy\": %.0f}",
+      first ? "" : ",\n", name, size, k->name,
+      check(k, map, size) ? "true" : "false", t_skim, t_disc, t_cls, t_cd,
+      t_simp, t_copy);
+
+  /* keep the loops */
+  if (sink == 0xdeadbeef) { printf(" "); }
+
+  ck_free(work);
+  ck_free(virgin);
+
+}
+
+static void bench_map(const u8 *map, u32 size, const char *name, u32 iters,
+                      u8 *first) {
+
+  const coverage_kernels_t *k;
+
+  for (k = coverage_kernels; k->name; ++k) {
+
+    if (!coverage_kernels_supported(k)) { continue; }
+    run(k, map, size, name, iters, *first);
+    *first = 0;
+
+  }
+
+}
+
+int main(int argc, char **argv) {
+
+  static afl_state_t afl;
+  static const u32   sizes[] = {65536, 262144, 1048576};
+  static const u32   permille[] = {20, 100};
+  u32                iters = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+  u32                i, j, size;
+  u8                 first = 1;
+  char               name[64];
+
+  if (!iters) { iters = 1; }
+
+  /* rand_below() would reseed from fd 0 otherwise */
+  afl.fixed_seed = 1;
+  rand_set_seed(&afl, 1);
+  init_count_class16();
+
+  printf("{\n  \"benchmark\": \"coverage\",\n  \"iterations\": %u,\n"
+         "  \"results\": [\n",
+         iters);
+
+  if (argc > 2) {
+
+    for (i = 2; i < (u32)argc; i++) {
+
+      u8 *map = load_map((u8 *)argv[i], &size);
+      bench_map(map, size, argv[i], iters, &first);
+      ck_free(map);
+
+    }
+
+  } else {
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+      for (j = 0; j < sizeof(permille) / sizeof(permille[0]); j++) {
+
+        u8 *map = ck_alloc(sizes[i]);
+        make_map(&afl, map, sizes[i], permille[j]);
+        snprintf(name, sizeof(name), "synthetic-%u%%", permille[j] / 10);
+        bench_map(map, sizes[i], name, iters, &first);
+        ck_free(map);
+
+      }
+
+    }
+
+  }
+
+  printf("\n  ]\n}\n");
+  return 0;
+
+}
+